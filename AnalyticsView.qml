@@ -30,7 +30,10 @@ Item {
 
             Button {
                 text: "Refresh Data"
-                onClicked: userDashboard.refresh()
+                onClicked: {
+                    userDashboard.refresh()
+                    analyticsModel.compute(analyticsModel.dimension)
+                }
                 background: Rectangle {
                     color: parent.pressed ? "#1e90ff" : "#2196f3"
                     radius: 20
@@ -112,6 +115,84 @@ Item {
             }
         }
 
+        Rectangle {
+            Layout.fillWidth: true
+            Layout.fillHeight: true
+            color: "#2c2c2c"
+            radius: 10
+
+            ColumnLayout {
+                anchors.fill: parent
+                anchors.margins: 20
+                spacing: 15
+
+                RowLayout {
+                    Layout.fillWidth: true
+                    spacing: 10
+
+                    Text {
+                        text: "Breakdown by " + (analyticsModel.dimension === "supplier" ? "Supplier" : "Category")
+                        font.pixelSize: 24
+                        font.bold: true
+                        color: "#ffffff"
+                    }
+
+                    BusyIndicator {
+                        running: analyticsModel.busy
+                        Layout.preferredHeight: 30
+                        Layout.preferredWidth: 30
+                    }
+
+                    Item { Layout.fillWidth: true }
+
+                    ComboBox {
+                        id: dimensionSelector
+                        model: ["Category", "Supplier"]
+                        onActivated: analyticsModel.compute(currentIndex === 1 ? "supplier" : "category")
+                    }
+                }
+
+                ListView {
+                    Layout.fillWidth: true
+                    Layout.fillHeight: true
+                    model: analyticsModel
+                    clip: true
+                    spacing: 10
+
+                    delegate: Rectangle {
+                        width: parent.width
+                        height: 60
+                        color: "#1e1e1e"
+                        radius: 5
+
+                        RowLayout {
+                            anchors.fill: parent
+                            anchors.margins: 10
+                            spacing: 15
+
+                            ColumnLayout {
+                                spacing: 5
+                                Text { text: model.key; color: "#ffffff"; font.pixelSize: 16; font.bold: true }
+                                Text { text: model.itemCount + " items, " + model.unitsSold + " units sold"; color: "#a0a0a0"; font.pixelSize: 14 }
+                            }
+
+                            Item { Layout.fillWidth: true }
+
+                            ColumnLayout {
+                                spacing: 5
+                                Text { text: "Margin $" + model.margin.toFixed(2) + " (" + model.marginPercent.toFixed(1) + "%)"; color: "#4CAF50"; font.pixelSize: 14; horizontalAlignment: Text.AlignRight }
+                                Text { text: "Sell-through " + model.sellThrough.toFixed(1) + "% | Stock $" + model.stockValue.toFixed(2); color: "#ffffff"; font.pixelSize: 14; horizontalAlignment: Text.AlignRight }
+                            }
+                        }
+                    }
+
+                    ScrollBar.vertical: ScrollBar {
+                        active: true
+                    }
+                }
+            }
+        }
+
         Rectangle {
             Layout.fillWidth: true
             Layout.fillHeight: true
@@ -190,5 +271,6 @@ Item {
     Component.onCompleted: {
         console.log("AnalyticsView loaded")
         userDashboard.refresh()
+        analyticsModel.compute(analyticsModel.dimension)
     }
 }
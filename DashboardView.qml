@@ -114,70 +114,10 @@ Item {
         }
     }
 
-    Connections {
-        target: userDashboard
-        function onItemNearExpiry(itemId, itemName, expiryDate) {
-            expiryNotificationDialog.itemName = itemName
-            expiryNotificationDialog.expiryDate = expiryDate
-            expiryNotificationDialog.open()
-        }
-    }
-
-    Dialog {
-        id: expiryNotificationDialog
-        title: "Item Nearing Expiry"
-        modal: true
-        x: (parent.width - width) / 2
-        y: (parent.height - height) / 2
-
-        property string itemName: ""
-        property date expiryDate
-
-        background: Rectangle {
-            color: "#ffffff"
-            radius: 10
-            border.color: "#e0e0e0"
-            border.width: 1
-        }
-
-        header: Rectangle {
-            color: "#f44336"
-            height: 50
-            radius: 10
-            Text {
-                anchors.centerIn: parent
-                text: expiryNotificationDialog.title
-                color: "white"
-                font.pixelSize: 18
-                font.bold: true
-            }
-        }
-
-        contentItem: ColumnLayout {
-            spacing: 10
-            Text {
-                text: "The following item is nearing its expiry date:"
-                color: "#333333"
-                font.pixelSize: 16
-            }
-            Text {
-                text: expiryNotificationDialog.itemName
-                color: "#f44336"
-                font.pixelSize: 20
-                font.bold: true
-            }
-            Text {
-                text: "Expiry Date: " + Qt.formatDate(expiryNotificationDialog.expiryDate, "yyyy-MM-dd")
-                color: "#333333"
-                font.pixelSize: 16
-            }
-        }
-
-        standardButtons: Dialog.Ok
-    }
-
     Component.onCompleted: {
         console.log("DashboardView loaded")
-        userDashboard.refresh()
+        // Headline figures come from the per-user counters; the inventory
+        // and sales models are not needed here.
+        userDashboard.recalculate()
     }
 }
@@ -1,9 +1,14 @@
-QT       += core gui sql quick charts
+QT       += core gui sql quick charts concurrent network
 
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
 CONFIG += c++17
 
+# The online backup and diagnostics call the SQLite C API directly. Link the
+# same SQLite the Qt SQL driver uses (Qt configured with -system-sqlite);
+# DatabaseManager::sqliteApiUsable() turns them off at run time otherwise.
+LIBS += -lsqlite3
+
 # You can make your code fail to compile if it uses deprecated APIs.
 # In order to do so, uncomment the following line.
 #DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
@@ -11,19 +16,63 @@ CONFIG += c++17
 
 SOURCES += \
     main.cpp \
+    analyticsmodel.cpp \
+    changefeed.cpp \
+    commandline.cpp \
     databasemanager.cpp \
+    demandforecaster.cpp \
     usermodel.cpp \
     inventorymodel.cpp \
+    notificationhub.cpp \
+    maintenancescheduler.cpp \
+    memorymonitor.cpp \
+    onlinebackup.cpp \
+    queryservice.cpp \
+    salesarchive.cpp \
     salesmodel.cpp \
-    userdashboard.cpp
+    sessioncache.cpp \
+    startuptimeline.cpp \
+    skuindex.cpp \
+    stockledger.cpp \
+    streamexporter.cpp \
+    tilljournal.cpp \
+    tracer.cpp \
+    trigramindex.cpp \
+    userdashboard.cpp \
+    workloadrecorder.cpp \
+    workloadreplay.cpp
 
 
 HEADERS += \
+    analyticsmodel.h \
+    changefeed.h \
+    commandline.h \
     databasemanager.h \
+    demandforecaster.h \
     usermodel.h \
     inventorymodel.h \
+    notificationhub.h \
+    maintenancescheduler.h \
+    memoryestimate.h \
+    memorymonitor.h \
+    money.h \
+    onlinebackup.h \
+    queryservice.h \
+    salesarchive.h \
+    rowmapper.h \
     salesmodel.h \
-    userdashboard.h
+    sessioncache.h \
+    startuptimeline.h \
+    skuindex.h \
+    sqlids.h \
+    stockledger.h \
+    streamexporter.h \
+    tilljournal.h \
+    tracer.h \
+    trigramindex.h \
+    userdashboard.h \
+    workloadrecorder.h \
+    workloadreplay.h
 
 
 QMAKE_EXTRA_COMPILERS+=compiler_json
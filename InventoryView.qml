@@ -59,6 +59,30 @@ Item {
             }
         }
 
+        // Shown when the substring search finds nothing; the trigram index
+        // tolerates misspellings.
+        RowLayout {
+            Layout.fillWidth: true
+            spacing: 10
+            visible: searchField.text.length > 0 && inventoryListView.count === 0 && suggestions.count > 0
+
+            Text {
+                text: "Did you mean:"
+                color: "white"
+                font.pixelSize: 14
+            }
+
+            Repeater {
+                id: suggestions
+                model: searchField.text.length > 0 ? inventoryModel.fuzzySearch(searchField.text, 5) : []
+                delegate: Button {
+                    text: modelData.name
+                    flat: true
+                    onClicked: searchField.text = modelData.name
+                }
+            }
+        }
+
         ListView {
             id: inventoryListView
             Layout.fillWidth: true
@@ -256,6 +280,13 @@ Item {
                     placeholderText: "YYYY-MM-DD"
                     inputMask: "9999-99-99"
                 }
+
+                Label { text: "SKU / Barcode:"; color: "#333333" }
+                TextField {
+                    id: skuField
+                    Layout.fillWidth: true
+                    placeholderText: "Scan or enter SKU (optional)"
+                }
             }
 
             RowLayout {
@@ -288,7 +319,8 @@ Item {
                             parseFloat(priceField.text),
                             supplierNameField.text,
                             supplierAddressField.text,
-                            new Date(expiryDateField.text)
+                            new Date(expiryDateField.text),
+                            skuField.text
                         )
                         addItemDialog.close()
                         nameField.text = ""
@@ -298,6 +330,7 @@ Item {
                         supplierNameField.text = ""
                         supplierAddressField.text = ""
                         expiryDateField.text = ""
+                        skuField.text = ""
                     }
                     background: Rectangle {
                         radius: 5
@@ -493,4 +526,9 @@ Item {
 
         standardButtons: Dialog.Ok
     }
+
+    Component.onCompleted: {
+        // Rows are loaded on first visit rather than at login.
+        inventoryModel.ensureLoaded()
+    }
 }
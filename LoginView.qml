@@ -70,11 +70,12 @@ Item {
         }
 
         Button {
-            text: "Login"
+            text: databaseManager.ready ? "Login" : "Opening database..."
+            enabled: databaseManager.ready
             Layout.fillWidth: true
             implicitHeight: 50
             background: Rectangle {
-                color: parent.pressed ? "#1e88e5" : "#2196f3"
+                color: !parent.enabled ? "#455a64" : parent.pressed ? "#1e88e5" : "#2196f3"
                 radius: 25
             }
             contentItem: Text {
@@ -116,6 +117,8 @@ Item {
         }
     }
 
+    Component.onCompleted: startupTimeline.mark("login view created")
+
     Connections {
         target: userModel
         function onErrorOccurred(error) {
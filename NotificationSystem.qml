@@ -5,8 +5,6 @@ import QtQuick.Layouts 1.15
 Item {
     id: root
 
-    property var lowStockItems: []
-
     Popup {
         id: notificationPopup
         width: 300
@@ -31,7 +29,7 @@ Item {
                 Layout.fillWidth: true
 
                 Text {
-                    text: "Low Stock Notifications"
+                    text: "Notifications"
                     font.pixelSize: 18
                     font.bold: true
                     color: "white"
@@ -53,25 +51,38 @@ Item {
                 }
             }
 
+            Text {
+                visible: notificationHub.suppressedCount > 0
+                text: notificationHub.suppressedCount + " more alerts held back"
+                color: "#9E9E9E"
+                font.pixelSize: 12
+            }
+
             ListView {
                 Layout.fillWidth: true
                 Layout.fillHeight: true
-                model: lowStockItems
+                model: notificationHub
                 clip: true
                 delegate: ItemDelegate {
-                    width: parent.width
+                    width: ListView.view.width
                     contentItem: RowLayout {
-                        Text { 
-                            text: modelData.name
+                        Text {
+                            text: model.itemName
                             color: "white"
                             font.pixelSize: 14
+                            elide: Text.ElideRight
                             Layout.fillWidth: true
                         }
-                        Text { 
-                            text: "Quantity: " + modelData.quantity
-                            color: "#F44336"
+                        Text {
+                            text: model.message
+                            color: model.type === "expiry" ? "#FF9800" : "#F44336"
                             font.pixelSize: 14
                         }
+                        Button {
+                            text: "\u2715"
+                            flat: true
+                            onClicked: notificationHub.dismiss(index)
+                        }
                     }
                     background: Rectangle {
                         color: "transparent"
@@ -82,15 +93,14 @@ Item {
     }
 
     function showNotifications() {
-        lowStockItems = userDashboard.lowStockItemsList
-        if (lowStockItems.length > 0) {
+        if (notificationHub.count > 0) {
             notificationPopup.open()
         }
     }
 
     Connections {
-        target: userDashboard
-        function onLowStockItemsListChanged() {
+        target: notificationHub
+        function onAlertsRaised(newAlerts) {
             showNotifications()
         }
     }
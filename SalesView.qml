@@ -28,6 +28,22 @@ Item {
 
             Item { Layout.fillWidth: true }
 
+            // Offline-first checkout: sales taken here but not yet merged
+            // into the shared database, and those it refused.
+            Text {
+                visible: tillJournal.pendingCount > 0 || tillJournal.conflictCount > 0
+                text: tillJournal.pendingCount + " to merge"
+                      + (tillJournal.conflictCount > 0 ? ", " + tillJournal.conflictCount + " conflicts" : "")
+                color: tillJournal.conflictCount > 0 ? "#ff9800" : "#808080"
+                font.pixelSize: 14
+
+                MouseArea {
+                    anchors.fill: parent
+                    enabled: tillJournal.conflictCount > 0
+                    onClicked: tillJournal.retryConflicts()
+                }
+            }
+
             Rectangle {
                 Layout.preferredWidth: 240
                 Layout.preferredHeight: 40
@@ -57,6 +73,20 @@ Item {
                 }
             }
 
+            TextField {
+                id: scanField
+                placeholderText: "Scan SKU..."
+                Layout.preferredWidth: 160
+                Layout.preferredHeight: 40
+                // Barcode scanners type the code and press Enter.
+                onAccepted: {
+                    if (salesModel.addSaleBySku(text, 1))
+                        text = ""
+                    else
+                        selectAll()
+                }
+            }
+
             Button {
                 text: "Add Sale"
                 onClicked: addSaleDialog.open()
@@ -282,4 +312,11 @@ Item {
             }
         }
     }
+
+    Component.onCompleted: {
+        // Rows are loaded on first visit rather than at login; the item
+        // picker and the scanner need the inventory too.
+        salesModel.ensureLoaded()
+        inventoryModel.ensureLoaded()
+    }
 }
@@ -0,0 +1,281 @@
+#include "analyticsmodel.h"
+#include <QDebug>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QThread>
+#include <QtConcurrent>
+#include <algorithm>
+
+namespace {
+// One unit of work for the thread pool: either a slice of the Sales rowid
+// range or the (much smaller) inventory snapshot.
+struct Partition {
+  enum Kind { SalesRange, Inventory };
+  Kind kind;
+  int userId;
+  QString databasePath; // the user's file when the job was queued
+  QString groupColumn;
+  QString salesTable;
+  qint64 firstId;
+  qint64 lastId;
+};
+
+AnalyticsModel::RollupTable computePartition(const DatabaseManager *dbManager,
+                                             const Partition &partition) {
+  AnalyticsModel::RollupTable table;
+  WorkerConnection connection(dbManager, true, partition.databasePath);
+  if (!connection.isOpen()) {
+    qWarning() << "Analytics worker failed to open database:"
+               << connection.lastError();
+    return table;
+  }
+
+  QSqlQuery query(connection.database());
+  query.setForwardOnly(true);
+
+  if (partition.kind == Partition::SalesRange) {
+    query.prepare(QString("SELECT IFNULL(i.%1, ''), SUM(s.quantity), "
+                          "SUM(s.total_price), SUM(s.total_cost) "
+                          "FROM %2 s "
+                          "JOIN Inventory i ON s.item_id = i.id "
+                          "WHERE s.id BETWEEN :firstId AND :lastId "
+                          "AND s.user_id = :userId "
+                          "GROUP BY 1")
+                      .arg(partition.groupColumn, partition.salesTable));
+    query.bindValue(":firstId", partition.firstId);
+    query.bindValue(":lastId", partition.lastId);
+    query.bindValue(":userId", partition.userId);
+    if (!query.exec()) {
+      qWarning() << "Analytics sales partition failed:"
+                 << query.lastError().text();
+      return table;
+    }
+    while (query.next()) {
+      AnalyticsModel::Rollup &rollup = table[query.value(0).toString()];
+      rollup.unitsSold += query.value(1).toLongLong();
+      rollup.revenue += query.value(2).toLongLong();
+      rollup.cost += query.value(3).toLongLong();
+    }
+  } else {
+    query.prepare(QString("SELECT IFNULL(%1, ''), COUNT(*), SUM(quantity), "
+                          "SUM(quantity * price) "
+                          "FROM Inventory WHERE user_id = :userId "
+                          "GROUP BY 1")
+                      .arg(partition.groupColumn));
+    query.bindValue(":userId", partition.userId);
+    if (!query.exec()) {
+      qWarning() << "Analytics inventory partition failed:"
+                 << query.lastError().text();
+      return table;
+    }
+    while (query.next()) {
+      AnalyticsModel::Rollup &rollup = table[query.value(0).toString()];
+      rollup.itemCount += query.value(1).toInt();
+      rollup.stockUnits += query.value(2).toLongLong();
+      rollup.stockValue += query.value(3).toLongLong();
+    }
+  }
+
+  query.finish();
+  return table;
+}
+
+void mergeRollups(AnalyticsModel::RollupTable &result,
+                  const AnalyticsModel::RollupTable &partial) {
+  for (auto it = partial.constBegin(); it != partial.constEnd(); ++it) {
+    AnalyticsModel::Rollup &rollup = result[it.key()];
+    rollup.itemCount += it->itemCount;
+    rollup.unitsSold += it->unitsSold;
+    rollup.revenue += it->revenue;
+    rollup.cost += it->cost;
+    rollup.stockUnits += it->stockUnits;
+    rollup.stockValue += it->stockValue;
+  }
+}
+} // namespace
+
+AnalyticsModel::AnalyticsModel(DatabaseManager *dbManager, QObject *parent)
+    : QAbstractListModel(parent), m_dbManager(dbManager), m_userId(-1),
+      m_jobUserId(-1), m_dimension("category") {
+  connect(&m_watcher, &QFutureWatcher<RollupTable>::finished, this,
+          &AnalyticsModel::onComputeFinished);
+}
+
+AnalyticsModel::~AnalyticsModel() { m_watcher.waitForFinished(); }
+
+int AnalyticsModel::rowCount(const QModelIndex &parent) const {
+  if (parent.isValid())
+    return 0;
+  return m_rows.size();
+}
+
+QVariant AnalyticsModel::data(const QModelIndex &index, int role) const {
+  if (!index.isValid() || index.row() >= m_rows.size())
+    return QVariant();
+
+  const Row &row = m_rows.at(index.row());
+  const Rollup &rollup = row.rollup;
+
+  switch (role) {
+  case KeyRole:
+    return row.key.isEmpty() ? tr("Unspecified") : row.key;
+  case ItemCountRole:
+    return rollup.itemCount;
+  case UnitsSoldRole:
+    return rollup.unitsSold;
+  case RevenueRole:
+    return Money::toUnits(rollup.revenue);
+  case CostRole:
+    return Money::toUnits(rollup.cost);
+  case MarginRole:
+    return Money::toUnits(rollup.revenue - rollup.cost);
+  case MarginPercentRole:
+    return rollup.revenue > 0
+               ? double(rollup.revenue - rollup.cost) / rollup.revenue * 100
+               : 0.0;
+  case StockUnitsRole:
+    return rollup.stockUnits;
+  case StockValueRole:
+    return Money::toUnits(rollup.stockValue);
+  case SellThroughRole: {
+    const qint64 received = rollup.unitsSold + rollup.stockUnits;
+    return received > 0 ? double(rollup.unitsSold) / received * 100 : 0.0;
+  }
+  default:
+    return QVariant();
+  }
+}
+
+QHash<int, QByteArray> AnalyticsModel::roleNames() const {
+  QHash<int, QByteArray> roles;
+  roles[KeyRole] = "key";
+  roles[ItemCountRole] = "itemCount";
+  roles[UnitsSoldRole] = "unitsSold";
+  roles[RevenueRole] = "revenue";
+  roles[CostRole] = "cost";
+  roles[MarginRole] = "margin";
+  roles[MarginPercentRole] = "marginPercent";
+  roles[StockUnitsRole] = "stockUnits";
+  roles[StockValueRole] = "stockValue";
+  roles[SellThroughRole] = "sellThrough";
+  return roles;
+}
+
+void AnalyticsModel::setUserId(int userId) {
+  if (m_userId == userId)
+    return;
+
+  m_userId = userId;
+  // A job still running for the previous user is discarded when it ends.
+  m_pendingDimension.clear();
+  beginResetModel();
+  m_rows.clear();
+  endResetModel();
+}
+
+void AnalyticsModel::compute(const QString &dimension) {
+  if (m_userId == -1) {
+    emit errorOccurred("User not set. Unable to compute analytics.");
+    return;
+  }
+  if (dimension != "category" && dimension != "supplier") {
+    emit errorOccurred(tr("Unknown analytics dimension: %1").arg(dimension));
+    return;
+  }
+
+  if (m_watcher.isRunning()) {
+    // Only the latest request matters; it starts when the current one ends.
+    m_pendingDimension = dimension;
+    return;
+  }
+  startCompute(dimension);
+}
+
+void AnalyticsModel::startCompute(const QString &dimension) {
+  const QString groupColumn =
+      dimension == "supplier" ? "supplier_name" : "category";
+
+  // Rollups cover the whole history, archived years included.
+  const QString salesTable = m_dbManager->salesSource();
+  qint64 minId = 0;
+  qint64 maxId = -1;
+  QSqlQuery query(m_dbManager->database());
+  query.prepare(QString("SELECT MIN(id), MAX(id) FROM %1 WHERE user_id = :userId")
+                    .arg(salesTable));
+  query.bindValue(":userId", m_userId);
+  if (query.exec() && query.next() && !query.isNull(0)) {
+    minId = query.value(0).toLongLong();
+    maxId = query.value(1).toLongLong();
+  }
+
+  const QString databasePath = m_dbManager->dataPath(m_userId);
+  QVector<Partition> partitions;
+  partitions.append({Partition::Inventory, m_userId, databasePath, groupColumn,
+                     salesTable, 0, 0});
+
+  // Rowid ranges keep every worker on a contiguous slice of the table's
+  // b-tree; a few more slices than cores smooths out uneven user density.
+  const qint64 span = maxId - minId + 1;
+  if (span > 0) {
+    const int sliceCount =
+        int(qMin<qint64>(span, qMax(1, QThread::idealThreadCount()) * 4));
+    const qint64 sliceSize = (span + sliceCount - 1) / sliceCount;
+    for (qint64 first = minId; first <= maxId; first += sliceSize) {
+      partitions.append({Partition::SalesRange, m_userId, databasePath,
+                         groupColumn, salesTable, first,
+                         qMin(maxId, first + sliceSize - 1)});
+    }
+  }
+
+  m_dimension = dimension;
+  emit dimensionChanged();
+  m_jobUserId = m_userId;
+
+  const DatabaseManager *dbManager = m_dbManager;
+  m_watcher.setFuture(QtConcurrent::mappedReduced<RollupTable>(
+      partitions,
+      [dbManager](const Partition &partition) {
+        return computePartition(dbManager, partition);
+      },
+      mergeRollups, QtConcurrent::UnorderedReduce));
+  emit busyChanged();
+}
+
+void AnalyticsModel::onComputeFinished() {
+  if (m_jobUserId != m_userId) {
+    // Computed for a user who has since logged out.
+    if (!m_pendingDimension.isEmpty() && m_userId != -1) {
+      const QString dimension = m_pendingDimension;
+      m_pendingDimension.clear();
+      startCompute(dimension);
+      return;
+    }
+    m_pendingDimension.clear();
+    emit busyChanged();
+    return;
+  }
+
+  const RollupTable table = m_watcher.future().result();
+
+  beginResetModel();
+  m_rows.clear();
+  m_rows.reserve(table.size());
+  for (auto it = table.constBegin(); it != table.constEnd(); ++it)
+    m_rows.append({it.key(), it.value()});
+  std::sort(m_rows.begin(), m_rows.end(), [](const Row &a, const Row &b) {
+    return a.rollup.revenue > b.rollup.revenue;
+  });
+  endResetModel();
+
+  if (!m_pendingDimension.isEmpty()) {
+    const QString dimension = m_pendingDimension;
+    m_pendingDimension.clear();
+    startCompute(dimension);
+    return;
+  }
+  emit busyChanged();
+}
+
+bool AnalyticsModel::busy() const { return m_watcher.isRunning(); }
+
+QString AnalyticsModel::dimension() const { return m_dimension; }
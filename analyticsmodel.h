@@ -0,0 +1,82 @@
+#ifndef ANALYTICSMODEL_H
+#define ANALYTICSMODEL_H
+
+#include <QAbstractListModel>
+#include <QFutureWatcher>
+#include <QHash>
+#include <QVector>
+#include "databasemanager.h"
+#include "money.h"
+
+class AnalyticsModel : public QAbstractListModel
+{
+    Q_OBJECT
+    Q_PROPERTY(bool busy READ busy NOTIFY busyChanged)
+    Q_PROPERTY(QString dimension READ dimension NOTIFY dimensionChanged)
+
+public:
+    enum Roles {
+        KeyRole = Qt::UserRole + 1,
+        ItemCountRole,
+        UnitsSoldRole,
+        RevenueRole,
+        CostRole,
+        MarginRole,
+        MarginPercentRole,
+        StockUnitsRole,
+        StockValueRole,
+        SellThroughRole
+    };
+
+    // Money in cents, so partitions merge to the same totals in any order.
+    struct Rollup {
+        int itemCount = 0;
+        qint64 unitsSold = 0;
+        Money::Cents revenue = 0;
+        Money::Cents cost = 0;
+        qint64 stockUnits = 0;
+        Money::Cents stockValue = 0;
+    };
+    using RollupTable = QHash<QString, Rollup>;
+
+    explicit AnalyticsModel(DatabaseManager *dbManager, QObject *parent = nullptr);
+    ~AnalyticsModel();
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+    QHash<int, QByteArray> roleNames() const override;
+
+    void setUserId(int userId);
+    // Recomputes the rollups grouped by "category" or "supplier" on the
+    // global thread pool; the model is reset once all partitions are merged.
+    Q_INVOKABLE void compute(const QString &dimension);
+
+    bool busy() const;
+    QString dimension() const;
+
+signals:
+    void errorOccurred(const QString &error);
+    void busyChanged();
+    void dimensionChanged();
+
+private slots:
+    void onComputeFinished();
+
+private:
+    struct Row {
+        QString key;
+        Rollup rollup;
+    };
+
+    DatabaseManager *m_dbManager;
+    QFutureWatcher<RollupTable> m_watcher;
+    QVector<Row> m_rows;
+    int m_userId;
+    int m_jobUserId; // whose rollups the running job computes
+    QString m_dimension;
+    QString m_pendingDimension;
+
+    void startCompute(const QString &dimension);
+};
+
+#endif // ANALYTICSMODEL_H
@@ -0,0 +1,159 @@
+#include "changefeed.h"
+#include <QDebug>
+#include <QHash>
+#include <QSqlError>
+#include <QSqlQuery>
+
+namespace {
+const int DEFAULT_POLL_INTERVAL_MS = 250;
+
+struct PendingChanges {
+  QHash<int, bool> deleted; // row id -> last operation was a delete
+
+  void add(int rowId, const QString &operation) {
+    deleted.insert(rowId, operation == "D");
+  }
+
+  void split(QList<int> &upserted, QList<int> &removed) const {
+    for (auto it = deleted.constBegin(); it != deleted.constEnd(); ++it) {
+      if (it.value())
+        removed.append(it.key());
+      else
+        upserted.append(it.key());
+    }
+  }
+};
+} // namespace
+
+ChangeFeed::ChangeFeed(DatabaseManager *dbManager, QObject *parent)
+    : QObject(parent), m_dbManager(dbManager), m_userId(-1),
+      m_lastSequence(0), m_dataVersion(-1) {
+  m_timer.setInterval(DEFAULT_POLL_INTERVAL_MS);
+  connect(&m_timer, &QTimer::timeout, this, &ChangeFeed::poll);
+}
+
+void ChangeFeed::setUserId(int userId) {
+  if (m_userId == userId)
+    return;
+
+  m_userId = userId;
+  if (m_userId == -1) {
+    m_timer.stop();
+    return;
+  }
+
+  // The models have just loaded everything, so start from the current head.
+  m_lastSequence = readMaxSequence();
+  m_dataVersion = readDataVersion();
+  emit lastSequenceChanged();
+  m_timer.start();
+}
+
+int ChangeFeed::resume(int userId, qint64 fromSequence) {
+  m_userId = userId;
+  m_lastSequence = fromSequence;
+  m_dataVersion = readDataVersion();
+  m_timer.start();
+  return readChanges(false);
+}
+
+void ChangeFeed::setPollInterval(int msec) { m_timer.setInterval(msec); }
+
+qint64 ChangeFeed::lastSequence() const { return m_lastSequence; }
+
+void ChangeFeed::poll() {
+  if (m_userId == -1)
+    return;
+
+  // data_version only moves when another connection commits, which makes
+  // the idle case a single pragma read with no table access.
+  const qint64 dataVersion = readDataVersion();
+  if (dataVersion == m_dataVersion)
+    return;
+  m_dataVersion = dataVersion;
+  readChanges(true);
+}
+
+int ChangeFeed::readChanges(bool notifyResync) {
+  QSqlQuery query(m_dbManager->database());
+  query.setForwardOnly(true);
+  query.prepare("SELECT MIN(seq) FROM ChangeLog");
+  if (query.exec() && query.next() && !query.isNull(0) &&
+      query.value(0).toLongLong() > m_lastSequence + 1 && m_lastSequence > 0) {
+    // Entries we never saw have been pruned; a delta is no longer possible.
+    m_lastSequence = readMaxSequence();
+    emit lastSequenceChanged();
+    if (notifyResync)
+      emit resyncRequired();
+    return -1;
+  }
+
+  // Other users' writes still advance the global sequence, so read up to a
+  // fixed head and resume from there next time.
+  const qint64 head = readMaxSequence();
+  query.prepare("SELECT table_name, row_id, operation FROM ChangeLog "
+                "WHERE user_id = :userId AND seq > :lastSeq AND seq <= :head "
+                "ORDER BY seq");
+  query.bindValue(":userId", m_userId);
+  query.bindValue(":lastSeq", m_lastSequence);
+  query.bindValue(":head", head);
+
+  if (!query.exec()) {
+    emit errorOccurred(
+        tr("Failed to read change log: %1").arg(query.lastError().text()));
+    return 0;
+  }
+
+  PendingChanges inventory;
+  PendingChanges sales;
+  while (query.next()) {
+    const QString table = query.value(0).toString();
+    const int rowId = query.value(1).toInt();
+    const QString operation = query.value(2).toString();
+    if (table == "Inventory")
+      inventory.add(rowId, operation);
+    else if (table == "Sales")
+      sales.add(rowId, operation);
+  }
+
+  // Archive runs log one entry for every user under user 0.
+  query.prepare("SELECT COUNT(*) FROM ChangeLog WHERE user_id = 0 AND "
+                "seq > :lastSeq AND seq <= :head");
+  query.bindValue(":lastSeq", m_lastSequence);
+  query.bindValue(":head", head);
+  const bool archived =
+      query.exec() && query.next() && query.value(0).toLongLong() > 0;
+
+  m_lastSequence = head;
+  emit lastSequenceChanged();
+
+  if (archived)
+    emit archivesChanged();
+
+  if (!inventory.deleted.isEmpty()) {
+    QList<int> upserted, removed;
+    inventory.split(upserted, removed);
+    emit inventoryChanged(upserted, removed);
+  }
+  if (!sales.deleted.isEmpty()) {
+    QList<int> upserted, removed;
+    sales.split(upserted, removed);
+    emit salesChanged(upserted, removed);
+  }
+  return inventory.deleted.size() + sales.deleted.size();
+}
+
+qint64 ChangeFeed::readDataVersion() const {
+  QSqlQuery query(m_dbManager->database());
+  if (!query.exec("PRAGMA data_version") || !query.next())
+    return -1;
+  return query.value(0).toLongLong();
+}
+
+qint64 ChangeFeed::readMaxSequence() const {
+  QSqlQuery query(m_dbManager->database());
+  if (!query.exec("SELECT IFNULL(MAX(seq), 0) FROM ChangeLog") ||
+      !query.next())
+    return m_lastSequence;
+  return query.value(0).toLongLong();
+}
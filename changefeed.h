@@ -0,0 +1,53 @@
+#ifndef CHANGEFEED_H
+#define CHANGEFEED_H
+
+#include <QList>
+#include <QObject>
+#include <QTimer>
+#include "databasemanager.h"
+
+// Polls the ChangeLog table for writes made by other connections to the same
+// database file. PRAGMA data_version is checked on every tick and only when it
+// moves is the log read, starting after the last sequence number seen.
+class ChangeFeed : public QObject
+{
+    Q_OBJECT
+    Q_PROPERTY(qint64 lastSequence READ lastSequence NOTIFY lastSequenceChanged)
+
+public:
+    explicit ChangeFeed(DatabaseManager *dbManager, QObject *parent = nullptr);
+
+    void setUserId(int userId);
+    // Starts following userId from fromSequence instead of the current head,
+    // delivering everything logged since then straight away. Returns the
+    // number of rows reported, or -1 when that part of the log has been
+    // pruned and the caller must reload.
+    int resume(int userId, qint64 fromSequence);
+    void setPollInterval(int msec);
+    qint64 lastSequence() const;
+
+public slots:
+    void poll();
+
+signals:
+    void inventoryChanged(const QList<int> &upsertedIds, const QList<int> &deletedIds);
+    void salesChanged(const QList<int> &upsertedIds, const QList<int> &deletedIds);
+    void resyncRequired();
+    // Another terminal moved closed years of sales into the archives.
+    void archivesChanged();
+    void lastSequenceChanged();
+    void errorOccurred(const QString &error);
+
+private:
+    DatabaseManager *m_dbManager;
+    QTimer m_timer;
+    int m_userId;
+    qint64 m_lastSequence;
+    qint64 m_dataVersion;
+
+    int readChanges(bool notifyResync);
+    qint64 readDataVersion() const;
+    qint64 readMaxSequence() const;
+};
+
+#endif // CHANGEFEED_H
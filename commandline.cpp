@@ -0,0 +1,785 @@
+#include "commandline.h"
+#include <QCoreApplication>
+#include <QDate>
+#include <QDebug>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QTemporaryDir>
+#include <QTextStream>
+#include "changefeed.h"
+#include "inventorymodel.h"
+#include "queryservice.h"
+#include "rowmapper.h"
+#include "salesarchive.h"
+#include "salesmodel.h"
+#include "stockledger.h"
+#include "streamexporter.h"
+#include "tracer.h"
+#include "userdashboard.h"
+#include "workloadreplay.h"
+
+namespace {
+// The columns InventoryModel loads, for --decode-benchmark.
+struct BenchmarkItem {
+  int id;
+  QString name;
+  QString category;
+  int quantity;
+  qint64 price;
+  QString supplierName;
+  QString supplierAddress;
+  QDate expiryDate;
+  QDateTime lastUpdated;
+  QString sku;
+
+  static auto columns() {
+    return std::make_tuple(
+        column("id", &BenchmarkItem::id), column("name", &BenchmarkItem::name),
+        column("category", &BenchmarkItem::category),
+        column("quantity", &BenchmarkItem::quantity),
+        column("price", &BenchmarkItem::price),
+        column("supplier_name", &BenchmarkItem::supplierName),
+        column("supplier_address", &BenchmarkItem::supplierAddress),
+        column("expiry_date", &BenchmarkItem::expiryDate),
+        column("last_updated", &BenchmarkItem::lastUpdated),
+        column("sku", &BenchmarkItem::sku));
+  }
+};
+} // namespace
+
+void CommandLine::addOptions(QCommandLineParser &parser) {
+  parser.setApplicationDescription("Business Inventory Management System");
+  parser.addHelpOption();
+  parser.addOptions({
+      {"database", "Path of the SQLite database file.", "path"},
+      {"user", "Username whose data a headless command operates on.",
+       "username"},
+      {"export-sales", "Stream the user's sales to <file> and exit.", "file"},
+      {"export-inventory", "Stream the user's inventory to <file> and exit.",
+       "file"},
+      {"format", "Export format: csv (default) or jsonl.", "format"},
+      {"from", "Export rows on or after <date> (yyyy-MM-dd).", "date"},
+      {"to", "Export rows on or before <date> (yyyy-MM-dd).", "date"},
+      {"category", "Export only rows in <category>.", "category"},
+      {"wal", "Open the database in write-ahead-log mode."},
+      {"shard-dir",
+       "Keep each user's inventory and sales in their own file under <dir>; "
+       "the main database then only holds accounts.",
+       "dir"},
+      {"archive-sales",
+       "Move sales from closed years into yearly archive files and exit."},
+      {"backup", "Write a verified online backup to <file> and exit.",
+       "file"},
+      {"backup-dir",
+       "Take scheduled snapshots into <dir> while the application runs.",
+       "dir"},
+      {"backup-interval", "Minutes between scheduled snapshots (default 60).",
+       "minutes"},
+      {"backup-retain", "Number of scheduled snapshots to keep (default 24).",
+       "count"},
+      {"maintenance-idle",
+       "Run database maintenance after <minutes> without writes (default "
+       "5, 0 disables).",
+       "minutes"},
+      {"maintenance-budget",
+       "Longest time in ms a maintenance step may hold the write lock "
+       "(default 50).",
+       "ms"},
+      {"maintain",
+       "Run database maintenance now, print what it did and exit."},
+      {"vacuum",
+       "Rebuild the database file with incremental auto-vacuum enabled and "
+       "exit. Other terminals are locked out while it runs."},
+      {"record-trace",
+       "Record the calls the UI makes on the models to <file> for replay.",
+       "file"},
+      {"replay",
+       "Replay a recorded trace against a copy of the database, print "
+       "per-operation latencies and exit.",
+       "trace"},
+      {"replay-sql",
+       "Run <statement> on the replay copy before replaying (repeatable), "
+       "e.g. to try an index or pragma.",
+       "statement"},
+      {"stock-at",
+       "Print the user's stock levels and values at the end of <date> "
+       "(yyyy-MM-dd) as CSV and exit.",
+       "date"},
+      {"serve",
+       "Answer local tools from the loaded models on the local socket "
+       "<name>.",
+       "name"},
+      {"daemon",
+       "Run only the query service given by --serve, without the window, "
+       "for the user given by --user."},
+      {"fast-start",
+       "Show the login screen while the database is opened and migrated "
+       "in the background."},
+      {"trace",
+       "Trace model operations, database work and frames from start-up "
+       "and write them to <file> as Chrome trace JSON on exit.",
+       "file"},
+      {"till-journal",
+       "Take sales offline-first: journal them in the local file <file> "
+       "and merge them into the database in the background.",
+       "file"},
+      {"merge-journal",
+       "Merge the sales waiting in the till journal <file> into the "
+       "database, print the outcome and exit.",
+       "file"},
+      {"memory-budget",
+       "Limit a component to <component>=<MiB> (repeatable); components "
+       "are inventory, sales, dashboard, sessionCache and sqlite. Models "
+       "over budget page their rows out while not on screen.",
+       "budget"},
+      {"memory-report",
+       "Load the user's models, print the memory used by each component "
+       "and exit."},
+      {"decode-benchmark",
+       "Decode the user's inventory <passes> times (default 20), by column "
+       "name and through RowMapper, print the time per pass and exit.",
+       "passes"},
+      {"startup-timeline",
+       "Write the timings of the start-up phases to <file> (- for stderr) "
+       "once the login screen can be used.",
+       "file"},
+  });
+}
+
+bool CommandLine::isHeadless(const QCommandLineParser &parser) {
+  return parser.isSet("export-sales") || parser.isSet("export-inventory") ||
+         parser.isSet("backup") || parser.isSet("archive-sales") ||
+         parser.isSet("replay") || parser.isSet("daemon") ||
+         parser.isSet("stock-at") || parser.isSet("maintain") ||
+         parser.isSet("vacuum") || parser.isSet("merge-journal") ||
+         parser.isSet("memory-report") ||
+         parser.isSet("decode-benchmark") || parser.isSet("help");
+}
+
+void CommandLine::applyDatabaseOptions(const QCommandLineParser &parser,
+                                       DatabaseManager &dbManager) {
+  if (parser.isSet("database"))
+    dbManager.setDatabasePath(parser.value("database"));
+  dbManager.setWalEnabled(parser.isSet("wal"));
+  if (parser.isSet("shard-dir"))
+    dbManager.setShardDirectory(parser.value("shard-dir"));
+}
+
+void CommandLine::applyBackupSchedule(const QCommandLineParser &parser,
+                                      DatabaseManager &dbManager) {
+  if (!parser.isSet("backup-dir"))
+    return;
+
+  bool ok = false;
+  int interval = parser.value("backup-interval").toInt(&ok);
+  if (!ok || interval <= 0)
+    interval = 60;
+  int retain = parser.value("backup-retain").toInt(&ok);
+  if (!ok || retain <= 0)
+    retain = 24;
+  dbManager.scheduleBackups(parser.value("backup-dir"), interval, retain);
+}
+
+void CommandLine::applyMaintenance(const QCommandLineParser &parser,
+                                   DatabaseManager &dbManager) {
+  bool ok = false;
+  int idleMinutes = parser.value("maintenance-idle").toInt(&ok);
+  if (!ok || idleMinutes < 0)
+    idleMinutes = 5;
+  int budget = parser.value("maintenance-budget").toInt(&ok);
+  if (!ok || budget <= 0)
+    budget = 50;
+  dbManager.scheduleMaintenance(idleMinutes, budget);
+}
+
+void CommandLine::applyTracing(const QCommandLineParser &parser) {
+  if (parser.isSet("trace"))
+    Tracer::start();
+}
+
+void CommandLine::finishTracing(const QCommandLineParser &parser) {
+  if (!parser.isSet("trace"))
+    return;
+  QString error;
+  if (!Tracer::writeChromeTrace(parser.value("trace"), &error))
+    qWarning() << "Cannot write trace:" << error;
+}
+
+void CommandLine::applyTillJournal(const QCommandLineParser &parser,
+                                   TillJournal &tillJournal) {
+  if (!parser.isSet("till-journal"))
+    return;
+
+  QString error;
+  if (!tillJournal.open(parser.value("till-journal"), &error))
+    qWarning() << "Cannot open the till journal, sales go straight to the "
+                  "database:"
+               << error;
+}
+
+void CommandLine::applyMemoryBudgets(const QCommandLineParser &parser,
+                                     MemoryMonitor &memoryMonitor) {
+  for (const QString &budget : parser.values("memory-budget")) {
+    const QString component = budget.section('=', 0, 0);
+    bool ok = false;
+    const double mebibytes = budget.section('=', 1).toDouble(&ok);
+    if (!ok || mebibytes < 0 ||
+        !memoryMonitor.setBudget(component, qint64(mebibytes * 1024 * 1024)))
+      qWarning() << "Ignoring memory budget" << budget
+                 << "- expected <component>=<MiB> with component one of"
+                 << MemoryMonitor::componentNames().join(", ");
+  }
+}
+
+void CommandLine::applyRecording(const QCommandLineParser &parser,
+                                 WorkloadRecorder &recorder) {
+  if (!parser.isSet("record-trace"))
+    return;
+
+  QString error;
+  if (!recorder.open(parser.value("record-trace"), &error)) {
+    qWarning() << "Cannot record workload trace:" << error;
+    return;
+  }
+  WorkloadRecorder::setActive(&recorder);
+}
+
+int CommandLine::run(const QCommandLineParser &parser,
+                     DatabaseManager &dbManager) {
+  QTextStream err(stderr);
+  if (parser.isSet("help")) {
+    QTextStream(stdout) << parser.helpText();
+    return 0;
+  }
+
+  // Replays never touch the database they were pointed at.
+  if (parser.isSet("replay"))
+    return runReplay(parser, dbManager);
+
+  if (!dbManager.initialize()) {
+    err << "Failed to initialize database" << Qt::endl;
+    return 1;
+  }
+
+  // Per-user commands operate on that user's shard in sharded mode.
+  if (parser.isSet("user")) {
+    const int userId = resolveUserId(dbManager, parser.value("user"));
+    if (userId == -1) {
+      err << "Unknown user: " << parser.value("user") << Qt::endl;
+      return 1;
+    }
+    if (!dbManager.activateUser(userId))
+      return 1;
+  }
+
+  if (parser.isSet("export-sales") || parser.isSet("export-inventory"))
+    return runExport(parser, dbManager);
+  if (parser.isSet("backup"))
+    return runBackup(parser, dbManager);
+  if (parser.isSet("archive-sales"))
+    return runArchive(dbManager);
+  if (parser.isSet("stock-at"))
+    return runStockAt(parser, dbManager);
+  if (parser.isSet("maintain"))
+    return runMaintain(parser, dbManager);
+  if (parser.isSet("vacuum"))
+    return runVacuum(dbManager);
+  if (parser.isSet("daemon"))
+    return runDaemon(parser, dbManager);
+  if (parser.isSet("merge-journal"))
+    return runMergeJournal(parser, dbManager);
+  if (parser.isSet("memory-report"))
+    return runMemoryReport(parser, dbManager);
+  if (parser.isSet("decode-benchmark"))
+    return runDecodeBenchmark(parser, dbManager);
+  return 0;
+}
+
+int CommandLine::resolveUserId(DatabaseManager &dbManager,
+                               const QString &username) {
+  QSqlQuery query(dbManager.catalogDatabase());
+  query.prepare("SELECT id FROM Users WHERE username = :username");
+  query.bindValue(":username", username);
+  if (!query.exec() || !query.next())
+    return -1;
+  return query.value(0).toInt();
+}
+
+int CommandLine::runExport(const QCommandLineParser &parser,
+                           DatabaseManager &dbManager) {
+  QTextStream err(stderr);
+  const int userId = resolveUserId(dbManager, parser.value("user"));
+  if (userId == -1) {
+    err << "Unknown user: " << parser.value("user") << Qt::endl;
+    return 1;
+  }
+
+  QVariantMap filter;
+  for (const QString &bound : {QString("from"), QString("to")}) {
+    if (!parser.isSet(bound))
+      continue;
+    const QDate date = QDate::fromString(parser.value(bound), Qt::ISODate);
+    if (!date.isValid()) {
+      err << "Invalid --" << bound << " date: " << parser.value(bound)
+          << " (expected yyyy-MM-dd)" << Qt::endl;
+      return 1;
+    }
+    filter.insert(bound, date);
+  }
+  if (parser.isSet("category"))
+    filter.insert("category", parser.value("category"));
+
+  const bool sales = parser.isSet("export-sales");
+  StreamExporter::Request request =
+      sales ? SalesModel::exportRequest(&dbManager, userId, filter)
+            : InventoryModel::exportRequest(userId, filter);
+  request.filePath =
+      parser.value(sales ? "export-sales" : "export-inventory");
+  if (!StreamExporter::parseFormat(parser.value("format"), &request.format)) {
+    err << "Unknown export format: " << parser.value("format") << Qt::endl;
+    return 1;
+  }
+
+  QElapsedTimer timer;
+  timer.start();
+  std::atomic_bool cancelled(false);
+  const StreamExporter::Result result = StreamExporter::run(
+      &dbManager, request, cancelled, [&err](qint64 rows) {
+        err << "\rExported " << rows << " rows" << Qt::flush;
+      });
+  err << Qt::endl;
+
+  if (!result.ok) {
+    err << "Export failed: " << result.error << Qt::endl;
+    return 1;
+  }
+  err << "Wrote " << result.rows << " rows to " << request.filePath << " in "
+      << timer.elapsed() << " ms" << Qt::endl;
+  return 0;
+}
+
+int CommandLine::runBackup(const QCommandLineParser &parser,
+                           DatabaseManager &dbManager) {
+  QTextStream err(stderr);
+  QString reason;
+  if (!DatabaseManager::sqliteApiUsable(&reason)) {
+    err << "Online backup is disabled: " << reason << Qt::endl;
+    return 1;
+  }
+  std::atomic_bool cancelled(false);
+  const OnlineBackup::Result result = OnlineBackup::run(
+      dbManager.databasePath(), parser.value("backup"),
+      OnlineBackup::Options(), cancelled,
+      [&err](int remaining, int pageCount) {
+        err << "\rBackup: " << (pageCount - remaining) << "/" << pageCount
+            << " pages" << Qt::flush;
+      });
+  err << Qt::endl;
+
+  if (!result.ok) {
+    err << "Backup failed: " << result.error << Qt::endl;
+    return 1;
+  }
+  err << "Backup of " << result.pageCount << " pages written to "
+      << result.filePath << " in " << result.elapsedMs << " ms ("
+      << result.restarts << " restarts, " << result.backoffs
+      << " pauses for writers, integrity "
+      << (result.verified ? "verified" : "not checked") << ")" << Qt::endl;
+  return 0;
+}
+
+int CommandLine::runArchive(DatabaseManager &dbManager) {
+  QTextStream err(stderr);
+  QElapsedTimer timer;
+  timer.start();
+  const qint64 moved = dbManager.archiveClosedPeriods();
+  if (moved < 0) {
+    err << "Archiving failed" << Qt::endl;
+    return 1;
+  }
+  err << "Archived " << moved << " sales in " << timer.elapsed() << " ms"
+      << Qt::endl;
+  return 0;
+}
+
+// What the GUI holds for the user once the inventory and sales views have
+// been opened, plus SQLite's share.
+int CommandLine::runMemoryReport(const QCommandLineParser &parser,
+                                 DatabaseManager &dbManager) {
+  if (!parser.isSet("user")) {
+    QTextStream(stderr) << "--memory-report needs --user <username>"
+                        << Qt::endl;
+    return 1;
+  }
+  // run() has already activated the user's database.
+  const int userId = resolveUserId(dbManager, parser.value("user"));
+
+  InventoryModel inventoryModel(&dbManager);
+  SalesModel salesModel(&dbManager);
+  salesModel.setInventoryModel(&inventoryModel);
+  UserDashboard dashboard(&dbManager, &inventoryModel, &salesModel);
+  dashboard.setUserId(userId);
+  inventoryModel.ensureLoaded();
+  salesModel.ensureLoaded();
+
+  MemoryMonitor memoryMonitor(&dbManager, &inventoryModel, &salesModel,
+                              &dashboard, nullptr);
+  memoryMonitor.setCheckInterval(0);
+  applyMemoryBudgets(parser, memoryMonitor);
+  QTextStream(stdout) << memoryMonitor.reportText() << Qt::flush;
+  return 0;
+}
+
+// Both ways of decoding run the same statement over the same rows, so the
+// difference between them is the decoding.
+int CommandLine::runDecodeBenchmark(const QCommandLineParser &parser,
+                                    DatabaseManager &dbManager) {
+  QTextStream err(stderr);
+  if (!parser.isSet("user")) {
+    err << "--decode-benchmark needs --user <username>" << Qt::endl;
+    return 1;
+  }
+  const int userId = resolveUserId(dbManager, parser.value("user"));
+  bool ok = false;
+  int passes = parser.value("decode-benchmark").toInt(&ok);
+  if (!ok || passes <= 0)
+    passes = 20;
+
+  QSqlQuery query(dbManager.database());
+  query.setForwardOnly(true);
+  query.prepare("SELECT id, name, category, quantity, price, supplier_name, "
+                "supplier_address, expiry_date, last_updated, sku "
+                "FROM Inventory WHERE user_id = :userId");
+  query.bindValue(":userId", userId);
+
+  qint64 rows = 0;
+  qint64 checksum = 0; // keeps the decoded rows alive
+  auto timePasses = [&](const std::function<void()> &decodeAll) {
+    QElapsedTimer timer;
+    timer.start();
+    for (int pass = 0; pass < passes; ++pass) {
+      if (!query.exec())
+        return qint64(-1);
+      rows = 0;
+      decodeAll();
+    }
+    return timer.nsecsElapsed();
+  };
+
+  const qint64 byNameNs = timePasses([&]() {
+    while (query.next()) {
+      BenchmarkItem item;
+      item.id = query.value("id").toInt();
+      item.name = query.value("name").toString();
+      item.category = query.value("category").toString();
+      item.quantity = query.value("quantity").toInt();
+      item.price = query.value("price").toLongLong();
+      item.supplierName = query.value("supplier_name").toString();
+      item.supplierAddress = query.value("supplier_address").toString();
+      item.expiryDate = query.value("expiry_date").toDate();
+      item.lastUpdated = query.value("last_updated").toDateTime();
+      item.sku = query.value("sku").toString();
+      checksum += item.id + item.name.size();
+      ++rows;
+    }
+  });
+  const qint64 mappedNs = timePasses([&]() {
+    const RowMapper<BenchmarkItem> mapper(query);
+    while (query.next()) {
+      const BenchmarkItem item = mapper.read(query);
+      checksum += item.id + item.name.size();
+      ++rows;
+    }
+  });
+  if (byNameNs < 0 || mappedNs < 0) {
+    err << "Query failed: " << query.lastError().text() << Qt::endl;
+    return 1;
+  }
+
+  QTextStream out(stdout);
+  out << rows << " rows, " << passes << " passes (checksum " << checksum
+      << ")\n";
+  out << "by name:   " << QString::number(byNameNs / 1e6 / passes, 'f', 2)
+      << " ms per pass\n";
+  out << "RowMapper: " << QString::number(mappedNs / 1e6 / passes, 'f', 2)
+      << " ms per pass\n";
+  out.flush();
+  return 0;
+}
+
+// Sales in the journal name their user, so no --user is needed; conflicts
+// stay in the journal for the till to retry.
+int CommandLine::runMergeJournal(const QCommandLineParser &parser,
+                                 DatabaseManager &dbManager) {
+  QTextStream err(stderr);
+  const QString journalPath = parser.value("merge-journal");
+  if (!QFileInfo::exists(journalPath)) {
+    err << "No till journal at " << journalPath << Qt::endl;
+    return 1;
+  }
+
+  QElapsedTimer timer;
+  timer.start();
+  int merged = 0;
+  int duplicates = 0;
+  int conflicts = 0;
+  TillJournal::MergeResult result;
+  do {
+    result = TillJournal::merge(journalPath, &dbManager);
+    merged += result.merged;
+    duplicates += result.duplicates;
+    conflicts += result.conflicts.size();
+    for (const TillJournal::Conflict &conflict : result.conflicts)
+      err << "Conflict: sale " << conflict.saleUuid << " of " << conflict.quantity
+          << " x item " << conflict.itemId << ": " << conflict.reason
+          << Qt::endl;
+  } while (result.ok && result.more);
+
+  if (!result.ok)
+    err << "Merging failed: " << result.error << Qt::endl;
+  err << "Merged " << merged << " sales (" << duplicates
+      << " already merged, " << conflicts << " conflicts) in "
+      << timer.elapsed() << " ms" << Qt::endl;
+  return result.ok ? 0 : 1;
+}
+
+int CommandLine::runMaintain(const QCommandLineParser &parser,
+                             DatabaseManager &dbManager) {
+  QString reason;
+  if (!DatabaseManager::sqliteApiUsable(&reason)) {
+    QTextStream(stderr) << "Maintenance is disabled: " << reason << Qt::endl;
+    return 1;
+  }
+  MaintenanceScheduler::Options options;
+  options.force = true;
+  bool ok = false;
+  const int budget = parser.value("maintenance-budget").toInt(&ok);
+  if (ok && budget > 0)
+    options.lockBudgetMs = budget;
+
+  std::atomic_bool cancelled(false);
+  bool allOk = true;
+  for (const QString &path : dbManager.dataFiles()) {
+    const MaintenanceScheduler::Result result =
+        MaintenanceScheduler::run(path, options, -1, cancelled);
+    QTextStream(stdout) << MaintenanceScheduler::report(result) << Qt::endl;
+    allOk = allOk && result.ok;
+  }
+  return allOk ? 0 : 1;
+}
+
+int CommandLine::runVacuum(DatabaseManager &dbManager) {
+  QTextStream err(stderr);
+  QElapsedTimer timer;
+  timer.start();
+  QSqlQuery query(dbManager.database());
+  // auto_vacuum can only change on an empty file or through a VACUUM.
+  if (!query.exec("PRAGMA auto_vacuum = INCREMENTAL") ||
+      !query.exec("VACUUM")) {
+    err << "Vacuum failed: " << query.lastError().text() << Qt::endl;
+    return 1;
+  }
+  const qint64 pages =
+      query.exec("PRAGMA page_count") && query.next() ? query.value(0).toLongLong()
+                                                      : 0;
+  err << "Rebuilt " << dbManager.databasePath() << " (" << pages
+      << " pages) in " << timer.elapsed() << " ms" << Qt::endl;
+  return 0;
+}
+
+int CommandLine::runStockAt(const QCommandLineParser &parser,
+                            DatabaseManager &dbManager) {
+  QTextStream err(stderr);
+  QTextStream out(stdout);
+  const int userId = resolveUserId(dbManager, parser.value("user"));
+  if (userId == -1) {
+    err << "Unknown user: " << parser.value("user") << Qt::endl;
+    return 1;
+  }
+  const QDate date = QDate::fromString(parser.value("stock-at"), Qt::ISODate);
+  if (!date.isValid()) {
+    err << "Invalid date: " << parser.value("stock-at") << Qt::endl;
+    return 1;
+  }
+
+  QElapsedTimer timer;
+  timer.start();
+  QString error;
+  QVector<StockLedger::Level> levels;
+  if (!StockLedger::takeMonthlySnapshots(dbManager.database(), userId,
+                                         &error) ||
+      !StockLedger::levelsAt(dbManager.database(), userId,
+                             QDateTime(date.addDays(1), QTime(0, 0)), -1,
+                             &levels, &error)) {
+    err << "Stock history query failed: " << error << Qt::endl;
+    return 1;
+  }
+
+  Money::Cents total = 0;
+  out << "item_id,name,quantity,unit_price,value" << Qt::endl;
+  for (const StockLedger::Level &level : levels) {
+    const Money::Cents value = level.quantity * level.unitPrice;
+    total += value;
+    QString name = level.name;
+    name.replace('"', "\"\"");
+    out << level.itemId << ",\"" << name << "\"," << level.quantity << ","
+        << Money::toString(level.unitPrice) << "," << Money::toString(value)
+        << "\n";
+  }
+  out.flush();
+  err << levels.size() << " items, total value " << Money::toString(total)
+      << ", in " << timer.elapsed() << " ms" << Qt::endl;
+  return 0;
+}
+
+int CommandLine::runDaemon(const QCommandLineParser &parser,
+                           DatabaseManager &dbManager) {
+  QTextStream err(stderr);
+  if (!parser.isSet("serve") || !parser.isSet("user")) {
+    err << "--daemon needs --serve <name> and --user <username>" << Qt::endl;
+    return 1;
+  }
+  // run() has already activated the user's database.
+  const int userId = resolveUserId(dbManager, parser.value("user"));
+  applyMaintenance(parser, dbManager);
+
+  // The same wiring as the GUI, minus the views.
+  InventoryModel inventoryModel(&dbManager);
+  SalesModel salesModel(&dbManager);
+  salesModel.setInventoryModel(&inventoryModel);
+  UserDashboard dashboard(&dbManager, &inventoryModel, &salesModel);
+  ChangeFeed changeFeed(&dbManager);
+  QObject::connect(&changeFeed, &ChangeFeed::inventoryChanged, &inventoryModel,
+                   &InventoryModel::applyChanges);
+  QObject::connect(&changeFeed, &ChangeFeed::salesChanged, &salesModel,
+                   &SalesModel::applyChanges);
+  QObject::connect(&changeFeed, &ChangeFeed::resyncRequired, &dashboard,
+                   &UserDashboard::refresh);
+  QObject::connect(&changeFeed, &ChangeFeed::archivesChanged, &dbManager,
+                   &DatabaseManager::refreshArchives);
+  StockLedger stockLedger(&dbManager);
+  QObject::connect(&dbManager, &DatabaseManager::maintenanceFinished,
+                   &stockLedger, &StockLedger::takeDueSnapshots);
+  dashboard.setUserId(userId);
+  changeFeed.setUserId(userId);
+  stockLedger.setUserId(userId);
+
+  MemoryMonitor memoryMonitor(&dbManager, &inventoryModel, &salesModel,
+                              &dashboard, nullptr);
+  applyMemoryBudgets(parser, memoryMonitor);
+
+  QueryService service(&inventoryModel, &salesModel, &dashboard);
+  service.setMemoryMonitor(&memoryMonitor);
+  QString error;
+  if (!service.listen(parser.value("serve"), &error)) {
+    err << "Cannot serve on " << parser.value("serve") << ": " << error
+        << Qt::endl;
+    return 1;
+  }
+  service.setUserId(userId);
+  err << "Serving " << parser.value("user") << " on "
+      << parser.value("serve") << Qt::endl;
+  return QCoreApplication::exec();
+}
+
+int CommandLine::runReplay(const QCommandLineParser &parser,
+                           DatabaseManager &dbManager) {
+  QTextStream err(stderr);
+  QTextStream out(stdout);
+  if (dbManager.isSharded()) {
+    err << "Replay does not support sharded databases" << Qt::endl;
+    return 1;
+  }
+  // The copy is taken with the online backup.
+  QString reason;
+  if (!DatabaseManager::sqliteApiUsable(&reason)) {
+    err << "Replay needs the online backup, which is disabled: " << reason
+        << Qt::endl;
+    return 1;
+  }
+
+  QTemporaryDir workDir;
+  if (!workDir.isValid()) {
+    err << "Cannot create a working directory for the replay" << Qt::endl;
+    return 1;
+  }
+
+  // The live file may be in use by tills, so copy it with the online
+  // backup; archives are closed files and are copied as they are.
+  const QString sourcePath = dbManager.databasePath();
+  const QString copyPath =
+      QDir(workDir.path()).filePath(QFileInfo(sourcePath).fileName());
+  OnlineBackup::Options options;
+  options.verify = false;
+  std::atomic_bool cancelled(false);
+  const OnlineBackup::Result copy =
+      OnlineBackup::run(sourcePath, copyPath, options, cancelled, nullptr);
+  if (!copy.ok) {
+    err << "Cannot copy " << sourcePath << ": " << copy.error << Qt::endl;
+    return 1;
+  }
+  for (int year : SalesArchive::archivedYears(sourcePath))
+    QFile::copy(SalesArchive::archivePath(sourcePath, year),
+                SalesArchive::archivePath(copyPath, year));
+  if (QFile::exists(SalesArchive::olderArchivePath(sourcePath)))
+    QFile::copy(SalesArchive::olderArchivePath(sourcePath),
+                SalesArchive::olderArchivePath(copyPath));
+
+  {
+    DatabaseManager replayDb;
+    replayDb.setDatabasePath(copyPath);
+    replayDb.setWalEnabled(parser.isSet("wal"));
+    if (!replayDb.initialize()) {
+      err << "Failed to initialize the replay copy" << Qt::endl;
+      return 1;
+    }
+
+    QSqlQuery setup(replayDb.database());
+    for (const QString &sql : parser.values("replay-sql")) {
+      if (!setup.exec(sql)) {
+        err << "Setup statement failed: " << setup.lastError().text()
+            << Qt::endl;
+        return 1;
+      }
+    }
+
+    WorkloadReplay replay(&replayDb);
+    const WorkloadReplay::Result result = replay.run(parser.value("replay"));
+    if (!result.ok) {
+      err << "Replay failed: " << result.error << Qt::endl;
+      return 1;
+    }
+
+    out << QString("%1 %2 %3 %4 %5 %6 %7 %8")
+               .arg("operation", -30)
+               .arg("calls", 7)
+               .arg("mean", 10)
+               .arg("p50", 10)
+               .arg("p90", 10)
+               .arg("p99", 10)
+               .arg("max", 10)
+               .arg("rec p50", 10)
+        << Qt::endl;
+    auto ms = [](double us) { return QString::number(us / 1000.0, 'f', 3); };
+    for (const WorkloadReplay::OperationStats &stats : result.operations) {
+      out << QString("%1 %2 %3 %4 %5 %6 %7 %8")
+                 .arg(stats.operation, -30)
+                 .arg(stats.calls, 7)
+                 .arg(ms(stats.meanUs), 10)
+                 .arg(ms(stats.p50Us), 10)
+                 .arg(ms(stats.p90Us), 10)
+                 .arg(ms(stats.p99Us), 10)
+                 .arg(ms(stats.maxUs), 10)
+                 .arg(ms(stats.recordedP50Us), 10)
+          << Qt::endl;
+    }
+    err << "Replayed " << result.calls << " calls (" << result.skipped
+        << " skipped) in " << result.elapsedMs << " ms; latencies in ms"
+        << Qt::endl;
+  }
+  return 0;
+}
@@ -0,0 +1,45 @@
+#ifndef COMMANDLINE_H
+#define COMMANDLINE_H
+
+#include <QCommandLineParser>
+#include "databasemanager.h"
+#include "memorymonitor.h"
+#include "tilljournal.h"
+#include "workloadrecorder.h"
+
+// Options shared by the GUI and the headless tools, and the headless entry
+// point used when one of the tool options is given.
+class CommandLine
+{
+public:
+    static void addOptions(QCommandLineParser &parser);
+    static bool isHeadless(const QCommandLineParser &parser);
+    static void applyDatabaseOptions(const QCommandLineParser &parser, DatabaseManager &dbManager);
+    static void applyBackupSchedule(const QCommandLineParser &parser, DatabaseManager &dbManager);
+    static void applyMaintenance(const QCommandLineParser &parser, DatabaseManager &dbManager);
+    // --till-journal: takes sales offline-first; call once the database is open.
+    static void applyTillJournal(const QCommandLineParser &parser, TillJournal &tillJournal);
+    // --memory-budget: one budget per occurrence, see MemoryMonitor.
+    static void applyMemoryBudgets(const QCommandLineParser &parser, MemoryMonitor &memoryMonitor);
+    static void applyRecording(const QCommandLineParser &parser, WorkloadRecorder &recorder);
+    // --trace: starts Tracer now; finishTracing() writes the file on exit.
+    static void applyTracing(const QCommandLineParser &parser);
+    static void finishTracing(const QCommandLineParser &parser);
+    static int run(const QCommandLineParser &parser, DatabaseManager &dbManager);
+
+private:
+    static int resolveUserId(DatabaseManager &dbManager, const QString &username);
+    static int runExport(const QCommandLineParser &parser, DatabaseManager &dbManager);
+    static int runBackup(const QCommandLineParser &parser, DatabaseManager &dbManager);
+    static int runArchive(DatabaseManager &dbManager);
+    static int runStockAt(const QCommandLineParser &parser, DatabaseManager &dbManager);
+    static int runMaintain(const QCommandLineParser &parser, DatabaseManager &dbManager);
+    static int runVacuum(DatabaseManager &dbManager);
+    static int runDaemon(const QCommandLineParser &parser, DatabaseManager &dbManager);
+    static int runMemoryReport(const QCommandLineParser &parser, DatabaseManager &dbManager);
+    static int runDecodeBenchmark(const QCommandLineParser &parser, DatabaseManager &dbManager);
+    static int runMergeJournal(const QCommandLineParser &parser, DatabaseManager &dbManager);
+    static int runReplay(const QCommandLineParser &parser, DatabaseManager &dbManager);
+};
+
+#endif // COMMANDLINE_H
@@ -1,19 +1,224 @@
 #include "databasemanager.h"
+#include <QAtomicInt>
 #include <QDebug>
+#include <QDir>
 #include <QSqlError>
 #include <QSqlQuery>
+#include <QStringList>
+#include <QtConcurrent>
+#include "salesarchive.h"
+#include "startuptimeline.h"
+#include "tracer.h"
+#include <sqlite3.h>
 
-DatabaseManager::DatabaseManager(QObject *parent) : QObject(parent) {}
+namespace {
+QAtomicInt workerConnectionCounter;
+const qint64 DEFAULT_SHARD_IDLE_MS = 10 * 60 * 1000;
+const int SHARD_IDLE_CHECK_MS = 60 * 1000;
+
+// 1 when the Inventory row `row` counts as low on stock: at or below its
+// forecast reorder point, or under the fixed threshold of 10 without one.
+// Mirrors InventoryModel::isLowStock().
+QString lowStockFlag(const QString &row) {
+  return QString("(%1.quantity <= IFNULL((SELECT reorder_point FROM "
+                 "ItemForecasts WHERE item_id = %1.id), 9))")
+      .arg(row);
+}
+
+// Creates the user's UserKpis row if needed, then applies `assignments`.
+QString kpiUpdate(const QString &userId, const QString &assignments) {
+  return QString("INSERT OR IGNORE INTO UserKpis (user_id) VALUES (%1); "
+                 "UPDATE UserKpis SET %2 WHERE user_id = %1;")
+      .arg(userId, assignments);
+}
+
+// Migration 4's counters table, its triggers and the backfill; migration 5
+// recreates them with amounts in cents.
+QStringList kpiSchema(const QString &moneyType) {
+  return {QString("CREATE TABLE IF NOT EXISTS UserKpis ("
+                  "user_id INTEGER PRIMARY KEY, "
+                  "item_count INTEGER NOT NULL DEFAULT 0, "
+                  "inventory_value %1 NOT NULL DEFAULT 0, "
+                  "low_stock_items INTEGER NOT NULL DEFAULT 0, "
+                  "sale_count INTEGER NOT NULL DEFAULT 0, "
+                  "revenue %1 NOT NULL DEFAULT 0, "
+                  "cost %1 NOT NULL DEFAULT 0)")
+              .arg(moneyType),
+          "CREATE TRIGGER IF NOT EXISTS trg_inventory_insert_kpi AFTER INSERT "
+          "ON Inventory BEGIN " +
+              kpiUpdate("NEW.user_id",
+                        "item_count = item_count + 1, inventory_value = "
+                        "inventory_value + NEW.quantity * NEW.price, "
+                        "low_stock_items = low_stock_items + " +
+                            lowStockFlag("NEW")) +
+              " END",
+          "CREATE TRIGGER IF NOT EXISTS trg_inventory_update_kpi AFTER UPDATE "
+          "OF quantity, price ON Inventory BEGIN " +
+              kpiUpdate("NEW.user_id",
+                        "inventory_value = inventory_value + NEW.quantity * "
+                        "NEW.price - OLD.quantity * OLD.price, "
+                        "low_stock_items = low_stock_items + " +
+                            lowStockFlag("NEW") + " - " + lowStockFlag("OLD")) +
+              " END",
+          "CREATE TRIGGER IF NOT EXISTS trg_inventory_delete_kpi AFTER DELETE "
+          "ON Inventory BEGIN " +
+              kpiUpdate("OLD.user_id",
+                        "item_count = item_count - 1, inventory_value = "
+                        "inventory_value - OLD.quantity * OLD.price, "
+                        "low_stock_items = low_stock_items - " +
+                            lowStockFlag("OLD")) +
+              " END",
+          "CREATE TRIGGER IF NOT EXISTS trg_sales_insert_kpi AFTER INSERT ON "
+          "Sales BEGIN " +
+              kpiUpdate("NEW.user_id",
+                        "sale_count = sale_count + 1, revenue = revenue + "
+                        "NEW.total_price, cost = cost + NEW.total_cost") +
+              " END",
+          "CREATE TRIGGER IF NOT EXISTS trg_sales_update_kpi AFTER UPDATE OF "
+          "total_price, total_cost ON Sales BEGIN " +
+              kpiUpdate("NEW.user_id",
+                        "revenue = revenue + NEW.total_price - OLD.total_price, "
+                        "cost = cost + NEW.total_cost - OLD.total_cost") +
+              " END",
+          "CREATE TRIGGER IF NOT EXISTS trg_sales_delete_kpi AFTER DELETE ON "
+          "Sales BEGIN " +
+              kpiUpdate("OLD.user_id",
+                        "sale_count = sale_count - 1, revenue = revenue - "
+                        "OLD.total_price, cost = cost - OLD.total_cost") +
+              " END",
+          "INSERT OR REPLACE INTO UserKpis (user_id, item_count, "
+          "inventory_value, low_stock_items, sale_count, revenue, cost) "
+          "SELECT u.user_id, "
+          "(SELECT COUNT(*) FROM Inventory WHERE user_id = u.user_id), "
+          "(SELECT IFNULL(SUM(quantity * price), 0) FROM Inventory "
+          "WHERE user_id = u.user_id), "
+          "(SELECT COUNT(*) FROM Inventory i WHERE i.user_id = u.user_id AND " +
+              lowStockFlag("i") +
+              "), "
+              "(SELECT COUNT(*) FROM Sales WHERE user_id = u.user_id), "
+              "(SELECT IFNULL(SUM(total_price), 0) FROM Sales "
+              "WHERE user_id = u.user_id), "
+              "(SELECT IFNULL(SUM(total_cost), 0) FROM Sales "
+              "WHERE user_id = u.user_id) "
+              "FROM (SELECT user_id FROM Inventory UNION "
+              "SELECT user_id FROM Sales) u"};
+}
+
+// Statements rebuilding `table` as CREATE TABLE table (definition) options,
+// copying `columns` across with each of `moneyColumns` converted from
+// currency units to cents. Indexes go with the old table and are recreated
+// by the caller; the AUTOINCREMENT counter is kept so ids are never reused.
+QStringList rebuildInCents(const QString &table, const QString &definition,
+                           const QStringList &columns,
+                           const QStringList &moneyColumns,
+                           const QString &options = QString()) {
+  QStringList values;
+  for (const QString &column : columns)
+    values.append(moneyColumns.contains(column)
+                      ? QString("CAST(ROUND(%1 * 100) AS INTEGER)").arg(column)
+                      : column);
+  const QString copy = table + "_cents";
+  return {QString("CREATE TABLE %1 (%2) %3").arg(copy, definition, options),
+          QString("INSERT INTO %1 (%2) SELECT %3 FROM %4")
+              .arg(copy, columns.join(", "), values.join(", "), table),
+          QString("DELETE FROM sqlite_sequence WHERE name = '%1'").arg(copy),
+          QString("INSERT INTO sqlite_sequence (name, seq) SELECT '%1', seq "
+                  "FROM sqlite_sequence WHERE name = '%2'")
+              .arg(copy, table),
+          QString("DROP TABLE %1").arg(table),
+          QString("ALTER TABLE %1 RENAME TO %2").arg(copy, table)};
+}
+} // namespace
+
+DatabaseManager::DatabaseManager(QObject *parent)
+    : QObject(parent), m_databasePath("BIMS3.db"), m_walEnabled(false),
+      m_activeUserId(-1), m_shardIdleTimeoutMs(DEFAULT_SHARD_IDLE_MS),
+      m_backup(new OnlineBackup(this)),
+      m_maintenance(new MaintenanceScheduler(this)), m_ready(false) {
+  connect(m_backup, &OnlineBackup::progress, this,
+          &DatabaseManager::backupProgress);
+  connect(m_backup, &OnlineBackup::finished, this,
+          &DatabaseManager::backupFinished);
+  connect(m_maintenance, &MaintenanceScheduler::finished, this,
+          &DatabaseManager::maintenanceFinished);
+  // Scheduled snapshots and maintenance cover every file, whichever user is
+  // active.
+  m_backup->setScheduledSources([this]() { return dataFiles(); });
+  m_maintenance->setSources([this]() { return dataFiles(); });
+  connect(&m_schemaWatcher, &QFutureWatcher<bool>::finished, this,
+          &DatabaseManager::onSchemaReady);
+
+  m_shardIdleTimer.setInterval(SHARD_IDLE_CHECK_MS);
+  connect(&m_shardIdleTimer, &QTimer::timeout, this,
+          &DatabaseManager::closeIdleShards);
+  m_shardIdleTimer.start();
+  setActivePath(m_databasePath);
+}
 
 DatabaseManager::~DatabaseManager() {
+  m_schemaWatcher.waitForFinished();
+  for (auto it = m_shards.constBegin(); it != m_shards.constEnd(); ++it) {
+    const Shard &shard = it.value();
+    {
+      QSqlDatabase db = QSqlDatabase::database(shard.connectionName, false);
+      db.close();
+    }
+    QSqlDatabase::removeDatabase(shard.connectionName);
+  }
   if (m_db.isOpen()) {
     m_db.close();
   }
 }
 
 bool DatabaseManager::initialize() {
+  Tracer::Scope trace("database", "DatabaseManager::initialize");
+  if (!openConnection())
+    return false;
+  {
+    StartupTimeline::Scope scope("schema check");
+    if (!createTables(m_db))
+      return false;
+  }
+  return finishInitialize();
+}
+
+void DatabaseManager::initializeAsync() {
+  const QString path = m_databasePath;
+  m_schemaWatcher.setFuture(QtConcurrent::run([this, path]() {
+    StartupTimeline::Scope scope("schema check");
+    const QString connectionName("bims_startup");
+    bool ok = false;
+    {
+      QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", connectionName);
+      db.setDatabaseName(path);
+      db.setConnectOptions("QSQLITE_BUSY_TIMEOUT=5000");
+      if (db.open()) {
+        // Pragmas first: auto_vacuum only applies before the first table.
+        applyConnectionPragmas(db);
+        ok = createTables(db);
+      } else {
+        emit errorOccurred(
+            tr("Failed to open database: %1").arg(db.lastError().text()));
+      }
+      db.close();
+    }
+    QSqlDatabase::removeDatabase(connectionName);
+    return ok;
+  }));
+}
+
+void DatabaseManager::onSchemaReady() {
+  const bool ok =
+      m_schemaWatcher.result() && openConnection() && finishInitialize();
+  emit initialized(ok);
+}
+
+bool DatabaseManager::isReady() const { return m_ready; }
+
+bool DatabaseManager::openConnection() {
+  StartupTimeline::Scope scope("database open");
   m_db = QSqlDatabase::addDatabase("QSQLITE");
-  m_db.setDatabaseName("BIMS3.db");
+  m_db.setDatabaseName(m_databasePath);
 
   if (!m_db.open()) {
     emit errorOccurred(
@@ -21,13 +226,325 @@ bool DatabaseManager::initialize() {
     return false;
   }
 
-  return createTables();
+  applyConnectionPragmas(m_db);
+  setActivePath(m_databasePath);
+  return true;
+}
+
+bool DatabaseManager::finishInitialize() {
+  if (!isSharded()) {
+    StartupTimeline::Scope scope("attach archives");
+    QString error;
+    if (!SalesArchive::consolidate(m_db, m_databasePath, &error))
+      qWarning() << "Failed to merge old sales archives:" << error;
+    if (!attachArchives(m_db, m_databasePath))
+      return false;
+    m_hotPeriodStart = SalesArchive::hotPeriodStart(m_databasePath);
+  }
+  m_ready = true;
+  emit readyChanged();
+  return true;
+}
+
+QSqlDatabase DatabaseManager::database() const {
+  if (m_activeUserId != -1) {
+    auto it = m_shards.constFind(m_activeUserId);
+    if (it != m_shards.constEnd())
+      return QSqlDatabase::database(it->connectionName, false);
+  }
+  return m_db;
+}
+
+QSqlDatabase DatabaseManager::catalogDatabase() const { return m_db; }
+
+void DatabaseManager::setDatabasePath(const QString &path) {
+  m_databasePath = path;
+  setActivePath(path);
+}
+
+QString DatabaseManager::databasePath() const {
+  QMutexLocker locker(&m_pathMutex);
+  return m_activePath;
+}
+
+QString DatabaseManager::dataPath(int userId) const {
+  if (!isSharded())
+    return m_databasePath;
+  return QDir(m_shardDirectory).filePath(QString("user_%1.db").arg(userId));
+}
+
+QStringList DatabaseManager::dataFiles() const {
+  if (!isSharded())
+    return {m_databasePath};
+  QStringList files = {m_databasePath};
+  const QDir directory(m_shardDirectory);
+  for (const QString &name :
+       directory.entryList({"user_*.db"}, QDir::Files, QDir::Name))
+    files.append(directory.filePath(name));
+  return files;
+}
+
+void DatabaseManager::setShardDirectory(const QString &directory) {
+  m_shardDirectory = directory;
+}
+
+bool DatabaseManager::isSharded() const { return !m_shardDirectory.isEmpty(); }
+
+bool DatabaseManager::activateUser(int userId) {
+  Tracer::Scope trace("database", "DatabaseManager::activateUser");
+  if (!isSharded()) {
+    // Another terminal may have archived a year since this one attached.
+    if (userId != -1 && m_ready)
+      refreshArchives();
+    return true;
+  }
+  if (m_activeUserId == userId)
+    return true;
+
+  if (m_activeUserId != -1 && m_shards.contains(m_activeUserId))
+    m_shards[m_activeUserId].lastUsed.start();
+
+  if (userId == -1) {
+    m_activeUserId = -1;
+    setActivePath(m_databasePath);
+    m_hotPeriodStart = QDate();
+    return true;
+  }
+
+  if (!m_shards.contains(userId)) {
+    Shard shard;
+    shard.connectionName = QString("bims_shard_%1").arg(userId);
+    shard.path = dataPath(userId);
+
+    QDir().mkpath(m_shardDirectory);
+    QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", shard.connectionName);
+    db.setDatabaseName(shard.path);
+    if (!db.open()) {
+      emit errorOccurred(tr("Failed to open shard for user %1: %2")
+                             .arg(userId)
+                             .arg(db.lastError().text()));
+      db = QSqlDatabase();
+      QSqlDatabase::removeDatabase(shard.connectionName);
+      return false;
+    }
+    applyConnectionPragmas(db);
+    const bool created = createDataTables(db);
+    QString error;
+    if (created && !SalesArchive::consolidate(db, shard.path, &error))
+      qWarning() << "Failed to merge old sales archives:" << error;
+    if (!created || !attachArchives(db, shard.path)) {
+      db.close();
+      db = QSqlDatabase();
+      QSqlDatabase::removeDatabase(shard.connectionName);
+      return false;
+    }
+    m_shards.insert(userId, shard);
+    qDebug() << "Opened shard" << shard.path;
+  }
+
+  m_activeUserId = userId;
+  setActivePath(m_shards.value(userId).path);
+  refreshArchives();
+  return true;
+}
+
+void DatabaseManager::setShardIdleTimeout(int minutes) {
+  m_shardIdleTimeoutMs = qint64(minutes) * 60 * 1000;
+}
+
+void DatabaseManager::closeIdleShards() {
+  Tracer::Scope trace("database", "DatabaseManager::closeIdleShards");
+  for (auto it = m_shards.begin(); it != m_shards.end();) {
+    if (it.key() == m_activeUserId ||
+        !it->lastUsed.hasExpired(m_shardIdleTimeoutMs)) {
+      ++it;
+      continue;
+    }
+    {
+      QSqlDatabase db = QSqlDatabase::database(it->connectionName, false);
+      db.close();
+    }
+    QSqlDatabase::removeDatabase(it->connectionName);
+    qDebug() << "Closed idle shard" << it->path;
+    it = m_shards.erase(it);
+  }
+}
+
+void DatabaseManager::applyConnectionPragmas(QSqlDatabase db) {
+  QSqlQuery query(db);
+  // Only takes effect on a new, empty file; existing files keep their mode
+  // until rebuilt with --vacuum. Incremental mode lets maintenance give free
+  // pages back a few at a time.
+  query.exec("PRAGMA auto_vacuum = INCREMENTAL");
+  if (m_walEnabled) {
+    if (!query.exec("PRAGMA journal_mode=WAL"))
+      qWarning() << "Failed to enable WAL:" << query.lastError().text();
+    // Truncate the log back to this size after each checkpoint instead of
+    // leaving it at its high-water mark.
+    query.exec("PRAGMA journal_size_limit = 4194304");
+  }
+}
+
+void DatabaseManager::setActivePath(const QString &path) {
+  {
+    QMutexLocker locker(&m_pathMutex);
+    m_activePath = path;
+  }
+  // A backup started by hand copies the file in use.
+  m_backup->setSourcePath(path);
+}
+
+void DatabaseManager::setWalEnabled(bool enabled) { m_walEnabled = enabled; }
+
+bool DatabaseManager::sqliteApiUsable(QString *reason) {
+  static const QString problem = []() {
+    const QString connectionName("bims_sqlite_check");
+    const QString linked = QString::fromLatin1(sqlite3_sourceid());
+    QString problem;
+    {
+      QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", connectionName);
+      db.setDatabaseName(":memory:");
+      if (!db.open()) {
+        problem = db.lastError().text();
+      } else {
+        QSqlQuery query(db);
+        if (!query.exec("SELECT sqlite_source_id()") || !query.next()) {
+          problem = query.lastError().text();
+        } else if (query.value(0).toString() != linked) {
+          problem = QString("the Qt SQL driver uses SQLite %1, the program "
+                            "links %2")
+                        .arg(query.value(0).toString(), linked);
+        } else {
+          // The same version may still be a second copy, e.g. one built
+          // into the driver plugin. A process-wide setting changed through
+          // the linked library must then read back through the driver.
+          const sqlite3_int64 previous = sqlite3_soft_heap_limit64(-1);
+          const sqlite3_int64 probe =
+              previous > 1 ? previous - 1 : sqlite3_int64(1) << 40;
+          sqlite3_soft_heap_limit64(probe);
+          const bool shared = query.exec("PRAGMA soft_heap_limit") &&
+                              query.next() &&
+                              query.value(0).toLongLong() == probe;
+          sqlite3_soft_heap_limit64(previous);
+          if (!shared)
+            problem = QString("the Qt SQL driver has its own copy of SQLite %1")
+                          .arg(linked);
+        }
+      }
+      db.close();
+    }
+    QSqlDatabase::removeDatabase(connectionName);
+    if (!problem.isEmpty())
+      qWarning() << "Online backup, maintenance and SQLite memory figures"
+                 << "are disabled:" << problem;
+    return problem;
+  }();
+  if (reason)
+    *reason = problem;
+  return problem.isEmpty();
 }
 
-QSqlDatabase DatabaseManager::database() const { return m_db; }
+bool DatabaseManager::startBackup(const QString &filePath) {
+  QString reason;
+  if (!sqliteApiUsable(&reason)) {
+    emit errorOccurred(tr("Online backup is disabled: %1").arg(reason));
+    return false;
+  }
+  if (!m_backup->start(filePath)) {
+    emit errorOccurred(tr("A backup is already running"));
+    return false;
+  }
+  return true;
+}
 
-bool DatabaseManager::createTables() {
-  QSqlQuery query(m_db);
+void DatabaseManager::cancelBackup() { m_backup->cancel(); }
+
+QString DatabaseManager::salesSource(const QDate &from) const {
+  if (!m_hotPeriodStart.isValid())
+    return "Sales";
+  if (from.isValid() && from >= m_hotPeriodStart)
+    return "Sales";
+  return "AllSales";
+}
+
+qint64 DatabaseManager::archiveClosedPeriods() {
+  Tracer::Scope trace("database", "DatabaseManager::archiveClosedPeriods");
+  QString error;
+  const QString path = databasePath();
+  const qint64 moved = SalesArchive::archiveBefore(
+      database(), path, QDate::currentDate().year(), &error);
+  if (moved < 0) {
+    emit errorOccurred(tr("Failed to archive sales: %1").arg(error));
+    return -1;
+  }
+  m_hotPeriodStart = SalesArchive::hotPeriodStart(path);
+  qDebug() << "Archived" << moved << "sales; hot period starts"
+           << m_hotPeriodStart;
+  return moved;
+}
+
+bool DatabaseManager::refreshArchives() {
+  if (isSharded() && m_activeUserId == -1)
+    return true;
+  const QString path = databasePath();
+  if (!attachArchives(database(), path))
+    return false;
+  m_hotPeriodStart = SalesArchive::hotPeriodStart(path);
+  return true;
+}
+
+bool DatabaseManager::attachArchives(QSqlDatabase db,
+                                     const QString &path) const {
+  Tracer::Scope trace("database", "DatabaseManager::attachArchives");
+  QString error;
+  if (!SalesArchive::attach(db, path, &error)) {
+    qWarning() << "Failed to attach sales archives:" << error;
+    return false;
+  }
+  return true;
+}
+
+void DatabaseManager::scheduleBackups(const QString &directory,
+                                      int intervalMinutes, int retainCount) {
+  // sqliteApiUsable() has logged why.
+  if (!sqliteApiUsable())
+    return;
+  m_backup->schedule(directory, intervalMinutes, retainCount);
+}
+
+void DatabaseManager::scheduleMaintenance(int idleMinutes, int lockBudgetMs) {
+  if (!sqliteApiUsable())
+    return;
+  MaintenanceScheduler::Options options;
+  options.lockBudgetMs = lockBudgetMs;
+  m_maintenance->setOptions(options);
+  m_maintenance->schedule(idleMinutes);
+}
+
+bool DatabaseManager::startMaintenance() {
+  QString reason;
+  if (!sqliteApiUsable(&reason)) {
+    emit errorOccurred(tr("Maintenance is disabled: %1").arg(reason));
+    return false;
+  }
+  if (!m_maintenance->start()) {
+    emit errorOccurred(tr("Maintenance is already running"));
+    return false;
+  }
+  return true;
+}
+
+bool DatabaseManager::createTables(QSqlDatabase db) {
+  Tracer::Scope trace("database", "DatabaseManager::createTables");
+  if (!createUserTables(db))
+    return false;
+  // In sharded mode the catalog only holds Users; data tables live in the
+  // per-user shard files created on activation.
+  return isSharded() || createDataTables(db);
+}
+
+bool DatabaseManager::createUserTables(QSqlDatabase db) {
+  QSqlQuery query(db);
 
   // Create Users table
   if (!query.exec("CREATE TABLE IF NOT EXISTS Users ("
@@ -41,6 +558,12 @@ bool DatabaseManager::createTables() {
     return false;
   }
 
+  return true;
+}
+
+bool DatabaseManager::createDataTables(QSqlDatabase db) {
+  QSqlQuery query(db);
+
   // Create Inventory table with supplier information and expiry date
   if (!query.exec("CREATE TABLE IF NOT EXISTS Inventory ("
                   "id INTEGER PRIMARY KEY AUTOINCREMENT, "
@@ -48,7 +571,7 @@ bool DatabaseManager::createTables() {
                   "name TEXT NOT NULL, "
                   "category TEXT NOT NULL, "
                   "quantity INTEGER NOT NULL DEFAULT 0, "
-                  "price REAL NOT NULL, "
+                  "price INTEGER NOT NULL, " // cents, like every amount
                   "supplier_name TEXT, "
                   "supplier_address TEXT, "
                   "expiry_date DATE, "
@@ -65,8 +588,8 @@ bool DatabaseManager::createTables() {
                   "user_id INTEGER NOT NULL, "
                   "item_id INTEGER NOT NULL, "
                   "quantity INTEGER NOT NULL, "
-                  "price REAL NOT NULL, "
-                  "total_price REAL NOT NULL, "
+                  "price INTEGER NOT NULL, "
+                  "total_price INTEGER NOT NULL, "
                   "sale_date DATETIME DEFAULT CURRENT_TIMESTAMP, "
                   "FOREIGN KEY(user_id) REFERENCES Users(id), "
                   "FOREIGN KEY(item_id) REFERENCES Inventory(id))")) {
@@ -75,11 +598,319 @@ bool DatabaseManager::createTables() {
     return false;
   }
 
+  // Persisted demand-forecast state, one row per item, so that forecasts
+  // only fold in the days closed since the previous run.
+  if (!query.exec("CREATE TABLE IF NOT EXISTS ItemForecasts ("
+                  "item_id INTEGER PRIMARY KEY, "
+                  "user_id INTEGER NOT NULL, "
+                  "level REAL NOT NULL DEFAULT 0, "
+                  "season TEXT, "
+                  "mean_abs_error REAL NOT NULL DEFAULT 0, "
+                  "last_date DATE, "
+                  "daily_demand REAL NOT NULL DEFAULT 0, "
+                  "reorder_point REAL NOT NULL DEFAULT 0, "
+                  "FOREIGN KEY(item_id) REFERENCES Inventory(id))")) {
+    emit errorOccurred(tr("Failed to create ItemForecasts table: %1")
+                           .arg(query.lastError().text()));
+    return false;
+  }
+
   // Create indexes for better performance
   query.exec(
       "CREATE INDEX IF NOT EXISTS idx_inventory_user_id ON Inventory(user_id)");
   query.exec("CREATE INDEX IF NOT EXISTS idx_sales_user_id ON Sales(user_id)");
   query.exec("CREATE INDEX IF NOT EXISTS idx_sales_item_id ON Sales(item_id)");
+  query.exec("CREATE INDEX IF NOT EXISTS idx_sales_user_date ON "
+             "Sales(user_id, sale_date)");
+  query.exec("CREATE INDEX IF NOT EXISTS idx_itemforecasts_user_id ON "
+             "ItemForecasts(user_id)");
+
+  // Migrations may rebuild Inventory and Sales, dropping their triggers, so
+  // the change log triggers are (re)created afterwards.
+  return migrateDataTables(db) && createChangeLog(db);
+}
+
+bool DatabaseManager::migrateDataTables(QSqlDatabase db) {
+  // Schema changes to existing files, applied in order. PRAGMA user_version
+  // records how many have run, so each one runs exactly once per file.
+  const QList<QStringList> migrations = {
+      // 1: SKU/barcode for scanner checkout, unique per user.
+      {"ALTER TABLE Inventory ADD COLUMN sku TEXT",
+       "CREATE UNIQUE INDEX IF NOT EXISTS idx_inventory_user_sku ON "
+       "Inventory(user_id, sku)"},
+      // 2: stock movement ledger and monthly snapshots. The opening
+      // snapshot holds the levels at upgrade time; history starts there.
+      {"CREATE TABLE IF NOT EXISTS StockMovements ("
+       "id INTEGER PRIMARY KEY AUTOINCREMENT, "
+       "user_id INTEGER NOT NULL, "
+       "item_id INTEGER NOT NULL, "
+       "kind TEXT NOT NULL, "
+       "delta INTEGER NOT NULL, "
+       "unit_price REAL NOT NULL, "
+       "ref_id INTEGER, "
+       "moved_at DATETIME NOT NULL)",
+       "CREATE INDEX IF NOT EXISTS idx_stockmovements_user_time ON "
+       "StockMovements(user_id, moved_at)",
+       "CREATE TABLE IF NOT EXISTS StockSnapshots ("
+       "user_id INTEGER NOT NULL, "
+       "taken_at DATETIME NOT NULL, "
+       "item_id INTEGER NOT NULL, "
+       "quantity INTEGER NOT NULL, "
+       "unit_price REAL NOT NULL, "
+       "PRIMARY KEY(user_id, taken_at, item_id)) WITHOUT ROWID",
+       // Same text format as the QDateTime values Qt binds.
+       "INSERT INTO StockSnapshots (user_id, taken_at, item_id, quantity, "
+       "unit_price) SELECT user_id, "
+       "strftime('%Y-%m-%dT%H:%M:%f', 'now', 'localtime'), id, quantity, "
+       "price FROM Inventory"},
+      // 3: cost of goods sold stored on each sale, from FIFO cost layers.
+      // Sales made before the upgrade are costed at the item's price then.
+      {"ALTER TABLE Sales ADD COLUMN unit_cost REAL NOT NULL DEFAULT 0",
+       "ALTER TABLE Sales ADD COLUMN total_cost REAL NOT NULL DEFAULT 0",
+       "UPDATE Sales SET unit_cost = COALESCE((SELECT price FROM Inventory "
+       "WHERE Inventory.id = Sales.item_id), 0), "
+       "total_cost = quantity * COALESCE((SELECT price FROM Inventory "
+       "WHERE Inventory.id = Sales.item_id), 0)",
+       "CREATE TABLE IF NOT EXISTS CostLayers ("
+       "id INTEGER PRIMARY KEY AUTOINCREMENT, "
+       "user_id INTEGER NOT NULL, "
+       "item_id INTEGER NOT NULL, "
+       "remaining INTEGER NOT NULL, "
+       "unit_cost REAL NOT NULL, "
+       "received_at DATETIME NOT NULL)",
+       "CREATE INDEX IF NOT EXISTS idx_costlayers_item ON "
+       "CostLayers(user_id, item_id, id)",
+       "INSERT INTO CostLayers (user_id, item_id, remaining, unit_cost, "
+       "received_at) SELECT user_id, id, quantity, price, "
+       "strftime('%Y-%m-%dT%H:%M:%f', 'now', 'localtime') FROM Inventory "
+       "WHERE quantity > 0"},
+      // 4: per-user headline counters for the dashboard, kept exact by
+      // triggers so reading them is one primary-key lookup. Reorder points
+      // changing is not a row write here; see recountLowStock().
+      kpiSchema("REAL"),
+      // 5: money as integer cents. The tables holding amounts are rebuilt
+      // with INTEGER columns, converting from currency units; ids and the
+      // AUTOINCREMENT counters carry over. The counters are rebuilt last,
+      // so that no trigger refers to a missing table in between.
+      rebuildInCents("Inventory",
+                     "id INTEGER PRIMARY KEY AUTOINCREMENT, "
+                     "user_id INTEGER NOT NULL, "
+                     "name TEXT NOT NULL, "
+                     "category TEXT NOT NULL, "
+                     "quantity INTEGER NOT NULL DEFAULT 0, "
+                     "price INTEGER NOT NULL, "
+                     "supplier_name TEXT, "
+                     "supplier_address TEXT, "
+                     "expiry_date DATE, "
+                     "last_updated DATETIME DEFAULT CURRENT_TIMESTAMP, "
+                     "sku TEXT, "
+                     "FOREIGN KEY(user_id) REFERENCES Users(id)",
+                     {"id", "user_id", "name", "category", "quantity",
+                      "price", "supplier_name", "supplier_address",
+                      "expiry_date", "last_updated", "sku"},
+                     {"price"}) +
+          QStringList{"CREATE INDEX IF NOT EXISTS idx_inventory_user_id ON "
+                      "Inventory(user_id)",
+                      "CREATE UNIQUE INDEX IF NOT EXISTS idx_inventory_user_sku "
+                      "ON Inventory(user_id, sku)"} +
+          rebuildInCents("Sales",
+                         "id INTEGER PRIMARY KEY AUTOINCREMENT, "
+                         "user_id INTEGER NOT NULL, "
+                         "item_id INTEGER NOT NULL, "
+                         "quantity INTEGER NOT NULL, "
+                         "price INTEGER NOT NULL, "
+                         "total_price INTEGER NOT NULL, "
+                         "sale_date DATETIME DEFAULT CURRENT_TIMESTAMP, "
+                         "unit_cost INTEGER NOT NULL DEFAULT 0, "
+                         "total_cost INTEGER NOT NULL DEFAULT 0, "
+                         "FOREIGN KEY(user_id) REFERENCES Users(id), "
+                         "FOREIGN KEY(item_id) REFERENCES Inventory(id)",
+                         {"id", "user_id", "item_id", "quantity", "price",
+                          "total_price", "sale_date", "unit_cost", "total_cost"},
+                         {"price", "total_price", "unit_cost", "total_cost"}) +
+          QStringList{
+              "CREATE INDEX IF NOT EXISTS idx_sales_user_id ON Sales(user_id)",
+              "CREATE INDEX IF NOT EXISTS idx_sales_item_id ON Sales(item_id)",
+              "CREATE INDEX IF NOT EXISTS idx_sales_user_date ON "
+              "Sales(user_id, sale_date)"} +
+          rebuildInCents("StockMovements",
+                         "id INTEGER PRIMARY KEY AUTOINCREMENT, "
+                         "user_id INTEGER NOT NULL, "
+                         "item_id INTEGER NOT NULL, "
+                         "kind TEXT NOT NULL, "
+                         "delta INTEGER NOT NULL, "
+                         "unit_price INTEGER NOT NULL, "
+                         "ref_id INTEGER, "
+                         "moved_at DATETIME NOT NULL",
+                         {"id", "user_id", "item_id", "kind", "delta",
+                          "unit_price", "ref_id", "moved_at"},
+                         {"unit_price"}) +
+          QStringList{"CREATE INDEX IF NOT EXISTS idx_stockmovements_user_time "
+                      "ON StockMovements(user_id, moved_at)"} +
+          rebuildInCents("StockSnapshots",
+                         "user_id INTEGER NOT NULL, "
+                         "taken_at DATETIME NOT NULL, "
+                         "item_id INTEGER NOT NULL, "
+                         "quantity INTEGER NOT NULL, "
+                         "unit_price INTEGER NOT NULL, "
+                         "PRIMARY KEY(user_id, taken_at, item_id)",
+                         {"user_id", "taken_at", "item_id", "quantity",
+                          "unit_price"},
+                         {"unit_price"}, "WITHOUT ROWID") +
+          rebuildInCents("CostLayers",
+                         "id INTEGER PRIMARY KEY AUTOINCREMENT, "
+                         "user_id INTEGER NOT NULL, "
+                         "item_id INTEGER NOT NULL, "
+                         "remaining INTEGER NOT NULL, "
+                         "unit_cost INTEGER NOT NULL, "
+                         "received_at DATETIME NOT NULL",
+                         {"id", "user_id", "item_id", "remaining", "unit_cost",
+                          "received_at"},
+                         {"unit_cost"}) +
+          QStringList{"CREATE INDEX IF NOT EXISTS idx_costlayers_item ON "
+                      "CostLayers(user_id, item_id, id)",
+                      "DROP TABLE UserKpis"} +
+          kpiSchema("INTEGER"),
+      // 6: till sales merged from a local journal carry the UUID they were
+      // journaled under, so a batch merged twice is only applied once.
+      {"ALTER TABLE Sales ADD COLUMN sale_uuid TEXT",
+       "CREATE UNIQUE INDEX IF NOT EXISTS idx_sales_uuid ON Sales(sale_uuid)"},
+  };
+
+  QSqlQuery query(db);
+  if (!query.exec("PRAGMA user_version") || !query.next()) {
+    emit errorOccurred(tr("Failed to read schema version: %1")
+                           .arg(query.lastError().text()));
+    return false;
+  }
 
+  for (int version = query.value(0).toInt(); version < migrations.size();
+       ++version) {
+    // Without a transaction each statement would commit on its own, and a
+    // failure part way would leave a half-migrated file.
+    if (!db.transaction()) {
+      emit errorOccurred(tr("Failed to migrate database to version %1: %2")
+                             .arg(version + 1)
+                             .arg(db.lastError().text()));
+      return false;
+    }
+    QStringList statements = migrations.at(version);
+    statements.append(QString("PRAGMA user_version = %1").arg(version + 1));
+    for (const QString &sql : statements) {
+      if (!query.exec(sql)) {
+        const QString error = query.lastError().text();
+        db.rollback();
+        emit errorOccurred(tr("Failed to migrate database to version %1: %2")
+                               .arg(version + 1)
+                               .arg(error));
+        return false;
+      }
+    }
+    if (!db.commit()) {
+      const QString error = db.lastError().text();
+      db.rollback();
+      emit errorOccurred(tr("Failed to migrate database to version %1: %2")
+                             .arg(version + 1)
+                             .arg(error));
+      return false;
+    }
+    qDebug() << "Migrated" << db.databaseName() << "to schema version"
+             << version + 1;
+  }
   return true;
 }
+
+bool DatabaseManager::recountLowStock(QSqlDatabase db, int userId) {
+  QSqlQuery query(db);
+  query.prepare("UPDATE UserKpis SET low_stock_items = (SELECT COUNT(*) "
+                "FROM Inventory i WHERE i.user_id = :userId AND " +
+                lowStockFlag("i") + ") WHERE user_id = :userId");
+  query.bindValue(":userId", userId);
+  if (!query.exec()) {
+    qWarning() << "Failed to recount low stock items:"
+               << query.lastError().text();
+    return false;
+  }
+  return true;
+}
+
+bool DatabaseManager::createChangeLog(QSqlDatabase db) {
+  QSqlQuery query(db);
+
+  // Change-data-capture log. Every write to Inventory or Sales, from this
+  // process or any other terminal sharing the file, appends one row here so
+  // that ChangeFeed can fetch only what changed since its last sequence.
+  if (!query.exec("CREATE TABLE IF NOT EXISTS ChangeLog ("
+                  "seq INTEGER PRIMARY KEY AUTOINCREMENT, "
+                  "table_name TEXT NOT NULL, "
+                  "row_id INTEGER NOT NULL, "
+                  "user_id INTEGER NOT NULL, "
+                  "operation TEXT NOT NULL, "
+                  "changed_at DATETIME DEFAULT CURRENT_TIMESTAMP)")) {
+    emit errorOccurred(tr("Failed to create ChangeLog table: %1")
+                           .arg(query.lastError().text()));
+    return false;
+  }
+  query.exec("CREATE INDEX IF NOT EXISTS idx_changelog_user_seq ON "
+             "ChangeLog(user_id, seq)");
+
+  const QStringList tables = {"Inventory", "Sales"};
+  for (const QString &table : tables) {
+    const QString name = table.toLower();
+    const QStringList triggers = {
+        QString("CREATE TRIGGER IF NOT EXISTS trg_%1_insert_log AFTER INSERT "
+                "ON %2 BEGIN INSERT INTO ChangeLog (table_name, row_id, "
+                "user_id, operation) VALUES ('%2', NEW.id, NEW.user_id, 'I'); "
+                "END")
+            .arg(name, table),
+        QString("CREATE TRIGGER IF NOT EXISTS trg_%1_update_log AFTER UPDATE "
+                "ON %2 BEGIN INSERT INTO ChangeLog (table_name, row_id, "
+                "user_id, operation) VALUES ('%2', NEW.id, NEW.user_id, 'U'); "
+                "END")
+            .arg(name, table),
+        QString("CREATE TRIGGER IF NOT EXISTS trg_%1_delete_log AFTER DELETE "
+                "ON %2 BEGIN INSERT INTO ChangeLog (table_name, row_id, "
+                "user_id, operation) VALUES ('%2', OLD.id, OLD.user_id, 'D'); "
+                "END")
+            .arg(name, table)};
+    for (const QString &sql : triggers) {
+      if (!query.exec(sql)) {
+        emit errorOccurred(tr("Failed to create change trigger: %1")
+                               .arg(query.lastError().text()));
+        return false;
+      }
+    }
+  }
+
+  // Long-running terminals are pruned by MaintenanceScheduler as well.
+  query.exec(QString("DELETE FROM ChangeLog WHERE changed_at < "
+                     "datetime('now', '-%1 hours')")
+                 .arg(MaintenanceScheduler::CHANGE_LOG_RETENTION_HOURS));
+
+  return true;
+}
+
+WorkerConnection::WorkerConnection(const DatabaseManager *dbManager,
+                                   bool readOnly, const QString &path)
+    : m_connectionName(QString("bims_worker_%1")
+                           .arg(workerConnectionCounter.fetchAndAddRelaxed(1))) {
+  m_db = QSqlDatabase::addDatabase("QSQLITE", m_connectionName);
+  m_db.setDatabaseName(path.isEmpty() ? dbManager->databasePath() : path);
+  m_db.setConnectOptions(readOnly
+                             ? "QSQLITE_OPEN_READONLY;QSQLITE_BUSY_TIMEOUT=5000"
+                             : "QSQLITE_BUSY_TIMEOUT=5000");
+  if (m_db.open())
+    dbManager->attachArchives(m_db, m_db.databaseName());
+}
+
+WorkerConnection::~WorkerConnection() {
+  m_db.close();
+  m_db = QSqlDatabase();
+  QSqlDatabase::removeDatabase(m_connectionName);
+}
+
+bool WorkerConnection::isOpen() const { return m_db.isOpen(); }
+
+QString WorkerConnection::lastError() const { return m_db.lastError().text(); }
+
+QSqlDatabase WorkerConnection::database() const { return m_db; }
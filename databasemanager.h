@@ -1,25 +1,164 @@
 #ifndef DATABASEMANAGER_H
 #define DATABASEMANAGER_H
 
+#include <QDate>
+#include <QElapsedTimer>
+#include <QFutureWatcher>
+#include <QHash>
+#include <QMutex>
 #include <QObject>
 #include <QSqlDatabase>
+#include <QStringList>
+#include <QTimer>
+#include "maintenancescheduler.h"
+#include "onlinebackup.h"
 
 class DatabaseManager : public QObject
 {
     Q_OBJECT
+    Q_PROPERTY(bool ready READ isReady NOTIFY readyChanged)
 public:
     explicit DatabaseManager(QObject *parent = nullptr);
     ~DatabaseManager();
 
     bool initialize();
+    // Fast start: creates and migrates the schema on a worker thread with its
+    // own connection, then opens database() on this thread and emits
+    // initialized(). Nothing may use database() before that.
+    void initializeAsync();
+    bool isReady() const;
+    // The current user's data connection: the shard in sharded mode, the
+    // single database file otherwise.
     QSqlDatabase database() const;
+    // The connection holding Users; the same as database() unless sharded.
+    QSqlDatabase catalogDatabase() const;
+
+    void setDatabasePath(const QString &path);
+    // File behind database(); safe to call from worker threads.
+    QString databasePath() const;
+    // File holding userId's Inventory and Sales whether or not that user is
+    // active: their shard when sharded, the database file otherwise.
+    QString dataPath(int userId) const;
+    // Every database file: the catalog and each user's shard when sharded,
+    // the database file otherwise. Backed up and maintained one by one.
+    QStringList dataFiles() const;
+
+    // Sharded mode keeps Users in the catalog file and each user's
+    // Inventory/Sales in <directory>/user_<id>.db, so tenants never contend
+    // on one file lock. Must be set before initialize().
+    void setShardDirectory(const QString &directory);
+    bool isSharded() const;
+    // Makes userId's shard the target of database(), opening it on first
+    // use; -1 deactivates. A no-op outside sharded mode.
+    bool activateUser(int userId);
+    void setShardIdleTimeout(int minutes);
+    // Write-ahead logging lets readers (backups, analytics workers) run
+    // alongside writers. Only enable it when every terminal shares one host;
+    // WAL does not work over network file systems.
+    void setWalEnabled(bool enabled);
+
+    // OnlineBackup, MaintenanceScheduler and MemoryMonitor's SQLite figures
+    // use the SQLite C API the program links. That is only safe if it is
+    // the library the Qt driver uses: with two copies in one process,
+    // closing a file in one drops the POSIX locks the other holds. Checked
+    // once, on first call; when false, those features stay off.
+    static bool sqliteApiUsable(QString *reason = nullptr);
+
+    // Online backup of the file in use; see OnlineBackup. Scheduled
+    // snapshots cover dataFiles().
+    bool startBackup(const QString &filePath);
+    void cancelBackup();
+    void scheduleBackups(const QString &directory, int intervalMinutes, int retainCount);
+
+    // Idle-time maintenance of dataFiles(); see MaintenanceScheduler.
+    // Runs once the file has had no writes for idleMinutes (0 disables),
+    // without ever holding the write lock longer than lockBudgetMs.
+    void scheduleMaintenance(int idleMinutes, int lockBudgetMs);
+    bool startMaintenance();
+
+    // Query router for Sales: "Sales" when every row from `from` onwards is
+    // still in the hot table, otherwise the AllSales view spanning the
+    // attached yearly archives. An invalid date means the whole history.
+    QString salesSource(const QDate &from = QDate()) const;
+    // Moves closed years (everything before January 1st of this year) out
+    // of the hot Sales table into their archive files.
+    qint64 archiveClosedPeriods();
+    bool attachArchives(QSqlDatabase db, const QString &path) const;
+    // Re-attaches database()'s archives and recomputes the hot period, after
+    // an archive run on another terminal; also done on every login.
+    bool refreshArchives();
+    // UserKpis is maintained by triggers on Inventory and Sales, which do not
+    // see reorder points moving; whoever rewrites ItemForecasts calls this.
+    static bool recountLowStock(QSqlDatabase db, int userId);
 
 signals:
     void errorOccurred(const QString &error);
+    void readyChanged();
+    void initialized(bool ok);
+    void backupProgress(int remaining, int pageCount);
+    void backupFinished(bool ok, const QString &filePath, const QString &error);
+    void maintenanceFinished(bool ok, const QString &report);
+
+private slots:
+    void closeIdleShards();
+    void onSchemaReady();
+
+private:
+    struct Shard {
+        QString connectionName;
+        QString path;
+        QElapsedTimer lastUsed; // started when the shard stops being active
+    };
+
+    QSqlDatabase m_db;
+    QString m_databasePath;
+    QString m_activePath;
+    mutable QMutex m_pathMutex;
+    bool m_walEnabled;
+    QDate m_hotPeriodStart;
+    QString m_shardDirectory;
+    QHash<int, Shard> m_shards;
+    int m_activeUserId;
+    qint64 m_shardIdleTimeoutMs;
+    QTimer m_shardIdleTimer;
+    OnlineBackup *m_backup;
+    MaintenanceScheduler *m_maintenance;
+    QFutureWatcher<bool> m_schemaWatcher;
+    bool m_ready;
+    bool openConnection();
+    bool finishInitialize();
+    bool createTables(QSqlDatabase db);
+    bool createUserTables(QSqlDatabase db);
+    bool createDataTables(QSqlDatabase db);
+    bool createChangeLog(QSqlDatabase db);
+    bool migrateDataTables(QSqlDatabase db);
+    void applyConnectionPragmas(QSqlDatabase db);
+    void setActivePath(const QString &path);
+};
+
+// A private connection to the same database file for use on a worker thread.
+// QSqlDatabase handles cannot cross threads, so each worker opens its own and
+// the connection is removed again when this goes out of scope.
+class WorkerConnection
+{
+public:
+    // path defaults to the file behind dbManager->database() when the
+    // connection opens. Jobs queued for a user pass the path they captured
+    // at queue time, since the active shard may change meanwhile.
+    WorkerConnection(const DatabaseManager *dbManager, bool readOnly,
+                     const QString &path = QString());
+    ~WorkerConnection();
+
+    WorkerConnection(const WorkerConnection &) = delete;
+    WorkerConnection &operator=(const WorkerConnection &) = delete;
+
+    bool isOpen() const;
+    QString lastError() const;
+    QSqlDatabase database() const;
 
 private:
+    QString m_connectionName;
     QSqlDatabase m_db;
-    bool createTables();
 };
 
 #endif // DATABASEMANAGER_H
@@ -0,0 +1,545 @@
+#include "demandforecaster.h"
+#include <QDateTime>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QStringList>
+#include <QThread>
+#include <QTimer>
+#include <QtConcurrent>
+#include <cmath>
+
+namespace {
+const int HORIZON_CHECK_INTERVAL_MS = 15 * 60 * 1000;
+// Smoothed absolute error to standard deviation for roughly normal errors.
+const double MAE_TO_SIGMA = 1.25;
+
+struct IdRange {
+  qint64 first;
+  qint64 last;
+};
+
+int seasonIndex(const QDate &day) { return day.dayOfWeek() - 1; }
+
+void foldDay(DemandForecaster::ItemState &state, double demand,
+             const QDate &day, const DemandForecaster::Settings &settings) {
+  const int s = seasonIndex(day);
+  const double seasonal = settings.seasonal ? state.season[s] : 0.0;
+  const double error = demand - (state.level + seasonal);
+  const double level =
+      settings.alpha * (demand - seasonal) + (1 - settings.alpha) * state.level;
+  if (settings.seasonal)
+    state.season[s] =
+        settings.gamma * (demand - level) + (1 - settings.gamma) * seasonal;
+  state.level = level;
+  state.meanAbsError = 0.1 * std::fabs(error) + 0.9 * state.meanAbsError;
+  state.lastDate = day;
+}
+
+void finalize(DemandForecaster::ItemState &state,
+              const DemandForecaster::Settings &settings) {
+  double leadTimeDemand = 0.0;
+  for (int d = 0; d < settings.leadTimeDays; ++d) {
+    const QDate day = settings.horizon.addDays(d);
+    const double seasonal =
+        settings.seasonal ? state.season[seasonIndex(day)] : 0.0;
+    const double demand = qMax(0.0, state.level + seasonal);
+    if (d == 0)
+      state.dailyDemand = demand;
+    leadTimeDemand += demand;
+  }
+  const double safetyStock = settings.serviceFactor * MAE_TO_SIGMA *
+                             state.meanAbsError *
+                             std::sqrt(double(settings.leadTimeDays));
+  state.reorderPoint = leadTimeDemand + safetyStock;
+}
+
+// Builds an item's state from its dense daily series, starting at the first
+// day with any demand so that days before the item was stocked do not drag
+// the level towards zero.
+void foldSeries(DemandForecaster::ItemState &state,
+                const QVector<double> &series, const QDate &from,
+                const DemandForecaster::Settings &settings) {
+  int first = 0;
+  while (first < series.size() && series.at(first) <= 0.0)
+    ++first;
+  if (first == series.size())
+    return;
+
+  const int warmup = qMin(7, series.size() - first);
+  double sum = 0.0;
+  for (int d = first; d < first + warmup; ++d)
+    sum += series.at(d);
+  state.level = sum / warmup;
+
+  for (int d = first; d < series.size(); ++d)
+    foldDay(state, series.at(d), from.addDays(d), settings);
+}
+
+DemandForecaster::StateTable
+forecastRange(const DatabaseManager *dbManager,
+              const DemandForecaster::Settings &settings,
+              const IdRange &range) {
+  DemandForecaster::StateTable states;
+  WorkerConnection connection(dbManager, true, settings.databasePath);
+  if (!connection.isOpen()) {
+    qWarning() << "Forecast worker failed to open database:"
+               << connection.lastError();
+    return states;
+  }
+
+  QSqlQuery query(connection.database());
+  query.setForwardOnly(true);
+  query.prepare("SELECT id FROM Inventory WHERE user_id = :userId "
+                "AND id BETWEEN :first AND :last");
+  query.bindValue(":userId", settings.userId);
+  query.bindValue(":first", range.first);
+  query.bindValue(":last", range.last);
+  if (!query.exec()) {
+    qWarning() << "Forecast item scan failed:" << query.lastError().text();
+    return states;
+  }
+  const QDate lastClosed = settings.horizon.addDays(-1);
+  while (query.next()) {
+    DemandForecaster::ItemState state;
+    state.itemId = query.value(0).toInt();
+    state.lastDate = lastClosed;
+    states.insert(state.itemId, state);
+  }
+
+  const QDate from = settings.horizon.addDays(-settings.historyDays);
+  query.prepare("SELECT item_id, CAST(julianday(date(sale_date)) - "
+                "julianday(:from) AS INTEGER) AS day, SUM(quantity) "
+                "FROM " + settings.salesTable + " WHERE user_id = :userId "
+                "AND item_id BETWEEN :first AND :last "
+                "AND sale_date >= :from AND sale_date < :horizon "
+                "GROUP BY item_id, day ORDER BY item_id, day");
+  query.bindValue(":from", from);
+  query.bindValue(":userId", settings.userId);
+  query.bindValue(":first", range.first);
+  query.bindValue(":last", range.last);
+  query.bindValue(":horizon", settings.horizon);
+  if (!query.exec()) {
+    qWarning() << "Forecast sales scan failed:" << query.lastError().text();
+    return states;
+  }
+
+  QVector<double> series(settings.historyDays, 0.0);
+  int currentItem = -1;
+  auto flush = [&]() {
+    auto it = states.find(currentItem);
+    if (it != states.end()) {
+      foldSeries(*it, series, from, settings);
+      it->lastDate = lastClosed;
+    }
+    series.fill(0.0);
+  };
+  while (query.next()) {
+    const int itemId = query.value(0).toInt();
+    if (itemId != currentItem) {
+      if (currentItem != -1)
+        flush();
+      currentItem = itemId;
+    }
+    const int day = query.value(1).toInt();
+    if (day >= 0 && day < series.size())
+      series[day] = query.value(2).toDouble();
+  }
+  if (currentItem != -1)
+    flush();
+
+  for (auto it = states.begin(); it != states.end(); ++it)
+    finalize(*it, settings);
+  return states;
+}
+
+void mergeStates(DemandForecaster::StateTable &result,
+                 const DemandForecaster::StateTable &partial) {
+  if (result.isEmpty()) {
+    result = partial;
+    return;
+  }
+  for (auto it = partial.constBegin(); it != partial.constEnd(); ++it)
+    result.insert(it.key(), it.value());
+}
+
+QString encodeSeason(const DemandForecaster::ItemState &state) {
+  QStringList parts;
+  for (double value : state.season)
+    parts.append(QString::number(value, 'g', 10));
+  return parts.join(',');
+}
+
+void decodeSeason(DemandForecaster::ItemState &state, const QString &text) {
+  const QStringList parts = text.split(',');
+  for (int i = 0; i < 7 && i < parts.size(); ++i)
+    state.season[i] = parts.at(i).toDouble();
+}
+
+DemandForecaster::StateTable loadStates(const QSqlDatabase &db, int userId) {
+  DemandForecaster::StateTable states;
+  QSqlQuery query(db);
+  query.setForwardOnly(true);
+  query.prepare("SELECT item_id, level, season, mean_abs_error, last_date, "
+                "daily_demand, reorder_point FROM ItemForecasts "
+                "WHERE user_id = :userId");
+  query.bindValue(":userId", userId);
+  if (!query.exec()) {
+    qWarning() << "Failed to load forecasts:" << query.lastError().text();
+    return states;
+  }
+  while (query.next()) {
+    DemandForecaster::ItemState state;
+    state.itemId = query.value(0).toInt();
+    state.level = query.value(1).toDouble();
+    decodeSeason(state, query.value(2).toString());
+    state.meanAbsError = query.value(3).toDouble();
+    state.lastDate = query.value(4).toDate();
+    state.dailyDemand = query.value(5).toDouble();
+    state.reorderPoint = query.value(6).toDouble();
+    states.insert(state.itemId, state);
+  }
+  return states;
+}
+
+bool sameState(const DemandForecaster::ItemState &a,
+               const DemandForecaster::ItemState &b) {
+  if (a.level != b.level || a.meanAbsError != b.meanAbsError ||
+      a.lastDate != b.lastDate || a.dailyDemand != b.dailyDemand ||
+      a.reorderPoint != b.reorderPoint)
+    return false;
+  for (int i = 0; i < 7; ++i) {
+    if (a.season[i] != b.season[i])
+      return false;
+  }
+  return true;
+}
+
+// Writes only the states that differ from `previous`, what ItemForecasts
+// held before the run, and drops the rows of items no longer stocked.
+bool persistStates(QSqlDatabase db, int userId,
+                   const DemandForecaster::StateTable &states,
+                   const DemandForecaster::StateTable &previous) {
+  if (!db.transaction())
+    return false;
+
+  QSqlQuery query(db);
+  query.prepare("DELETE FROM ItemForecasts WHERE user_id = :userId AND "
+                "item_id NOT IN (SELECT id FROM Inventory WHERE user_id = "
+                ":userId)");
+  query.bindValue(":userId", userId);
+  if (!query.exec()) {
+    qWarning() << "Failed to drop forecasts:" << query.lastError().text();
+    db.rollback();
+    return false;
+  }
+  bool changed = query.numRowsAffected() > 0;
+
+  query.prepare("INSERT INTO ItemForecasts (item_id, user_id, level, season, "
+                "mean_abs_error, last_date, daily_demand, reorder_point) "
+                "VALUES (?, ?, ?, ?, ?, ?, ?, ?) "
+                "ON CONFLICT(item_id) DO UPDATE SET user_id = excluded.user_id, "
+                "level = excluded.level, season = excluded.season, "
+                "mean_abs_error = excluded.mean_abs_error, "
+                "last_date = excluded.last_date, "
+                "daily_demand = excluded.daily_demand, "
+                "reorder_point = excluded.reorder_point");
+  for (const auto &state : states) {
+    auto it = previous.constFind(state.itemId);
+    if (it != previous.constEnd() && sameState(state, it.value()))
+      continue;
+    query.addBindValue(state.itemId);
+    query.addBindValue(userId);
+    query.addBindValue(state.level);
+    query.addBindValue(encodeSeason(state));
+    query.addBindValue(state.meanAbsError);
+    query.addBindValue(state.lastDate);
+    query.addBindValue(state.dailyDemand);
+    query.addBindValue(state.reorderPoint);
+    if (!query.exec()) {
+      qWarning() << "Failed to store forecast:" << query.lastError().text();
+      db.rollback();
+      return false;
+    }
+    changed = true;
+  }
+  // New reorder points move items in and out of the dashboard's count.
+  if (changed && !DatabaseManager::recountLowStock(db, userId)) {
+    db.rollback();
+    return false;
+  }
+  return db.commit();
+}
+
+DemandForecaster::StateTable
+runFullRecompute(const DatabaseManager *dbManager,
+                 const DemandForecaster::Settings &settings) {
+  QVector<IdRange> ranges;
+  {
+    WorkerConnection connection(dbManager, true, settings.databasePath);
+    QSqlQuery query(connection.database());
+    query.prepare(
+        "SELECT MIN(id), MAX(id) FROM Inventory WHERE user_id = :userId");
+    query.bindValue(":userId", settings.userId);
+    if (query.exec() && query.next() && !query.isNull(0)) {
+      const qint64 minId = query.value(0).toLongLong();
+      const qint64 maxId = query.value(1).toLongLong();
+      const qint64 span = maxId - minId + 1;
+      const int sliceCount = int(
+          qMin<qint64>(span, qMax(1, QThread::idealThreadCount()) * 4));
+      const qint64 sliceSize = (span + sliceCount - 1) / sliceCount;
+      for (qint64 first = minId; first <= maxId; first += sliceSize)
+        ranges.append({first, qMin(maxId, first + sliceSize - 1)});
+    }
+  }
+
+  DemandForecaster::StateTable states =
+      QtConcurrent::blockingMappedReduced<DemandForecaster::StateTable>(
+          ranges,
+          [dbManager, settings](const IdRange &range) {
+            return forecastRange(dbManager, settings, range);
+          },
+          mergeStates, QtConcurrent::UnorderedReduce);
+
+  WorkerConnection connection(dbManager, false, settings.databasePath);
+  const DemandForecaster::StateTable previous =
+      loadStates(connection.database(), settings.userId);
+  if (!persistStates(connection.database(), settings.userId, states,
+                     previous))
+    qWarning() << "Failed to persist forecasts";
+  return states;
+}
+
+DemandForecaster::StateTable
+runIncremental(const DatabaseManager *dbManager,
+               const DemandForecaster::Settings &settings,
+               DemandForecaster::StateTable states, bool loadPersisted) {
+  WorkerConnection connection(dbManager, false, settings.databasePath);
+  if (!connection.isOpen()) {
+    qWarning() << "Forecast worker failed to open database:"
+               << connection.lastError();
+    return states;
+  }
+  if (loadPersisted) {
+    states = loadStates(connection.database(), settings.userId);
+    // Nothing stored for this user yet: build from the full history.
+    if (states.isEmpty())
+      return runFullRecompute(dbManager, settings);
+  }
+
+  // Reconcile with the current catalogue: new items start with no demand,
+  // removed items are dropped.
+  const QDate lastClosed = settings.horizon.addDays(-1);
+  DemandForecaster::StateTable current;
+  QSqlQuery query(connection.database());
+  query.setForwardOnly(true);
+  query.prepare("SELECT id FROM Inventory WHERE user_id = :userId");
+  query.bindValue(":userId", settings.userId);
+  if (!query.exec()) {
+    qWarning() << "Forecast item scan failed:" << query.lastError().text();
+    return states;
+  }
+  while (query.next()) {
+    const int itemId = query.value(0).toInt();
+    auto it = states.constFind(itemId);
+    if (it != states.constEnd()) {
+      current.insert(itemId, it.value());
+    } else {
+      DemandForecaster::ItemState state;
+      state.itemId = itemId;
+      state.lastDate = lastClosed;
+      current.insert(itemId, state);
+    }
+  }
+  query.finish();
+
+  QDate earliest = lastClosed;
+  for (const auto &state : current) {
+    if (state.lastDate.isValid() && state.lastDate < earliest)
+      earliest = state.lastDate;
+  }
+  earliest = qMax(earliest, settings.horizon.addDays(-settings.historyDays));
+
+  if (earliest < lastClosed) {
+    const QDate from = earliest.addDays(1);
+    const int days = int(from.daysTo(settings.horizon));
+    QHash<int, QVector<double>> demand;
+    query.prepare("SELECT item_id, CAST(julianday(date(sale_date)) - "
+                  "julianday(:from) AS INTEGER) AS day, SUM(quantity) "
+                  "FROM " + settings.salesTable + " WHERE user_id = :userId "
+                  "AND sale_date >= :from AND sale_date < :horizon "
+                  "GROUP BY item_id, day");
+    query.bindValue(":from", from);
+    query.bindValue(":userId", settings.userId);
+    query.bindValue(":horizon", settings.horizon);
+    if (!query.exec()) {
+      qWarning() << "Forecast sales scan failed:" << query.lastError().text();
+      return states;
+    }
+    while (query.next()) {
+      const int day = query.value(1).toInt();
+      if (day < 0 || day >= days)
+        continue;
+      QVector<double> &series = demand[query.value(0).toInt()];
+      if (series.isEmpty())
+        series.resize(days);
+      series[day] = query.value(2).toDouble();
+    }
+    query.finish();
+
+    for (auto it = current.begin(); it != current.end(); ++it) {
+      const QVector<double> series = demand.value(it->itemId);
+      for (QDate day = qMax(it->lastDate.addDays(1), from);
+           day < settings.horizon; day = day.addDays(1)) {
+        const int offset = int(from.daysTo(day));
+        foldDay(*it, series.isEmpty() ? 0.0 : series.at(offset), day,
+                settings);
+      }
+    }
+  }
+
+  for (auto it = current.begin(); it != current.end(); ++it)
+    finalize(*it, settings);
+
+  if (!persistStates(connection.database(), settings.userId, current, states))
+    qWarning() << "Failed to persist forecasts";
+  return current;
+}
+} // namespace
+
+DemandForecaster::DemandForecaster(DatabaseManager *dbManager,
+                                   InventoryModel *inventoryModel,
+                                   QObject *parent)
+    : QObject(parent), m_dbManager(dbManager),
+      m_inventoryModel(inventoryModel), m_stateLoaded(false),
+      m_rerunPending(false), m_pendingKind(Incremental), m_jobUserId(-1),
+      m_lastRunMs(0), m_jobStartedMs(0) {
+  connect(&m_watcher, &QFutureWatcher<StateTable>::finished, this,
+          &DemandForecaster::onJobFinished);
+
+  // Fold in the previous day once the date rolls over.
+  auto *horizonTimer = new QTimer(this);
+  horizonTimer->setInterval(HORIZON_CHECK_INTERVAL_MS);
+  connect(horizonTimer, &QTimer::timeout, this, [this]() {
+    if (m_settings.userId != -1 &&
+        m_settings.horizon != QDate::currentDate())
+      update();
+  });
+  horizonTimer->start();
+}
+
+DemandForecaster::~DemandForecaster() { m_watcher.waitForFinished(); }
+
+void DemandForecaster::setUserId(int userId) {
+  if (m_settings.userId == userId)
+    return;
+
+  // A job still running for the previous user is discarded when it ends.
+  m_settings.userId = userId;
+  m_states.clear();
+  m_stateLoaded = false;
+  m_rerunPending = false;
+  m_inventoryModel->setStockPolicies({});
+  if (userId != -1)
+    update();
+}
+
+void DemandForecaster::recompute() { start(FullRecompute); }
+
+void DemandForecaster::update() { start(Incremental); }
+
+void DemandForecaster::start(JobKind kind) {
+  if (m_settings.userId == -1)
+    return;
+
+  if (m_watcher.isRunning()) {
+    if (!m_rerunPending || kind == FullRecompute)
+      m_pendingKind = kind;
+    m_rerunPending = true;
+    return;
+  }
+
+  Settings settings = m_settings;
+  settings.horizon = QDate::currentDate();
+  m_settings.horizon = settings.horizon;
+  settings.salesTable = m_dbManager->salesSource(
+      settings.horizon.addDays(-settings.historyDays));
+  settings.databasePath = m_dbManager->dataPath(settings.userId);
+  m_jobUserId = settings.userId;
+
+  const DatabaseManager *dbManager = m_dbManager;
+  m_jobStartedMs = QDateTime::currentMSecsSinceEpoch();
+  if (kind == FullRecompute) {
+    m_watcher.setFuture(QtConcurrent::run([dbManager, settings]() {
+      return runFullRecompute(dbManager, settings);
+    }));
+  } else {
+    const StateTable states = m_states;
+    const bool loadPersisted = !m_stateLoaded;
+    m_watcher.setFuture(
+        QtConcurrent::run([dbManager, settings, states, loadPersisted]() {
+          return runIncremental(dbManager, settings, states, loadPersisted);
+        }));
+  }
+  emit busyChanged();
+}
+
+void DemandForecaster::onJobFinished() {
+  if (m_jobUserId != m_settings.userId) {
+    m_rerunPending = false;
+    emit busyChanged();
+    if (m_settings.userId != -1)
+      update();
+    return;
+  }
+
+  m_states = m_watcher.future().result();
+  m_stateLoaded = true;
+  m_lastRunMs = QDateTime::currentMSecsSinceEpoch() - m_jobStartedMs;
+  publish();
+
+  if (m_rerunPending) {
+    m_rerunPending = false;
+    start(m_pendingKind);
+    return;
+  }
+  emit busyChanged();
+}
+
+void DemandForecaster::publish() {
+  QHash<int, InventoryModel::StockPolicy> policies;
+  policies.reserve(m_states.size());
+  for (const auto &state : m_states)
+    policies.insert(state.itemId, {state.dailyDemand, state.reorderPoint});
+  m_inventoryModel->setStockPolicies(policies);
+  emit forecastsUpdated();
+  qDebug() << "Demand forecasts updated. Items:" << m_states.size()
+           << "Run time (ms):" << m_lastRunMs;
+}
+
+bool DemandForecaster::busy() const { return m_watcher.isRunning(); }
+
+bool DemandForecaster::seasonal() const { return m_settings.seasonal; }
+
+void DemandForecaster::setSeasonal(bool seasonal) {
+  if (m_settings.seasonal == seasonal)
+    return;
+  m_settings.seasonal = seasonal;
+  emit settingsChanged();
+  recompute();
+}
+
+int DemandForecaster::leadTimeDays() const { return m_settings.leadTimeDays; }
+
+void DemandForecaster::setLeadTimeDays(int days) {
+  if (days < 1 || m_settings.leadTimeDays == days)
+    return;
+  m_settings.leadTimeDays = days;
+  emit settingsChanged();
+  update();
+}
+
+int DemandForecaster::itemCount() const { return m_states.size(); }
+
+qint64 DemandForecaster::lastRunMs() const { return m_lastRunMs; }
@@ -0,0 +1,96 @@
+#ifndef DEMANDFORECASTER_H
+#define DEMANDFORECASTER_H
+
+#include <QDate>
+#include <QFutureWatcher>
+#include <QHash>
+#include <QObject>
+#include <QVector>
+#include "databasemanager.h"
+#include "inventorymodel.h"
+
+// Per-item daily demand forecasts from the Sales history. Each item carries a
+// smoothed level, optional day-of-week seasonal offsets and a smoothed
+// absolute error; only closed days are folded in, so once the state is
+// persisted a new day costs one pass over that day's sales.
+class DemandForecaster : public QObject
+{
+    Q_OBJECT
+    Q_PROPERTY(bool busy READ busy NOTIFY busyChanged)
+    Q_PROPERTY(bool seasonal READ seasonal WRITE setSeasonal NOTIFY settingsChanged)
+    Q_PROPERTY(int leadTimeDays READ leadTimeDays WRITE setLeadTimeDays NOTIFY settingsChanged)
+    Q_PROPERTY(int itemCount READ itemCount NOTIFY forecastsUpdated)
+    Q_PROPERTY(qint64 lastRunMs READ lastRunMs NOTIFY forecastsUpdated)
+
+public:
+    struct Settings {
+        int userId = -1;
+        double alpha = 0.3;
+        double gamma = 0.1;
+        double serviceFactor = 1.65; // ~95% cycle service level
+        bool seasonal = true;
+        int leadTimeDays = 7;
+        int historyDays = 730;
+        QDate horizon; // first day not yet closed (today)
+        QString salesTable = "Sales";
+        QString databasePath; // the user's file, captured when queued
+    };
+
+    struct ItemState {
+        int itemId = 0;
+        double level = 0.0;
+        double season[7] = {0, 0, 0, 0, 0, 0, 0};
+        double meanAbsError = 0.0;
+        QDate lastDate; // last closed day folded into the state
+        double dailyDemand = 0.0;
+        double reorderPoint = 0.0;
+    };
+    using StateTable = QHash<int, ItemState>;
+
+    explicit DemandForecaster(DatabaseManager *dbManager, InventoryModel *inventoryModel, QObject *parent = nullptr);
+    ~DemandForecaster();
+
+    void setUserId(int userId);
+
+    // Rebuilds every item's state from the full history window.
+    Q_INVOKABLE void recompute();
+    // Folds in days closed since the last run and picks up new or removed items.
+    Q_INVOKABLE void update();
+
+    bool busy() const;
+    bool seasonal() const;
+    void setSeasonal(bool seasonal);
+    int leadTimeDays() const;
+    void setLeadTimeDays(int days);
+    int itemCount() const;
+    qint64 lastRunMs() const;
+
+signals:
+    void busyChanged();
+    void settingsChanged();
+    void forecastsUpdated();
+    void errorOccurred(const QString &error);
+
+private slots:
+    void onJobFinished();
+
+private:
+    enum JobKind { FullRecompute, Incremental };
+
+    DatabaseManager *m_dbManager;
+    InventoryModel *m_inventoryModel;
+    QFutureWatcher<StateTable> m_watcher;
+    Settings m_settings;
+    StateTable m_states;
+    bool m_stateLoaded;
+    bool m_rerunPending;
+    JobKind m_pendingKind;
+    int m_jobUserId;
+    qint64 m_lastRunMs;
+    qint64 m_jobStartedMs;
+
+    void start(JobKind kind);
+    void publish();
+};
+
+#endif // DEMANDFORECASTER_H
@@ -1,11 +1,21 @@
 #include "inventorymodel.h"
+#include "memoryestimate.h"
+#include "sqlids.h"
+#include "stockledger.h"
+#include "tracer.h"
+#include "workloadrecorder.h"
 #include <QDebug>
 #include <QSqlError>
 #include <QSqlQuery>
+#include <algorithm>
 
 InventoryModel::InventoryModel(DatabaseManager *dbManager, QObject *parent)
-    : QAbstractListModel(parent), m_dbManager(dbManager), m_userId(-1), m_lowStockItems(0), m_totalCost(0.0)
-{}
+    : QAbstractListModel(parent), m_dbManager(dbManager), m_exporter(new StreamExporter(dbManager, this)),
+      m_userId(-1), m_lowStockItems(0), m_totalCost(0), m_filtered(false), m_loaded(false)
+{
+    connect(m_exporter, &StreamExporter::progress, this, &InventoryModel::exportProgress);
+    connect(m_exporter, &StreamExporter::finished, this, &InventoryModel::exportFinished);
+}
 
 int InventoryModel::rowCount(const QModelIndex &parent) const
 {
@@ -31,7 +41,7 @@ QVariant InventoryModel::data(const QModelIndex &index, int role) const
     case QuantityRole:
         return item.quantity;
     case PriceRole:
-        return item.price;
+        return Money::toUnits(item.price);
     case SupplierNameRole:
         return item.supplierName;
     case SupplierAddressRole:
@@ -40,6 +50,14 @@ QVariant InventoryModel::data(const QModelIndex &index, int role) const
         return item.expiryDate;
     case LastUpdatedRole:
         return item.lastUpdated;
+    case SkuRole:
+        return item.sku;
+    case ReorderPointRole: {
+        auto it = m_policies.constFind(item.id);
+        return it != m_policies.constEnd() ? QVariant(it->reorderPoint) : QVariant(double(LOW_STOCK_THRESHOLD));
+    }
+    case DaysOfCoverRole:
+        return daysOfCover(item);
     default:
         return QVariant();
     }
@@ -57,63 +75,133 @@ QHash<int, QByteArray> InventoryModel::roleNames() const
     roles[SupplierAddressRole] = "supplierAddress";
     roles[ExpiryDateRole] = "expiryDate";
     roles[LastUpdatedRole] = "lastUpdated";
+    roles[ReorderPointRole] = "reorderPoint";
+    roles[DaysOfCoverRole] = "daysOfCover";
+    roles[SkuRole] = "sku";
     return roles;
 }
 
 void InventoryModel::setUserId(int userId)
 {
-    if (m_userId != userId) {
-        m_userId = userId;
+    WorkloadRecorder::Scope scope("InventoryModel::setUserId", {userId});
+    Tracer::Scope trace("model", "InventoryModel::setUserId");
+    if (m_userId == userId)
+        return;
+
+    beginResetModel();
+    m_userId = userId;
+    m_items.clear();
+    m_rowById.clear();
+    m_searchIndex.clear();
+    m_skuIndex.clear();
+    m_filtered = false;
+    m_loaded = false;
+    m_totalCost = 0;
+    endResetModel();
+    emit totalCostChanged();
+    emit searchIndexChanged();
+    checkLowStockItems();
+    // Expiry alerts should not wait for the inventory view to be opened.
+    if (m_userId != -1)
+        checkExpiringItems();
+}
+
+void InventoryModel::ensureLoaded()
+{
+    if (!m_loaded && m_userId != -1)
         refresh();
-    }
+}
+
+bool InventoryModel::isLoaded() const
+{
+    return m_loaded;
 }
 
 bool InventoryModel::addItem(const QString &name, const QString &category, int quantity, double price,
-                             const QString &supplierName, const QString &supplierAddress, const QDate &expiryDate)
+                             const QString &supplierName, const QString &supplierAddress, const QDate &expiryDate,
+                             const QString &sku)
 {
+    WorkloadRecorder::Scope scope("InventoryModel::addItem", {name, category, quantity, price, supplierName,
+                                                             supplierAddress, expiryDate, sku});
     if (m_userId == -1) {
         emit errorOccurred("User not set. Unable to add item.");
         return false;
     }
 
-    QSqlQuery query(m_dbManager->database());
-    query.prepare("INSERT INTO Inventory (user_id, name, category, quantity, price, supplier_name, supplier_address, expiry_date, last_updated) "
-                  "VALUES (:userId, :name, :category, :quantity, :price, :supplierName, :supplierAddress, :expiryDate, :lastUpdated)");
+    QSqlDatabase db = m_dbManager->database();
+    if (!db.transaction()) {
+        emit errorOccurred(tr("Failed to add item: %1").arg(db.lastError().text()));
+        return false;
+    }
+
+    QSqlQuery query(db);
+    query.prepare("INSERT INTO Inventory (user_id, name, category, quantity, price, supplier_name, supplier_address, expiry_date, last_updated, sku) "
+                  "VALUES (:userId, :name, :category, :quantity, :price, :supplierName, :supplierAddress, :expiryDate, :lastUpdated, :sku)");
     query.bindValue(":userId", m_userId);
     query.bindValue(":name", name);
     query.bindValue(":category", category);
     query.bindValue(":quantity", quantity);
-    query.bindValue(":price", price);
+    query.bindValue(":price", Money::fromUnits(price));
     query.bindValue(":supplierName", supplierName);
     query.bindValue(":supplierAddress", supplierAddress);
     query.bindValue(":expiryDate", expiryDate);
     query.bindValue(":lastUpdated", QDateTime::currentDateTime());
+    query.bindValue(":sku", sku.isEmpty() ? QVariant() : QVariant(sku));
 
     if (!query.exec()) {
+        db.rollback();
         emit errorOccurred(tr("Failed to add item: %1").arg(query.lastError().text()));
         return false;
     }
+    const int itemId = query.lastInsertId().toInt();
+
+    QString error;
+    if (!StockLedger::record(db, m_userId, itemId, StockLedger::Receipt, quantity, QVariant(), &error)) {
+        db.rollback();
+        emit errorOccurred(tr("Failed to add item: %1").arg(error));
+        return false;
+    }
+    if (!db.commit()) {
+        db.rollback();
+        emit errorOccurred(tr("Failed to add item: %1").arg(db.lastError().text()));
+        return false;
+    }
 
-    refresh();
+    applyChanges({itemId}, {});
     return true;
 }
 
 bool InventoryModel::updateItem(int id, const QString &name, const QString &category, int quantity, double price,
                                 const QString &supplierName, const QString &supplierAddress, const QDate &expiryDate)
 {
+    WorkloadRecorder::Scope scope("InventoryModel::updateItem", {id, name, category, quantity, price, supplierName,
+                                                                supplierAddress, expiryDate});
     if (m_userId == -1) {
         emit errorOccurred("User not set. Unable to update item.");
         return false;
     }
 
-    QSqlQuery query(m_dbManager->database());
+    QSqlDatabase db = m_dbManager->database();
+    if (!db.transaction()) {
+        emit errorOccurred(tr("Failed to update item: %1").arg(db.lastError().text()));
+        return false;
+    }
+
+    QString error;
+    if (!StockLedger::recordRestate(db, m_userId, id, quantity, Money::fromUnits(price), &error)) {
+        db.rollback();
+        emit errorOccurred(tr("Failed to update item: %1").arg(error));
+        return false;
+    }
+
+    QSqlQuery query(db);
     query.prepare("UPDATE Inventory SET name = :name, category = :category, quantity = :quantity, "
                   "price = :price, supplier_name = :supplierName, supplier_address = :supplierAddress, "
                   "expiry_date = :expiryDate, last_updated = :lastUpdated WHERE id = :id AND user_id = :userId");
     query.bindValue(":name", name);
     query.bindValue(":category", category);
     query.bindValue(":quantity", quantity);
-    query.bindValue(":price", price);
+    query.bindValue(":price", Money::fromUnits(price));
     query.bindValue(":supplierName", supplierName);
     query.bindValue(":supplierAddress", supplierAddress);
     query.bindValue(":expiryDate", expiryDate);
@@ -122,44 +210,101 @@ bool InventoryModel::updateItem(int id, const QString &name, const QString &cate
     query.bindValue(":userId", m_userId);
 
     if (!query.exec()) {
+        db.rollback();
         emit errorOccurred(tr("Failed to update item: %1").arg(query.lastError().text()));
         return false;
     }
+    if (!db.commit()) {
+        db.rollback();
+        emit errorOccurred(tr("Failed to update item: %1").arg(db.lastError().text()));
+        return false;
+    }
 
-    refresh();
+    applyChanges({id}, {});
     return true;
 }
 
 bool InventoryModel::deleteItem(int id)
 {
+    WorkloadRecorder::Scope scope("InventoryModel::deleteItem", {id});
     if (m_userId == -1) {
         emit errorOccurred("User not set. Unable to delete item.");
         return false;
     }
 
-    QSqlQuery query(m_dbManager->database());
+    QSqlDatabase db = m_dbManager->database();
+    if (!db.transaction()) {
+        emit errorOccurred(tr("Failed to delete item: %1").arg(db.lastError().text()));
+        return false;
+    }
+
+    // The remaining stock leaves the ledger with the item.
+    QString error;
+    if (!StockLedger::recordRestate(db, m_userId, id, 0, QVariant(), &error)) {
+        db.rollback();
+        emit errorOccurred(tr("Failed to delete item: %1").arg(error));
+        return false;
+    }
+
+    QSqlQuery query(db);
     query.prepare("DELETE FROM Inventory WHERE id = :id AND user_id = :userId");
     query.bindValue(":id", id);
     query.bindValue(":userId", m_userId);
 
     if (!query.exec()) {
+        db.rollback();
         emit errorOccurred(tr("Failed to delete item: %1").arg(query.lastError().text()));
         return false;
     }
+    if (!db.commit()) {
+        db.rollback();
+        emit errorOccurred(tr("Failed to delete item: %1").arg(db.lastError().text()));
+        return false;
+    }
 
-    refresh();
+    applyChanges({}, {id});
     return true;
 }
 
+bool InventoryModel::setItemSku(int id, const QString &sku)
+{
+    WorkloadRecorder::Scope scope("InventoryModel::setItemSku", {id, sku});
+    if (m_userId == -1) {
+        emit errorOccurred("User not set. Unable to set SKU.");
+        return false;
+    }
+
+    QSqlQuery query(m_dbManager->database());
+    query.prepare("UPDATE Inventory SET sku = :sku WHERE id = :id AND user_id = :userId");
+    query.bindValue(":sku", sku.isEmpty() ? QVariant() : QVariant(sku));
+    query.bindValue(":id", id);
+    query.bindValue(":userId", m_userId);
+
+    if (!query.exec()) {
+        emit errorOccurred(tr("Failed to set SKU: %1").arg(query.lastError().text()));
+        return false;
+    }
+
+    applyChanges({id}, {});
+    return true;
+}
+
+int InventoryModel::itemIdForSku(const QString &sku) const
+{
+    return m_skuIndex.find(sku);
+}
+
 void InventoryModel::searchItems(const QString &searchText)
 {
+    WorkloadRecorder::Scope scope("InventoryModel::searchItems", {searchText});
+    Tracer::Scope trace("model", "InventoryModel::searchItems");
     if (m_userId == -1) {
         emit errorOccurred("User not set. Unable to search items.");
         return;
     }
 
     QSqlQuery query(m_dbManager->database());
-    query.prepare("SELECT id, name, category, quantity, price, supplier_name, supplier_address, expiry_date, last_updated FROM Inventory "
+    query.prepare("SELECT id, name, category, quantity, price, supplier_name, supplier_address, expiry_date, last_updated, sku FROM Inventory "
                   "WHERE user_id = :userId AND (name LIKE :searchText OR category LIKE :searchText)");
     query.bindValue(":userId", m_userId);
     query.bindValue(":searchText", "%" + searchText + "%");
@@ -171,21 +316,15 @@ void InventoryModel::searchItems(const QString &searchText)
 
     beginResetModel();
     m_items.clear();
-    m_totalCost = 0.0;
+    m_filtered = !searchText.isEmpty();
+    m_totalCost = 0;
+    const RowMapper<InventoryItem> mapper(query);
     while (query.next()) {
-        InventoryItem item;
-        item.id = query.value("id").toInt();
-        item.name = query.value("name").toString();
-        item.category = query.value("category").toString();
-        item.quantity = query.value("quantity").toInt();
-        item.price = query.value("price").toDouble();
-        item.supplierName = query.value("supplier_name").toString();
-        item.supplierAddress = query.value("supplier_address").toString();
-        item.expiryDate = query.value("expiry_date").toDate();
-        item.lastUpdated = query.value("last_updated").toDateTime();
+        InventoryItem item = mapper.read(query);
         m_items.append(item);
-        m_totalCost += item.quantity * item.price;
+        m_totalCost += item.value();
     }
+    rebuildRowIndex();
     endResetModel();
     checkLowStockItems();
     checkExpiringItems();
@@ -193,13 +332,15 @@ void InventoryModel::searchItems(const QString &searchText)
 
 void InventoryModel::refresh()
 {
+    WorkloadRecorder::Scope scope("InventoryModel::refresh");
+    Tracer::Scope trace("model", "InventoryModel::refresh");
     if (m_userId == -1) {
         qWarning() << "User not set. Unable to refresh inventory.";
         return;
     }
 
     QSqlQuery query(m_dbManager->database());
-    query.prepare("SELECT id, name, category, quantity, price, supplier_name, supplier_address, expiry_date, last_updated FROM Inventory WHERE user_id = :userId");
+    query.prepare("SELECT id, name, category, quantity, price, supplier_name, supplier_address, expiry_date, last_updated, sku FROM Inventory WHERE user_id = :userId");
     query.bindValue(":userId", m_userId);
 
     if (!query.exec()) {
@@ -209,31 +350,561 @@ void InventoryModel::refresh()
 
     beginResetModel();
     m_items.clear();
-    m_totalCost = 0.0;
+    m_searchIndex.clear();
+    m_skuIndex.clear();
+    m_filtered = false;
+    m_totalCost = 0;
+    const RowMapper<InventoryItem> mapper(query);
     while (query.next()) {
-        InventoryItem item;
-        item.id = query.value("id").toInt();
-        item.name = query.value("name").toString();
-        item.category = query.value("category").toString();
-        item.quantity = query.value("quantity").toInt();
-        item.price = query.value("price").toDouble();
-        item.supplierName = query.value("supplier_name").toString();
-        item.supplierAddress = query.value("supplier_address").toString();
-        item.expiryDate = query.value("expiry_date").toDate();
-        item.lastUpdated = query.value("last_updated").toDateTime();
+        InventoryItem item = mapper.read(query);
         m_items.append(item);
-        m_totalCost += item.quantity * item.price;
+        indexItem(item);
+        m_totalCost += item.value();
     }
+    rebuildRowIndex();
+    m_loaded = true;
     endResetModel();
+    Tracer::counter("model", "InventoryModel rows", m_items.size());
+    emit searchIndexChanged();
     checkLowStockItems();
     checkExpiringItems();
 }
 
+bool InventoryModel::adjustQuantities(const QVariantList &adjustments, QString *error)
+{
+    WorkloadRecorder::Scope scope("InventoryModel::adjustQuantities", {QVariant(adjustments)});
+    auto fail = [this, error](const QString &message) {
+        if (error)
+            *error = message;
+        else
+            emit errorOccurred(message);
+        return false;
+    };
+
+    if (m_userId == -1)
+        return fail("User not set. Unable to adjust stock.");
+    if (adjustments.isEmpty())
+        return true;
+
+    QSqlDatabase db = m_dbManager->database();
+    if (!db.transaction())
+        return fail(tr("Failed to adjust stock: %1").arg(db.lastError().text()));
+
+    QSqlQuery query(db);
+    query.prepare("UPDATE Inventory SET quantity = quantity + :delta, last_updated = :lastUpdated "
+                  "WHERE id = :id AND user_id = :userId AND quantity + :delta >= 0");
+    const QDateTime now = QDateTime::currentDateTime();
+    QList<int> adjustedIds;
+    for (const QVariant &adjustment : adjustments) {
+        const QVariantMap map = adjustment.toMap();
+        const int id = map.value("id").toInt();
+        query.bindValue(":delta", map.value("delta").toInt());
+        query.bindValue(":lastUpdated", now);
+        query.bindValue(":id", id);
+        query.bindValue(":userId", m_userId);
+
+        if (!query.exec()) {
+            db.rollback();
+            return fail(tr("Failed to adjust stock: %1").arg(query.lastError().text()));
+        }
+        if (query.numRowsAffected() == 0) {
+            db.rollback();
+            return fail(tr("Item %1 is unknown or has too little stock").arg(id));
+        }
+        const int delta = map.value("delta").toInt();
+        QString ledgerError;
+        if (!StockLedger::record(db, m_userId, id, delta > 0 ? StockLedger::Receipt : StockLedger::Adjustment,
+                                 delta, QVariant(), &ledgerError)) {
+            db.rollback();
+            return fail(tr("Failed to adjust stock: %1").arg(ledgerError));
+        }
+        if (!adjustedIds.contains(id))
+            adjustedIds.append(id);
+    }
+
+    if (!db.commit()) {
+        db.rollback();
+        return fail(tr("Failed to adjust stock: %1").arg(db.lastError().text()));
+    }
+
+    applyChanges(adjustedIds, {});
+    return true;
+}
+
+bool InventoryModel::adjustPrices(const QString &category, double percent)
+{
+    WorkloadRecorder::Scope scope("InventoryModel::adjustPrices", {category, percent});
+    Tracer::Scope trace("model", "InventoryModel::adjustPrices");
+    if (m_userId == -1) {
+        emit errorOccurred("User not set. Unable to adjust prices.");
+        return false;
+    }
+
+    QSqlDatabase db = m_dbManager->database();
+    if (!db.transaction()) {
+        emit errorOccurred(tr("Failed to adjust prices: %1").arg(db.lastError().text()));
+        return false;
+    }
+
+    QSqlQuery query(db);
+    query.setForwardOnly(true);
+    query.prepare("SELECT id FROM Inventory WHERE user_id = :userId AND category = :category");
+    query.bindValue(":userId", m_userId);
+    query.bindValue(":category", category);
+    if (!query.exec()) {
+        db.rollback();
+        emit errorOccurred(tr("Failed to adjust prices: %1").arg(query.lastError().text()));
+        return false;
+    }
+    QList<int> ids;
+    while (query.next())
+        ids.append(query.value(0).toInt());
+
+    query.prepare("UPDATE Inventory SET price = CAST(ROUND(price * :factor) AS INTEGER), last_updated = :lastUpdated "
+                  "WHERE user_id = :userId AND category = :category");
+    query.bindValue(":factor", 1.0 + percent / 100.0);
+    query.bindValue(":lastUpdated", QDateTime::currentDateTime());
+    query.bindValue(":userId", m_userId);
+    query.bindValue(":category", category);
+
+    QString error;
+    if (!query.exec() || !StockLedger::recordPrices(db, m_userId, category, &error) || !db.commit()) {
+        if (error.isEmpty())
+            error = query.lastError().isValid() ? query.lastError().text() : db.lastError().text();
+        db.rollback();
+        emit errorOccurred(tr("Failed to adjust prices: %1").arg(error));
+        return false;
+    }
+
+    applyChanges(ids, {});
+    return true;
+}
+
+bool InventoryModel::setQuantities(const QVariantMap &quantities)
+{
+    WorkloadRecorder::Scope scope("InventoryModel::setQuantities", {quantities});
+    Tracer::Scope trace("model", "InventoryModel::setQuantities");
+    if (m_userId == -1) {
+        emit errorOccurred("User not set. Unable to set quantities.");
+        return false;
+    }
+
+    QSqlDatabase db = m_dbManager->database();
+    if (!db.transaction()) {
+        emit errorOccurred(tr("Failed to set quantities: %1").arg(db.lastError().text()));
+        return false;
+    }
+
+    // Only the quantity column is written, and only where it differs.
+    QSqlQuery query(db);
+    query.prepare("UPDATE Inventory SET quantity = :quantity, last_updated = :lastUpdated "
+                  "WHERE id = :id AND user_id = :userId AND quantity <> :quantity");
+    const QDateTime now = QDateTime::currentDateTime();
+    QList<int> changedIds;
+    for (auto it = quantities.constBegin(); it != quantities.constEnd(); ++it) {
+        bool idOk = false;
+        bool quantityOk = false;
+        const int id = it.key().toInt(&idOk);
+        const int quantity = it.value().toInt(&quantityOk);
+        if (!idOk) {
+            db.rollback();
+            emit errorOccurred(tr("Invalid item id: %1").arg(it.key()));
+            return false;
+        }
+        if (!quantityOk) {
+            db.rollback();
+            emit errorOccurred(tr("Invalid quantity for item %1: %2").arg(id).arg(it.value().toString()));
+            return false;
+        }
+        if (quantity < 0) {
+            db.rollback();
+            emit errorOccurred(tr("Quantity for item %1 cannot be negative").arg(id));
+            return false;
+        }
+
+        QString error;
+        if (!StockLedger::recordRestate(db, m_userId, id, quantity, QVariant(), &error)) {
+            db.rollback();
+            emit errorOccurred(tr("Failed to set quantities: %1").arg(error));
+            return false;
+        }
+        query.bindValue(":quantity", quantity);
+        query.bindValue(":lastUpdated", now);
+        query.bindValue(":id", id);
+        query.bindValue(":userId", m_userId);
+        if (!query.exec()) {
+            db.rollback();
+            emit errorOccurred(tr("Failed to set quantities: %1").arg(query.lastError().text()));
+            return false;
+        }
+        if (query.numRowsAffected() > 0)
+            changedIds.append(id);
+    }
+
+    if (!db.commit()) {
+        db.rollback();
+        emit errorOccurred(tr("Failed to set quantities: %1").arg(db.lastError().text()));
+        return false;
+    }
+
+    applyChanges(changedIds, {});
+    return true;
+}
+
+bool InventoryModel::deleteItems(const QVariantList &ids)
+{
+    WorkloadRecorder::Scope scope("InventoryModel::deleteItems", {QVariant(ids)});
+    Tracer::Scope trace("model", "InventoryModel::deleteItems");
+    if (m_userId == -1) {
+        emit errorOccurred("User not set. Unable to delete items.");
+        return false;
+    }
+
+    QList<int> itemIds;
+    itemIds.reserve(ids.size());
+    for (const QVariant &id : ids)
+        itemIds.append(id.toInt());
+    if (itemIds.isEmpty())
+        return true;
+
+    QSqlDatabase db = m_dbManager->database();
+    if (!db.transaction()) {
+        emit errorOccurred(tr("Failed to delete items: %1").arg(db.lastError().text()));
+        return false;
+    }
+
+    QString error;
+    if (!StockLedger::recordRemoval(db, m_userId, itemIds, &error)) {
+        db.rollback();
+        emit errorOccurred(tr("Failed to delete items: %1").arg(error));
+        return false;
+    }
+
+    QSqlQuery query(db);
+    for (const QList<int> &chunk : SqlIds::chunks(itemIds)) {
+        query.prepare(QString("DELETE FROM Inventory WHERE user_id = :userId AND id IN (%1)").arg(SqlIds::list(chunk)));
+        query.bindValue(":userId", m_userId);
+        if (!query.exec()) {
+            db.rollback();
+            emit errorOccurred(tr("Failed to delete items: %1").arg(query.lastError().text()));
+            return false;
+        }
+    }
+    if (!db.commit()) {
+        db.rollback();
+        emit errorOccurred(tr("Failed to delete items: %1").arg(db.lastError().text()));
+        return false;
+    }
+
+    applyChanges({}, itemIds);
+    return true;
+}
+
+QVariantMap InventoryModel::itemRecord(int id) const
+{
+    auto row = m_rowById.constFind(id);
+    if (row != m_rowById.constEnd())
+        return toRecord(m_items.at(row.value()));
+    if (m_userId == -1 || !m_filtered)
+        return QVariantMap();
+
+    // A search has hidden some rows; the index still knows every item.
+    if (!m_searchIndex.contains(id))
+        return QVariantMap();
+    QSqlQuery query(m_dbManager->database());
+    query.prepare("SELECT id, name, category, quantity, price, supplier_name, supplier_address, expiry_date, last_updated, sku FROM Inventory "
+                  "WHERE id = :id AND user_id = :userId");
+    query.bindValue(":id", id);
+    query.bindValue(":userId", m_userId);
+    if (!query.exec() || !query.next())
+        return QVariantMap();
+    return toRecord(RowMapper<InventoryItem>(query).read(query));
+}
+
+QVariantList InventoryModel::fuzzySearch(const QString &text, int limit) const
+{
+    WorkloadRecorder::Scope scope("InventoryModel::fuzzySearch", {text, limit});
+    Tracer::Scope trace("model", "InventoryModel::fuzzySearch");
+    QVariantList results;
+    const QVector<TrigramIndex::Match> matches = m_searchIndex.search(text, limit);
+    for (const auto &match : matches) {
+        QVariantMap result;
+        result["id"] = match.id;
+        result["name"] = match.name;
+        result["category"] = match.category;
+        result["supplierName"] = match.supplier;
+        result["score"] = match.score;
+        results.append(result);
+    }
+    return results;
+}
+
+void InventoryModel::applyChanges(const QList<int> &upsertedIds, const QList<int> &deletedIds)
+{
+    Tracer::Scope trace("model", "InventoryModel::applyChanges");
+    if (m_userId == -1)
+        return;
+    if (!m_loaded) {
+        // Nothing in memory to patch; listeners still hear about the change.
+        emit itemsChanged(upsertedIds, deletedIds);
+        return;
+    }
+
+    QList<int> removedRows;
+    for (int id : deletedIds) {
+        m_searchIndex.remove(id);
+        m_skuIndex.removeItem(id);
+        auto it = m_rowById.constFind(id);
+        if (it != m_rowById.constEnd()) {
+            removedRows.append(it.value());
+            m_totalCost -= m_items.at(it.value()).value();
+        }
+    }
+    if (!removedRows.isEmpty()) {
+        // Adjacent rows go in one removal, so a bulk delete is a handful of
+        // notifications rather than one per row.
+        std::sort(removedRows.begin(), removedRows.end(), std::greater<int>());
+        int i = 0;
+        while (i < removedRows.size()) {
+            const int last = removedRows.at(i);
+            int first = last;
+            while (++i < removedRows.size() && removedRows.at(i) == first - 1)
+                first = removedRows.at(i);
+            beginRemoveRows(QModelIndex(), first, last);
+            m_items.erase(m_items.begin() + first, m_items.begin() + last + 1);
+            endRemoveRows();
+        }
+        // Rows after the removed ones have moved up.
+        rebuildRowIndex();
+    }
+
+    if (!upsertedIds.isEmpty()) {
+        const QDate expiryHorizon = QDate::currentDate().addDays(30);
+        int firstChanged = m_items.size();
+        int lastChanged = -1;
+        QList<InventoryItem> added;
+
+        QSqlQuery query(m_dbManager->database());
+        query.setForwardOnly(true);
+        for (const QList<int> &chunk : SqlIds::chunks(upsertedIds)) {
+            query.prepare(QString("SELECT id, name, category, quantity, price, supplier_name, supplier_address, expiry_date, last_updated, sku FROM Inventory "
+                                  "WHERE user_id = :userId AND id IN (%1)").arg(SqlIds::list(chunk)));
+            query.bindValue(":userId", m_userId);
+
+            if (!query.exec()) {
+                // Rows from earlier chunks are in already; still notify them.
+                emit errorOccurred(tr("Failed to fetch changed items: %1").arg(query.lastError().text()));
+                break;
+            }
+
+            const RowMapper<InventoryItem> mapper(query);
+
+            while (query.next()) {
+                InventoryItem item = mapper.read(query);
+                indexItem(item);
+                if (item.expiryDate.isValid() && item.expiryDate <= expiryHorizon) {
+                    Tracer::instant("signal", "InventoryModel::itemNearExpiry");
+                    emit itemNearExpiry(item.id, item.name, item.expiryDate);
+                }
+                auto it = m_rowById.constFind(item.id);
+                if (it != m_rowById.constEnd()) {
+                    m_totalCost += item.value() - m_items.at(it.value()).value();
+                    m_items[it.value()] = item;
+                    firstChanged = qMin(firstChanged, it.value());
+                    lastChanged = qMax(lastChanged, it.value());
+                } else if (!m_filtered) {
+                    // New rows are not evaluated against an active search filter.
+                    m_totalCost += item.value();
+                    added.append(item);
+                }
+            }
+        }
+
+        // One range covering every updated row; views only repaint what is
+        // visible of it.
+        if (lastChanged >= 0)
+            emit dataChanged(index(firstChanged), index(lastChanged));
+        if (!added.isEmpty()) {
+            beginInsertRows(QModelIndex(), m_items.size(), m_items.size() + added.size() - 1);
+            for (const InventoryItem &item : added) {
+                m_rowById.insert(item.id, m_items.size());
+                m_items.append(item);
+            }
+            endInsertRows();
+        }
+    }
+
+    // The total was adjusted row by row above; in cents it stays exact
+    // however many changes are applied.
+    emit totalCostChanged();
+    emit searchIndexChanged();
+    checkLowStockItems();
+    Tracer::counter("model", "InventoryModel rows", m_items.size());
+    emit itemsChanged(upsertedIds, deletedIds);
+}
+
+bool InventoryModel::canSnapshot() const
+{
+    return m_userId != -1 && !m_filtered;
+}
+
+InventoryModel::Snapshot InventoryModel::snapshot() const
+{
+    Snapshot snapshot;
+    snapshot.items = m_items;
+    snapshot.policies = m_policies;
+    snapshot.searchIndex = m_searchIndex;
+    snapshot.skuIndex = m_skuIndex;
+    snapshot.totalCost = m_totalCost;
+    snapshot.loaded = m_loaded;
+
+    snapshot.bytes = memoryBytes();
+    return snapshot;
+}
+
+qint64 InventoryModel::memoryBytes() const
+{
+    using namespace MemoryEstimate;
+    qint64 bytes = listBytes(m_items) + nodeBytes<int, int>(m_rowById.size())
+                   + nodeBytes<int, StockPolicy>(m_policies.size())
+                   + m_searchIndex.memoryBytes() + m_skuIndex.memoryBytes();
+    for (const auto &item : m_items) {
+        bytes += stringBytes(item.name) + stringBytes(item.category) + stringBytes(item.supplierName)
+                 + stringBytes(item.supplierAddress) + stringBytes(item.sku);
+    }
+    return bytes;
+}
+
+bool InventoryModel::releaseRows()
+{
+    Tracer::Scope trace("model", "InventoryModel::releaseRows");
+    if (!m_loaded)
+        return false;
+
+    beginResetModel();
+    m_items.clear();
+    m_rowById.clear();
+    m_searchIndex.clear();
+    m_skuIndex.clear();
+    m_filtered = false;
+    m_loaded = false;
+    m_totalCost = 0;
+    endResetModel();
+    emit totalCostChanged();
+    emit searchIndexChanged();
+    // The low-stock count is left as it was rather than dropping to zero and
+    // clearing the alerts that follow it.
+    return true;
+}
+
+void InventoryModel::restoreSnapshot(int userId, const Snapshot &snapshot)
+{
+    Tracer::Scope trace("model", "InventoryModel::restoreSnapshot");
+    beginResetModel();
+    m_userId = userId;
+    m_items = snapshot.items;
+    rebuildRowIndex();
+    m_policies = snapshot.policies;
+    m_searchIndex = snapshot.searchIndex;
+    m_skuIndex = snapshot.skuIndex;
+    m_totalCost = snapshot.totalCost;
+    m_filtered = false;
+    m_loaded = snapshot.loaded;
+    endResetModel();
+    emit totalCostChanged();
+    emit searchIndexChanged();
+    checkLowStockItems();
+    checkExpiringItems();
+}
+
+bool InventoryModel::exportItems(const QString &filePath, const QString &format, const QVariantMap &filter)
+{
+    if (m_userId == -1) {
+        emit errorOccurred("User not set. Unable to export items.");
+        return false;
+    }
+
+    StreamExporter::Request request = exportRequest(m_userId, filter);
+    request.filePath = filePath;
+    if (!StreamExporter::parseFormat(format, &request.format)) {
+        emit errorOccurred(tr("Unknown export format: %1").arg(format));
+        return false;
+    }
+    if (!m_exporter->start(request)) {
+        emit errorOccurred("An export is already running.");
+        return false;
+    }
+    return true;
+}
+
+void InventoryModel::cancelExport()
+{
+    m_exporter->cancel();
+}
+
+StreamExporter::Request InventoryModel::exportRequest(int userId, const QVariantMap &filter)
+{
+    StreamExporter::Request request;
+    // Prices are stored in cents; exports keep using currency units.
+    request.sql = "SELECT id, name, category, quantity, price / 100.0 AS price, supplier_name, "
+                  "supplier_address, expiry_date, last_updated, sku FROM Inventory WHERE user_id = :userId";
+    request.bindings.insert(":userId", userId);
+
+    const QString category = filter.value("category").toString();
+    if (!category.isEmpty()) {
+        request.sql += " AND category = :category";
+        request.bindings.insert(":category", category);
+    }
+    const QDate from = filter.value("from").toDate();
+    if (from.isValid()) {
+        request.sql += " AND last_updated >= :from";
+        request.bindings.insert(":from", from);
+    }
+    const QDate to = filter.value("to").toDate();
+    if (to.isValid()) {
+        request.sql += " AND last_updated < :to";
+        request.bindings.insert(":to", to.addDays(1));
+    }
+    request.sql += " ORDER BY id";
+    return request;
+}
+
+void InventoryModel::indexItem(const InventoryItem &item)
+{
+    m_searchIndex.insert(item.id, item.name, item.category, item.supplierName);
+    m_skuIndex.insert(item.id, item.sku);
+}
+
+void InventoryModel::rebuildRowIndex()
+{
+    m_rowById.clear();
+    m_rowById.reserve(m_items.size());
+    for (int row = 0; row < m_items.size(); ++row)
+        m_rowById.insert(m_items.at(row).id, row);
+}
+
+QVariantMap InventoryModel::toRecord(const InventoryItem &item) const
+{
+    QVariantMap record;
+    record["id"] = item.id;
+    record["name"] = item.name;
+    record["category"] = item.category;
+    record["quantity"] = item.quantity;
+    record["price"] = Money::toUnits(item.price);
+    record["supplierName"] = item.supplierName;
+    record["supplierAddress"] = item.supplierAddress;
+    record["expiryDate"] = item.expiryDate.toString(Qt::ISODate);
+    record["lastUpdated"] = item.lastUpdated.toString(Qt::ISODate);
+    record["sku"] = item.sku;
+    record["lowStock"] = isLowStock(item);
+    return record;
+}
+
 void InventoryModel::checkLowStockItems()
 {
     int lowStockCount = 0;
     for (const auto &item : m_items) {
-        if (item.quantity < LOW_STOCK_THRESHOLD) {
+        if (isLowStock(item)) {
             lowStockCount++;
         }
     }
@@ -246,25 +917,104 @@ void InventoryModel::checkLowStockItems()
 
 void InventoryModel::checkExpiringItems()
 {
+    Tracer::Scope trace("model", "InventoryModel::checkExpiringItems");
     QDate currentDate = QDate::currentDate();
     QDate thirtyDaysFromNow = currentDate.addDays(30);
-    
+
+    if (!m_loaded) {
+        QSqlQuery query(m_dbManager->database());
+        query.setForwardOnly(true);
+        query.prepare("SELECT id, name, expiry_date FROM Inventory "
+                      "WHERE user_id = :userId AND expiry_date <= :expiryDate");
+        query.bindValue(":userId", m_userId);
+        query.bindValue(":expiryDate", thirtyDaysFromNow);
+        if (!query.exec()) {
+            qWarning() << "Failed to check expiring items:" << query.lastError().text();
+            return;
+        }
+        while (query.next()) {
+            Tracer::instant("signal", "InventoryModel::itemNearExpiry");
+            emit itemNearExpiry(query.value(0).toInt(), query.value(1).toString(), query.value(2).toDate());
+        }
+        return;
+    }
+
     for (const auto &item : m_items) {
         if (item.expiryDate.isValid() && item.expiryDate <= thirtyDaysFromNow) {
+            Tracer::instant("signal", "InventoryModel::itemNearExpiry");
             emit itemNearExpiry(item.id, item.name, item.expiryDate);
         }
     }
 }
 
+void InventoryModel::setStockPolicies(const QHash<int, StockPolicy> &policies)
+{
+    m_policies = policies;
+    if (!m_items.isEmpty())
+        emit dataChanged(index(0), index(m_items.size() - 1), {ReorderPointRole, DaysOfCoverRole});
+
+    // Membership of the low-stock list can change even when the count does not.
+    const int previousCount = m_lowStockItems;
+    checkLowStockItems();
+    if (m_lowStockItems == previousCount)
+        emit lowStockItemsChanged();
+}
+
+bool InventoryModel::isLowStock(const InventoryItem &item) const
+{
+    // Items without a forecast yet fall back to the fixed threshold.
+    auto it = m_policies.constFind(item.id);
+    if (it == m_policies.constEnd())
+        return item.quantity < LOW_STOCK_THRESHOLD;
+    return item.quantity <= it->reorderPoint;
+}
+
+double InventoryModel::daysOfCover(const InventoryItem &item) const
+{
+    auto it = m_policies.constFind(item.id);
+    if (it == m_policies.constEnd() || it->dailyDemand <= 0.0)
+        return -1.0;
+    return item.quantity / it->dailyDemand;
+}
+
 QVariantList InventoryModel::getLowStockItems() const
 {
     QVariantList lowStockItems;
+    if (!m_loaded) {
+        if (m_userId == -1)
+            return lowStockItems;
+        // Same rule as isLowStock(), against the persisted forecasts.
+        QSqlQuery query(m_dbManager->database());
+        query.setForwardOnly(true);
+        query.prepare("SELECT i.id, i.name, i.quantity, "
+                      "CASE WHEN f.daily_demand > 0 THEN i.quantity / f.daily_demand ELSE -1 END "
+                      "FROM Inventory i LEFT JOIN ItemForecasts f ON f.item_id = i.id "
+                      "WHERE i.user_id = :userId AND (f.item_id IS NULL AND i.quantity < :threshold "
+                      "OR i.quantity <= f.reorder_point)");
+        query.bindValue(":userId", m_userId);
+        query.bindValue(":threshold", LOW_STOCK_THRESHOLD);
+        if (!query.exec()) {
+            qWarning() << "Failed to fetch low stock items:" << query.lastError().text();
+            return lowStockItems;
+        }
+        while (query.next()) {
+            QVariantMap itemMap;
+            itemMap["id"] = query.value(0).toInt();
+            itemMap["name"] = query.value(1).toString();
+            itemMap["quantity"] = query.value(2).toInt();
+            itemMap["daysOfCover"] = query.value(3).toDouble();
+            lowStockItems.append(itemMap);
+        }
+        return lowStockItems;
+    }
+
     for (const auto &item : m_items) {
-        if (item.quantity < LOW_STOCK_THRESHOLD) {
+        if (isLowStock(item)) {
             QVariantMap itemMap;
             itemMap["id"] = item.id;
             itemMap["name"] = item.name;
             itemMap["quantity"] = item.quantity;
+            itemMap["daysOfCover"] = daysOfCover(item);
             lowStockItems.append(itemMap);
         }
     }
@@ -278,5 +1028,10 @@ int InventoryModel::lowStockItems() const
 
 double InventoryModel::totalCost() const
 {
-    return m_totalCost;
+    return Money::toUnits(m_totalCost);
+}
+
+qint64 InventoryModel::searchIndexBytes() const
+{
+    return m_searchIndex.memoryBytes();
 }
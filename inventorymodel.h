@@ -3,13 +3,20 @@
 
 #include <QAbstractListModel>
 #include <QDate>
+#include <QSqlQuery>
 #include "databasemanager.h"
+#include "money.h"
+#include "rowmapper.h"
+#include "skuindex.h"
+#include "streamexporter.h"
+#include "trigramindex.h"
 
 class InventoryModel : public QAbstractListModel
 {
     Q_OBJECT
     Q_PROPERTY(int lowStockItems READ lowStockItems NOTIFY lowStockItemsChanged)
     Q_PROPERTY(double totalCost READ totalCost NOTIFY totalCostChanged)
+    Q_PROPERTY(qint64 searchIndexBytes READ searchIndexBytes NOTIFY searchIndexChanged)
 
 public:
     enum Roles {
@@ -21,7 +28,16 @@ public:
         SupplierNameRole,
         SupplierAddressRole,
         ExpiryDateRole,
-        LastUpdatedRole
+        LastUpdatedRole,
+        ReorderPointRole,
+        DaysOfCoverRole,
+        SkuRole
+    };
+
+    // Forecast-derived stocking levels for one item.
+    struct StockPolicy {
+        double dailyDemand;
+        double reorderPoint;
     };
 
     explicit InventoryModel(DatabaseManager *dbManager, QObject *parent = nullptr);
@@ -30,24 +46,78 @@ public:
     QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
     QHash<int, QByteArray> roleNames() const override;
 
+    // Switching user empties the model; rows are only read from the database
+    // once something needs them, see ensureLoaded().
     void setUserId(int userId);
+    // Loads the user's items unless they are already in memory. The
+    // inventory and sales views call this when they open.
+    Q_INVOKABLE void ensureLoaded();
+    bool isLoaded() const;
     Q_INVOKABLE bool addItem(const QString &name, const QString &category, int quantity, double price,
-                             const QString &supplierName, const QString &supplierAddress, const QDate &expiryDate);
+                             const QString &supplierName, const QString &supplierAddress, const QDate &expiryDate,
+                             const QString &sku = QString());
     Q_INVOKABLE bool updateItem(int id, const QString &name, const QString &category, int quantity, double price,
                                 const QString &supplierName, const QString &supplierAddress, const QDate &expiryDate);
     Q_INVOKABLE bool deleteItem(int id);
+    // SKUs are unique per user; an empty sku clears it.
+    Q_INVOKABLE bool setItemSku(int id, const QString &sku);
+    // Resolves a scanned SKU from memory; -1 when unknown.
+    Q_INVOKABLE int itemIdForSku(const QString &sku) const;
     Q_INVOKABLE void searchItems(const QString &searchText);
+    // Typo-tolerant lookup over name, category and supplier, answered from
+    // the in-memory trigram index. Returns maps with id, name, category,
+    // supplierName and score, best match first.
+    Q_INVOKABLE QVariantList fuzzySearch(const QString &text, int limit = 10) const;
     Q_INVOKABLE void refresh();
+    // Applies quantity deltas ({"id", "delta"} maps) in one transaction; the
+    // batch is refused as a whole if any item is unknown or would go below
+    // zero. When error is given it receives the reason instead of
+    // errorOccurred being emitted.
+    bool adjustQuantities(const QVariantList &adjustments, QString *error = nullptr);
+    // Bulk edits, each one transaction and one model update however many
+    // rows they touch. percent may be negative; prices are rounded to cents.
+    Q_INVOKABLE bool adjustPrices(const QString &category, double percent);
+    // Stocktake: item id (as a string key) -> counted quantity.
+    Q_INVOKABLE bool setQuantities(const QVariantMap &quantities);
+    Q_INVOKABLE bool deleteItems(const QVariantList &ids);
+    // One item as a map keyed like the role names plus "lowStock"; empty when
+    // the user has no such item.
+    QVariantMap itemRecord(int id) const;
+    void applyChanges(const QList<int> &upsertedIds, const QList<int> &deletedIds);
+    void setStockPolicies(const QHash<int, StockPolicy> &policies);
+
+    // Approximate heap footprint of the rows and both indexes; see
+    // MemoryEstimate.
+    qint64 memoryBytes() const;
+    // Pages the rows out to free memory: the model goes back to the state
+    // setUserId() leaves it in and ensureLoaded() reads them again. Stock
+    // policies are kept. Returns false when nothing was loaded.
+    bool releaseRows();
+
+    // Streams the user's items to filePath without touching the model.
+    // Filter keys: "category", and "from"/"to" applied to last_updated.
+    Q_INVOKABLE bool exportItems(const QString &filePath, const QString &format,
+                                 const QVariantMap &filter = QVariantMap());
+    Q_INVOKABLE void cancelExport();
+    static StreamExporter::Request exportRequest(int userId, const QVariantMap &filter);
 
     int lowStockItems() const;
     double totalCost() const;
+    qint64 searchIndexBytes() const;
+    // Answered from the database while the model is not loaded.
     QVariantList getLowStockItems() const;
 
 signals:
     void errorOccurred(const QString &error);
     void lowStockItemsChanged();
     void totalCostChanged();
+    void searchIndexChanged();
+    // Every row change the model applies, whether made here or picked up
+    // from another connection through ChangeFeed.
+    void itemsChanged(const QList<int> &upsertedIds, const QList<int> &deletedIds);
     void itemNearExpiry(int itemId, const QString &itemName, const QDate &expiryDate);
+    void exportProgress(qint64 rows);
+    void exportFinished(bool ok, qint64 rows, const QString &filePath, const QString &error);
 
 private:
     static const int LOW_STOCK_THRESHOLD = 10;
@@ -57,21 +127,68 @@ private:
         QString name;
         QString category;
         int quantity;
-        double price;
+        Money::Cents price;
         QString supplierName;
         QString supplierAddress;
         QDate expiryDate;
         QDateTime lastUpdated;
+        QString sku;
+
+        static auto columns()
+        {
+            return std::make_tuple(column("id", &InventoryItem::id),
+                                   column("name", &InventoryItem::name),
+                                   column("category", &InventoryItem::category),
+                                   column("quantity", &InventoryItem::quantity),
+                                   column("price", &InventoryItem::price),
+                                   column("supplier_name", &InventoryItem::supplierName),
+                                   column("supplier_address", &InventoryItem::supplierAddress),
+                                   column("expiry_date", &InventoryItem::expiryDate),
+                                   column("last_updated", &InventoryItem::lastUpdated),
+                                   column("sku", &InventoryItem::sku));
+        }
+
+        Money::Cents value() const { return quantity * price; }
     };
 
     DatabaseManager *m_dbManager;
+    StreamExporter *m_exporter;
     QList<InventoryItem> m_items;
+    QHash<int, int> m_rowById; // item id -> row in m_items
     int m_userId;
     int m_lowStockItems;
-    double m_totalCost;
+    Money::Cents m_totalCost; // kept up to date row by row, see applyChanges()
+    bool m_filtered;
+    bool m_loaded;
+    QHash<int, StockPolicy> m_policies;
+    TrigramIndex m_searchIndex; // always covers every item, even while filtered
+    SkuIndex m_skuIndex;        // likewise
 
+    bool isLowStock(const InventoryItem &item) const;
+    double daysOfCover(const InventoryItem &item) const;
     void checkLowStockItems();
     void checkExpiringItems();
+    void indexItem(const InventoryItem &item);
+    void rebuildRowIndex();
+    QVariantMap toRecord(const InventoryItem &item) const;
+
+public:
+    // Everything loaded for one user, as kept by SessionCache. The lists are
+    // implicitly shared, so taking or restoring a snapshot copies no rows.
+    struct Snapshot {
+        QList<InventoryItem> items;
+        QHash<int, StockPolicy> policies;
+        TrigramIndex searchIndex;
+        SkuIndex skuIndex;
+        Money::Cents totalCost = 0;
+        bool loaded = false;
+        qint64 bytes = 0; // estimated heap footprint
+    };
+
+    // False while a search has narrowed the rows to a subset.
+    bool canSnapshot() const;
+    Snapshot snapshot() const;
+    void restoreSnapshot(int userId, const Snapshot &snapshot);
 };
 
 #endif // INVENTORYMODEL_H
@@ -1,42 +1,171 @@
 #include <QGuiApplication>
 #include <QQmlApplicationEngine>
 #include <QQmlContext>
+#include <QQuickWindow>
+#include "analyticsmodel.h"
+#include "changefeed.h"
+#include "commandline.h"
 #include "databasemanager.h"
+#include "demandforecaster.h"
 #include "inventorymodel.h"
+#include "memorymonitor.h"
+#include "notificationhub.h"
+#include "queryservice.h"
 #include "salesmodel.h"
+#include "sessioncache.h"
+#include "startuptimeline.h"
+#include "stockledger.h"
+#include "tilljournal.h"
+#include "tracer.h"
 #include "userdashboard.h"
 #include "usermodel.h"
+#include "workloadrecorder.h"
 
 int main(int argc, char *argv[])
 {
+    QStringList arguments;
+    for (int i = 0; i < argc; ++i)
+        arguments.append(QString::fromLocal8Bit(argv[i]));
+
+    QCommandLineParser parser;
+    CommandLine::addOptions(parser);
+    if (!parser.parse(arguments)) {
+        qCritical().noquote() << parser.errorText();
+        return -1;
+    }
+
+    CommandLine::applyTracing(parser);
+    if (CommandLine::isHeadless(parser)) {
+        QCoreApplication app(argc, argv);
+        DatabaseManager dbManager;
+        CommandLine::applyDatabaseOptions(parser, dbManager);
+        const int status = CommandLine::run(parser, dbManager);
+        CommandLine::finishTracing(parser);
+        return status;
+    }
+
+    StartupTimeline timeline(parser.isSet("fast-start"));
+    StartupTimeline::setActive(&timeline);
+
+    qint64 phaseStart = timeline.elapsedNs();
     QGuiApplication app(argc, argv);
+    timeline.record("create application", phaseStart, timeline.elapsedNs());
 
+    // With --fast-start the schema is checked on a worker thread while the
+    // login screen comes up; login waits for DatabaseManager::ready.
     DatabaseManager dbManager;
-    if (!dbManager.initialize()) {
-        qCritical() << "Failed to initialize database";
-        return -1;
+    CommandLine::applyDatabaseOptions(parser, dbManager);
+    // The journal's merger writes to the database, so it only starts once
+    // the schema is up to date.
+    TillJournal tillJournal(&dbManager);
+    auto startDatabaseServices = [&]() {
+        CommandLine::applyBackupSchedule(parser, dbManager);
+        CommandLine::applyMaintenance(parser, dbManager);
+        CommandLine::applyTillJournal(parser, tillJournal);
+    };
+    if (timeline.fastStart()) {
+        QObject::connect(&dbManager, &DatabaseManager::initialized, [&](bool ok) {
+            if (!ok) {
+                qCritical() << "Failed to initialize database";
+                QCoreApplication::exit(-1);
+                return;
+            }
+            startDatabaseServices();
+        });
+        dbManager.initializeAsync();
+    } else {
+        if (!dbManager.initialize()) {
+            qCritical() << "Failed to initialize database";
+            return -1;
+        }
+        startDatabaseServices();
     }
+    WorkloadRecorder recorder;
+    CommandLine::applyRecording(parser, recorder);
 
+    phaseStart = timeline.elapsedNs();
     InventoryModel inventoryModel(&dbManager);
     SalesModel salesModel(&dbManager);
+    salesModel.setInventoryModel(&inventoryModel);
+    salesModel.setTillJournal(&tillJournal);
     UserModel userModel(&dbManager, &inventoryModel, &salesModel);
     UserDashboard userDashboard(&dbManager, &inventoryModel, &salesModel);
+    ChangeFeed changeFeed(&dbManager);
+    AnalyticsModel analyticsModel(&dbManager);
+    DemandForecaster demandForecaster(&dbManager, &inventoryModel);
+    NotificationHub notificationHub(&inventoryModel);
+    StockLedger stockLedger(&dbManager);
+    SessionCache sessionCache(&inventoryModel, &salesModel, &userDashboard, &changeFeed);
+    userModel.setSessionCache(&sessionCache);
+    MemoryMonitor memoryMonitor(&dbManager, &inventoryModel, &salesModel, &userDashboard, &sessionCache);
+    CommandLine::applyMemoryBudgets(parser, memoryMonitor);
+    QueryService queryService(&inventoryModel, &salesModel, &userDashboard);
+    queryService.setMemoryMonitor(&memoryMonitor);
+    if (parser.isSet("serve")) {
+        QString error;
+        if (!queryService.listen(parser.value("serve"), &error))
+            qWarning() << "Cannot start the query service:" << error;
+    }
+    timeline.record("create models", phaseStart, timeline.elapsedNs());
+
+    QObject::connect(&changeFeed, &ChangeFeed::inventoryChanged,
+                     &inventoryModel, &InventoryModel::applyChanges);
+    QObject::connect(&changeFeed, &ChangeFeed::salesChanged,
+                     &salesModel, &SalesModel::applyChanges);
+    QObject::connect(&changeFeed, &ChangeFeed::resyncRequired, &userDashboard, &UserDashboard::refresh);
+    QObject::connect(&changeFeed, &ChangeFeed::archivesChanged, &dbManager, &DatabaseManager::refreshArchives);
+    QObject::connect(&dbManager, &DatabaseManager::maintenanceFinished, &stockLedger, &StockLedger::takeDueSnapshots);
 
     QObject::connect(&userModel, &UserModel::loginStatusChanged, [&]() {
         if (userModel.isLoggedIn()) {
             qDebug() << "User logged in, setting user ID for dashboard";
             userDashboard.setUserId(userModel.currentUserId());
+            changeFeed.setUserId(userModel.currentUserId());
+            analyticsModel.setUserId(userModel.currentUserId());
+            demandForecaster.setUserId(userModel.currentUserId());
+            queryService.setUserId(userModel.currentUserId());
+            stockLedger.setUserId(userModel.currentUserId());
         } else {
             qDebug() << "User logged out, clearing dashboard";
+            notificationHub.clear();
             userDashboard.setUserId(-1);
+            changeFeed.setUserId(-1);
+            analyticsModel.setUserId(-1);
+            demandForecaster.setUserId(-1);
+            queryService.setUserId(-1);
+            stockLedger.setUserId(-1);
         }
     });
 
+    // Start-up is over once the login screen is shown and the database is
+    // open, whichever comes last.
+    auto startupFinished = [&]() {
+        if (!timeline.isFirstFrameShown() || !dbManager.isReady())
+            return;
+        timeline.mark("interactive");
+        StartupTimeline::setActive(nullptr);
+        QString error;
+        if (parser.isSet("startup-timeline") && !timeline.dump(parser.value("startup-timeline"), &error))
+            qWarning() << "Cannot write the start-up timeline:" << error;
+    };
+    QObject::connect(&timeline, &StartupTimeline::firstFrameShown, startupFinished);
+    QObject::connect(&dbManager, &DatabaseManager::readyChanged, startupFinished);
+
+    phaseStart = timeline.elapsedNs();
     QQmlApplicationEngine engine;
+    engine.rootContext()->setContextProperty("startupTimeline", &timeline);
+    engine.rootContext()->setContextProperty("databaseManager", &dbManager);
     engine.rootContext()->setContextProperty("userModel", &userModel);
     engine.rootContext()->setContextProperty("inventoryModel", &inventoryModel);
     engine.rootContext()->setContextProperty("salesModel", &salesModel);
     engine.rootContext()->setContextProperty("userDashboard", &userDashboard);
+    engine.rootContext()->setContextProperty("analyticsModel", &analyticsModel);
+    engine.rootContext()->setContextProperty("demandForecaster", &demandForecaster);
+    engine.rootContext()->setContextProperty("sessionCache", &sessionCache);
+    engine.rootContext()->setContextProperty("notificationHub", &notificationHub);
+    engine.rootContext()->setContextProperty("stockLedger", &stockLedger);
+    engine.rootContext()->setContextProperty("tillJournal", &tillJournal);
+    engine.rootContext()->setContextProperty("memoryMonitor", &memoryMonitor);
 
     const QUrl url(QStringLiteral("../../Demo/main.qml"));
     QObject::connect(&engine, &QQmlApplicationEngine::objectCreated,
@@ -45,6 +174,14 @@ int main(int argc, char *argv[])
             QCoreApplication::exit(-1);
     }, Qt::QueuedConnection);
     engine.load(url);
+    timeline.record("load QML", phaseStart, timeline.elapsedNs());
+    if (auto *window = qobject_cast<QQuickWindow *>(engine.rootObjects().value(0))) {
+        timeline.watchFirstFrame(window);
+        // Always connected so that a trace started later still has frames.
+        Tracer::traceFrames(window);
+    }
 
-    return app.exec();
+    const int status = app.exec();
+    CommandLine::finishTracing(parser);
+    return status;
 }
@@ -8,6 +8,32 @@ ApplicationWindow {
     height: 768
     title: qsTr("Business Inventory Management System")
 
+    // Views are created when they are first opened. With --fast-start their
+    // QML is also compiled in the background once the login screen is up,
+    // so that opening one later does not stall the window either.
+    property var viewComponents: ({})
+
+    function showView(name) {
+        var component = viewComponents[name]
+        if (component && component.status === Component.Ready)
+            stackView.replace(component)
+        else
+            stackView.replace(name + ".qml")
+        // Models of the view just left may now be paged out if over budget.
+        memoryMonitor.setActiveView(name)
+    }
+
+    Connections {
+        target: startupTimeline
+        function onFirstFrameShown() {
+            if (!startupTimeline.fastStart)
+                return
+            var views = ["DashboardView", "InventoryView", "SalesView", "AnalyticsView"]
+            for (var i = 0; i < views.length; ++i)
+                viewComponents[views[i]] = Qt.createComponent(views[i] + ".qml", Component.Asynchronous)
+        }
+    }
+
     Rectangle {
         anchors.fill: parent
         color: "#1e2329"
@@ -90,22 +116,7 @@ ApplicationWindow {
                             background: Rectangle {
                                 color: "transparent"
                             }
-                            onClicked: {
-                                switch(modelData) {
-                                    case "Dashboard":
-                                        stackView.replace("DashboardView.qml")
-                                        break
-                                    case "Inventory":
-                                        stackView.replace("InventoryView.qml")
-                                        break
-                                    case "Sales":
-                                        stackView.replace("SalesView.qml")
-                                        break
-                                    case "Analytics":
-                                        stackView.replace("AnalyticsView.qml")
-                                        break
-                                }
-                            }
+                            onClicked: showView(modelData + "View")
                         }
                     }
 
@@ -142,53 +153,10 @@ ApplicationWindow {
         target: userModel
         function onLoginSuccessful() {
             console.log("Login successful, transitioning to dashboard")
-            stackView.replace("DashboardView.qml")
-            userDashboard.refresh()
+            showView("DashboardView")
         }
         function onErrorOccurred(error) {
             console.log("Error occurred:", error)
         }
     }
-
-    // Handle expiry notifications
-    Connections {
-        target: userDashboard
-        function onItemNearExpiry(itemId, itemName, expiryDate) {
-            expiryNotificationDialog.itemName = itemName
-            expiryNotificationDialog.expiryDate = expiryDate
-            expiryNotificationDialog.open()
-        }
-    }
-
-    Dialog {
-        id: expiryNotificationDialog
-        title: "Item Nearing Expiry"
-        modal: true
-        x: (parent.width - width) / 2
-        y: (parent.height - height) / 2
-
-        property string itemName: ""
-        property date expiryDate
-
-        contentItem: ColumnLayout {
-            Text {
-                text: "The following item is nearing its expiry date:"
-                color: "white"
-                font.pixelSize: 16
-            }
-            Text {
-                text: expiryNotificationDialog.itemName
-                color: "#FF9800"
-                font.pixelSize: 18
-                font.bold: true
-            }
-            Text {
-                text: "Expiry Date: " + Qt.formatDate(expiryNotificationDialog.expiryDate, "yyyy-MM-dd")
-                color: "white"
-                font.pixelSize: 16
-            }
-        }
-
-        standardButtons: Dialog.Ok
-    }
 }
@@ -0,0 +1,554 @@
+#include "maintenancescheduler.h"
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QRegularExpression>
+#include <QThread>
+#include <QtConcurrent>
+#include <sqlite3.h>
+
+namespace {
+const int IDLE_CHECK_MS = 60 * 1000;
+// Virtual machine instructions between deadline checks; well under a
+// millisecond of work.
+const int PROGRESS_OPS = 1000;
+const int MIN_ANALYSIS_LIMIT = 50;
+const int MIN_VACUUM_PAGES = 1;
+const int MAX_VACUUM_PAGES = 4096;
+const int MIN_PRUNE_ROWS = 16;
+const int MAX_PRUNE_ROWS = 8192;
+
+// Statements the application runs constantly, with the table each one
+// should reach through an index rather than scan.
+struct PlanProbe {
+  const char *name;
+  const char *table;
+  const char *sql;
+};
+
+const PlanProbe PLAN_PROBES[] = {
+    {"inventory by user", "Inventory",
+     "SELECT id FROM Inventory WHERE user_id = ?"},
+    {"sales by user and date", "Sales",
+     "SELECT SUM(total_price) FROM Sales WHERE user_id = ? AND sale_date >= ?"},
+    {"sales by item", "Sales", "SELECT COUNT(*) FROM Sales WHERE item_id = ?"},
+    {"change feed", "ChangeLog",
+     "SELECT row_id FROM ChangeLog WHERE user_id = ? AND seq > ?"},
+    {"stock movements", "StockMovements",
+     "SELECT SUM(delta) FROM StockMovements WHERE user_id = ? AND "
+     "moved_at >= ? AND moved_at < ?"},
+    {"cost layers", "CostLayers",
+     "SELECT id FROM CostLayers WHERE user_id = ? AND item_id = ? ORDER BY id"},
+    {"dashboard counters", "UserKpis",
+     "SELECT revenue FROM UserKpis WHERE user_id = ?"},
+};
+
+struct Deadline {
+  QElapsedTimer timer;
+  qint64 budgetMs;
+};
+
+int pastDeadline(void *arg) {
+  const auto *deadline = static_cast<Deadline *>(arg);
+  return deadline->timer.elapsed() > deadline->budgetMs ? 1 : 0;
+}
+
+QString sqliteError(sqlite3 *db) {
+  return db ? QString::fromUtf8(sqlite3_errmsg(db))
+            : QStringLiteral("out of memory");
+}
+
+// Runs sql as one autocommit statement, interrupting it once it has run
+// for budgetMs. An interrupted statement is rolled back by SQLite, so the
+// write lock is never held much past the budget.
+int execSlice(sqlite3 *db, const QByteArray &sql, qint64 budgetMs,
+              qint64 *elapsedMs) {
+  Deadline deadline;
+  deadline.budgetMs = budgetMs;
+  deadline.timer.start();
+  sqlite3_progress_handler(db, PROGRESS_OPS, pastDeadline, &deadline);
+  const int rc = sqlite3_exec(db, sql.constData(), nullptr, nullptr, nullptr);
+  sqlite3_progress_handler(db, 0, nullptr, nullptr);
+  *elapsedMs = deadline.timer.elapsed();
+  return rc;
+}
+
+bool queryRow(sqlite3 *db, const QByteArray &sql, QVector<qint64> *values) {
+  sqlite3_stmt *stmt = nullptr;
+  bool found = false;
+  if (sqlite3_prepare_v2(db, sql.constData(), -1, &stmt, nullptr) ==
+          SQLITE_OK &&
+      sqlite3_step(stmt) == SQLITE_ROW) {
+    values->clear();
+    for (int i = 0; i < sqlite3_column_count(stmt); ++i)
+      values->append(sqlite3_column_int64(stmt, i));
+    found = true;
+  }
+  sqlite3_finalize(stmt);
+  return found;
+}
+
+qint64 queryInt(sqlite3 *db, const QByteArray &sql, qint64 fallback = -1) {
+  QVector<qint64> values;
+  return queryRow(db, sql, &values) && !values.isEmpty() ? values.first()
+                                                         : fallback;
+}
+
+QStringList queryColumn(sqlite3 *db, const QByteArray &sql, int column = 0) {
+  QStringList values;
+  sqlite3_stmt *stmt = nullptr;
+  if (sqlite3_prepare_v2(db, sql.constData(), -1, &stmt, nullptr) ==
+      SQLITE_OK) {
+    while (sqlite3_step(stmt) == SQLITE_ROW)
+      values.append(QString::fromUtf8(reinterpret_cast<const char *>(
+          sqlite3_column_text(stmt, column))));
+  }
+  sqlite3_finalize(stmt);
+  return values;
+}
+
+QByteArray quoted(const QString &identifier) {
+  return "\"" + QString(identifier).replace('"', "\"\"").toUtf8() + "\"";
+}
+
+// Runs between slices: waits pauseMs, then reports whether another
+// connection committed meanwhile, in which case the user is back and the
+// run stops.
+class Pacer {
+public:
+  Pacer(sqlite3 *db, int pauseMs) : m_db(db), m_pauseMs(pauseMs) {
+    m_version = queryInt(db, "PRAGMA data_version");
+  }
+
+  bool othersWrote() {
+    QThread::msleep(m_pauseMs);
+    const qint64 version = queryInt(m_db, "PRAGMA data_version");
+    const bool changed = version != m_version;
+    m_version = version;
+    return changed;
+  }
+
+private:
+  sqlite3 *m_db;
+  int m_pauseMs;
+  qint64 m_version;
+};
+
+void addSlice(MaintenanceScheduler::TaskReport *task, qint64 elapsedMs) {
+  ++task->slices;
+  task->elapsedMs += elapsedMs;
+  task->longestSliceMs = qMax(task->longestSliceMs, elapsedMs);
+}
+} // namespace
+
+MaintenanceScheduler::MaintenanceScheduler(QObject *parent)
+    : QObject(parent), m_cancelled(false) {
+  connect(&m_watcher, &QFutureWatcher<QVector<Result>>::finished, this,
+          &MaintenanceScheduler::onFinished);
+  connect(&m_idleTimer, &QTimer::timeout, this,
+          &MaintenanceScheduler::checkIdle);
+}
+
+MaintenanceScheduler::~MaintenanceScheduler() {
+  m_cancelled = true;
+  m_watcher.waitForFinished();
+}
+
+void MaintenanceScheduler::setSourcePath(const QString &path) {
+  m_sourcePath = path;
+}
+
+void MaintenanceScheduler::setSources(const SourceList &sources) {
+  m_sources = sources;
+}
+
+void MaintenanceScheduler::setOptions(const Options &options) {
+  m_options = options;
+}
+
+bool MaintenanceScheduler::start() {
+  Options options = m_options;
+  options.force = true;
+  return launch(options);
+}
+
+void MaintenanceScheduler::cancel() { m_cancelled = true; }
+
+bool MaintenanceScheduler::isRunning() const { return m_watcher.isRunning(); }
+
+void MaintenanceScheduler::schedule(int idleMinutes) {
+  m_idleTimer.stop();
+  if (idleMinutes <= 0)
+    return;
+
+  m_options.idleSeconds = idleMinutes * 60;
+  m_idleTimer.start(IDLE_CHECK_MS);
+}
+
+void MaintenanceScheduler::checkIdle() {
+  // The worker does the idle check itself, on its own connection.
+  if (!m_watcher.isRunning())
+    launch(m_options);
+}
+
+bool MaintenanceScheduler::launch(const Options &options) {
+  if (m_watcher.isRunning())
+    return false;
+
+  const QStringList paths =
+      m_sources ? m_sources() : QStringList{m_sourcePath};
+  QVector<QPair<QString, qint64>> files;
+  for (const QString &path : paths) {
+    if (!path.isEmpty())
+      files.append(qMakePair(
+          path, options.force ? -1 : m_lastRunChanges.value(path, -1)));
+  }
+  if (files.isEmpty())
+    return false;
+
+  m_cancelled = false;
+  m_watcher.setFuture(QtConcurrent::run([this, files, options]() {
+    QVector<Result> results;
+    for (const auto &file : files) {
+      if (m_cancelled)
+        break;
+      results.append(run(file.first, options, file.second, m_cancelled));
+    }
+    return results;
+  }));
+  return true;
+}
+
+void MaintenanceScheduler::onFinished() {
+  const QVector<Result> results = m_watcher.future().result();
+  QStringList reports;
+  bool ok = true;
+  for (const Result &result : results) {
+    if (!result.ran && result.error.isEmpty())
+      continue;
+
+    // A run cut short by activity is tried again at the next idle period.
+    if (result.ok && !result.yielded && !result.cancelled)
+      m_lastRunChanges.insert(result.filePath, result.lastChange);
+    ok = ok && result.ok;
+    reports.append(report(result));
+  }
+  if (reports.isEmpty())
+    return;
+
+  const QString text = reports.join('\n');
+  qDebug().noquote() << text;
+  emit finished(ok, text);
+}
+
+MaintenanceScheduler::Result
+MaintenanceScheduler::run(const QString &filePath, const Options &options,
+                          qint64 lastRunChange,
+                          const std::atomic_bool &cancelled) {
+  Result result;
+  result.filePath = filePath;
+  QElapsedTimer timer;
+  timer.start();
+
+  sqlite3 *db = nullptr;
+  if (sqlite3_open_v2(filePath.toUtf8().constData(), &db,
+                      SQLITE_OPEN_READWRITE, nullptr) != SQLITE_OK) {
+    result.error = sqliteError(db);
+    sqlite3_close(db);
+    return result;
+  }
+  // Never wait on a writer: a busy slice simply ends the task.
+  sqlite3_busy_timeout(db, 0);
+
+  QVector<qint64> newest;
+  if (queryRow(db,
+               "SELECT seq, strftime('%s', 'now') - strftime('%s', changed_at) "
+               "FROM ChangeLog ORDER BY seq DESC LIMIT 1",
+               &newest))
+    result.lastChange = newest.at(0);
+  if (!options.force) {
+    const bool changedSinceLastRun = result.lastChange != lastRunChange;
+    const bool quiet = newest.isEmpty() || newest.at(1) >= options.idleSeconds;
+    if (!changedSinceLastRun || !quiet) {
+      sqlite3_close(db);
+      return result;
+    }
+  }
+  result.ran = true;
+  result.ok = true;
+
+  Pacer pacer(db, options.pauseMs);
+  auto shouldStop = [&]() {
+    if (cancelled) {
+      result.cancelled = true;
+      return true;
+    }
+    if (pacer.othersWrote()) {
+      result.yielded = true;
+      return true;
+    }
+    return false;
+  };
+  auto fail = [&](TaskReport *task, int rc) {
+    // Busy means someone else is writing; that is a reason to stop, not
+    // a failure.
+    if (rc == SQLITE_BUSY || rc == SQLITE_LOCKED) {
+      result.yielded = true;
+      task->detail = "stopped, database busy";
+      return;
+    }
+    task->ok = false;
+    task->detail = sqliteError(db);
+    result.ok = false;
+  };
+
+  // Old ChangeLog entries, oldest first and a slice at a time, before the
+  // free-page count is taken so the vacuum below can reclaim them. Sized
+  // like the vacuum slices.
+  TaskReport changeLog;
+  changeLog.name = "change log";
+  {
+    const QByteArray cutoff =
+        "datetime('now', '-" +
+        QByteArray::number(MaintenanceScheduler::CHANGE_LOG_RETENTION_HOURS) +
+        " hours')";
+    int sliceRows = 512;
+    qint64 pruned = 0;
+    qint64 elapsed = 0;
+    while (!result.yielded && !result.cancelled) {
+      const int rc = execSlice(
+          db,
+          "DELETE FROM ChangeLog WHERE seq IN (SELECT seq FROM ChangeLog "
+          "WHERE changed_at < " + cutoff + " ORDER BY seq LIMIT " +
+              QByteArray::number(sliceRows) + ")",
+          options.lockBudgetMs, &elapsed);
+      addSlice(&changeLog, elapsed);
+      if (rc == SQLITE_INTERRUPT) {
+        if (sliceRows == MIN_PRUNE_ROWS)
+          break;
+        sliceRows = qMax(MIN_PRUNE_ROWS, sliceRows / 2);
+      } else if (rc != SQLITE_OK) {
+        fail(&changeLog, rc);
+        break;
+      } else {
+        const int deleted = sqlite3_changes(db);
+        pruned += deleted;
+        if (deleted < sliceRows)
+          break;
+        if (elapsed * 4 < options.lockBudgetMs)
+          sliceRows = qMin(MAX_PRUNE_ROWS, sliceRows * 2);
+      }
+      if (shouldStop())
+        break;
+    }
+    if (changeLog.ok && changeLog.detail.isEmpty())
+      changeLog.detail = QString("%1 entries pruned").arg(pruned);
+  }
+  result.tasks.append(changeLog);
+
+  // Fragmentation.
+  TaskReport pages;
+  pages.name = "fragmentation";
+  const qint64 pageCount = queryInt(db, "PRAGMA page_count", 0);
+  const qint64 freeBefore = queryInt(db, "PRAGMA freelist_count", 0);
+  const bool incremental = queryInt(db, "PRAGMA auto_vacuum", 0) == 2;
+  const double freeRatio = pageCount > 0 ? double(freeBefore) / pageCount : 0.0;
+  pages.detail = QString("%1 of %2 pages free (%3%)")
+                     .arg(freeBefore)
+                     .arg(pageCount)
+                     .arg(freeRatio * 100.0, 0, 'f', 1);
+  result.tasks.append(pages);
+
+  // Statistics. With stats already present PRAGMA optimize only analyzes
+  // the tables that need it; when that does not fit in one slice, or there
+  // are no stats yet, tables are analyzed one per slice, sampling fewer rows
+  // whenever a slice runs out of budget.
+  TaskReport analyze;
+  analyze.name = "analyze";
+  int limit = options.analysisLimit;
+  qint64 elapsed = 0;
+  sqlite3_exec(db, QByteArray("PRAGMA analysis_limit = ") +
+                       QByteArray::number(limit),
+               nullptr, nullptr, nullptr);
+  const bool haveStats =
+      queryInt(db, "SELECT COUNT(*) FROM sqlite_master WHERE name = "
+                   "'sqlite_stat1'", 0) > 0;
+  int rc = SQLITE_INTERRUPT;
+  if (haveStats) {
+    rc = execSlice(db, "PRAGMA optimize(0x10002)", options.lockBudgetMs,
+                   &elapsed);
+    addSlice(&analyze, elapsed);
+    if (rc == SQLITE_OK)
+      analyze.detail = "optimize";
+  }
+  if (rc == SQLITE_INTERRUPT) {
+    const QStringList tables = queryColumn(
+        db, "SELECT name FROM sqlite_master WHERE type = 'table' AND "
+            "name NOT LIKE 'sqlite_%'");
+    int analyzed = 0;
+    QStringList tooLarge;
+    for (const QString &table : tables) {
+      if (shouldStop())
+        break;
+      while (true) {
+        rc = execSlice(db, "ANALYZE " + quoted(table), options.lockBudgetMs,
+                       &elapsed);
+        addSlice(&analyze, elapsed);
+        if (rc != SQLITE_INTERRUPT || limit <= MIN_ANALYSIS_LIMIT)
+          break;
+        limit = qMax(MIN_ANALYSIS_LIMIT, limit / 2);
+        sqlite3_exec(db, QByteArray("PRAGMA analysis_limit = ") +
+                             QByteArray::number(limit),
+                     nullptr, nullptr, nullptr);
+      }
+      if (rc == SQLITE_OK) {
+        ++analyzed;
+      } else if (rc == SQLITE_INTERRUPT) {
+        tooLarge.append(table);
+      } else {
+        fail(&analyze, rc);
+        break;
+      }
+    }
+    if (analyze.ok && analyze.detail.isEmpty()) {
+      analyze.detail = QString("%1 of %2 tables, analysis_limit %3")
+                           .arg(analyzed)
+                           .arg(tables.size())
+                           .arg(limit);
+      if (!tooLarge.isEmpty())
+        analyze.detail += "; over budget: " + tooLarge.join(", ");
+    }
+  } else if (rc != SQLITE_OK) {
+    fail(&analyze, rc);
+  }
+  result.tasks.append(analyze);
+
+  // Free pages, a few at a time. The slice grows while it stays well inside
+  // the budget and halves when it is interrupted.
+  TaskReport vacuum;
+  vacuum.name = "incremental vacuum";
+  if (!incremental) {
+    vacuum.skipped = true;
+    vacuum.detail = "auto_vacuum is not incremental; run --vacuum once to "
+                    "enable it";
+  } else if (freeRatio < options.vacuumThreshold) {
+    vacuum.skipped = true;
+    vacuum.detail = "below threshold";
+  } else {
+    int slicePages = 32;
+    while (!result.yielded && !result.cancelled &&
+           queryInt(db, "PRAGMA freelist_count", 0) > 0) {
+      rc = execSlice(db,
+                     "PRAGMA incremental_vacuum(" +
+                         QByteArray::number(slicePages) + ")",
+                     options.lockBudgetMs, &elapsed);
+      addSlice(&vacuum, elapsed);
+      if (rc == SQLITE_INTERRUPT) {
+        if (slicePages == MIN_VACUUM_PAGES)
+          break;
+        slicePages = qMax(MIN_VACUUM_PAGES, slicePages / 2);
+      } else if (rc != SQLITE_OK) {
+        fail(&vacuum, rc);
+        break;
+      } else if (elapsed * 4 < options.lockBudgetMs) {
+        slicePages = qMin(MAX_VACUUM_PAGES, slicePages * 2);
+      }
+      if (shouldStop())
+        break;
+    }
+    if (vacuum.ok && vacuum.detail.isEmpty())
+      vacuum.detail = QString("%1 pages reclaimed")
+                          .arg(freeBefore -
+                               queryInt(db, "PRAGMA freelist_count", 0));
+  }
+  result.tasks.append(vacuum);
+
+  // A passive checkpoint copies what it can without taking the write lock.
+  TaskReport checkpoint;
+  checkpoint.name = "checkpoint";
+  const QStringList journalMode = queryColumn(db, "PRAGMA journal_mode");
+  if (journalMode.value(0).compare("wal", Qt::CaseInsensitive) != 0) {
+    checkpoint.skipped = true;
+    checkpoint.detail = "not in WAL mode";
+  } else if (!result.yielded && !result.cancelled) {
+    QElapsedTimer checkpointTimer;
+    checkpointTimer.start();
+    QVector<qint64> frames;
+    if (queryRow(db, "PRAGMA wal_checkpoint(PASSIVE)", &frames) &&
+        frames.size() == 3) {
+      checkpoint.detail = QString("%1 of %2 frames copied")
+                              .arg(frames.at(2))
+                              .arg(frames.at(1));
+    } else {
+      fail(&checkpoint, sqlite3_errcode(db));
+    }
+    addSlice(&checkpoint, checkpointTimer.elapsed());
+  } else {
+    checkpoint.skipped = true;
+    checkpoint.detail = "not run";
+  }
+  result.tasks.append(checkpoint);
+
+  // Query plans, after the new statistics are in place. Reads only.
+  TaskReport plans;
+  plans.name = "query plans";
+  QElapsedTimer planTimer;
+  planTimer.start();
+  int probed = 0;
+  for (const PlanProbe &probe : PLAN_PROBES) {
+    const QStringList steps = queryColumn(
+        db, QByteArray("EXPLAIN QUERY PLAN ") + probe.sql, 3);
+    if (steps.isEmpty())
+      continue; // table not in this file
+    ++probed;
+    // A scan through an index reads the index in order and is expected;
+    // only a scan of the table's own rows is a regression.
+    const QRegularExpression fullScan(
+        QString("^SCAN (TABLE )?%1\\b(?! USING (COVERING )?INDEX)")
+            .arg(probe.table));
+    for (const QString &step : steps) {
+      if (fullScan.match(step).hasMatch()) {
+        result.planRegressions.append(
+            QString("%1: %2").arg(probe.name, steps.join("; ")));
+        break;
+      }
+    }
+  }
+  addSlice(&plans, planTimer.elapsed());
+  plans.detail = QString("%1 checked, %2 scanning")
+                     .arg(probed)
+                     .arg(result.planRegressions.size());
+  result.tasks.append(plans);
+
+  sqlite3_close(db);
+  result.elapsedMs = timer.elapsed();
+  return result;
+}
+
+QString MaintenanceScheduler::report(const Result &result) {
+  QStringList lines;
+  QString status;
+  if (result.cancelled)
+    status = " (cancelled)";
+  else if (result.yielded)
+    status = " (stopped early for other writers)";
+  lines.append(QString("Maintenance of %1 took %2 ms%3")
+                   .arg(result.filePath)
+                   .arg(result.elapsedMs)
+                   .arg(status));
+  if (!result.error.isEmpty())
+    lines.append("  error: " + result.error);
+  for (const TaskReport &task : result.tasks) {
+    QString line = QString("  %1: %2").arg(task.name, task.detail);
+    if (!task.skipped && task.slices > 0)
+      line += QString(" [%1 ms in %2 slices, longest %3 ms]")
+                  .arg(task.elapsedMs)
+                  .arg(task.slices)
+                  .arg(task.longestSliceMs);
+    if (!task.ok)
+      line += " FAILED";
+    lines.append(line);
+  }
+  for (const QString &regression : result.planRegressions)
+    lines.append("  plan regression: " + regression);
+  return lines.join('\n');
+}
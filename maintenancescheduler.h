@@ -0,0 +1,112 @@
+#ifndef MAINTENANCESCHEDULER_H
+#define MAINTENANCESCHEDULER_H
+
+#include <QFutureWatcher>
+#include <QHash>
+#include <QObject>
+#include <QStringList>
+#include <QTimer>
+#include <QVector>
+#include <atomic>
+#include <functional>
+
+// Housekeeping for a long-lived database file: refreshes planner statistics
+// (ANALYZE, PRAGMA optimize), gives free pages back with incremental vacuum,
+// checkpoints the WAL, prunes old ChangeLog entries and checks that the hot queries still use their
+// indexes. It waits until ChangeLog has been quiet for a while, then works
+// on its own connection on a worker thread in slices. Every statement that
+// writes runs under a deadline and is interrupted, and rolled back, once it
+// would hold the write lock longer than lockBudgetMs; the next slice is
+// made smaller instead.
+class MaintenanceScheduler : public QObject
+{
+    Q_OBJECT
+
+public:
+    // ChangeLog keeps this much history. ChangeFeed readers that fall further
+    // behind resynchronise with a full refresh, so a working day is enough.
+    static const int CHANGE_LOG_RETENTION_HOURS = 24;
+
+    struct Options {
+        int idleSeconds = 300;     // quiet time on ChangeLog before starting
+        int lockBudgetMs = 50;     // longest any one slice may hold the lock
+        int pauseMs = 200;         // between slices, so writers get a turn
+        double vacuumThreshold = 0.05; // free page fraction worth reclaiming
+        int analysisLimit = 1000;  // rows sampled per index by ANALYZE
+        bool force = false;        // skip the idle check
+    };
+
+    struct TaskReport {
+        QString name;
+        bool ok = true;
+        bool skipped = false;
+        int slices = 0;
+        qint64 elapsedMs = 0;
+        qint64 longestSliceMs = 0;
+        QString detail;
+    };
+
+    struct Result {
+        bool ran = false; // false when the database was not idle
+        bool ok = false;
+        bool cancelled = false;
+        bool yielded = false; // stopped early because another connection wrote
+        qint64 lastChange = 0; // newest ChangeLog sequence seen
+        qint64 elapsedMs = 0;
+        QVector<TaskReport> tasks;
+        QStringList planRegressions;
+        QString filePath;
+        QString error;
+    };
+
+    using SourceList = std::function<QStringList()>;
+
+    explicit MaintenanceScheduler(QObject *parent = nullptr);
+    ~MaintenanceScheduler();
+
+    void setSourcePath(const QString &path);
+    // The files to maintain, e.g. the catalog and every shard, asked for
+    // again at every run; the source path alone when not set. Each is
+    // checked for idleness and maintained on its own.
+    void setSources(const SourceList &sources);
+    void setOptions(const Options &options);
+
+    // Runs once now, idle or not.
+    bool start();
+    void cancel();
+    bool isRunning() const;
+
+    // Checks for an idle period every minute and runs once per idle period;
+    // an idleMinutes of 0 stops the schedule.
+    void schedule(int idleMinutes);
+
+    // lastRunChange is the ChangeLog sequence of the previous run; nothing is
+    // done unless something has been written since.
+    static Result run(const QString &filePath, const Options &options, qint64 lastRunChange,
+                      const std::atomic_bool &cancelled);
+    // One line per task with what it did and how long it took.
+    static QString report(const Result &result);
+
+signals:
+    // One report for every file that was maintained in the run.
+    void finished(bool ok, const QString &report);
+
+private slots:
+    void onFinished();
+    void checkIdle();
+
+private:
+    QString m_sourcePath;
+    SourceList m_sources;
+    Options m_options;
+    QFutureWatcher<QVector<Result>> m_watcher;
+    std::atomic_bool m_cancelled;
+    QTimer m_idleTimer;
+    // Per file. A file without ChangeLog, like the catalog, always reports
+    // 0 and so is maintained once per session unless forced.
+    QHash<QString, qint64> m_lastRunChanges;
+
+    bool launch(const Options &options);
+};
+
+#endif // MAINTENANCESCHEDULER_H
@@ -0,0 +1,84 @@
+#ifndef MEMORYESTIMATE_H
+#define MEMORYESTIMATE_H
+
+#include <QList>
+#include <QString>
+#include <QVariant>
+#include <QVariantList>
+#include <QVariantMap>
+#include <QtGlobal>
+
+// Approximate heap footprint of the containers the models keep, for
+// MemoryMonitor and SessionCache. The figures count the payload plus the
+// bookkeeping Qt and the allocator add per string, per list slot and per map
+// node, so that a list of many small rows is not reported as cheaper than it
+// is. Implicitly shared data is counted by every holder.
+namespace MemoryEstimate {
+
+// Typical malloc header and rounding per block on 64-bit platforms.
+const qint64 HEAP_BLOCK_OVERHEAD = 16;
+// QArrayData header in front of every non-empty string's characters.
+const qint64 STRING_HEADER_BYTES = 24;
+
+inline qint64 stringBytes(const QString &text)
+{
+    if (text.isNull())
+        return 0;
+    return STRING_HEADER_BYTES + (text.capacity() + 1) * qint64(sizeof(QChar)) + HEAP_BLOCK_OVERHEAD;
+}
+
+// The list's own storage, not what its elements point to.
+template <typename T>
+qint64 listBytes(const QList<T> &list)
+{
+#if QT_VERSION < QT_VERSION_CHECK(6, 0, 0)
+    // Qt 5 stores large or non-movable types as one heap node per element.
+    qint64 perElement = sizeof(void *);
+    if (QTypeInfo<T>::isLarge || QTypeInfo<T>::isStatic)
+        perElement += sizeof(T) + HEAP_BLOCK_OVERHEAD;
+    return list.size() * perElement + HEAP_BLOCK_OVERHEAD;
+#else
+    return list.capacity() * qint64(sizeof(T)) + HEAP_BLOCK_OVERHEAD;
+#endif
+}
+
+// A node per entry for hashes and maps: key, value and two or three links.
+template <typename Key, typename Value>
+qint64 nodeBytes(int count)
+{
+    return count * qint64(sizeof(Key) + sizeof(Value) + 3 * sizeof(void *) + HEAP_BLOCK_OVERHEAD);
+}
+
+inline qint64 variantBytes(const QVariant &value)
+{
+    switch (value.userType()) {
+    case QMetaType::QString:
+        return stringBytes(value.toString());
+    case QMetaType::QVariantMap: {
+        const QVariantMap map = value.toMap();
+        qint64 bytes = nodeBytes<QString, QVariant>(map.size());
+        for (auto it = map.constBegin(); it != map.constEnd(); ++it)
+            bytes += stringBytes(it.key()) + variantBytes(it.value());
+        return bytes;
+    }
+    case QMetaType::QVariantList: {
+        const QVariantList list = value.toList();
+        qint64 bytes = listBytes(list);
+        for (const QVariant &element : list)
+            bytes += variantBytes(element);
+        return bytes;
+    }
+    default:
+        // Ints, doubles and dates live inside the QVariant itself.
+        return 0;
+    }
+}
+
+inline qint64 variantListBytes(const QVariantList &list)
+{
+    return variantBytes(QVariant(list));
+}
+
+} // namespace MemoryEstimate
+
+#endif // MEMORYESTIMATE_H
@@ -0,0 +1,275 @@
+#include "memorymonitor.h"
+#include "databasemanager.h"
+#include "inventorymodel.h"
+#include "salesmodel.h"
+#include "sessioncache.h"
+#include "tracer.h"
+#include "userdashboard.h"
+#include <QDebug>
+#include <QSqlDriver>
+#include <QSqlQuery>
+#include <QTextStream>
+#include <limits>
+#include <sqlite3.h>
+
+namespace {
+const int DEFAULT_CHECK_INTERVAL_SECONDS = 60;
+
+QString formatBytes(qint64 bytes) {
+  if (bytes < 1024)
+    return QString("%1 B").arg(bytes);
+  if (bytes < 1024 * 1024)
+    return QString("%1 KiB").arg(bytes / 1024.0, 0, 'f', 1);
+  return QString("%1 MiB").arg(bytes / (1024.0 * 1024.0), 0, 'f', 1);
+}
+
+// The connection's sqlite3 handle, through the driver; null if the driver
+// is not SQLite or the connection is closed.
+sqlite3 *sqliteHandle(const QSqlDatabase &db) {
+  if (!db.isOpen())
+    return nullptr;
+  const QVariant handle = db.driver()->handle();
+  if (!handle.isValid() || qstrcmp(handle.typeName(), "sqlite3*") != 0)
+    return nullptr;
+  return *static_cast<sqlite3 *const *>(handle.data());
+}
+
+qint64 cacheUsed(const QSqlDatabase &db) {
+  sqlite3 *handle = sqliteHandle(db);
+  int current = 0;
+  int highwater = 0;
+  if (!handle || sqlite3_db_status(handle, SQLITE_DBSTATUS_CACHE_USED,
+                                   &current, &highwater, 0) != SQLITE_OK)
+    return 0;
+  return current;
+}
+} // namespace
+
+MemoryMonitor::MemoryMonitor(DatabaseManager *dbManager,
+                             InventoryModel *inventoryModel,
+                             SalesModel *salesModel, UserDashboard *dashboard,
+                             SessionCache *sessionCache, QObject *parent)
+    : QObject(parent), m_dbManager(dbManager),
+      m_inventoryModel(inventoryModel), m_salesModel(salesModel),
+      m_dashboard(dashboard), m_sessionCache(sessionCache) {
+  connect(&m_checkTimer, &QTimer::timeout, this, &MemoryMonitor::check);
+  setCheckInterval(DEFAULT_CHECK_INTERVAL_SECONDS);
+}
+
+QStringList MemoryMonitor::componentNames() {
+  return {"inventory", "sales", "dashboard", "sessionCache", "sqlite"};
+}
+
+bool MemoryMonitor::setBudget(const QString &component, qint64 bytes) {
+  if (!componentNames().contains(component))
+    return false;
+  bytes = qMax<qint64>(bytes, 0);
+  if (component == "sessionCache") {
+    // SessionCache already evicts by its own budget; no budget means its
+    // default.
+    if (!m_sessionCache)
+      return true;
+    if (bytes > 0)
+      m_sessionCache->setBudgetBytes(bytes);
+    return true;
+  }
+  if (component == "sqlite") {
+    // Set through the driver's SQLite or not at all.
+    if (!DatabaseManager::sqliteApiUsable())
+      return false;
+    // SQLite then recycles page cache before growing past the limit.
+    sqlite3_soft_heap_limit64(bytes);
+  }
+  if (bytes > 0)
+    m_budgets.insert(component, bytes);
+  else
+    m_budgets.remove(component);
+  return true;
+}
+
+qint64 MemoryMonitor::budget(const QString &component) const {
+  if (component == "sessionCache")
+    return m_sessionCache ? m_sessionCache->budgetBytes() : 0;
+  return m_budgets.value(component, 0);
+}
+
+void MemoryMonitor::setCheckInterval(int seconds) {
+  if (seconds > 0)
+    m_checkTimer.start(seconds * 1000);
+  else
+    m_checkTimer.stop();
+}
+
+void MemoryMonitor::setActiveView(const QString &view) {
+  // The sales view also lists the items to sell from.
+  if (view == "SalesView")
+    m_inUse = {"sales", "inventory"};
+  else if (view == "InventoryView")
+    m_inUse = {"inventory"};
+  else
+    m_inUse.clear();
+  // Leaving a view is when its rows become candidates for paging out.
+  check();
+}
+
+QVector<MemoryMonitor::Component> MemoryMonitor::measure() const {
+  QVector<Component> components;
+
+  Component inventory;
+  inventory.name = "inventory";
+  inventory.bytes = m_inventoryModel->memoryBytes();
+  inventory.items = m_inventoryModel->rowCount();
+  inventory.detail =
+      m_inventoryModel->isLoaded()
+          ? QString("search index %1")
+                .arg(formatBytes(m_inventoryModel->searchIndexBytes()))
+          : QString("not loaded");
+  components.append(inventory);
+
+  Component sales;
+  sales.name = "sales";
+  sales.bytes = m_salesModel->memoryBytes();
+  sales.items = m_salesModel->rowCount();
+  sales.detail = m_salesModel->isLoaded() ? QString() : QString("not loaded");
+  components.append(sales);
+
+  Component dashboard;
+  dashboard.name = "dashboard";
+  dashboard.bytes = m_dashboard->memoryBytes();
+  dashboard.items = m_dashboard->recentActivities().size() +
+                    m_dashboard->lowStockItemsList().size() +
+                    m_dashboard->monthlyProfitData().size();
+  dashboard.detail = QString("%1 low-stock entries")
+                         .arg(m_dashboard->lowStockItemsList().size());
+  components.append(dashboard);
+
+  if (m_sessionCache) {
+    Component cache;
+    cache.name = "sessionCache";
+    cache.bytes = m_sessionCache->residentBytes();
+    cache.items = m_sessionCache->entryCount();
+    cache.detail = QString("hit rate %1%")
+                       .arg(m_sessionCache->hitRate() * 100, 0, 'f', 0);
+    components.append(cache);
+  }
+
+  // Process-wide, so it covers every connection including worker ones.
+  Component sqlite;
+  sqlite.name = "sqlite";
+  QString reason;
+  if (!DatabaseManager::sqliteApiUsable(&reason)) {
+    // The linked library's counters would describe the wrong SQLite.
+    sqlite.detail = QString("not available: %1").arg(reason);
+    components.append(sqlite);
+    for (Component &component : components)
+      component.budgetBytes = budget(component.name);
+    return components;
+  }
+  sqlite3_int64 current = 0;
+  sqlite3_int64 highwater = 0;
+  sqlite3_status64(SQLITE_STATUS_MEMORY_USED, &current, &highwater, 0);
+  sqlite.bytes = current;
+  sqlite3_int64 overflow = 0;
+  sqlite3_int64 unused = 0;
+  sqlite3_status64(SQLITE_STATUS_PAGECACHE_OVERFLOW, &overflow, &unused, 0);
+  const qint64 mainCache = cacheUsed(m_dbManager->database());
+  const qint64 catalogCache =
+      m_dbManager->isSharded() ? cacheUsed(m_dbManager->catalogDatabase()) : 0;
+  sqlite.detail = QString("peak %1, page cache %2, main connection cache %3")
+                      .arg(formatBytes(highwater), formatBytes(overflow),
+                           formatBytes(mainCache + catalogCache));
+  components.append(sqlite);
+
+  for (Component &component : components)
+    component.budgetBytes = budget(component.name);
+  return components;
+}
+
+QVariantList MemoryMonitor::report() const {
+  QVariantList report;
+  for (const Component &component : m_last) {
+    QVariantMap entry;
+    entry["component"] = component.name;
+    entry["bytes"] = component.bytes;
+    entry["budgetBytes"] = component.budgetBytes;
+    entry["items"] = component.items;
+    entry["detail"] = component.detail;
+    report.append(entry);
+  }
+  return report;
+}
+
+qint64 MemoryMonitor::totalBytes() const {
+  qint64 total = 0;
+  for (const Component &component : m_last)
+    total += component.bytes;
+  return total;
+}
+
+QString MemoryMonitor::reportText() const {
+  const QVector<Component> components = measure();
+  QString text;
+  QTextStream out(&text);
+  out << "Memory by component (approximate)\n";
+  out << qSetFieldWidth(14) << Qt::left << "component" << Qt::right
+      << qSetFieldWidth(12) << "bytes" << "budget" << qSetFieldWidth(9)
+      << "items" << qSetFieldWidth(0) << "  detail\n";
+  qint64 total = 0;
+  for (const Component &component : components) {
+    out << qSetFieldWidth(14) << Qt::left << component.name << Qt::right
+        << qSetFieldWidth(12) << formatBytes(component.bytes)
+        << (component.budgetBytes > 0 ? formatBytes(component.budgetBytes)
+                                      : QString("-"))
+        << qSetFieldWidth(9) << component.items << qSetFieldWidth(0) << "  "
+        << component.detail << "\n";
+    total += component.bytes;
+  }
+  out << qSetFieldWidth(14) << Qt::left << "total" << Qt::right
+      << qSetFieldWidth(12) << formatBytes(total) << qSetFieldWidth(0)
+      << "\n";
+  out.flush();
+  return text;
+}
+
+void MemoryMonitor::refresh() {
+  m_last = measure();
+  emit reportChanged();
+}
+
+void MemoryMonitor::check() {
+  Tracer::Scope trace("memory", "MemoryMonitor::check");
+  m_last = measure();
+  bool changed = false;
+  for (const Component &component : m_last) {
+    if (component.budgetBytes > 0 && component.bytes > component.budgetBytes)
+      changed = enforce(component) || changed;
+  }
+  if (changed)
+    m_last = measure();
+  emit reportChanged();
+}
+
+bool MemoryMonitor::enforce(const Component &component) {
+  qDebug() << "Memory budget exceeded by" << component.name << ":"
+           << component.bytes << "of" << component.budgetBytes << "bytes";
+  if (component.name == "inventory") {
+    return !m_inUse.contains("inventory") && m_inventoryModel->releaseRows();
+  } else if (component.name == "sales") {
+    return !m_inUse.contains("sales") && m_salesModel->releaseRows();
+  } else if (component.name == "dashboard") {
+    return m_dashboard->trimLists(component.budgetBytes) > 0;
+  } else if (component.name == "sqlite") {
+    // The first only frees anything in SQLite builds with memory management
+    // enabled; shrink_memory always empties the given connection's cache.
+    if (DatabaseManager::sqliteApiUsable())
+      sqlite3_release_memory(int(qMin<qint64>(component.bytes - component.budgetBytes,
+                                              std::numeric_limits<int>::max())));
+    if (!m_dbManager->isReady())
+      return false;
+    QSqlQuery(m_dbManager->database()).exec("PRAGMA shrink_memory");
+    if (m_dbManager->isSharded())
+      QSqlQuery(m_dbManager->catalogDatabase()).exec("PRAGMA shrink_memory");
+    return true;
+  }
+  return false;
+}
@@ -0,0 +1,86 @@
+#ifndef MEMORYMONITOR_H
+#define MEMORYMONITOR_H
+
+#include <QHash>
+#include <QObject>
+#include <QSet>
+#include <QTimer>
+#include <QVariantList>
+#include <QVector>
+
+class DatabaseManager;
+class InventoryModel;
+class SalesModel;
+class SessionCache;
+class UserDashboard;
+
+// Where the memory goes, per subsystem: the inventory and sales rows, the
+// dashboard lists, SessionCache, and SQLite's own heap including the page
+// cache. The models are estimated from what they hold (see MemoryEstimate);
+// SQLite reports its allocations itself.
+//
+// Each component can be given a budget. check() runs periodically and when
+// the user switches views, and brings components back under budget: models
+// not on screen page their rows out, the dashboard trims its low-stock
+// list, and SQLite gives back cache memory. SessionCache and SQLite also
+// hold themselves to their budgets in between.
+class MemoryMonitor : public QObject
+{
+    Q_OBJECT
+    // One map per component: component, bytes, budgetBytes (0 for none),
+    // items and detail. As of the last check() or refresh().
+    Q_PROPERTY(QVariantList report READ report NOTIFY reportChanged)
+    Q_PROPERTY(qint64 totalBytes READ totalBytes NOTIFY reportChanged)
+
+public:
+    struct Component {
+        QString name;
+        qint64 bytes = 0;
+        qint64 budgetBytes = 0;
+        int items = 0; // rows, list entries or cache entries
+        QString detail;
+    };
+
+    // sessionCache may be null, e.g. in the daemon.
+    MemoryMonitor(DatabaseManager *dbManager, InventoryModel *inventoryModel, SalesModel *salesModel,
+                  UserDashboard *dashboard, SessionCache *sessionCache, QObject *parent = nullptr);
+
+    // "inventory", "sales", "dashboard", "sessionCache" and "sqlite".
+    static QStringList componentNames();
+    // 0 removes the budget. Returns false for an unknown component, and for
+    // "sqlite" when DatabaseManager::sqliteApiUsable() is false.
+    Q_INVOKABLE bool setBudget(const QString &component, qint64 bytes);
+    qint64 budget(const QString &component) const;
+    void setCheckInterval(int seconds);
+    // The view on screen; the models it shows are never paged out.
+    Q_INVOKABLE void setActiveView(const QString &view);
+
+    QVector<Component> measure() const;
+    QVariantList report() const;
+    qint64 totalBytes() const;
+    // measure() as a table, for the command line.
+    Q_INVOKABLE QString reportText() const;
+
+public slots:
+    // Measures without enforcing anything.
+    void refresh();
+    void check();
+
+signals:
+    void reportChanged();
+
+private:
+    DatabaseManager *m_dbManager;
+    InventoryModel *m_inventoryModel;
+    SalesModel *m_salesModel;
+    UserDashboard *m_dashboard;
+    SessionCache *m_sessionCache;
+    QHash<QString, qint64> m_budgets;
+    QSet<QString> m_inUse;
+    QVector<Component> m_last;
+    QTimer m_checkTimer;
+
+    bool enforce(const Component &component);
+};
+
+#endif // MEMORYMONITOR_H
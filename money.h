@@ -0,0 +1,37 @@
+#ifndef MONEY_H
+#define MONEY_H
+
+#include <QString>
+#include <QtGlobal>
+
+// Amounts of money are whole cents in a qint64 everywhere below QML: in the
+// database columns, in the models and in every total. Sums are then exact,
+// and the same whatever order the rows are added in. QML, the query service
+// and the export files keep working in currency units; convert only there.
+namespace Money {
+
+using Cents = qint64;
+
+inline Cents fromUnits(double units)
+{
+    return qRound64(units * 100.0);
+}
+
+inline double toUnits(Cents cents)
+{
+    return cents / 100.0;
+}
+
+// "-12.34", exact, for text formats.
+inline QString toString(Cents cents)
+{
+    const Cents magnitude = cents < 0 ? -cents : cents;
+    return QString("%1%2.%3")
+        .arg(cents < 0 ? "-" : "")
+        .arg(magnitude / 100)
+        .arg(magnitude % 100, 2, 10, QChar('0'));
+}
+
+} // namespace Money
+
+#endif // MONEY_H
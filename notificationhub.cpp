@@ -0,0 +1,293 @@
+#include "notificationhub.h"
+#include <QDebug>
+#include <algorithm>
+
+namespace {
+// One batch per frame at 60 Hz.
+const int FLUSH_INTERVAL_MS = 16;
+const int DEFAULT_CAPACITY = 200;
+const int DEFAULT_MAX_ALERTS = 50;
+const qint64 DEFAULT_WINDOW_MS = 60 * 1000;
+} // namespace
+
+NotificationHub::NotificationHub(InventoryModel *inventoryModel,
+                                 QObject *parent)
+    : QAbstractListModel(parent), m_inventoryModel(inventoryModel),
+      m_lowStockPending(false), m_capacity(DEFAULT_CAPACITY),
+      m_suppressedCount(0) {
+  for (RateLimit &limit : m_limits) {
+    limit.maxAlerts = DEFAULT_MAX_ALERTS;
+    limit.windowMs = DEFAULT_WINDOW_MS;
+    limit.used = 0;
+  }
+
+  m_flushTimer.setSingleShot(true);
+  m_flushTimer.setInterval(FLUSH_INTERVAL_MS);
+  connect(&m_flushTimer, &QTimer::timeout, this, &NotificationHub::flush);
+
+  connect(m_inventoryModel, &InventoryModel::itemNearExpiry, this,
+          &NotificationHub::postExpiry);
+  connect(m_inventoryModel, &InventoryModel::lowStockItemsChanged, this,
+          &NotificationHub::postLowStockItems);
+}
+
+int NotificationHub::rowCount(const QModelIndex &parent) const {
+  if (parent.isValid())
+    return 0;
+  return m_alerts.size();
+}
+
+QVariant NotificationHub::data(const QModelIndex &index, int role) const {
+  if (!index.isValid() || index.row() >= m_alerts.size())
+    return QVariant();
+
+  const Alert &alert = m_alerts.at(index.row());
+  switch (role) {
+  case TypeRole:
+    return alert.type == ExpiryAlert ? QStringLiteral("expiry")
+                                     : QStringLiteral("lowStock");
+  case ItemIdRole:
+    return alert.itemId;
+  case ItemNameRole:
+    return alert.itemName;
+  case DetailRole:
+    return alert.detail;
+  case MessageRole:
+    if (alert.type == ExpiryAlert) {
+      const QDate expiryDate = alert.detail.toDate();
+      const QString date = expiryDate.toString("yyyy-MM-dd");
+      return expiryDate < QDate::currentDate() ? tr("Expired %1").arg(date)
+                                               : tr("Expires %1").arg(date);
+    }
+    return tr("Quantity: %1").arg(alert.detail.toInt());
+  case RaisedAtRole:
+    return alert.raisedAt;
+  case RepeatsRole:
+    return alert.repeats;
+  default:
+    return QVariant();
+  }
+}
+
+QHash<int, QByteArray> NotificationHub::roleNames() const {
+  QHash<int, QByteArray> roles;
+  roles[TypeRole] = "type";
+  roles[ItemIdRole] = "itemId";
+  roles[ItemNameRole] = "itemName";
+  roles[DetailRole] = "detail";
+  roles[MessageRole] = "message";
+  roles[RaisedAtRole] = "raisedAt";
+  roles[RepeatsRole] = "repeats";
+  return roles;
+}
+
+int NotificationHub::count() const { return m_alerts.size(); }
+
+int NotificationHub::suppressedCount() const { return m_suppressedCount; }
+
+void NotificationHub::setCapacity(int capacity) {
+  m_capacity = qMax(1, capacity);
+  m_flushTimer.start();
+}
+
+void NotificationHub::setRateLimit(int type, int maxAlerts, int windowSeconds) {
+  if (type < 0 || type >= AlertTypeCount) {
+    qWarning() << "NotificationHub: unknown alert type" << type;
+    return;
+  }
+  RateLimit &limit = m_limits[type];
+  limit.maxAlerts = qMax(0, maxAlerts);
+  limit.windowMs = qMax(1, windowSeconds) * qint64(1000);
+  limit.window.invalidate();
+  limit.used = 0;
+}
+
+void NotificationHub::dismiss(int row) {
+  if (row < 0 || row >= m_alerts.size())
+    return;
+
+  const Alert &alert = m_alerts.at(row);
+  m_dismissed.insert(keyOf(alert.type, alert.itemId), alert.detail);
+  beginRemoveRows(QModelIndex(), row, row);
+  m_alerts.removeAt(row);
+  endRemoveRows();
+  rebuildIndex();
+  emit countChanged();
+}
+
+void NotificationHub::clear() {
+  m_flushTimer.stop();
+  m_pending.clear();
+  m_dismissed.clear();
+  m_lowStockIds.clear();
+  m_lowStockPending = false;
+
+  beginResetModel();
+  m_alerts.clear();
+  m_rowByKey.clear();
+  endResetModel();
+  emit countChanged();
+
+  if (m_suppressedCount != 0) {
+    m_suppressedCount = 0;
+    emit suppressedCountChanged();
+  }
+}
+
+void NotificationHub::postExpiry(int itemId, const QString &itemName,
+                                 const QDate &expiryDate) {
+  post({ExpiryAlert, itemId, itemName, expiryDate, QDateTime(), 0});
+}
+
+void NotificationHub::postLowStockItems() {
+  // The list is a complete picture, so anything still pending from an
+  // earlier report in this frame is superseded by it.
+  for (auto it = m_pending.begin(); it != m_pending.end();) {
+    if (it->type == LowStockAlert)
+      it = m_pending.erase(it);
+    else
+      ++it;
+  }
+
+  m_lowStockIds.clear();
+  const QVariantList items = m_inventoryModel->getLowStockItems();
+  for (const QVariant &value : items) {
+    const QVariantMap item = value.toMap();
+    const int itemId = item.value("id").toInt();
+    m_lowStockIds.insert(itemId);
+    post({LowStockAlert, itemId, item.value("name").toString(),
+          item.value("quantity").toInt(), QDateTime(), 0});
+  }
+  m_lowStockPending = true;
+  m_flushTimer.start();
+}
+
+void NotificationHub::post(const Alert &alert) {
+  m_pending.insert(keyOf(alert.type, alert.itemId), alert);
+  if (!m_flushTimer.isActive())
+    m_flushTimer.start();
+}
+
+void NotificationHub::flush() {
+  const int previousCount = m_alerts.size();
+  const int previousSuppressed = m_suppressedCount;
+
+  if (m_lowStockPending) {
+    removeResolvedLowStock();
+    m_lowStockPending = false;
+  }
+
+  const QDateTime now = QDateTime::currentDateTime();
+  QList<Alert> added;
+  int firstChanged = -1;
+  int lastChanged = -1;
+
+  for (auto it = m_pending.constBegin(); it != m_pending.constEnd(); ++it) {
+    Alert alert = it.value();
+
+    auto dismissed = m_dismissed.constFind(it.key());
+    if (dismissed != m_dismissed.constEnd()) {
+      if (dismissed.value() == alert.detail)
+        continue;
+      m_dismissed.erase(dismissed);
+    }
+
+    auto existing = m_rowByKey.constFind(it.key());
+    if (existing != m_rowByKey.constEnd()) {
+      const int row = existing.value();
+      Alert &current = m_alerts[row];
+      if (current.detail != alert.detail)
+        current.raisedAt = now;
+      current.itemName = alert.itemName;
+      current.detail = alert.detail;
+      ++current.repeats;
+      firstChanged = firstChanged == -1 ? row : qMin(firstChanged, row);
+      lastChanged = qMax(lastChanged, row);
+      continue;
+    }
+
+    if (!takeRateToken(alert.type)) {
+      ++m_suppressedCount;
+      continue;
+    }
+    alert.raisedAt = now;
+    added.append(alert);
+  }
+  m_pending.clear();
+
+  if (firstChanged != -1)
+    emit dataChanged(index(firstChanged), index(lastChanged));
+
+  if (!added.isEmpty()) {
+    std::sort(added.begin(), added.end(), [](const Alert &a, const Alert &b) {
+      return a.type != b.type ? a.type < b.type : a.itemName < b.itemName;
+    });
+    if (added.size() > m_capacity)
+      added.erase(added.begin() + m_capacity, added.end());
+
+    beginInsertRows(QModelIndex(), 0, added.size() - 1);
+    m_alerts = added + m_alerts;
+    endInsertRows();
+  }
+
+  // The oldest alerts make room for new ones.
+  if (m_alerts.size() > m_capacity) {
+    beginRemoveRows(QModelIndex(), m_capacity, m_alerts.size() - 1);
+    m_alerts.erase(m_alerts.begin() + m_capacity, m_alerts.end());
+    endRemoveRows();
+  }
+
+  rebuildIndex();
+
+  if (m_alerts.size() != previousCount)
+    emit countChanged();
+  if (m_suppressedCount != previousSuppressed)
+    emit suppressedCountChanged();
+  if (!added.isEmpty())
+    emit alertsRaised(added.size());
+}
+
+quint64 NotificationHub::keyOf(AlertType type, int itemId) {
+  return (quint64(type) << 32) | quint32(itemId);
+}
+
+bool NotificationHub::takeRateToken(AlertType type) {
+  RateLimit &limit = m_limits[type];
+  if (!limit.window.isValid() || limit.window.elapsed() >= limit.windowMs) {
+    limit.window.start();
+    limit.used = 0;
+  }
+  if (limit.used >= limit.maxAlerts)
+    return false;
+  ++limit.used;
+  return true;
+}
+
+void NotificationHub::removeResolvedLowStock() {
+  for (int row = m_alerts.size() - 1; row >= 0; --row) {
+    const Alert &alert = m_alerts.at(row);
+    if (alert.type != LowStockAlert || m_lowStockIds.contains(alert.itemId))
+      continue;
+    beginRemoveRows(QModelIndex(), row, row);
+    m_alerts.removeAt(row);
+    endRemoveRows();
+  }
+
+  // A dismissal only lasts while the item stays low.
+  for (auto it = m_dismissed.begin(); it != m_dismissed.end();) {
+    const bool lowStock = (it.key() >> 32) == quint64(LowStockAlert);
+    if (lowStock && !m_lowStockIds.contains(int(quint32(it.key()))))
+      it = m_dismissed.erase(it);
+    else
+      ++it;
+  }
+  rebuildIndex();
+}
+
+void NotificationHub::rebuildIndex() {
+  m_rowByKey.clear();
+  for (int row = 0; row < m_alerts.size(); ++row) {
+    const Alert &alert = m_alerts.at(row);
+    m_rowByKey.insert(keyOf(alert.type, alert.itemId), row);
+  }
+}
@@ -0,0 +1,107 @@
+#ifndef NOTIFICATIONHUB_H
+#define NOTIFICATIONHUB_H
+
+#include <QAbstractListModel>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QSet>
+#include <QTimer>
+#include "inventorymodel.h"
+
+// Collects expiry and low-stock alerts from InventoryModel and presents them
+// to QML as one bounded list. Alerts are keyed by (type, item), so a refresh
+// that reports the same items again only updates existing rows. Everything
+// posted within a frame is applied in a single batch, and each alert type has
+// its own limit on how many new rows it may add per time window.
+class NotificationHub : public QAbstractListModel
+{
+    Q_OBJECT
+    Q_PROPERTY(int count READ count NOTIFY countChanged)
+    Q_PROPERTY(int suppressedCount READ suppressedCount NOTIFY suppressedCountChanged)
+
+public:
+    enum AlertType {
+        ExpiryAlert,
+        LowStockAlert,
+        AlertTypeCount
+    };
+    Q_ENUM(AlertType)
+
+    enum Roles {
+        TypeRole = Qt::UserRole + 1,
+        ItemIdRole,
+        ItemNameRole,
+        DetailRole,
+        MessageRole,
+        RaisedAtRole,
+        RepeatsRole
+    };
+
+    explicit NotificationHub(InventoryModel *inventoryModel, QObject *parent = nullptr);
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+    QHash<int, QByteArray> roleNames() const override;
+
+    int count() const;
+    int suppressedCount() const;
+
+    void setCapacity(int capacity);
+    // At most maxAlerts new rows of this type per windowSeconds; alerts over
+    // the limit are counted in suppressedCount and dropped.
+    Q_INVOKABLE void setRateLimit(int type, int maxAlerts, int windowSeconds);
+    // Hides the alert until its detail (expiry date, quantity) changes.
+    Q_INVOKABLE void dismiss(int row);
+    Q_INVOKABLE void clear();
+
+public slots:
+    void postExpiry(int itemId, const QString &itemName, const QDate &expiryDate);
+    void postLowStockItems();
+
+signals:
+    void countChanged();
+    void suppressedCountChanged();
+    // Emitted once per flushed batch that added rows.
+    void alertsRaised(int newAlerts);
+
+private slots:
+    void flush();
+
+private:
+    struct Alert {
+        AlertType type;
+        int itemId;
+        QString itemName;
+        QVariant detail;
+        QDateTime raisedAt;
+        int repeats;
+    };
+
+    struct RateLimit {
+        int maxAlerts;
+        qint64 windowMs;
+        QElapsedTimer window;
+        int used;
+    };
+
+    InventoryModel *m_inventoryModel;
+    QList<Alert> m_alerts; // newest first
+    QHash<quint64, int> m_rowByKey;
+    QHash<quint64, Alert> m_pending;
+    QHash<quint64, QVariant> m_dismissed;
+    QSet<int> m_lowStockIds;
+    bool m_lowStockPending;
+    RateLimit m_limits[AlertTypeCount];
+    int m_capacity;
+    int m_suppressedCount;
+    QTimer m_flushTimer;
+
+    static quint64 keyOf(AlertType type, int itemId);
+    void post(const Alert &alert);
+    bool takeRateToken(AlertType type);
+    void removeResolvedLowStock();
+    void rebuildIndex();
+};
+
+#endif // NOTIFICATIONHUB_H
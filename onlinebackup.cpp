@@ -0,0 +1,331 @@
+#include "onlinebackup.h"
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QThread>
+#include <QtConcurrent>
+#include <sqlite3.h>
+
+namespace {
+const char SNAPSHOT_PREFIX[] = "BIMS3-";
+const char SNAPSHOT_SUFFIX[] = ".db";
+
+QString sqliteError(sqlite3 *db) {
+  return db ? QString::fromUtf8(sqlite3_errmsg(db))
+            : QStringLiteral("out of memory");
+}
+
+bool isWalMode(sqlite3 *db) {
+  sqlite3_stmt *stmt = nullptr;
+  bool wal = false;
+  if (sqlite3_prepare_v2(db, "PRAGMA journal_mode", -1, &stmt, nullptr) ==
+          SQLITE_OK &&
+      sqlite3_step(stmt) == SQLITE_ROW) {
+    wal = qstricmp(reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0)),
+                   "wal") == 0;
+  }
+  sqlite3_finalize(stmt);
+  return wal;
+}
+
+bool verifyIntegrity(const QString &path, QString *error) {
+  sqlite3 *db = nullptr;
+  if (sqlite3_open_v2(path.toUtf8().constData(), &db, SQLITE_OPEN_READONLY,
+                      nullptr) != SQLITE_OK) {
+    *error = sqliteError(db);
+    sqlite3_close(db);
+    return false;
+  }
+
+  sqlite3_stmt *stmt = nullptr;
+  bool ok = false;
+  if (sqlite3_prepare_v2(db, "PRAGMA integrity_check", -1, &stmt, nullptr) ==
+      SQLITE_OK) {
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+      const QString verdict = QString::fromUtf8(
+          reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0)));
+      ok = verdict == "ok";
+      if (!ok)
+        *error = QObject::tr("Integrity check failed: %1").arg(verdict);
+    }
+  } else {
+    *error = sqliteError(db);
+  }
+  sqlite3_finalize(stmt);
+  sqlite3_close(db);
+  return ok;
+}
+} // namespace
+
+OnlineBackup::OnlineBackup(QObject *parent)
+    : QObject(parent), m_cancelled(false), m_retainCount(0),
+      m_scheduledRun(false) {
+  connect(&m_watcher, &QFutureWatcher<Result>::finished, this,
+          &OnlineBackup::onFinished);
+  connect(&m_scheduleTimer, &QTimer::timeout, this,
+          &OnlineBackup::takeScheduledSnapshot);
+}
+
+OnlineBackup::~OnlineBackup() {
+  m_cancelled = true;
+  m_watcher.waitForFinished();
+}
+
+void OnlineBackup::setSourcePath(const QString &path) { m_sourcePath = path; }
+
+void OnlineBackup::setScheduledSources(const SourceList &sources) {
+  m_scheduledSources = sources;
+}
+
+void OnlineBackup::setOptions(const Options &options) { m_options = options; }
+
+bool OnlineBackup::start(const QString &filePath) {
+  return launch({qMakePair(m_sourcePath, filePath)});
+}
+
+bool OnlineBackup::launch(const QVector<QPair<QString, QString>> &copies) {
+  if (m_watcher.isRunning() || copies.isEmpty())
+    return false;
+
+  m_cancelled = false;
+  const Options options = m_options;
+  m_watcher.setFuture(QtConcurrent::run([this, copies, options]() {
+    const ProgressCallback report = [this](int remaining, int pageCount) {
+      emit progress(remaining, pageCount);
+    };
+    if (copies.size() == 1)
+      return run(copies.first().first, copies.first().second, options,
+                 m_cancelled, report);
+
+    // Several files: one result covering all of them.
+    Result total;
+    total.ok = true;
+    total.verified = true;
+    for (const auto &copy : copies) {
+      const Result result =
+          run(copy.first, copy.second, options, m_cancelled, report);
+      total.ok = total.ok && result.ok;
+      total.cancelled = total.cancelled || result.cancelled;
+      total.verified = total.verified && result.verified;
+      total.pageCount += result.pageCount;
+      total.restarts += result.restarts;
+      total.backoffs += result.backoffs;
+      total.elapsedMs += result.elapsedMs;
+      total.filePath = result.filePath;
+      if (!result.ok && !result.error.isEmpty() && total.error.isEmpty())
+        total.error = QString("%1: %2").arg(
+            QFileInfo(copy.first).fileName(), result.error);
+      if (result.cancelled)
+        break;
+    }
+    return total;
+  }));
+  return true;
+}
+
+void OnlineBackup::cancel() { m_cancelled = true; }
+
+bool OnlineBackup::isRunning() const { return m_watcher.isRunning(); }
+
+void OnlineBackup::schedule(const QString &directory, int intervalMinutes,
+                            int retainCount) {
+  m_scheduleTimer.stop();
+  m_scheduleDirectory = directory;
+  m_retainCount = retainCount;
+  if (intervalMinutes <= 0)
+    return;
+
+  QDir().mkpath(directory);
+  m_scheduleTimer.start(intervalMinutes * 60 * 1000);
+}
+
+void OnlineBackup::takeScheduledSnapshot() {
+  const QString name =
+      SNAPSHOT_PREFIX +
+      QDateTime::currentDateTime().toString("yyyyMMdd-HHmmss") +
+      SNAPSHOT_SUFFIX;
+  const QStringList sources =
+      m_scheduledSources ? m_scheduledSources() : QStringList{m_sourcePath};
+
+  QVector<QPair<QString, QString>> copies;
+  QStringList directories;
+  for (const QString &source : sources) {
+    // Retention counts snapshots per directory, so files never share one.
+    const QString directory =
+        sources.size() == 1
+            ? m_scheduleDirectory
+            : QDir(m_scheduleDirectory)
+                  .filePath(QFileInfo(source).completeBaseName());
+    QDir().mkpath(directory);
+    copies.append(qMakePair(source, QDir(directory).filePath(name)));
+    directories.append(directory);
+  }
+
+  if (launch(copies)) {
+    m_scheduledRun = true;
+    m_snapshotDirectories = directories;
+  } else if (m_watcher.isRunning()) {
+    qWarning() << "Skipping scheduled backup; previous backup still running";
+  }
+}
+
+void OnlineBackup::onFinished() {
+  const Result result = m_watcher.future().result();
+  const bool scheduledRun = m_scheduledRun;
+  m_scheduledRun = false;
+
+  QString error = result.error;
+  if (result.cancelled)
+    error = tr("Backup cancelled");
+  qDebug() << "Backup finished:" << result.filePath << "ok:" << result.ok
+           << "pages:" << result.pageCount << "restarts:" << result.restarts
+           << "backoffs:" << result.backoffs
+           << "elapsed (ms):" << result.elapsedMs;
+
+  if (result.ok && scheduledRun) {
+    for (const QString &directory : m_snapshotDirectories)
+      applyRetention(directory);
+  }
+  emit finished(result.ok, result.filePath, error);
+}
+
+void OnlineBackup::applyRetention(const QString &directory) {
+  if (m_retainCount <= 0)
+    return;
+
+  QDir dir(directory);
+  // The timestamped names sort chronologically.
+  const QStringList snapshots = dir.entryList(
+      {QString(SNAPSHOT_PREFIX) + "*" + SNAPSHOT_SUFFIX}, QDir::Files,
+      QDir::Name | QDir::Reversed);
+  for (int i = m_retainCount; i < snapshots.size(); ++i) {
+    if (!dir.remove(snapshots.at(i)))
+      qWarning() << "Failed to remove old backup" << snapshots.at(i);
+  }
+}
+
+OnlineBackup::Result OnlineBackup::run(const QString &sourcePath,
+                                       const QString &filePath,
+                                       const Options &options,
+                                       const std::atomic_bool &cancelled,
+                                       const ProgressCallback &progress) {
+  Result result;
+  result.filePath = filePath;
+  QElapsedTimer timer;
+  timer.start();
+
+  const QString partPath = filePath + ".part";
+  QFile::remove(partPath);
+
+  sqlite3 *source = nullptr;
+  sqlite3 *target = nullptr;
+  if (sqlite3_open_v2(sourcePath.toUtf8().constData(), &source,
+                      SQLITE_OPEN_READONLY, nullptr) != SQLITE_OK) {
+    result.error = sqliteError(source);
+    sqlite3_close(source);
+    return result;
+  }
+  if (sqlite3_open_v2(partPath.toUtf8().constData(), &target,
+                      SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE,
+                      nullptr) != SQLITE_OK) {
+    result.error = sqliteError(target);
+    sqlite3_close(target);
+    sqlite3_close(source);
+    return result;
+  }
+
+  const bool wal = isWalMode(source);
+  sqlite3_backup *backup =
+      sqlite3_backup_init(target, "main", source, "main");
+  if (!backup) {
+    result.error = sqliteError(target);
+    sqlite3_close(target);
+    sqlite3_close(source);
+    return result;
+  }
+
+  int rc = SQLITE_OK;
+  int lastRemaining = -1;
+  int restartsSinceBackoff = 0;
+  int backoffMs = options.restartBackoffMs;
+  while (true) {
+    if (cancelled) {
+      result.cancelled = true;
+      break;
+    }
+
+    const bool singlePass = wal && restartsSinceBackoff >= options.maxRestarts;
+    rc = sqlite3_backup_step(backup, singlePass ? -1 : options.pagesPerStep);
+
+    const int remaining = sqlite3_backup_remaining(backup);
+    result.pageCount = sqlite3_backup_pagecount(backup);
+    // A write from another connection makes the next step start over.
+    if (lastRemaining != -1 && remaining > lastRemaining) {
+      ++result.restarts;
+      ++restartsSinceBackoff;
+    }
+    lastRemaining = remaining;
+    if (progress)
+      progress(remaining, result.pageCount);
+
+    if (rc == SQLITE_DONE)
+      break;
+    if (rc == SQLITE_OK && !wal &&
+        restartsSinceBackoff >= options.maxRestarts) {
+      // Writers keep getting in first. Leave them the file for a while
+      // rather than locking them out, and say that the copy is slow.
+      ++result.backoffs;
+      qWarning() << "Backup of" << sourcePath << "keeps restarting under"
+                 << "writes;" << remaining << "of" << result.pageCount
+                 << "pages left, pausing" << backoffMs << "ms";
+      QElapsedTimer pause;
+      pause.start();
+      while (!cancelled && pause.elapsed() < backoffMs)
+        QThread::msleep(100);
+      backoffMs = qMin(backoffMs * 2, options.maxBackoffMs);
+      restartsSinceBackoff = 0;
+    } else if (rc == SQLITE_OK) {
+      QThread::msleep(options.pauseMs);
+    } else if (rc == SQLITE_BUSY || rc == SQLITE_LOCKED) {
+      QThread::msleep(options.busyRetryMs);
+    } else {
+      break;
+    }
+  }
+
+  sqlite3_backup_finish(backup);
+  if (rc != SQLITE_DONE && !result.cancelled)
+    result.error = sqliteError(target);
+  sqlite3_close(target);
+  sqlite3_close(source);
+
+  if (rc != SQLITE_DONE) {
+    QFile::remove(partPath);
+    result.elapsedMs = timer.elapsed();
+    return result;
+  }
+
+  if (options.verify) {
+    if (!verifyIntegrity(partPath, &result.error)) {
+      QFile::remove(partPath);
+      result.elapsedMs = timer.elapsed();
+      return result;
+    }
+    result.verified = true;
+  }
+
+  QFile::remove(filePath);
+  if (!QFile::rename(partPath, filePath)) {
+    result.error = QObject::tr("Failed to move backup into place: %1")
+                       .arg(filePath);
+    result.elapsedMs = timer.elapsed();
+    return result;
+  }
+
+  result.ok = true;
+  result.elapsedMs = timer.elapsed();
+  return result;
+}
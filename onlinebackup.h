@@ -0,0 +1,103 @@
+#ifndef ONLINEBACKUP_H
+#define ONLINEBACKUP_H
+
+#include <QFutureWatcher>
+#include <QObject>
+#include <QPair>
+#include <QStringList>
+#include <QTimer>
+#include <QVector>
+#include <atomic>
+#include <functional>
+
+// Copies a live database with the SQLite online backup API on a worker
+// thread. Pages are copied in small steps with a pause between them so that
+// writers on other connections get the lock back between steps; the copy is
+// written beside the destination, checked with PRAGMA integrity_check and
+// only then renamed into place.
+class OnlineBackup : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Options {
+        int pagesPerStep = 64;
+        int pauseMs = 5;
+        int busyRetryMs = 25;
+        // After this many restarts caused by concurrent writes, a WAL-mode
+        // source is copied in a single read transaction instead; readers do
+        // not block writers in WAL mode, so checkout is unaffected. With a
+        // rollback journal one long read lock would hold off every writer,
+        // so the copy keeps to pagesPerStep and backs off instead: it waits
+        // restartBackoffMs, doubling up to maxBackoffMs, and then gets
+        // maxRestarts more tries.
+        int maxRestarts = 3;
+        int restartBackoffMs = 1000;
+        int maxBackoffMs = 30000;
+        bool verify = true;
+    };
+
+    struct Result {
+        bool ok = false;
+        bool cancelled = false;
+        bool verified = false;
+        int pageCount = 0;
+        int restarts = 0;
+        int backoffs = 0; // pauses for writers, rollback journal only
+        qint64 elapsedMs = 0;
+        QString filePath;
+        QString error;
+    };
+
+    using ProgressCallback = std::function<void(int remaining, int pageCount)>;
+    using SourceList = std::function<QStringList()>;
+
+    explicit OnlineBackup(QObject *parent = nullptr);
+    ~OnlineBackup();
+
+    void setSourcePath(const QString &path);
+    // The files scheduled snapshots copy, asked for again at every snapshot;
+    // the source path alone when not set. With more than one, each file's
+    // snapshots go into a subdirectory named after it and are retained
+    // separately.
+    void setScheduledSources(const SourceList &sources);
+    void setOptions(const Options &options);
+
+    // Copies the source path to filePath.
+    bool start(const QString &filePath);
+    void cancel();
+    bool isRunning() const;
+
+    // Takes a snapshot into directory every intervalMinutes, keeping only the
+    // newest retainCount files. An interval of 0 stops the schedule.
+    void schedule(const QString &directory, int intervalMinutes, int retainCount);
+
+    static Result run(const QString &sourcePath, const QString &filePath, const Options &options,
+                      const std::atomic_bool &cancelled, const ProgressCallback &progress);
+
+signals:
+    void progress(int remaining, int pageCount);
+    void finished(bool ok, const QString &filePath, const QString &error);
+
+private slots:
+    void onFinished();
+    void takeScheduledSnapshot();
+
+private:
+    QString m_sourcePath;
+    SourceList m_scheduledSources;
+    Options m_options;
+    QFutureWatcher<Result> m_watcher;
+    std::atomic_bool m_cancelled;
+    QTimer m_scheduleTimer;
+    QString m_scheduleDirectory;
+    QStringList m_snapshotDirectories; // of the scheduled run in progress
+    int m_retainCount;
+    bool m_scheduledRun;
+
+    // Runs the (source, destination) copies one after another on a worker.
+    bool launch(const QVector<QPair<QString, QString>> &copies);
+    void applyRetention(const QString &directory);
+};
+
+#endif // ONLINEBACKUP_H
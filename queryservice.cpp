@@ -0,0 +1,285 @@
+#include "queryservice.h"
+#include <QDebug>
+#include <QDir>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QJsonParseError>
+#include <QSet>
+#include "memorymonitor.h"
+#include "tracer.h"
+
+QueryService::QueryService(InventoryModel *inventoryModel,
+                           SalesModel *salesModel, UserDashboard *dashboard,
+                           QObject *parent)
+    : QObject(parent), m_inventoryModel(inventoryModel),
+      m_salesModel(salesModel), m_dashboard(dashboard), m_memoryMonitor(nullptr),
+      m_userId(-1) {
+  connect(&m_server, &QLocalServer::newConnection, this,
+          &QueryService::acceptConnections);
+
+  auto toArray = [](const QList<int> &ids) {
+    QJsonArray array;
+    for (int id : ids)
+      array.append(id);
+    return array;
+  };
+  connect(m_inventoryModel, &InventoryModel::itemsChanged, this,
+          [this, toArray](const QList<int> &upserted,
+                          const QList<int> &deleted) {
+            publish({{"event", "inventory"},
+                     {"upserted", toArray(upserted)},
+                     {"deleted", toArray(deleted)}});
+          });
+  connect(m_salesModel, &SalesModel::salesChanged, this,
+          [this, toArray](const QList<int> &upserted,
+                          const QList<int> &deleted) {
+            publish({{"event", "sales"},
+                     {"upserted", toArray(upserted)},
+                     {"deleted", toArray(deleted)}});
+          });
+}
+
+QueryService::~QueryService() { close(); }
+
+bool QueryService::listen(const QString &name, QString *error) {
+  close();
+  QLocalServer::removeServer(name);
+  m_server.setSocketOptions(QLocalServer::UserAccessOption);
+  if (!m_server.listen(name)) {
+    if (error)
+      *error = m_server.errorString();
+    return false;
+  }
+  qDebug() << "Query service listening on" << m_server.fullServerName();
+  return true;
+}
+
+void QueryService::close() {
+  m_server.close();
+  const QList<QLocalSocket *> sockets = m_clients.keys();
+  m_clients.clear();
+  for (QLocalSocket *socket : sockets) {
+    socket->disconnect(this);
+    socket->abort();
+    socket->deleteLater();
+  }
+  if (!sockets.isEmpty())
+    emit clientCountChanged();
+}
+
+void QueryService::setUserId(int userId) {
+  if (m_userId == userId)
+    return;
+  m_userId = userId;
+  publish({{"event", "reset"}, {"signedIn", userId != -1}});
+}
+
+int QueryService::clientCount() const { return m_clients.size(); }
+
+void QueryService::setMemoryMonitor(MemoryMonitor *memoryMonitor) {
+  m_memoryMonitor = memoryMonitor;
+}
+
+void QueryService::acceptConnections() {
+  while (QLocalSocket *socket = m_server.nextPendingConnection()) {
+    m_clients.insert(socket, Client());
+    connect(socket, &QLocalSocket::readyRead, this,
+            [this, socket]() { readRequests(socket); });
+    connect(socket, &QLocalSocket::disconnected, this, [this, socket]() {
+      m_clients.remove(socket);
+      socket->deleteLater();
+      emit clientCountChanged();
+    });
+    emit clientCountChanged();
+  }
+}
+
+void QueryService::readRequests(QLocalSocket *socket) {
+  auto it = m_clients.find(socket);
+  if (it == m_clients.end())
+    return;
+
+  it->buffer.append(socket->readAll());
+  int start = 0;
+  int end;
+  while ((end = it->buffer.indexOf('\n', start)) != -1) {
+    const QByteArray line = it->buffer.mid(start, end - start).trimmed();
+    start = end + 1;
+    if (line.isEmpty())
+      continue;
+
+    QJsonParseError parseError;
+    const QJsonDocument document = QJsonDocument::fromJson(line, &parseError);
+    if (!document.isObject()) {
+      send(socket, {{"ok", false},
+                    {"error", parseError.error != QJsonParseError::NoError
+                                  ? parseError.errorString()
+                                  : QString("Request is not an object")}});
+      continue;
+    }
+
+    // A failed write can disconnect the client while it is being served.
+    send(socket, handle(socket, document.object()));
+    it = m_clients.find(socket);
+    if (it == m_clients.end())
+      return;
+  }
+  it->buffer.remove(0, start);
+
+  if (it->buffer.size() > MAX_REQUEST_BYTES) {
+    qWarning() << "Query service: dropping client with an oversized request";
+    send(socket, {{"ok", false}, {"error", "Request too large"}});
+    socket->disconnectFromServer();
+  }
+}
+
+QJsonObject QueryService::handle(QLocalSocket *socket,
+                                 const QJsonObject &request) {
+  QJsonObject response;
+  if (request.contains("seq"))
+    response.insert("seq", request.value("seq"));
+
+  QString error;
+  QJsonValue result;
+  const QString op = request.value("op").toString();
+  // SKU lookups, fuzzy search and stock levels are answered from the
+  // inventory model's rows and indexes, which are only built once it loads.
+  // Other operations leave an unloaded model unloaded.
+  static const QSet<QString> inventoryOps = {"item", "search", "stock",
+                                             "adjust"};
+  if (m_userId != -1 && inventoryOps.contains(op))
+    m_inventoryModel->ensureLoaded();
+
+  if (op == "subscribe" || op == "unsubscribe") {
+    m_clients[socket].subscribed = op == "subscribe";
+    result = true;
+  } else if (op == "traceStart") {
+    Tracer::start();
+    result = true;
+  } else if (op == "traceStop") {
+    // Clients name the file only; it always goes to the temporary
+    // directory, so a request cannot overwrite files elsewhere.
+    const QString fileName = request.value("file").toString();
+    if (fileName.isEmpty()) {
+      error = "traceStop needs a file";
+    } else if (QFileInfo(fileName).fileName() != fileName ||
+               fileName.startsWith('.') || fileName.contains('\\')) {
+      error = QString("traceStop takes a file name, not a path: %1")
+                  .arg(fileName);
+    } else {
+      const QString filePath = QDir::temp().filePath(fileName);
+      if (Tracer::writeChromeTrace(filePath, &error))
+        result = filePath;
+    }
+  } else if (op == "memory") {
+    if (!m_memoryMonitor) {
+      error = "Memory accounting is not available";
+    } else {
+      if (request.value("check").toBool())
+        m_memoryMonitor->check();
+      else
+        m_memoryMonitor->refresh();
+      result = QJsonArray::fromVariantList(m_memoryMonitor->report());
+    }
+  } else if (m_userId == -1) {
+    error = "No user is signed in";
+  } else if (op == "item") {
+    int id = request.value("id").toInt(-1);
+    if (request.contains("sku")) {
+      id = m_inventoryModel->itemIdForSku(request.value("sku").toString());
+      if (id == -1)
+        error = QString("Unknown SKU: %1").arg(request.value("sku").toString());
+    }
+    if (error.isEmpty()) {
+      const QVariantMap record = m_inventoryModel->itemRecord(id);
+      if (record.isEmpty())
+        error = QString("Unknown item: %1").arg(id);
+      else
+        result = QJsonObject::fromVariantMap(record);
+    }
+  } else if (op == "search") {
+    result = QJsonArray::fromVariantList(m_inventoryModel->fuzzySearch(
+        request.value("text").toString(), request.value("limit").toInt(10)));
+  } else if (op == "stock") {
+    result = stockLevels(request, &error);
+  } else if (op == "lowStock") {
+    result = QJsonArray::fromVariantList(m_inventoryModel->getLowStockItems());
+  } else if (op == "dashboard") {
+    result = dashboardAggregates(request.value("recalculate").toBool());
+  } else if (op == "adjust") {
+    const QVariantList adjustments =
+        request.value("adjustments").toArray().toVariantList();
+    if (m_inventoryModel->adjustQuantities(adjustments, &error))
+      result = QJsonObject{{"adjusted", adjustments.size()}};
+  } else {
+    error = QString("Unknown operation: %1").arg(op);
+  }
+
+  response.insert("ok", error.isEmpty());
+  if (error.isEmpty())
+    response.insert("result", result);
+  else
+    response.insert("error", error);
+  return response;
+}
+
+QJsonArray QueryService::stockLevels(const QJsonObject &request,
+                                     QString *error) const {
+  QList<int> ids;
+  for (const QJsonValue &id : request.value("ids").toArray())
+    ids.append(id.toInt(-1));
+  for (const QJsonValue &sku : request.value("skus").toArray()) {
+    const int id = m_inventoryModel->itemIdForSku(sku.toString());
+    if (id == -1) {
+      *error = QString("Unknown SKU: %1").arg(sku.toString());
+      return QJsonArray();
+    }
+    ids.append(id);
+  }
+
+  QJsonArray levels;
+  for (int id : ids) {
+    const QVariantMap record = m_inventoryModel->itemRecord(id);
+    if (record.isEmpty()) {
+      *error = QString("Unknown item: %1").arg(id);
+      return QJsonArray();
+    }
+    levels.append(QJsonObject{{"id", id},
+                              {"sku", record.value("sku").toString()},
+                              {"quantity", record.value("quantity").toInt()},
+                              {"lowStock", record.value("lowStock").toBool()}});
+  }
+  return levels;
+}
+
+QJsonObject QueryService::dashboardAggregates(bool recalculate) {
+  // The headline figures come from UserKpis through the dashboard, which
+  // rereads them on every change, so neither model has to be loaded; the
+  // lists and charts are as of its last calculation.
+  if (recalculate)
+    m_dashboard->recalculate();
+  return {
+      {"totalInventoryValue", m_dashboard->totalInventoryValue()},
+      {"lowStockItems", m_dashboard->lowStockItems()},
+      {"totalSales", m_dashboard->totalSales()},
+      {"totalRevenue", m_dashboard->totalRevenue()},
+      {"totalInventoryItems", m_dashboard->totalInventoryItems()},
+      {"grossProfit", m_dashboard->grossProfit()},
+      {"profitMargin", m_dashboard->profitMargin()},
+      {"expiringItems", m_dashboard->expiringItems()},
+      {"monthlyProfitData",
+       QJsonArray::fromVariantList(m_dashboard->monthlyProfitData())},
+  };
+}
+
+void QueryService::publish(const QJsonObject &event) {
+  for (auto it = m_clients.constBegin(); it != m_clients.constEnd(); ++it) {
+    if (it->subscribed)
+      send(it.key(), event);
+  }
+}
+
+void QueryService::send(QLocalSocket *socket, const QJsonObject &message) {
+  socket->write(QJsonDocument(message).toJson(QJsonDocument::Compact));
+  socket->write("\n");
+}
@@ -0,0 +1,94 @@
+#ifndef QUERYSERVICE_H
+#define QUERYSERVICE_H
+
+#include <QHash>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QObject>
+#include "inventorymodel.h"
+#include "salesmodel.h"
+#include "userdashboard.h"
+
+class MemoryMonitor;
+
+// Answers label printers, report scripts and other local tools from the
+// models this process already has loaded, so they neither read the database
+// cold nor take write locks of their own: every write they ask for goes
+// through the same connection as the GUI's.
+//
+// Protocol: one JSON object per line in each direction. A request carries
+// "op" and an optional "seq" that the response echoes:
+//
+//     {"seq": 1, "op": "item", "sku": "4006381333931"}
+//     {"seq": 1, "ok": true, "result": {"id": 12, "quantity": 40, ...}}
+//     {"seq": 2, "ok": false, "error": "Unknown SKU: 123"}
+//
+// Operations:
+//   item       {"id"} or {"sku"}            one item record
+//   search     {"text", "limit"}            fuzzy matches, best first
+//   stock      {"ids"} and/or {"skus"}      [{id, sku, quantity, lowStock}]
+//   lowStock                                items at or below reorder point
+//   dashboard  {"recalculate": bool}        dashboard aggregates
+//   adjust     {"adjustments": [{"id", "delta"}]}  all-or-nothing
+//   subscribe / unsubscribe                 change events on this socket
+//   traceStart                              start recording a Tracer trace
+//   traceStop  {"file"}                     stop and write it as Chrome JSON
+//                                           to file in the temporary directory
+//   memory     {"check": bool}              bytes per component (MemoryMonitor),
+//                                           enforcing budgets first if check
+//
+// Subscribed clients receive {"event": "inventory" | "sales", "upserted": [...],
+// "deleted": [...]} for every change the models apply, and {"event": "reset"}
+// when the signed-in user changes.
+class QueryService : public QObject
+{
+    Q_OBJECT
+    Q_PROPERTY(int clientCount READ clientCount NOTIFY clientCountChanged)
+
+public:
+    QueryService(InventoryModel *inventoryModel, SalesModel *salesModel, UserDashboard *dashboard,
+                 QObject *parent = nullptr);
+    ~QueryService() override;
+
+    // Starts listening on the local socket name (a path on Unix, a pipe
+    // name on Windows). A stale socket left by a crashed run is removed.
+    bool listen(const QString &name, QString *error);
+    void close();
+
+    // Requests are refused while no user is signed in (-1).
+    void setUserId(int userId);
+    int clientCount() const;
+    // Answers the memory operation; without one it is refused.
+    void setMemoryMonitor(MemoryMonitor *memoryMonitor);
+
+signals:
+    void clientCountChanged();
+
+private:
+    static const int MAX_REQUEST_BYTES = 1024 * 1024;
+
+    struct Client {
+        QByteArray buffer;
+        bool subscribed = false;
+    };
+
+    InventoryModel *m_inventoryModel;
+    SalesModel *m_salesModel;
+    UserDashboard *m_dashboard;
+    MemoryMonitor *m_memoryMonitor;
+    QLocalServer m_server;
+    QHash<QLocalSocket *, Client> m_clients;
+    int m_userId;
+
+    void acceptConnections();
+    void readRequests(QLocalSocket *socket);
+    QJsonObject handle(QLocalSocket *socket, const QJsonObject &request);
+    QJsonArray stockLevels(const QJsonObject &request, QString *error) const;
+    QJsonObject dashboardAggregates(bool recalculate);
+    void publish(const QJsonObject &event);
+    static void send(QLocalSocket *socket, const QJsonObject &message);
+};
+
+#endif // QUERYSERVICE_H
@@ -0,0 +1,106 @@
+#ifndef ROWMAPPER_H
+#define ROWMAPPER_H
+
+#include <QDate>
+#include <QDateTime>
+#include <QDebug>
+#include <QSqlQuery>
+#include <QSqlRecord>
+#include <QString>
+#include <array>
+#include <tuple>
+#include <utility>
+
+// Typed decoding of result rows into plain structs. A struct lists its
+// columns once:
+//
+//     struct SaleItem {
+//         int id;
+//         QString itemName;
+//         static auto columns() {
+//             return std::make_tuple(column("id", &SaleItem::id),
+//                                    column("item_name", &SaleItem::itemName));
+//         }
+//     };
+//
+// RowMapper<SaleItem> then resolves each name to its position once per
+// statement, and read() assigns every field by index with a conversion chosen
+// at compile time, instead of a by-name lookup per field per row.
+
+template <typename Row, typename T>
+struct ColumnBinding {
+    const char *name;
+    T Row::*member;
+};
+
+template <typename Row, typename T>
+constexpr ColumnBinding<Row, T> column(const char *name, T Row::*member)
+{
+    return {name, member};
+}
+
+namespace RowMapperDetail {
+inline void assign(int &field, const QVariant &value) { field = value.toInt(); }
+inline void assign(qint64 &field, const QVariant &value) { field = value.toLongLong(); }
+inline void assign(double &field, const QVariant &value) { field = value.toDouble(); }
+inline void assign(bool &field, const QVariant &value) { field = value.toBool(); }
+inline void assign(QString &field, const QVariant &value) { field = value.toString(); }
+inline void assign(QDate &field, const QVariant &value) { field = value.toDate(); }
+inline void assign(QDateTime &field, const QVariant &value) { field = value.toDateTime(); }
+} // namespace RowMapperDetail
+
+template <typename Row>
+class RowMapper
+{
+    using Columns = decltype(Row::columns());
+    static constexpr std::size_t COUNT = std::tuple_size<Columns>::value;
+
+public:
+    explicit RowMapper(const QSqlQuery &query)
+        : RowMapper(query.record())
+    {
+    }
+
+    explicit RowMapper(const QSqlRecord &record)
+        : m_columns(Row::columns())
+    {
+        resolve(record, std::make_index_sequence<COUNT>());
+    }
+
+    // Columns missing from the statement, reported once when the mapper is
+    // built, are left default-initialised.
+    Row read(const QSqlQuery &query) const
+    {
+        Row row{};
+        readInto(query, row, std::make_index_sequence<COUNT>());
+        return row;
+    }
+
+private:
+    Columns m_columns;
+    std::array<int, COUNT> m_indexes;
+
+    template <std::size_t... I>
+    void resolve(const QSqlRecord &record, std::index_sequence<I...>)
+    {
+        ((m_indexes[I] = record.indexOf(QLatin1String(std::get<I>(m_columns).name))), ...);
+        // Usually a renamed column or a SELECT list that fell out of step
+        // with the struct.
+        ((m_indexes[I] < 0
+              ? void(qWarning() << "RowMapper: column" << std::get<I>(m_columns).name
+                                << "is not in the statement")
+              : void()),
+         ...);
+    }
+
+    template <std::size_t... I>
+    void readInto(const QSqlQuery &query, Row &row, std::index_sequence<I...>) const
+    {
+        ((m_indexes[I] >= 0
+              ? RowMapperDetail::assign(row.*(std::get<I>(m_columns).member), query.value(m_indexes[I]))
+              : void()),
+         ...);
+    }
+};
+
+#endif // ROWMAPPER_H
@@ -0,0 +1,388 @@
+#include "salesarchive.h"
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QRegularExpression>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QStringList>
+#include <algorithm>
+
+namespace {
+// SQLite attaches at most ten databases by default. The newest years keep
+// a file each; older ones are merged into one, which leaves a slot for the
+// year archiveBefore() is filling.
+const int MAX_YEAR_ARCHIVES = 7;
+const char OLDER_SCHEMA[] = "sales_older";
+
+QString schemaName(int year) { return QString("sales_%1").arg(year); }
+
+// Years with their own attached file; anything before them is in the
+// older archive.
+QList<int> attachableYears(const QList<int> &years) {
+  return years.mid(qMax(0, years.size() - MAX_YEAR_ARCHIVES));
+}
+
+QStringList attachedSchemas(QSqlDatabase db) {
+  QStringList schemas;
+  QSqlQuery query(db);
+  if (query.exec("PRAGMA database_list")) {
+    while (query.next())
+      schemas.append(query.value(1).toString());
+  }
+  return schemas;
+}
+
+// Archives carry no foreign keys; their items may since have been deleted.
+// Amounts are in cents, as in the main table.
+bool createSalesTable(QSqlDatabase db, const QString &schema,
+                      QString *error) {
+  QSqlQuery query(db);
+  if (!query.exec(QString("CREATE TABLE IF NOT EXISTS %1.Sales ("
+                          "id INTEGER PRIMARY KEY, "
+                          "user_id INTEGER NOT NULL, "
+                          "item_id INTEGER NOT NULL, "
+                          "quantity INTEGER NOT NULL, "
+                          "price INTEGER NOT NULL, "
+                          "total_price INTEGER NOT NULL, "
+                          "sale_date DATETIME, "
+                          "unit_cost INTEGER NOT NULL DEFAULT 0, "
+                          "total_cost INTEGER NOT NULL DEFAULT 0)")
+                      .arg(schema)) ||
+      !query.exec(QString("CREATE INDEX IF NOT EXISTS %1.idx_sales_user_date "
+                          "ON Sales(user_id, sale_date)")
+                      .arg(schema))) {
+    *error = query.lastError().text();
+    return false;
+  }
+  return true;
+}
+
+// Archives written by older versions are brought up to date on first attach:
+// amounts still in currency units are converted to cents, and sales from
+// before costs were recorded are costed at the item's current price, like
+// the main table was at its upgrade.
+bool upgradeArchive(QSqlDatabase db, const QString &schema, QString *error) {
+  QSqlQuery query(db);
+  if (!query.exec(QString("PRAGMA %1.table_info(Sales)").arg(schema))) {
+    *error = query.lastError().text();
+    return false;
+  }
+  bool hasCost = false;
+  bool inUnits = false;
+  while (query.next()) {
+    const QString column = query.value(1).toString();
+    if (column == "total_cost")
+      hasCost = true;
+    else if (column == "total_price")
+      inUnits = query.value(2).toString().compare(
+                    "REAL", Qt::CaseInsensitive) == 0;
+  }
+  if (hasCost && !inUnits)
+    return true;
+
+  auto cents = [inUnits](const QString &column) {
+    return inUnits ? QString("CAST(ROUND(%1 * 100) AS INTEGER)").arg(column)
+                   : column;
+  };
+  const QString currentCost =
+      "COALESCE((SELECT price FROM main.Inventory WHERE id = item_id), 0)";
+  const QString unitCost = hasCost ? cents("unit_cost") : currentCost;
+  const QString totalCost =
+      hasCost ? cents("total_cost") : "quantity * " + currentCost;
+
+  // The rename must not commit on its own: a later failure would leave the
+  // archive without a Sales table.
+  if (!db.transaction()) {
+    *error = db.lastError().text();
+    return false;
+  }
+  if (!query.exec(QString("ALTER TABLE %1.Sales RENAME TO Sales_old")
+                      .arg(schema)) ||
+      !query.exec(QString("DROP INDEX IF EXISTS %1.idx_sales_user_date")
+                      .arg(schema)) ||
+      !createSalesTable(db, schema, error) ||
+      !query.exec(QString("INSERT INTO %1.Sales (%2) SELECT id, user_id, "
+                          "item_id, quantity, %3, %4, sale_date, %5, %6 "
+                          "FROM %1.Sales_old")
+                      .arg(schema, SalesArchive::columns(), cents("price"),
+                           cents("total_price"), unitCost, totalCost)) ||
+      !query.exec(QString("DROP TABLE %1.Sales_old").arg(schema))) {
+    if (error->isEmpty())
+      *error = query.lastError().text();
+    db.rollback();
+    return false;
+  }
+  if (!db.commit()) {
+    *error = db.lastError().text();
+    db.rollback();
+    return false;
+  }
+  return true;
+}
+
+bool attachFile(QSqlDatabase db, const QString &path, const QString &schema,
+                QString *error) {
+  if (attachedSchemas(db).contains(schema))
+    return true;
+
+  QSqlQuery query(db);
+  query.prepare(QString("ATTACH DATABASE :path AS %1").arg(schema));
+  query.bindValue(":path", path);
+  if (!query.exec()) {
+    *error = query.lastError().text();
+    return false;
+  }
+
+  return createSalesTable(db, schema, error) &&
+         upgradeArchive(db, schema, error);
+}
+
+bool attachYear(QSqlDatabase db, const QString &databasePath, int year,
+                QString *error) {
+  return attachFile(db, SalesArchive::archivePath(databasePath, year),
+                    schemaName(year), error);
+}
+
+void detach(QSqlDatabase db, const QString &schema) {
+  QSqlQuery query(db);
+  if (!query.exec(QString("DETACH DATABASE %1").arg(schema)))
+    qWarning() << "Failed to detach" << schema << query.lastError().text();
+}
+
+bool rebuildView(QSqlDatabase db, const QList<int> &years, bool withOlder,
+                 QString *error) {
+  QStringList selects;
+  selects.append(QString("SELECT %1 FROM main.Sales").arg(SalesArchive::columns()));
+  if (withOlder) {
+    selects.append(QString("SELECT %1 FROM %2.Sales")
+                       .arg(SalesArchive::columns(), OLDER_SCHEMA));
+  }
+  for (int year : years) {
+    selects.append(QString("SELECT %1 FROM %2.Sales")
+                       .arg(SalesArchive::columns(), schemaName(year)));
+  }
+
+  QSqlQuery query(db);
+  if (!query.exec("DROP VIEW IF EXISTS temp.AllSales") ||
+      !query.exec("CREATE TEMP VIEW AllSales AS " +
+                  selects.join(" UNION ALL "))) {
+    *error = query.lastError().text();
+    return false;
+  }
+  return true;
+}
+} // namespace
+
+QString SalesArchive::columns() {
+  return "id, user_id, item_id, quantity, price, total_price, sale_date, "
+         "unit_cost, total_cost";
+}
+
+QString SalesArchive::archivePath(const QString &databasePath, int year) {
+  const QFileInfo info(databasePath);
+  return info.dir().filePath(
+      QString("%1_sales_%2.db").arg(info.completeBaseName()).arg(year));
+}
+
+QString SalesArchive::olderArchivePath(const QString &databasePath) {
+  const QFileInfo info(databasePath);
+  return info.dir().filePath(
+      QString("%1_sales_older.db").arg(info.completeBaseName()));
+}
+
+QList<int> SalesArchive::archivedYears(const QString &databasePath) {
+  const QFileInfo info(databasePath);
+  const QRegularExpression pattern(
+      QString("^%1_sales_(\\d{4})\\.db$")
+          .arg(QRegularExpression::escape(info.completeBaseName())));
+
+  QList<int> years;
+  const QStringList files = info.dir().entryList(
+      {info.completeBaseName() + "_sales_*.db"}, QDir::Files);
+  for (const QString &file : files) {
+    const QRegularExpressionMatch match = pattern.match(file);
+    if (match.hasMatch())
+      years.append(match.captured(1).toInt());
+  }
+  std::sort(years.begin(), years.end());
+  return years;
+}
+
+QDate SalesArchive::hotPeriodStart(const QString &databasePath) {
+  const QList<int> years = archivedYears(databasePath);
+  if (years.isEmpty())
+    return QDate();
+  return QDate(years.last() + 1, 1, 1);
+}
+
+bool SalesArchive::attach(QSqlDatabase db, const QString &databasePath,
+                          QString *error) {
+  const QList<int> years = attachableYears(archivedYears(databasePath));
+  const bool withOlder = QFile::exists(olderArchivePath(databasePath));
+
+  // Archives merged or removed since this connection attached them, e.g.
+  // by an archive run on another terminal.
+  for (const QString &schema : attachedSchemas(db)) {
+    if (!schema.startsWith("sales_"))
+      continue;
+    const bool current =
+        schema == OLDER_SCHEMA ? withOlder
+                               : years.contains(schema.mid(6).toInt());
+    if (!current)
+      detach(db, schema);
+  }
+
+  if (withOlder &&
+      !attachFile(db, olderArchivePath(databasePath), OLDER_SCHEMA, error))
+    return false;
+  for (int year : years) {
+    if (!attachYear(db, databasePath, year, error))
+      return false;
+  }
+  return rebuildView(db, years, withOlder, error);
+}
+
+bool SalesArchive::consolidate(QSqlDatabase db, const QString &databasePath,
+                               QString *error) {
+  const QList<int> years = archivedYears(databasePath);
+  if (years.size() <= MAX_YEAR_ARCHIVES)
+    return true;
+
+  if (!attachFile(db, olderArchivePath(databasePath), OLDER_SCHEMA, error))
+    return false;
+  QSqlQuery query(db);
+  for (int year : years.mid(0, years.size() - MAX_YEAR_ARCHIVES)) {
+    if (!attachYear(db, databasePath, year, error))
+      return false;
+    // Ids are kept, so a merge repeated after a failed removal is a no-op.
+    if (!db.transaction()) {
+      *error = db.lastError().text();
+      return false;
+    }
+    if (!query.exec(QString("INSERT OR IGNORE INTO %1.Sales (%2) SELECT %2 "
+                            "FROM %3.Sales")
+                        .arg(OLDER_SCHEMA, columns(), schemaName(year)))) {
+      *error = query.lastError().text();
+      db.rollback();
+      return false;
+    }
+    if (!db.commit()) {
+      *error = db.lastError().text();
+      return false;
+    }
+    detach(db, schemaName(year));
+    // Once merged the file is never attached again, so a removal that fails
+    // (another terminal still has it open) is only retried later.
+    if (!QFile::remove(archivePath(databasePath, year)))
+      qWarning() << "Could not remove merged sales archive for" << year;
+  }
+  return true;
+}
+
+qint64 SalesArchive::archiveBefore(QSqlDatabase db,
+                                   const QString &databasePath,
+                                   int beforeYear, QString *error) {
+  QSqlQuery query(db);
+  query.prepare("SELECT DISTINCT CAST(strftime('%Y', sale_date) AS INTEGER) "
+                "FROM Sales WHERE sale_date < :cutoff ORDER BY 1");
+  query.bindValue(":cutoff", QDate(beforeYear, 1, 1));
+  if (!query.exec()) {
+    *error = query.lastError().text();
+    return -1;
+  }
+  QList<int> years;
+  while (query.next())
+    years.append(query.value(0).toInt());
+  query.finish();
+
+  qint64 moved = 0;
+  for (int year : years) {
+    // ATTACH is not allowed inside a transaction, so do it first.
+    if (!attachYear(db, databasePath, year, error))
+      return -1;
+
+    const QDate from(year, 1, 1);
+    const QDate to(year + 1, 1, 1);
+    if (!db.transaction()) {
+      *error = db.lastError().text();
+      return -1;
+    }
+
+    qint64 headSeq = 0;
+    if (query.exec("SELECT IFNULL(MAX(seq), 0) FROM ChangeLog") && query.next())
+      headSeq = query.value(0).toLongLong();
+
+    query.prepare(QString("INSERT OR IGNORE INTO %1.Sales (%2) SELECT %2 FROM "
+                          "main.Sales WHERE sale_date >= :from AND "
+                          "sale_date < :to")
+                      .arg(schemaName(year), columns()));
+    query.bindValue(":from", from);
+    query.bindValue(":to", to);
+    bool ok = query.exec();
+    if (ok) {
+      // The dashboard totals cover archived sales too, but the delete
+      // trigger takes the moved rows off UserKpis; add them back first so
+      // the move leaves the totals as they were.
+      query.prepare("INSERT OR IGNORE INTO UserKpis (user_id) SELECT DISTINCT "
+                    "user_id FROM main.Sales WHERE sale_date >= :from AND "
+                    "sale_date < :to");
+      query.bindValue(":from", from);
+      query.bindValue(":to", to);
+      ok = query.exec();
+    }
+    if (ok) {
+      query.prepare("UPDATE UserKpis SET (sale_count, revenue, cost) = "
+                    "(SELECT sale_count + COUNT(*), "
+                    "revenue + IFNULL(SUM(s.total_price), 0), "
+                    "cost + IFNULL(SUM(s.total_cost), 0) FROM main.Sales s "
+                    "WHERE s.user_id = UserKpis.user_id AND "
+                    "s.sale_date >= :from AND s.sale_date < :to) "
+                    "WHERE user_id IN (SELECT user_id FROM main.Sales "
+                    "WHERE sale_date >= :from AND sale_date < :to)");
+      query.bindValue(":from", from);
+      query.bindValue(":to", to);
+      ok = query.exec();
+    }
+    if (ok) {
+      query.prepare("DELETE FROM main.Sales WHERE sale_date >= :from AND "
+                    "sale_date < :to");
+      query.bindValue(":from", from);
+      query.bindValue(":to", to);
+      ok = query.exec();
+      moved += query.numRowsAffected();
+    }
+    if (ok) {
+      // Archiving is not a user-visible delete; keep it out of the change
+      // log so other terminals do not replay millions of removals.
+      query.prepare("DELETE FROM ChangeLog WHERE seq > :headSeq AND "
+                    "table_name = 'Sales' AND operation = 'D'");
+      query.bindValue(":headSeq", headSeq);
+      ok = query.exec();
+    }
+    if (ok) {
+      // Instead, one entry for every user (user 0) tells other terminals to
+      // re-attach their archives.
+      query.prepare("INSERT INTO ChangeLog (table_name, row_id, user_id, "
+                    "operation) VALUES ('Sales', :year, 0, 'A')");
+      query.bindValue(":year", year);
+      ok = query.exec();
+    }
+    if (!ok) {
+      *error = query.lastError().text();
+      db.rollback();
+      return -1;
+    }
+    if (!db.commit()) {
+      *error = db.lastError().text();
+      return -1;
+    }
+    if (!consolidate(db, databasePath, error))
+      return -1;
+  }
+
+  if (!attach(db, databasePath, error))
+    return -1;
+  return moved;
+}
@@ -0,0 +1,39 @@
+#ifndef SALESARCHIVE_H
+#define SALESARCHIVE_H
+
+#include <QDate>
+#include <QList>
+#include <QSqlDatabase>
+#include <QString>
+
+// Closed years of Sales live in their own files next to the main database
+// (BIMS3_sales_2023.db, ...). Connections attach them as sales_<year> and get
+// a temporary AllSales view that unions the hot table with every archive, so
+// history queries read AllSales and day-to-day queries keep using Sales.
+// Only the newest years keep a file each; consolidate() merges the rest into
+// BIMS3_sales_older.db so that the number attached stays within SQLite's
+// limit.
+class SalesArchive
+{
+public:
+    // Column list shared by the archive tables and the AllSales view.
+    static QString columns();
+
+    static QString archivePath(const QString &databasePath, int year);
+    static QString olderArchivePath(const QString &databasePath);
+    static QList<int> archivedYears(const QString &databasePath);
+    // First day held only by the hot table; invalid when nothing is archived.
+    static QDate hotPeriodStart(const QString &databasePath);
+
+    // Attaches the current archives and rebuilds AllSales; archives this
+    // connection still has attached but that were merged since are detached.
+    static bool attach(QSqlDatabase db, const QString &databasePath, QString *error);
+    // Merges the years past the per-year limit into the older archive.
+    static bool consolidate(QSqlDatabase db, const QString &databasePath, QString *error);
+    // Moves every sale dated before January 1st of beforeYear into its
+    // year's archive file; returns the number of rows moved or -1.
+    static qint64 archiveBefore(QSqlDatabase db, const QString &databasePath, int beforeYear,
+                                QString *error);
+};
+
+#endif // SALESARCHIVE_H
@@ -1,11 +1,24 @@
 #include "salesmodel.h"
+#include "inventorymodel.h"
+#include "memoryestimate.h"
+#include "sqlids.h"
+#include "stockledger.h"
+#include "tilljournal.h"
+#include "tracer.h"
+#include "workloadrecorder.h"
 #include <QDebug>
 #include <QSqlError>
 #include <QSqlQuery>
+#include <algorithm>
 
 SalesModel::SalesModel(DatabaseManager *dbManager, QObject *parent)
-    : QAbstractListModel(parent), m_dbManager(dbManager), m_userId(-1), m_totalSales(0), m_totalRevenue(0.0)
-{}
+    : QAbstractListModel(parent), m_dbManager(dbManager), m_inventoryModel(nullptr), m_tillJournal(nullptr),
+      m_exporter(new StreamExporter(dbManager, this)),
+      m_userId(-1), m_totalSales(0), m_totalRevenue(0), m_totalCost(0), m_filtered(false), m_loaded(false)
+{
+    connect(m_exporter, &StreamExporter::progress, this, &SalesModel::exportProgress);
+    connect(m_exporter, &StreamExporter::finished, this, &SalesModel::exportFinished);
+}
 
 int SalesModel::rowCount(const QModelIndex &parent) const
 {
@@ -31,9 +44,13 @@ QVariant SalesModel::data(const QModelIndex &index, int role) const
     case QuantityRole:
         return sale.quantity;
     case PriceRole:
-        return sale.price;
+        return Money::toUnits(sale.price);
     case TotalPriceRole:
-        return sale.totalPrice;
+        return Money::toUnits(sale.totalPrice);
+    case UnitCostRole:
+        return Money::toUnits(sale.unitCost);
+    case TotalCostRole:
+        return Money::toUnits(sale.totalCost);
     case SaleDateRole:
         return sale.saleDate;
     default:
@@ -50,45 +67,94 @@ QHash<int, QByteArray> SalesModel::roleNames() const
     roles[QuantityRole] = "quantity";
     roles[PriceRole] = "price";
     roles[TotalPriceRole] = "totalPrice";
+    roles[UnitCostRole] = "unitCost";
+    roles[TotalCostRole] = "totalCost";
     roles[SaleDateRole] = "saleDate";
     return roles;
 }
 
 void SalesModel::setUserId(int userId)
 {
-    if (m_userId != userId) {
-        m_userId = userId;
+    WorkloadRecorder::Scope scope("SalesModel::setUserId", {userId});
+    Tracer::Scope trace("model", "SalesModel::setUserId");
+    if (m_userId == userId)
+        return;
+
+    beginResetModel();
+    m_userId = userId;
+    m_sales.clear();
+    m_filtered = false;
+    m_loaded = false;
+    m_totalSales = 0;
+    m_totalRevenue = 0;
+    m_totalCost = 0;
+    endResetModel();
+    emit totalSalesChanged();
+    emit totalRevenueChanged();
+}
+
+void SalesModel::ensureLoaded()
+{
+    if (!m_loaded && m_userId != -1)
         refresh();
-    }
+}
+
+bool SalesModel::isLoaded() const
+{
+    return m_loaded;
 }
 
 bool SalesModel::addSale(int itemId, int quantity, double price)
 {
+    WorkloadRecorder::Scope scope("SalesModel::addSale", {itemId, quantity, price});
+    Tracer::Scope trace("model", "SalesModel::addSale");
     if (m_userId == -1) {
         emit errorOccurred("User not set. Unable to add sale.");
         return false;
     }
+    if (quantity <= 0) {
+        emit errorOccurred("Quantity must be positive.");
+        return false;
+    }
+    if (m_tillJournal && m_tillJournal->isOpen())
+        return journalSale(itemId, quantity, Money::fromUnits(price));
 
     QSqlDatabase db = m_dbManager->database();
-    db.transaction();
+    if (!db.transaction()) {
+        emit errorOccurred(tr("Failed to add sale: %1").arg(db.lastError().text()));
+        return false;
+    }
+
+    // The cost of the units sold comes off the item's oldest cost layers.
+    QString error;
+    Money::Cents totalCost = 0;
+    if (!StockLedger::issue(db, m_userId, itemId, quantity, &totalCost, &error)) {
+        db.rollback();
+        emit errorOccurred(tr("Failed to add sale: %1").arg(error));
+        return false;
+    }
 
     QSqlQuery query(db);
     query.prepare(
-        "INSERT INTO Sales (user_id, item_id, quantity, price, total_price, sale_date) "
-        "VALUES (:userId, :itemId, :quantity, :price, :totalPrice, :saleDate)"
+        "INSERT INTO Sales (user_id, item_id, quantity, price, total_price, sale_date, unit_cost, total_cost) "
+        "VALUES (:userId, :itemId, :quantity, :price, :totalPrice, :saleDate, :unitCost, :totalCost)"
     );
     query.bindValue(":userId", m_userId);
     query.bindValue(":itemId", itemId);
     query.bindValue(":quantity", quantity);
-    query.bindValue(":price", price);
-    query.bindValue(":totalPrice", price * quantity);
+    const Money::Cents unitPrice = Money::fromUnits(price);
+    query.bindValue(":price", unitPrice);
+    query.bindValue(":totalPrice", unitPrice * quantity);
     query.bindValue(":saleDate", QDateTime::currentDateTime());
+    query.bindValue(":unitCost", qRound64(double(totalCost) / quantity));
+    query.bindValue(":totalCost", totalCost);
 
     if (!query.exec()) {
         db.rollback();
         emit errorOccurred(tr("Failed to add sale: %1").arg(query.lastError().text()));
         return false;
     }
+    const int saleId = query.lastInsertId().toInt();
 
     // Update inventory
     query.prepare("UPDATE Inventory SET quantity = quantity - :soldQuantity WHERE id = :itemId AND user_id = :userId");
@@ -102,21 +168,169 @@ bool SalesModel::addSale(int itemId, int quantity, double price)
         return false;
     }
 
-    db.commit();
-    refresh();
+    if (!StockLedger::record(db, m_userId, itemId, StockLedger::Sale, -quantity, saleId, &error)) {
+        db.rollback();
+        emit errorOccurred(tr("Failed to add sale: %1").arg(error));
+        return false;
+    }
+
+    if (!db.commit()) {
+        db.rollback();
+        emit errorOccurred(tr("Failed to add sale: %1").arg(db.lastError().text()));
+        return false;
+    }
+
+    // Patched in rather than reloaded, so an unloaded model stays unloaded;
+    // ChangeFeed does not see this connection's own writes.
+    applyChanges({saleId}, {});
+    if (m_inventoryModel)
+        m_inventoryModel->applyChanges({itemId}, {});
+    return true;
+}
+
+void SalesModel::setInventoryModel(InventoryModel *inventoryModel)
+{
+    m_inventoryModel = inventoryModel;
+}
+
+void SalesModel::setTillJournal(TillJournal *tillJournal)
+{
+    m_tillJournal = tillJournal;
+}
+
+bool SalesModel::journalSale(int itemId, int quantity, Money::Cents price)
+{
+    if (quantity <= 0) {
+        emit errorOccurred("Quantity must be positive.");
+        return false;
+    }
+    QString error;
+    if (m_tillJournal->append(m_userId, itemId, quantity, price, &error).isEmpty()) {
+        emit errorOccurred(tr("Failed to add sale: %1").arg(error));
+        return false;
+    }
+    return true;
+}
+
+bool SalesModel::addSaleBySku(const QString &sku, int quantity)
+{
+    WorkloadRecorder::Scope scope("SalesModel::addSaleBySku", {sku, quantity});
+    Tracer::Scope trace("model", "SalesModel::addSaleBySku");
+    if (m_userId == -1) {
+        emit errorOccurred("User not set. Unable to add sale.");
+        return false;
+    }
+    if (!m_inventoryModel) {
+        emit errorOccurred("Inventory not available. Unable to look up SKU.");
+        return false;
+    }
+    if (quantity <= 0) {
+        emit errorOccurred("Quantity must be positive.");
+        return false;
+    }
+
+    m_inventoryModel->ensureLoaded();
+    const int itemId = m_inventoryModel->itemIdForSku(sku);
+    if (itemId == -1) {
+        emit errorOccurred(tr("Unknown SKU: %1").arg(sku));
+        return false;
+    }
+
+    if (m_tillJournal && m_tillJournal->isOpen()) {
+        // Checked against the stock last seen here, less what this till has
+        // sold but not merged yet; the merge checks again against the shared
+        // database and reports a conflict if other tills got there first.
+        const QVariantMap item = m_inventoryModel->itemRecord(itemId);
+        const int available = item.value("quantity").toInt()
+                              - m_tillJournal->pendingQuantity(m_userId, itemId);
+        if (available < quantity) {
+            emit errorOccurred(tr("Not enough stock for SKU %1").arg(sku));
+            return false;
+        }
+        return journalSale(itemId, quantity, Money::fromUnits(item.value("price").toDouble()));
+    }
+
+    QSqlDatabase db = m_dbManager->database();
+    if (!db.transaction()) {
+        emit errorOccurred(tr("Failed to add sale: %1").arg(db.lastError().text()));
+        return false;
+    }
+
+    // The stock check and the decrement are one statement, so two tills
+    // selling the last unit cannot both succeed.
+    QSqlQuery query(db);
+    query.prepare("UPDATE Inventory SET quantity = quantity - :quantity "
+                  "WHERE id = :itemId AND user_id = :userId AND quantity >= :quantity");
+    query.bindValue(":quantity", quantity);
+    query.bindValue(":itemId", itemId);
+    query.bindValue(":userId", m_userId);
+
+    if (!query.exec()) {
+        db.rollback();
+        emit errorOccurred(tr("Failed to update inventory: %1").arg(query.lastError().text()));
+        return false;
+    }
+    if (query.numRowsAffected() == 0) {
+        db.rollback();
+        emit errorOccurred(tr("Not enough stock for SKU %1").arg(sku));
+        return false;
+    }
+
+    QString error;
+    Money::Cents totalCost = 0;
+    if (!StockLedger::issue(db, m_userId, itemId, quantity, &totalCost, &error)) {
+        db.rollback();
+        emit errorOccurred(tr("Failed to add sale: %1").arg(error));
+        return false;
+    }
+
+    query.prepare("INSERT INTO Sales (user_id, item_id, quantity, price, total_price, sale_date, unit_cost, total_cost) "
+                  "SELECT :userId, id, :quantity, price, price * :quantity, :saleDate, :unitCost, :totalCost "
+                  "FROM Inventory WHERE id = :itemId");
+    query.bindValue(":userId", m_userId);
+    query.bindValue(":quantity", quantity);
+    query.bindValue(":saleDate", QDateTime::currentDateTime());
+    query.bindValue(":unitCost", qRound64(double(totalCost) / quantity));
+    query.bindValue(":totalCost", totalCost);
+    query.bindValue(":itemId", itemId);
+
+    if (!query.exec()) {
+        db.rollback();
+        emit errorOccurred(tr("Failed to add sale: %1").arg(query.lastError().text()));
+        return false;
+    }
+    const int saleId = query.lastInsertId().toInt();
+
+    if (!StockLedger::record(db, m_userId, itemId, StockLedger::Sale, -quantity, saleId, &error)) {
+        db.rollback();
+        emit errorOccurred(tr("Failed to add sale: %1").arg(error));
+        return false;
+    }
+
+    if (!db.commit()) {
+        db.rollback();
+        emit errorOccurred(tr("Failed to add sale: %1").arg(db.lastError().text()));
+        return false;
+    }
+
+    applyChanges({saleId}, {});
+    m_inventoryModel->applyChanges({itemId}, {});
     return true;
 }
 
 void SalesModel::searchSales(const QString &searchText)
 {
+    WorkloadRecorder::Scope scope("SalesModel::searchSales", {searchText});
+    Tracer::Scope trace("model", "SalesModel::searchSales");
     if (m_userId == -1) {
         emit errorOccurred("User not set. Unable to search sales.");
         return;
     }
 
     QSqlQuery query(m_dbManager->database());
-    query.prepare("SELECT s.id, s.item_id, i.name AS item_name, s.quantity, s.price, s.total_price, s.sale_date "
-                  "FROM Sales s "
+    // Searches span the archived years as well as the hot table.
+    query.prepare("SELECT s.id, s.item_id, i.name AS item_name, s.quantity, s.price, s.total_price, s.sale_date, s.unit_cost, s.total_cost "
+                  "FROM " + m_dbManager->salesSource() + " s "
                   "JOIN Inventory i ON s.item_id = i.id "
                   "WHERE s.user_id = :userId AND i.name LIKE :searchText "
                   "ORDER BY s.sale_date DESC");
@@ -130,18 +344,15 @@ void SalesModel::searchSales(const QString &searchText)
 
     beginResetModel();
     m_sales.clear();
-    m_totalRevenue = 0.0;
+    m_filtered = !searchText.isEmpty();
+    m_totalRevenue = 0;
+    m_totalCost = 0;
+    const RowMapper<SaleItem> mapper(query);
     while (query.next()) {
-        SaleItem sale;
-        sale.id = query.value("id").toInt();
-        sale.itemId = query.value("item_id").toInt();
-        sale.itemName = query.value("item_name").toString();
-        sale.quantity = query.value("quantity").toInt();
-        sale.price = query.value("price").toDouble();
-        sale.totalPrice = query.value("total_price").toDouble();
-        sale.saleDate = query.value("sale_date").toDateTime();
+        SaleItem sale = mapper.read(query);
         m_sales.append(sale);
         m_totalRevenue += sale.totalPrice;
+        m_totalCost += sale.totalCost;
     }
     m_totalSales = m_sales.size();
     endResetModel();
@@ -151,13 +362,15 @@ void SalesModel::searchSales(const QString &searchText)
 
 void SalesModel::refresh()
 {
+    WorkloadRecorder::Scope scope("SalesModel::refresh");
+    Tracer::Scope trace("model", "SalesModel::refresh");
     if (m_userId == -1) {
         qWarning() << "User not set. Unable to refresh sales.";
         return;
     }
 
     QSqlQuery query(m_dbManager->database());
-    query.prepare("SELECT s.id, s.item_id, i.name AS item_name, s.quantity, s.price, s.total_price, s.sale_date "
+    query.prepare("SELECT s.id, s.item_id, i.name AS item_name, s.quantity, s.price, s.total_price, s.sale_date, s.unit_cost, s.total_cost "
                   "FROM Sales s "
                   "JOIN Inventory i ON s.item_id = i.id "
                   "WHERE s.user_id = :userId "
@@ -171,25 +384,227 @@ void SalesModel::refresh()
 
     beginResetModel();
     m_sales.clear();
-    m_totalRevenue = 0.0;
+    m_filtered = false;
+    m_totalRevenue = 0;
+    m_totalCost = 0;
+    const RowMapper<SaleItem> mapper(query);
     while (query.next()) {
-        SaleItem sale;
-        sale.id = query.value("id").toInt();
-        sale.itemId = query.value("item_id").toInt();
-        sale.itemName = query.value("item_name").toString();
-        sale.quantity = query.value("quantity").toInt();
-        sale.price = query.value("price").toDouble();
-        sale.totalPrice = query.value("total_price").toDouble();
-        sale.saleDate = query.value("sale_date").toDateTime();
+        SaleItem sale = mapper.read(query);
         m_sales.append(sale);
         m_totalRevenue += sale.totalPrice;
+        m_totalCost += sale.totalCost;
     }
     m_totalSales = m_sales.size();
+    m_loaded = true;
+    endResetModel();
+    emit totalSalesChanged();
+    emit totalRevenueChanged();
+}
+
+void SalesModel::applyChanges(const QList<int> &upsertedIds, const QList<int> &deletedIds)
+{
+    Tracer::Scope trace("model", "SalesModel::applyChanges");
+    if (m_userId == -1)
+        return;
+    if (!m_loaded) {
+        emit salesChanged(upsertedIds, deletedIds);
+        return;
+    }
+
+    QHash<int, int> rowById;
+    for (int row = 0; row < m_sales.size(); ++row)
+        rowById.insert(m_sales.at(row).id, row);
+
+    QList<int> removedRows;
+    for (int id : deletedIds) {
+        auto it = rowById.constFind(id);
+        if (it != rowById.constEnd()) {
+            removedRows.append(it.value());
+            m_totalRevenue -= m_sales.at(it.value()).totalPrice;
+            m_totalCost -= m_sales.at(it.value()).totalCost;
+        }
+    }
+    if (!removedRows.isEmpty()) {
+        std::sort(removedRows.begin(), removedRows.end(), std::greater<int>());
+        for (int row : removedRows) {
+            beginRemoveRows(QModelIndex(), row, row);
+            m_sales.removeAt(row);
+            endRemoveRows();
+        }
+        rowById.clear();
+        for (int row = 0; row < m_sales.size(); ++row)
+            rowById.insert(m_sales.at(row).id, row);
+    }
+
+    if (!upsertedIds.isEmpty()) {
+        // Chunks in id order, so sales still arrive oldest first.
+        QList<int> ids = upsertedIds;
+        std::sort(ids.begin(), ids.end());
+
+        QSqlQuery query(m_dbManager->database());
+        query.setForwardOnly(true);
+        for (const QList<int> &chunk : SqlIds::chunks(ids)) {
+            query.prepare(QString("SELECT s.id, s.item_id, i.name AS item_name, s.quantity, s.price, s.total_price, s.sale_date, s.unit_cost, s.total_cost "
+                                  "FROM Sales s "
+                                  "JOIN Inventory i ON s.item_id = i.id "
+                                  "WHERE s.user_id = :userId AND s.id IN (%1) "
+                                  "ORDER BY s.sale_date").arg(SqlIds::list(chunk)));
+            query.bindValue(":userId", m_userId);
+
+            if (!query.exec()) {
+                emit errorOccurred(tr("Failed to fetch changed sales: %1").arg(query.lastError().text()));
+                break;
+            }
+
+            const RowMapper<SaleItem> mapper(query);
+
+            while (query.next()) {
+                SaleItem sale = mapper.read(query);
+                auto it = rowById.constFind(sale.id);
+                if (it != rowById.constEnd()) {
+                    m_totalRevenue += sale.totalPrice - m_sales.at(it.value()).totalPrice;
+                    m_totalCost += sale.totalCost - m_sales.at(it.value()).totalCost;
+                    m_sales[it.value()] = sale;
+                    emit dataChanged(index(it.value()), index(it.value()));
+                } else if (!m_filtered) {
+                    // Sales arrive newest last; the list is ordered newest first.
+                    m_totalRevenue += sale.totalPrice;
+                    m_totalCost += sale.totalCost;
+                    beginInsertRows(QModelIndex(), 0, 0);
+                    m_sales.prepend(sale);
+                    endInsertRows();
+                    for (auto rit = rowById.begin(); rit != rowById.end(); ++rit)
+                        ++rit.value();
+                    rowById.insert(sale.id, 0);
+                }
+            }
+        }
+    }
+
+    // The totals were adjusted row by row above and, in cents, stay exact.
+    m_totalSales = m_sales.size();
+    Tracer::counter("model", "SalesModel rows", m_sales.size());
+    emit totalSalesChanged();
+    emit totalRevenueChanged();
+    emit salesChanged(upsertedIds, deletedIds);
+}
+
+bool SalesModel::canSnapshot() const
+{
+    return m_userId != -1 && !m_filtered;
+}
+
+SalesModel::Snapshot SalesModel::snapshot() const
+{
+    Snapshot snapshot;
+    snapshot.sales = m_sales;
+    snapshot.totalRevenue = m_totalRevenue;
+    snapshot.totalCost = m_totalCost;
+    snapshot.loaded = m_loaded;
+
+    snapshot.bytes = memoryBytes();
+    return snapshot;
+}
+
+qint64 SalesModel::memoryBytes() const
+{
+    qint64 bytes = MemoryEstimate::listBytes(m_sales);
+    for (const auto &sale : m_sales)
+        bytes += MemoryEstimate::stringBytes(sale.itemName);
+    return bytes;
+}
+
+bool SalesModel::releaseRows()
+{
+    Tracer::Scope trace("model", "SalesModel::releaseRows");
+    if (!m_loaded)
+        return false;
+
+    beginResetModel();
+    m_sales.clear();
+    m_filtered = false;
+    m_loaded = false;
+    m_totalSales = 0;
+    m_totalRevenue = 0;
+    m_totalCost = 0;
+    endResetModel();
+    emit totalSalesChanged();
+    emit totalRevenueChanged();
+    return true;
+}
+
+void SalesModel::restoreSnapshot(int userId, const Snapshot &snapshot)
+{
+    Tracer::Scope trace("model", "SalesModel::restoreSnapshot");
+    beginResetModel();
+    m_userId = userId;
+    m_sales = snapshot.sales;
+    m_totalRevenue = snapshot.totalRevenue;
+    m_totalCost = snapshot.totalCost;
+    m_totalSales = m_sales.size();
+    m_filtered = false;
+    m_loaded = snapshot.loaded;
     endResetModel();
     emit totalSalesChanged();
     emit totalRevenueChanged();
 }
 
+bool SalesModel::exportSales(const QString &filePath, const QString &format, const QVariantMap &filter)
+{
+    if (m_userId == -1) {
+        emit errorOccurred("User not set. Unable to export sales.");
+        return false;
+    }
+
+    StreamExporter::Request request = exportRequest(m_dbManager, m_userId, filter);
+    request.filePath = filePath;
+    if (!StreamExporter::parseFormat(format, &request.format)) {
+        emit errorOccurred(tr("Unknown export format: %1").arg(format));
+        return false;
+    }
+    if (!m_exporter->start(request)) {
+        emit errorOccurred("An export is already running.");
+        return false;
+    }
+    return true;
+}
+
+void SalesModel::cancelExport()
+{
+    m_exporter->cancel();
+}
+
+StreamExporter::Request SalesModel::exportRequest(const DatabaseManager *dbManager, int userId,
+                                                 const QVariantMap &filter)
+{
+    const QDate from = filter.value("from").toDate();
+
+    StreamExporter::Request request;
+    request.sql = "SELECT s.id, s.sale_date, s.item_id, i.name AS item_name, i.category, "
+                  "s.quantity, s.price / 100.0 AS price, s.total_price / 100.0 AS total_price "
+                  "FROM " + dbManager->salesSource(from) + " s "
+                  "LEFT JOIN Inventory i ON s.item_id = i.id "
+                  "WHERE s.user_id = :userId";
+    request.bindings.insert(":userId", userId);
+
+    if (from.isValid()) {
+        request.sql += " AND s.sale_date >= :from";
+        request.bindings.insert(":from", from);
+    }
+    const QDate to = filter.value("to").toDate();
+    if (to.isValid()) {
+        request.sql += " AND s.sale_date < :to";
+        request.bindings.insert(":to", to.addDays(1));
+    }
+    const QString category = filter.value("category").toString();
+    if (!category.isEmpty()) {
+        request.sql += " AND i.category = :category";
+        request.bindings.insert(":category", category);
+    }
+    request.sql += " ORDER BY s.id";
+    return request;
+}
+
 int SalesModel::totalSales() const
 {
     return m_totalSales;
@@ -197,5 +612,10 @@ int SalesModel::totalSales() const
 
 double SalesModel::totalRevenue() const
 {
-    return m_totalRevenue;
+    return Money::toUnits(m_totalRevenue);
+}
+
+double SalesModel::totalCost() const
+{
+    return Money::toUnits(m_totalCost);
 }
@@ -3,13 +3,22 @@
 
 #include <QAbstractListModel>
 #include <QDateTime>
+#include <QSqlQuery>
 #include "databasemanager.h"
+#include "money.h"
+#include "rowmapper.h"
+#include "streamexporter.h"
+
+class InventoryModel;
+class TillJournal;
 
 class SalesModel : public QAbstractListModel
 {
     Q_OBJECT
     Q_PROPERTY(int totalSales READ totalSales NOTIFY totalSalesChanged)
     Q_PROPERTY(double totalRevenue READ totalRevenue NOTIFY totalRevenueChanged)
+    // Cost of goods sold, maintained with the revenue.
+    Q_PROPERTY(double totalCost READ totalCost NOTIFY totalRevenueChanged)
 
 public:
     enum SalesRoles {
@@ -19,7 +28,9 @@ public:
         QuantityRole,
         PriceRole,
         TotalPriceRole,
-        SaleDateRole
+        SaleDateRole,
+        UnitCostRole,
+        TotalCostRole
     };
 
     explicit SalesModel(DatabaseManager *dbManager, QObject *parent = nullptr);
@@ -28,19 +39,51 @@ public:
     QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
     QHash<int, QByteArray> roleNames() const override;
 
+    // Like InventoryModel, rows are read on first use rather than here.
     void setUserId(int userId);
+    Q_INVOKABLE void ensureLoaded();
+    bool isLoaded() const;
+    // Needed for addSaleBySku, which resolves SKUs through its index.
+    void setInventoryModel(InventoryModel *inventoryModel);
+    // Offline-first checkout: with an open journal, sales are journaled and
+    // acknowledged without touching the shared database. They show up here
+    // once merged, through ChangeFeed like other terminals' sales.
+    void setTillJournal(TillJournal *tillJournal);
 
     Q_INVOKABLE bool addSale(int itemId, int quantity, double price);
+    // Scanner checkout: resolves sku in memory, takes the stock only if
+    // enough is on hand, and records the sale at the item's current price.
+    Q_INVOKABLE bool addSaleBySku(const QString &sku, int quantity = 1);
     Q_INVOKABLE void searchSales(const QString &searchText);
     Q_INVOKABLE void refresh();
+    void applyChanges(const QList<int> &upsertedIds, const QList<int> &deletedIds);
+
+    // Streams the user's sales to filePath without loading them into the
+    // model. Filter keys: "from", "to" (inclusive dates) and "category".
+    Q_INVOKABLE bool exportSales(const QString &filePath, const QString &format,
+                                 const QVariantMap &filter = QVariantMap());
+    Q_INVOKABLE void cancelExport();
+    static StreamExporter::Request exportRequest(const DatabaseManager *dbManager, int userId,
+                                                 const QVariantMap &filter);
 
     int totalSales() const;
     double totalRevenue() const;
+    double totalCost() const;
+
+    // Approximate heap footprint of the loaded rows; see MemoryEstimate.
+    qint64 memoryBytes() const;
+    // Pages the rows out to free memory until ensureLoaded() is called
+    // again. Returns false when nothing was loaded.
+    bool releaseRows();
 
 signals:
     void errorOccurred(const QString &error);
     void totalSalesChanged();
     void totalRevenueChanged();
+    // Every row change the model applies, local or from ChangeFeed.
+    void salesChanged(const QList<int> &upsertedIds, const QList<int> &deletedIds);
+    void exportProgress(qint64 rows);
+    void exportFinished(bool ok, qint64 rows, const QString &filePath, const QString &error);
 
 private:
     struct SaleItem {
@@ -48,16 +91,55 @@ private:
         int itemId;
         QString itemName;
         int quantity;
-        double price;
-        double totalPrice;
+        Money::Cents price;
+        Money::Cents totalPrice;
         QDateTime saleDate;
+        Money::Cents unitCost; // FIFO cost at the time of sale, rounded
+        Money::Cents totalCost;
+
+        static auto columns()
+        {
+            return std::make_tuple(column("id", &SaleItem::id),
+                                   column("item_id", &SaleItem::itemId),
+                                   column("item_name", &SaleItem::itemName),
+                                   column("quantity", &SaleItem::quantity),
+                                   column("price", &SaleItem::price),
+                                   column("total_price", &SaleItem::totalPrice),
+                                   column("sale_date", &SaleItem::saleDate),
+                                   column("unit_cost", &SaleItem::unitCost),
+                                   column("total_cost", &SaleItem::totalCost));
+        }
     };
 
     DatabaseManager *m_dbManager;
+    InventoryModel *m_inventoryModel;
+    TillJournal *m_tillJournal;
+    StreamExporter *m_exporter;
     int m_userId;
     QList<SaleItem> m_sales;
     int m_totalSales;
-    double m_totalRevenue;
+    Money::Cents m_totalRevenue; // both kept up to date row by row
+    Money::Cents m_totalCost;
+    bool m_filtered;
+    bool m_loaded;
+
+    bool journalSale(int itemId, int quantity, Money::Cents price);
+
+public:
+    // The user's loaded sales, as kept by SessionCache; see
+    // InventoryModel::Snapshot.
+    struct Snapshot {
+        QList<SaleItem> sales;
+        Money::Cents totalRevenue = 0;
+        Money::Cents totalCost = 0;
+        bool loaded = false;
+        qint64 bytes = 0; // estimated heap footprint
+    };
+
+    // False while a search has narrowed the rows to a subset.
+    bool canSnapshot() const;
+    Snapshot snapshot() const;
+    void restoreSnapshot(int userId, const Snapshot &snapshot);
 };
 
 #endif // SALESMODEL_H
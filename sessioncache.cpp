@@ -0,0 +1,105 @@
+#include "sessioncache.h"
+#include <QDebug>
+
+namespace {
+const qint64 DEFAULT_BUDGET_BYTES = 64 * 1024 * 1024;
+
+int costOf(qint64 bytes) { return int((bytes + 1023) / 1024); }
+} // namespace
+
+SessionCache::SessionCache(InventoryModel *inventoryModel,
+                           SalesModel *salesModel, UserDashboard *dashboard,
+                           ChangeFeed *changeFeed, QObject *parent)
+    : QObject(parent), m_inventoryModel(inventoryModel),
+      m_salesModel(salesModel), m_dashboard(dashboard),
+      m_changeFeed(changeFeed), m_hits(0), m_misses(0) {
+  m_entries.setMaxCost(costOf(DEFAULT_BUDGET_BYTES));
+}
+
+void SessionCache::activate(int userId) {
+  // The entry becomes the live state, so it leaves the cache until the
+  // user is stashed again.
+  Entry *entry = m_entries.take(userId);
+  if (!entry) {
+    ++m_misses;
+    emit statsChanged();
+    qDebug() << "SessionCache miss for user" << userId;
+    m_inventoryModel->setUserId(userId);
+    m_salesModel->setUserId(userId);
+    return;
+  }
+
+  ++m_hits;
+  m_inventoryModel->restoreSnapshot(userId, entry->inventory);
+  m_salesModel->restoreSnapshot(userId, entry->sales);
+  m_dashboard->restoreSnapshot(userId, entry->dashboard);
+
+  // Writes made from other terminals while this user was away arrive
+  // through the feed's usual signals and are applied row by row.
+  const int changes = m_changeFeed->resume(userId, entry->sequence);
+  if (changes < 0)
+    m_dashboard->refresh();
+  else if (changes > 0)
+    m_dashboard->recalculate();
+
+  qDebug() << "SessionCache hit for user" << userId << "with" << changes
+           << "changes to catch up";
+  delete entry;
+  emit statsChanged();
+}
+
+void SessionCache::stash(int userId) {
+  if (userId == -1)
+    return;
+
+  // A filtered view is only part of the data and cannot be restored.
+  if (!m_inventoryModel->canSnapshot() || !m_salesModel->canSnapshot()) {
+    qDebug() << "SessionCache skipping user" << userId << "while a search is active";
+    m_entries.remove(userId);
+    emit statsChanged();
+    return;
+  }
+
+  auto *entry = new Entry;
+  entry->inventory = m_inventoryModel->snapshot();
+  entry->sales = m_salesModel->snapshot();
+  entry->dashboard = m_dashboard->snapshot();
+  entry->sequence = m_changeFeed->lastSequence();
+
+  const qint64 bytes = entry->inventory.bytes + entry->sales.bytes +
+                       entry->dashboard.bytes + qint64(sizeof(Entry));
+  // QCache deletes the entry itself when it alone exceeds the budget.
+  if (!m_entries.insert(userId, entry, costOf(bytes)))
+    qDebug() << "SessionCache entry for user" << userId << "exceeds the budget:" << bytes << "bytes";
+  emit statsChanged();
+}
+
+void SessionCache::clear() {
+  m_entries.clear();
+  emit statsChanged();
+}
+
+double SessionCache::hitRate() const {
+  const int lookups = m_hits + m_misses;
+  return lookups > 0 ? double(m_hits) / lookups : 0.0;
+}
+
+int SessionCache::hits() const { return m_hits; }
+
+int SessionCache::misses() const { return m_misses; }
+
+int SessionCache::entryCount() const { return m_entries.count(); }
+
+qint64 SessionCache::residentBytes() const {
+  return qint64(m_entries.totalCost()) * 1024;
+}
+
+qint64 SessionCache::budgetBytes() const {
+  return qint64(m_entries.maxCost()) * 1024;
+}
+
+void SessionCache::setBudgetBytes(qint64 bytes) {
+  // Lowering the budget evicts least recently used entries straight away.
+  m_entries.setMaxCost(costOf(qMax<qint64>(bytes, 0)));
+  emit statsChanged();
+}
@@ -0,0 +1,66 @@
+#ifndef SESSIONCACHE_H
+#define SESSIONCACHE_H
+
+#include <QCache>
+#include <QObject>
+#include "changefeed.h"
+#include "inventorymodel.h"
+#include "salesmodel.h"
+#include "userdashboard.h"
+
+// Keeps the loaded models and dashboard aggregates of recently active users
+// so that switching back to one is a swap of implicitly shared lists plus a
+// ChangeLog catch-up instead of a reload. Entries are evicted least recently
+// used first once their estimated size exceeds the memory budget.
+class SessionCache : public QObject
+{
+    Q_OBJECT
+    Q_PROPERTY(double hitRate READ hitRate NOTIFY statsChanged)
+    Q_PROPERTY(int hits READ hits NOTIFY statsChanged)
+    Q_PROPERTY(int misses READ misses NOTIFY statsChanged)
+    Q_PROPERTY(int entryCount READ entryCount NOTIFY statsChanged)
+    Q_PROPERTY(qint64 residentBytes READ residentBytes NOTIFY statsChanged)
+    Q_PROPERTY(qint64 budgetBytes READ budgetBytes WRITE setBudgetBytes NOTIFY statsChanged)
+
+public:
+    SessionCache(InventoryModel *inventoryModel, SalesModel *salesModel,
+                 UserDashboard *dashboard, ChangeFeed *changeFeed, QObject *parent = nullptr);
+
+    // Puts userId's state into the models: from the cache when it holds an
+    // entry, otherwise by loading it. The database must already be
+    // activated for userId.
+    void activate(int userId);
+    // Keeps the current state of userId before the models move on.
+    void stash(int userId);
+    Q_INVOKABLE void clear();
+
+    double hitRate() const;
+    int hits() const;
+    int misses() const;
+    int entryCount() const;
+    qint64 residentBytes() const;
+    qint64 budgetBytes() const;
+    void setBudgetBytes(qint64 bytes);
+
+signals:
+    void statsChanged();
+
+private:
+    struct Entry {
+        InventoryModel::Snapshot inventory;
+        SalesModel::Snapshot sales;
+        UserDashboard::Snapshot dashboard;
+        qint64 sequence = 0; // last ChangeLog entry reflected in the snapshots
+    };
+
+    InventoryModel *m_inventoryModel;
+    SalesModel *m_salesModel;
+    UserDashboard *m_dashboard;
+    ChangeFeed *m_changeFeed;
+    // Costs are in KiB so large budgets fit QCache's int cost.
+    QCache<int, Entry> m_entries;
+    int m_hits;
+    int m_misses;
+};
+
+#endif // SESSIONCACHE_H
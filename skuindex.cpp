@@ -0,0 +1,146 @@
+#include "skuindex.h"
+
+namespace {
+const int MIN_CAPACITY = 16;
+
+int capacityFor(int count) {
+    // Keep the load factor, tombstones included, at or below 0.7.
+    int capacity = MIN_CAPACITY;
+    while (capacity * 7 < count * 10)
+        capacity *= 2;
+    return capacity;
+}
+} // namespace
+
+void SkuIndex::clear()
+{
+    m_slots.clear();
+    m_size = 0;
+    m_removed = 0;
+    m_skuByItem.clear();
+}
+
+void SkuIndex::reserve(int count)
+{
+    if (capacityFor(count) > m_slots.size())
+        rehash(capacityFor(count));
+    m_skuByItem.reserve(count);
+}
+
+void SkuIndex::insert(int itemId, const QString &sku)
+{
+    removeItem(itemId);
+    if (sku.isEmpty())
+        return;
+
+    if (m_slots.isEmpty() || (m_size + m_removed + 1) * 10 > m_slots.size() * 7)
+        rehash(capacityFor(m_size + 1));
+
+    const uint hash = qHash(sku);
+    const int mask = m_slots.size() - 1;
+    int firstRemoved = -1;
+    for (int i = int(hash) & mask;; i = (i + 1) & mask) {
+        Slot &slot = m_slots[i];
+        if (slot.state == Occupied && slot.hash == hash && slot.sku == sku) {
+            // The SKU moved to another item; the unique index in the
+            // database makes this rare, but the latest write wins.
+            m_skuByItem.remove(slot.itemId);
+            slot.itemId = itemId;
+            m_skuByItem.insert(itemId, sku);
+            return;
+        }
+        if (slot.state == Removed && firstRemoved == -1)
+            firstRemoved = i;
+        if (slot.state == Empty) {
+            Slot &target = firstRemoved != -1 ? m_slots[firstRemoved] : slot;
+            if (firstRemoved != -1)
+                --m_removed;
+            target.sku = sku;
+            target.hash = hash;
+            target.itemId = itemId;
+            target.state = Occupied;
+            ++m_size;
+            m_skuByItem.insert(itemId, sku);
+            return;
+        }
+    }
+}
+
+void SkuIndex::removeItem(int itemId)
+{
+    auto it = m_skuByItem.find(itemId);
+    if (it == m_skuByItem.end())
+        return;
+    const QString sku = it.value();
+    m_skuByItem.erase(it);
+    eraseSku(sku);
+}
+
+int SkuIndex::find(const QString &sku) const
+{
+    if (m_slots.isEmpty() || sku.isEmpty())
+        return -1;
+    const int slot = findSlot(sku, qHash(sku));
+    return slot == -1 ? -1 : m_slots.at(slot).itemId;
+}
+
+int SkuIndex::size() const
+{
+    return m_size;
+}
+
+qint64 SkuIndex::memoryBytes() const
+{
+    qint64 bytes = m_slots.capacity() * qint64(sizeof(Slot))
+                   + m_skuByItem.size() * qint64(sizeof(int) + sizeof(QString) + 2 * sizeof(void *));
+    // Each SKU string is shared between the table and the reverse map.
+    for (auto it = m_skuByItem.constBegin(); it != m_skuByItem.constEnd(); ++it)
+        bytes += it.value().size() * qint64(sizeof(QChar));
+    return bytes;
+}
+
+int SkuIndex::findSlot(const QString &sku, uint hash) const
+{
+    const int mask = m_slots.size() - 1;
+    for (int i = int(hash) & mask;; i = (i + 1) & mask) {
+        const Slot &slot = m_slots.at(i);
+        if (slot.state == Empty)
+            return -1;
+        if (slot.state == Occupied && slot.hash == hash && slot.sku == sku)
+            return i;
+    }
+}
+
+void SkuIndex::eraseSku(const QString &sku)
+{
+    if (m_slots.isEmpty())
+        return;
+    const int i = findSlot(sku, qHash(sku));
+    if (i == -1)
+        return;
+    Slot &slot = m_slots[i];
+    slot.sku.clear();
+    slot.itemId = -1;
+    slot.state = Removed;
+    --m_size;
+    ++m_removed;
+}
+
+void SkuIndex::rehash(int capacity)
+{
+    const QVector<Slot> old = m_slots;
+    m_slots = QVector<Slot>(capacity);
+    m_size = 0;
+    m_removed = 0;
+
+    const int mask = capacity - 1;
+    for (const Slot &slot : old) {
+        if (slot.state != Occupied)
+            continue;
+        int i = int(slot.hash) & mask;
+        while (m_slots.at(i).state != Empty)
+            i = (i + 1) & mask;
+        m_slots[i] = slot;
+        ++m_size;
+    }
+}
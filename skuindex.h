@@ -0,0 +1,46 @@
+#ifndef SKUINDEX_H
+#define SKUINDEX_H
+
+#include <QHash>
+#include <QString>
+#include <QVector>
+
+// SKU/barcode -> item id lookup for scanner-driven checkout. The lookup path
+// is a single open-addressing table with linear probing and cached hashes, so
+// a scan resolves in one or two probes without touching the item list. The
+// reverse map is only used to keep the table current when an item's SKU
+// changes or the item is deleted.
+class SkuIndex
+{
+public:
+    void clear();
+    void reserve(int count);
+    // Associates sku with itemId, replacing the item's previous SKU. An empty
+    // sku just removes the item.
+    void insert(int itemId, const QString &sku);
+    void removeItem(int itemId);
+    int find(const QString &sku) const; // -1 when unknown
+    int size() const;
+    qint64 memoryBytes() const;
+
+private:
+    enum SlotState : quint8 { Empty, Occupied, Removed };
+
+    struct Slot {
+        QString sku;
+        uint hash = 0;
+        int itemId = -1;
+        SlotState state = Empty;
+    };
+
+    QVector<Slot> m_slots; // size is zero or a power of two
+    int m_size = 0;
+    int m_removed = 0;
+    QHash<int, QString> m_skuByItem;
+
+    int findSlot(const QString &sku, uint hash) const;
+    void eraseSku(const QString &sku);
+    void rehash(int capacity);
+};
+
+#endif // SKUINDEX_H
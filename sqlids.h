@@ -0,0 +1,34 @@
+#ifndef SQLIDS_H
+#define SQLIDS_H
+
+#include <QList>
+#include <QString>
+#include <QStringList>
+
+// Row ids inlined into "IN (...)" lists by the bulk statements. Ids are
+// integers, so they need no binding; but a statement has a length limit, so
+// long lists are run in chunks of CHUNK_SIZE ids, one statement each.
+namespace SqlIds {
+
+const int CHUNK_SIZE = 5000;
+
+inline QString list(const QList<int> &ids)
+{
+    QStringList list;
+    list.reserve(ids.size());
+    for (int id : ids)
+        list.append(QString::number(id));
+    return list.join(',');
+}
+
+inline QList<QList<int>> chunks(const QList<int> &ids, int size = CHUNK_SIZE)
+{
+    QList<QList<int>> chunks;
+    for (int i = 0; i < ids.size(); i += size)
+        chunks.append(ids.mid(i, size));
+    return chunks;
+}
+
+} // namespace SqlIds
+
+#endif // SQLIDS_H
@@ -0,0 +1,130 @@
+#include "startuptimeline.h"
+#include <QFile>
+#include <QMutexLocker>
+#include <QQuickWindow>
+#include <QTextStream>
+#include <QThread>
+#include <algorithm>
+#include <atomic>
+
+namespace {
+std::atomic<StartupTimeline *> activeTimeline{nullptr};
+
+QString milliseconds(qint64 ns) { return QString::number(ns / 1e6, 'f', 3); }
+} // namespace
+
+StartupTimeline::StartupTimeline(bool fastStart, QObject *parent)
+    : QObject(parent), m_fastStart(fastStart), m_firstFrameShown(false) {
+  m_clock.start();
+}
+
+StartupTimeline::~StartupTimeline() {
+  StartupTimeline *self = this;
+  activeTimeline.compare_exchange_strong(self, nullptr);
+}
+
+StartupTimeline *StartupTimeline::active() { return activeTimeline.load(); }
+
+void StartupTimeline::setActive(StartupTimeline *timeline) {
+  activeTimeline.store(timeline);
+}
+
+StartupTimeline::Scope::Scope(const char *phase)
+    : m_timeline(StartupTimeline::active()), m_phase(phase),
+      m_startNs(m_timeline ? m_timeline->elapsedNs() : 0) {}
+
+StartupTimeline::Scope::~Scope() {
+  if (m_timeline)
+    m_timeline->record(QString::fromLatin1(m_phase), m_startNs,
+                       m_timeline->elapsedNs());
+}
+
+bool StartupTimeline::fastStart() const { return m_fastStart; }
+
+qint64 StartupTimeline::elapsedNs() const { return m_clock.nsecsElapsed(); }
+
+void StartupTimeline::record(const QString &phase, qint64 startNs,
+                             qint64 endNs) {
+  Phase entry;
+  entry.name = phase;
+  entry.startNs = startNs;
+  entry.endNs = endNs;
+  entry.mainThread = QThread::currentThread() == thread();
+  QMutexLocker locker(&m_mutex);
+  m_phases.append(entry);
+}
+
+void StartupTimeline::mark(const QString &phase) {
+  const qint64 now = elapsedNs();
+  record(phase, now, now);
+}
+
+void StartupTimeline::watchFirstFrame(QQuickWindow *window) {
+  // frameSwapped comes from the render thread.
+  m_frameConnection =
+      connect(window, &QQuickWindow::frameSwapped, this,
+              &StartupTimeline::markFirstFrame, Qt::QueuedConnection);
+}
+
+bool StartupTimeline::isFirstFrameShown() const { return m_firstFrameShown; }
+
+void StartupTimeline::markFirstFrame() {
+  if (m_firstFrameShown)
+    return;
+  m_firstFrameShown = true;
+  disconnect(m_frameConnection);
+  mark("first frame");
+  emit firstFrameShown();
+}
+
+QVector<StartupTimeline::Phase> StartupTimeline::phases() const {
+  QVector<Phase> phases;
+  {
+    QMutexLocker locker(&m_mutex);
+    phases = m_phases;
+  }
+  // Scopes are recorded when they end, so nested ones come first.
+  std::stable_sort(phases.begin(), phases.end(),
+                   [](const Phase &a, const Phase &b) {
+                     return a.startNs < b.startNs;
+                   });
+  return phases;
+}
+
+QString StartupTimeline::report() const {
+  QString text;
+  QTextStream out(&text);
+  out << "Start-up timeline (ms since main(), "
+      << (m_fastStart ? "fast start" : "normal start") << ")\n";
+  out << qSetFieldWidth(10) << "start" << "duration" << qSetFieldWidth(0)
+      << "  thread  phase\n";
+  for (const Phase &phase : phases()) {
+    out << qSetFieldWidth(10) << milliseconds(phase.startNs);
+    if (phase.endNs > phase.startNs)
+      out << milliseconds(phase.endNs - phase.startNs);
+    else
+      out << "-";
+    out << qSetFieldWidth(0) << "  " << (phase.mainThread ? "main  " : "worker")
+        << "  " << phase.name << "\n";
+  }
+  out.flush();
+  return text;
+}
+
+bool StartupTimeline::dump(const QString &filePath, QString *error) const {
+  QFile file;
+  bool opened;
+  if (filePath == "-") {
+    opened = file.open(stderr, QIODevice::WriteOnly);
+  } else {
+    file.setFileName(filePath);
+    opened = file.open(QIODevice::WriteOnly | QIODevice::Truncate |
+                       QIODevice::Text);
+  }
+  if (!opened || file.write(report().toUtf8()) == -1) {
+    if (error)
+      *error = file.errorString();
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,80 @@
+#ifndef STARTUPTIMELINE_H
+#define STARTUPTIMELINE_H
+
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QObject>
+#include <QVector>
+
+class QQuickWindow;
+
+// Where start-up time goes: named phases on the monotonic clock, measured
+// from the moment main() created the timeline. Phases may be recorded from
+// worker threads. Recording costs a pointer check when no timeline is
+// active, so the scopes stay in place in release builds.
+class StartupTimeline : public QObject
+{
+    Q_OBJECT
+    Q_PROPERTY(bool fastStart READ fastStart CONSTANT)
+
+public:
+    struct Phase {
+        QString name;
+        qint64 startNs = 0;
+        qint64 endNs = 0; // equal to startNs for a mark
+        bool mainThread = true;
+    };
+
+    explicit StartupTimeline(bool fastStart, QObject *parent = nullptr);
+    ~StartupTimeline();
+
+    // The timeline Scope records to, or nullptr when there is none.
+    static StartupTimeline *active();
+    static void setActive(StartupTimeline *timeline);
+
+    // Times the enclosing block as one phase.
+    class Scope
+    {
+    public:
+        explicit Scope(const char *phase);
+        ~Scope();
+
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+
+    private:
+        StartupTimeline *m_timeline;
+        const char *m_phase;
+        qint64 m_startNs;
+    };
+
+    bool fastStart() const;
+    qint64 elapsedNs() const;
+    void record(const QString &phase, qint64 startNs, qint64 endNs);
+    // A point in time rather than a span, e.g. "login view created".
+    Q_INVOKABLE void mark(const QString &phase);
+    // Marks "first frame" once the window has put its first frame on screen.
+    void watchFirstFrame(QQuickWindow *window);
+    bool isFirstFrameShown() const;
+    QVector<Phase> phases() const;
+    // One line per phase, in start order.
+    Q_INVOKABLE QString report() const;
+    // Writes report() to filePath, or to stderr for "-".
+    bool dump(const QString &filePath, QString *error = nullptr) const;
+
+signals:
+    void firstFrameShown();
+
+private slots:
+    void markFirstFrame();
+
+private:
+    bool m_fastStart;
+    QElapsedTimer m_clock;
+    mutable QMutex m_mutex;
+    QVector<Phase> m_phases;
+    bool m_firstFrameShown;
+    QMetaObject::Connection m_frameConnection;
+};
+
+#endif // STARTUPTIMELINE_H
@@ -0,0 +1,491 @@
+#include "stockledger.h"
+#include <QDebug>
+#include <QSqlError>
+#include <QSqlQuery>
+#include "rowmapper.h"
+#include "sqlids.h"
+
+namespace {
+struct LevelRow {
+  int itemId;
+  QString name;
+  int quantity;
+  Money::Cents unitPrice;
+
+  static auto columns() {
+    return std::make_tuple(column("item_id", &LevelRow::itemId),
+                           column("name", &LevelRow::name),
+                           column("quantity", &LevelRow::quantity),
+                           column("unit_price", &LevelRow::unitPrice));
+  }
+};
+
+// Sums the snapshot taken at :base and the movements from :base up to
+// :before per item. With one max() in the query, SQLite takes the bare
+// unit_price column from the row holding the maximum, i.e. the latest.
+const char *LEVELS_SQL =
+    "SELECT l.item_id, i.name, SUM(l.delta) AS quantity, l.unit_price, "
+    "MAX(l.seq) AS seq "
+    "FROM ("
+    " SELECT item_id, quantity AS delta, unit_price, 0 AS seq "
+    " FROM StockSnapshots WHERE user_id = :userId AND taken_at = :base"
+    " UNION ALL"
+    " SELECT item_id, delta, unit_price, id AS seq "
+    " FROM StockMovements WHERE user_id = :userId "
+    " AND moved_at >= :base AND moved_at < :before"
+    ") l "
+    "LEFT JOIN Inventory i ON i.id = l.item_id "
+    "%1 "
+    "GROUP BY l.item_id "
+    "HAVING SUM(l.delta) <> 0";
+
+bool latestSnapshot(QSqlDatabase db, int userId, const QDateTime &before,
+                    QVariant *base, QString *error) {
+  QSqlQuery query(db);
+  query.prepare("SELECT MAX(taken_at) FROM StockSnapshots "
+                "WHERE user_id = :userId AND taken_at <= :before");
+  query.bindValue(":userId", userId);
+  query.bindValue(":before", before);
+  if (!query.exec() || !query.next()) {
+    *error = query.lastError().text();
+    return false;
+  }
+  // With no snapshot yet, every movement counts.
+  *base = query.isNull(0) ? QVariant(QString("")) : query.value(0);
+  return true;
+}
+} // namespace
+
+StockLedger::StockLedger(DatabaseManager *dbManager, QObject *parent)
+    : QObject(parent), m_dbManager(dbManager), m_userId(-1) {}
+
+void StockLedger::setUserId(int userId) {
+  m_userId = userId;
+  if (userId == -1)
+    return;
+
+  QString error;
+  if (!takeMonthlySnapshots(m_dbManager->database(), userId, &error))
+    qWarning() << "Stock snapshots not taken:" << error;
+}
+
+void StockLedger::takeDueSnapshots() {
+  if (!m_dbManager->isReady())
+    return;
+
+  // A shard only holds its own user's ledger; other shards catch up when
+  // their user next logs in.
+  QString error;
+  bool ok = true;
+  if (m_dbManager->isSharded()) {
+    if (m_userId != -1)
+      ok = takeMonthlySnapshots(m_dbManager->database(), m_userId, &error);
+  } else {
+    ok = takeAllMonthlySnapshots(m_dbManager->database(), &error);
+  }
+  if (!ok)
+    qWarning() << "Stock snapshots not taken:" << error;
+}
+
+int StockLedger::stockAt(int itemId, const QDate &date) {
+  if (m_userId == -1) {
+    emit errorOccurred("User not set. Unable to read stock history.");
+    return 0;
+  }
+
+  QVector<Level> levels;
+  QString error;
+  if (!levelsAt(m_dbManager->database(), m_userId, endOfDay(date), itemId,
+                &levels, &error)) {
+    emit errorOccurred(tr("Failed to read stock history: %1").arg(error));
+    return 0;
+  }
+  return levels.isEmpty() ? 0 : levels.first().quantity;
+}
+
+double StockLedger::stockValueAt(const QDate &date) {
+  if (m_userId == -1) {
+    emit errorOccurred("User not set. Unable to read stock history.");
+    return 0.0;
+  }
+
+  QVector<Level> levels;
+  QString error;
+  if (!levelsAt(m_dbManager->database(), m_userId, endOfDay(date), -1,
+                &levels, &error)) {
+    emit errorOccurred(tr("Failed to read stock history: %1").arg(error));
+    return 0.0;
+  }
+
+  Money::Cents value = 0;
+  for (const Level &level : levels)
+    value += level.quantity * level.unitPrice;
+  return Money::toUnits(value);
+}
+
+QVariantList StockLedger::valuationAt(const QDate &date) {
+  QVariantList valuation;
+  if (m_userId == -1) {
+    emit errorOccurred("User not set. Unable to read stock history.");
+    return valuation;
+  }
+
+  QVector<Level> levels;
+  QString error;
+  if (!levelsAt(m_dbManager->database(), m_userId, endOfDay(date), -1,
+                &levels, &error)) {
+    emit errorOccurred(tr("Failed to read stock history: %1").arg(error));
+    return valuation;
+  }
+
+  valuation.reserve(levels.size());
+  for (const Level &level : levels) {
+    QVariantMap map;
+    map["itemId"] = level.itemId;
+    map["name"] = level.name;
+    map["quantity"] = level.quantity;
+    map["unitPrice"] = Money::toUnits(level.unitPrice);
+    map["value"] = Money::toUnits(level.quantity * level.unitPrice);
+    valuation.append(map);
+  }
+  return valuation;
+}
+
+bool StockLedger::levelsAt(QSqlDatabase db, int userId,
+                           const QDateTime &before, int itemId,
+                           QVector<Level> *levels, QString *error) {
+  QVariant base;
+  if (!latestSnapshot(db, userId, before, &base, error))
+    return false;
+
+  QSqlQuery query(db);
+  query.setForwardOnly(true);
+  query.prepare(QString(LEVELS_SQL)
+                    .arg(itemId == -1 ? "" : "WHERE l.item_id = :itemId"));
+  query.bindValue(":userId", userId);
+  query.bindValue(":base", base);
+  query.bindValue(":before", before);
+  if (itemId != -1)
+    query.bindValue(":itemId", itemId);
+  if (!query.exec()) {
+    *error = query.lastError().text();
+    return false;
+  }
+
+  levels->clear();
+  const RowMapper<LevelRow> mapper(query);
+  while (query.next()) {
+    const LevelRow row = mapper.read(query);
+    levels->append({row.itemId, row.name, row.quantity, row.unitPrice});
+  }
+  return true;
+}
+
+bool StockLedger::takeMonthlySnapshots(QSqlDatabase db, int userId,
+                                       QString *error) {
+  QSqlQuery query(db);
+  query.prepare("SELECT (SELECT MAX(taken_at) FROM StockSnapshots "
+                "WHERE user_id = :userId), "
+                "(SELECT MIN(moved_at) FROM StockMovements "
+                "WHERE user_id = :userId)");
+  query.bindValue(":userId", userId);
+  if (!query.exec() || !query.next()) {
+    *error = query.lastError().text();
+    return false;
+  }
+  const QVariant from = query.isNull(0) ? query.value(1) : query.value(0);
+  if (from.isNull())
+    return true; // no history yet
+
+  // Month starts after the latest snapshot (or first movement) up to and
+  // including the current one. Each is computed from the one before it.
+  const QDate fromDate = from.toDateTime().date();
+  QDate boundary = QDate(fromDate.year(), fromDate.month(), 1).addMonths(1);
+  const QDate today = QDate::currentDate();
+  const QDate last = QDate(today.year(), today.month(), 1);
+
+  for (; boundary <= last; boundary = boundary.addMonths(1)) {
+    const QDateTime takenAt(boundary, QTime(0, 0));
+    QVector<Level> levels;
+    if (!levelsAt(db, userId, takenAt, -1, &levels, error))
+      return false;
+
+    if (!db.transaction()) {
+      *error = db.lastError().text();
+      return false;
+    }
+    query.prepare("INSERT OR REPLACE INTO StockSnapshots "
+                  "(user_id, taken_at, item_id, quantity, unit_price) "
+                  "VALUES (:userId, :takenAt, :itemId, :quantity, :unitPrice)");
+    for (const Level &level : levels) {
+      query.bindValue(":userId", userId);
+      query.bindValue(":takenAt", takenAt);
+      query.bindValue(":itemId", level.itemId);
+      query.bindValue(":quantity", level.quantity);
+      query.bindValue(":unitPrice", level.unitPrice);
+      if (!query.exec()) {
+        *error = query.lastError().text();
+        db.rollback();
+        return false;
+      }
+    }
+    if (!db.commit()) {
+      *error = db.lastError().text();
+      db.rollback();
+      return false;
+    }
+  }
+  return true;
+}
+
+bool StockLedger::takeAllMonthlySnapshots(QSqlDatabase db, QString *error) {
+  QSqlQuery query(db);
+  query.setForwardOnly(true);
+  if (!query.exec("SELECT DISTINCT user_id FROM StockMovements")) {
+    *error = query.lastError().text();
+    return false;
+  }
+  QList<int> userIds;
+  while (query.next())
+    userIds.append(query.value(0).toInt());
+  query.finish();
+
+  for (int userId : userIds) {
+    if (!takeMonthlySnapshots(db, userId, error))
+      return false;
+  }
+  return true;
+}
+
+bool StockLedger::record(QSqlDatabase db, int userId, int itemId, Kind kind,
+                         int delta, const QVariant &refId, QString *error) {
+  if (delta == 0)
+    return true;
+
+  QSqlQuery query(db);
+  query.prepare("INSERT INTO StockMovements "
+                "(user_id, item_id, kind, delta, unit_price, ref_id, moved_at) "
+                "SELECT :userId, id, :kind, :delta, price, :refId, :movedAt "
+                "FROM Inventory WHERE id = :itemId AND user_id = :userId");
+  query.bindValue(":userId", userId);
+  query.bindValue(":kind", kindName(kind));
+  query.bindValue(":delta", delta);
+  query.bindValue(":refId", refId);
+  query.bindValue(":movedAt", QDateTime::currentDateTime());
+  query.bindValue(":itemId", itemId);
+  if (!query.exec()) {
+    *error = query.lastError().text();
+    return false;
+  }
+
+  // Sales have already taken their cost with issue().
+  if (delta > 0)
+    return addLayer(db, userId, itemId, delta, QVariant(), error);
+  if (kind == Sale)
+    return true;
+  Money::Cents cost = 0;
+  return issue(db, userId, itemId, -delta, &cost, error);
+}
+
+bool StockLedger::recordRestate(QSqlDatabase db, int userId, int itemId,
+                                int newQuantity, const QVariant &newPrice,
+                                QString *error) {
+  QSqlQuery query(db);
+  query.prepare("SELECT quantity, price FROM Inventory "
+                "WHERE id = :itemId AND user_id = :userId");
+  query.bindValue(":itemId", itemId);
+  query.bindValue(":userId", userId);
+  if (!query.exec()) {
+    *error = query.lastError().text();
+    return false;
+  }
+  if (!query.next())
+    return true; // the writer will find no row either
+
+  const int delta = newQuantity - query.value(0).toInt();
+  const Money::Cents price = newPrice.isNull() ? query.value(1).toLongLong()
+                                               : newPrice.toLongLong();
+  // A price change alone is logged as a zero movement so that later
+  // valuations pick up the new price.
+  if (delta == 0 && price == query.value(1).toLongLong())
+    return true;
+
+  query.prepare("INSERT INTO StockMovements "
+                "(user_id, item_id, kind, delta, unit_price, moved_at) "
+                "VALUES (:userId, :itemId, 'adjustment', :delta, :price, "
+                ":movedAt)");
+  query.bindValue(":userId", userId);
+  query.bindValue(":itemId", itemId);
+  query.bindValue(":delta", delta);
+  query.bindValue(":price", price);
+  query.bindValue(":movedAt", QDateTime::currentDateTime());
+  if (!query.exec()) {
+    *error = query.lastError().text();
+    return false;
+  }
+
+  if (delta > 0)
+    return addLayer(db, userId, itemId, delta, price, error);
+  if (delta < 0) {
+    Money::Cents cost = 0;
+    return issue(db, userId, itemId, -delta, &cost, error);
+  }
+  return true;
+}
+
+bool StockLedger::issue(QSqlDatabase db, int userId, int itemId, int quantity,
+                        Money::Cents *totalCost, QString *error) {
+  *totalCost = 0;
+  QSqlQuery query(db);
+  query.setForwardOnly(true);
+  query.prepare("SELECT id, remaining, unit_cost FROM CostLayers "
+                "WHERE user_id = :userId AND item_id = :itemId "
+                "ORDER BY id");
+  query.bindValue(":userId", userId);
+  query.bindValue(":itemId", itemId);
+  if (!query.exec()) {
+    *error = query.lastError().text();
+    return false;
+  }
+
+  // Oldest layers first. Usually one or two rows are read.
+  int left = quantity;
+  int exhaustedUpTo = -1;
+  int partialId = -1;
+  int partialTaken = 0;
+  while (left > 0 && query.next()) {
+    const int id = query.value(0).toInt();
+    const int remaining = query.value(1).toInt();
+    const Money::Cents unitCost = query.value(2).toLongLong();
+    const int taken = qMin(left, remaining);
+    *totalCost += taken * unitCost;
+    left -= taken;
+    if (taken == remaining) {
+      exhaustedUpTo = id;
+    } else {
+      partialId = id;
+      partialTaken = taken;
+    }
+  }
+  query.finish();
+
+  if (exhaustedUpTo != -1) {
+    query.prepare("DELETE FROM CostLayers WHERE user_id = :userId "
+                  "AND item_id = :itemId AND id <= :id");
+    query.bindValue(":userId", userId);
+    query.bindValue(":itemId", itemId);
+    query.bindValue(":id", exhaustedUpTo);
+    if (!query.exec()) {
+      *error = query.lastError().text();
+      return false;
+    }
+  }
+  if (partialId != -1) {
+    query.prepare("UPDATE CostLayers SET remaining = remaining - :taken "
+                  "WHERE id = :id");
+    query.bindValue(":taken", partialTaken);
+    query.bindValue(":id", partialId);
+    if (!query.exec()) {
+      *error = query.lastError().text();
+      return false;
+    }
+  }
+
+  // Stock sold beyond the recorded layers is costed at the current price.
+  if (left > 0) {
+    query.prepare("SELECT price FROM Inventory WHERE id = :itemId");
+    query.bindValue(":itemId", itemId);
+    if (!query.exec()) {
+      *error = query.lastError().text();
+      return false;
+    }
+    if (query.next())
+      *totalCost += left * query.value(0).toLongLong();
+  }
+  return true;
+}
+
+bool StockLedger::addLayer(QSqlDatabase db, int userId, int itemId,
+                           int quantity, const QVariant &unitCost,
+                           QString *error) {
+  QSqlQuery query(db);
+  query.prepare("INSERT INTO CostLayers "
+                "(user_id, item_id, remaining, unit_cost, received_at) "
+                "SELECT :userId, id, :quantity, COALESCE(:unitCost, price), "
+                ":receivedAt FROM Inventory "
+                "WHERE id = :itemId AND user_id = :userId");
+  query.bindValue(":userId", userId);
+  query.bindValue(":quantity", quantity);
+  query.bindValue(":unitCost", unitCost);
+  query.bindValue(":receivedAt", QDateTime::currentDateTime());
+  query.bindValue(":itemId", itemId);
+  if (!query.exec()) {
+    *error = query.lastError().text();
+    return false;
+  }
+  return true;
+}
+
+bool StockLedger::recordPrices(QSqlDatabase db, int userId,
+                               const QString &category, QString *error) {
+  QSqlQuery query(db);
+  query.prepare("INSERT INTO StockMovements "
+                "(user_id, item_id, kind, delta, unit_price, moved_at) "
+                "SELECT user_id, id, 'adjustment', 0, price, :movedAt "
+                "FROM Inventory "
+                "WHERE user_id = :userId AND category = :category");
+  query.bindValue(":movedAt", QDateTime::currentDateTime());
+  query.bindValue(":userId", userId);
+  query.bindValue(":category", category);
+  if (!query.exec()) {
+    *error = query.lastError().text();
+    return false;
+  }
+  return true;
+}
+
+bool StockLedger::recordRemoval(QSqlDatabase db, int userId,
+                                const QList<int> &itemIds, QString *error) {
+  const QDateTime now = QDateTime::currentDateTime();
+  QSqlQuery query(db);
+  for (const QList<int> &chunk : SqlIds::chunks(itemIds)) {
+    query.prepare(QString("INSERT INTO StockMovements (user_id, item_id, "
+                          "kind, delta, unit_price, moved_at) "
+                          "SELECT user_id, id, 'adjustment', -quantity, price, "
+                          ":movedAt FROM Inventory "
+                          "WHERE user_id = :userId AND id IN (%1)")
+                      .arg(SqlIds::list(chunk)));
+    query.bindValue(":movedAt", now);
+    query.bindValue(":userId", userId);
+    if (!query.exec()) {
+      *error = query.lastError().text();
+      return false;
+    }
+
+    query.prepare(QString("DELETE FROM CostLayers WHERE user_id = :userId "
+                          "AND item_id IN (%1)")
+                      .arg(SqlIds::list(chunk)));
+    query.bindValue(":userId", userId);
+    if (!query.exec()) {
+      *error = query.lastError().text();
+      return false;
+    }
+  }
+  return true;
+}
+
+QDateTime StockLedger::endOfDay(const QDate &date) {
+  return QDateTime(date.addDays(1), QTime(0, 0));
+}
+
+QString StockLedger::kindName(Kind kind) {
+  switch (kind) {
+  case Receipt:
+    return "receipt";
+  case Sale:
+    return "sale";
+  case Adjustment:
+    break;
+  }
+  return "adjustment";
+}
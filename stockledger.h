@@ -0,0 +1,92 @@
+#ifndef STOCKLEDGER_H
+#define STOCKLEDGER_H
+
+#include <QDate>
+#include <QObject>
+#include <QVariantList>
+#include <QVector>
+#include "databasemanager.h"
+#include "money.h"
+
+// History of stock levels. Every change to Inventory.quantity is written to
+// StockMovements by the code making it, in the same transaction, and at the
+// start of each month the levels are folded into StockSnapshots, at login
+// and after each idle-time maintenance run. The level at any instant is then
+// the nearest snapshot before it plus the movements since, so a query reads
+// at most about a month of movements however long the history is.
+//
+// "At a date" means at the end of that day. Values use the item's price as
+// of its last movement before that moment.
+//
+// The same writes keep FIFO cost layers in CostLayers: stock coming in adds
+// a layer at the item's price, stock going out uses up the oldest layers
+// first. Sales take their cost with issue() so it can be stored on the row.
+class StockLedger : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum Kind { Receipt, Sale, Adjustment };
+
+    struct Level {
+        int itemId = 0;
+        QString name; // empty for items deleted since
+        int quantity = 0;
+        Money::Cents unitPrice = 0;
+    };
+
+    explicit StockLedger(DatabaseManager *dbManager, QObject *parent = nullptr);
+
+    // Also takes any monthly snapshots that are due for userId.
+    void setUserId(int userId);
+
+    Q_INVOKABLE int stockAt(int itemId, const QDate &date);
+    Q_INVOKABLE double stockValueAt(const QDate &date);
+    // {itemId, name, quantity, unitPrice, value} for every item with stock.
+    Q_INVOKABLE QVariantList valuationAt(const QDate &date);
+
+    // Levels just before the instant `before`; itemId -1 for every item.
+    static bool levelsAt(QSqlDatabase db, int userId, const QDateTime &before, int itemId,
+                         QVector<Level> *levels, QString *error);
+    static bool takeMonthlySnapshots(QSqlDatabase db, int userId, QString *error);
+    // The same for every user with stock history in db.
+    static bool takeAllMonthlySnapshots(QSqlDatabase db, QString *error);
+
+    // Writers call these inside their own transaction. record() logs a known
+    // delta at the item's current price, after the change; recordRestate()
+    // logs the move to newQuantity (and newPrice when given) and must run
+    // before the change.
+    static bool record(QSqlDatabase db, int userId, int itemId, Kind kind, int delta,
+                       const QVariant &refId, QString *error);
+    static bool recordRestate(QSqlDatabase db, int userId, int itemId, int newQuantity,
+                              const QVariant &newPrice, QString *error);
+    // Takes quantity units off the item's oldest cost layers and returns
+    // their cost in cents. Call before record() for a sale; record() then leaves
+    // the layers alone.
+    static bool issue(QSqlDatabase db, int userId, int itemId, int quantity, Money::Cents *totalCost,
+                      QString *error);
+    // Set-based forms for bulk edits: recordPrices() logs the current prices
+    // of a category after a repricing, recordRemoval() the items' remaining
+    // stock before they are deleted.
+    static bool recordPrices(QSqlDatabase db, int userId, const QString &category, QString *error);
+    static bool recordRemoval(QSqlDatabase db, int userId, const QList<int> &itemIds, QString *error);
+
+public slots:
+    // Snapshots due since the last fold, so that a terminal left running
+    // past a month boundary keeps its history reads short.
+    void takeDueSnapshots();
+
+signals:
+    void errorOccurred(const QString &error);
+
+private:
+    DatabaseManager *m_dbManager;
+    int m_userId;
+
+    static QDateTime endOfDay(const QDate &date);
+    static QString kindName(Kind kind);
+    static bool addLayer(QSqlDatabase db, int userId, int itemId, int quantity, const QVariant &unitCost,
+                         QString *error);
+};
+
+#endif // STOCKLEDGER_H
@@ -0,0 +1,272 @@
+#include "streamexporter.h"
+#include <QDate>
+#include <QDateTime>
+#include <QDebug>
+#include <QSaveFile>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QSqlRecord>
+#include <QtConcurrent>
+
+namespace {
+const int WRITE_BUFFER_BYTES = 1 << 20;
+const qint64 PROGRESS_INTERVAL_ROWS = 10000;
+
+class BufferedWriter {
+public:
+  explicit BufferedWriter(QSaveFile *file) : m_file(file) {
+    m_buffer.reserve(WRITE_BUFFER_BYTES + 4096);
+  }
+
+  QByteArray &buffer() { return m_buffer; }
+
+  bool flushIfFull() {
+    return m_buffer.size() < WRITE_BUFFER_BYTES || flush();
+  }
+
+  bool flush() {
+    if (m_buffer.isEmpty())
+      return true;
+    const bool ok = m_file->write(m_buffer) == m_buffer.size();
+    m_buffer.clear();
+    return ok;
+  }
+
+private:
+  QSaveFile *m_file;
+  QByteArray m_buffer;
+};
+
+QByteArray textOf(const QVariant &value) {
+  switch (value.userType()) {
+  case QMetaType::QDate:
+    return value.toDate().toString(Qt::ISODate).toUtf8();
+  case QMetaType::QDateTime:
+    return value.toDateTime().toString(Qt::ISODate).toUtf8();
+  default:
+    return value.toString().toUtf8();
+  }
+}
+
+bool isNumeric(const QVariant &value) {
+  switch (value.userType()) {
+  case QMetaType::Int:
+  case QMetaType::UInt:
+  case QMetaType::LongLong:
+  case QMetaType::ULongLong:
+  case QMetaType::Double:
+    return true;
+  default:
+    return false;
+  }
+}
+
+void appendCsvField(QByteArray &out, const QByteArray &text) {
+  if (text.contains(',') || text.contains('"') || text.contains('\n') ||
+      text.contains('\r')) {
+    out.append('"');
+    for (char c : text) {
+      if (c == '"')
+        out.append('"');
+      out.append(c);
+    }
+    out.append('"');
+  } else {
+    out.append(text);
+  }
+}
+
+void appendJsonString(QByteArray &out, const QByteArray &text) {
+  static const char hex[] = "0123456789abcdef";
+  out.append('"');
+  for (char c : text) {
+    switch (c) {
+    case '"':
+      out.append("\\\"");
+      break;
+    case '\\':
+      out.append("\\\\");
+      break;
+    case '\n':
+      out.append("\\n");
+      break;
+    case '\r':
+      out.append("\\r");
+      break;
+    case '\t':
+      out.append("\\t");
+      break;
+    default:
+      if (static_cast<unsigned char>(c) < 0x20) {
+        out.append("\\u00");
+        out.append(hex[(c >> 4) & 0xf]);
+        out.append(hex[c & 0xf]);
+      } else {
+        out.append(c);
+      }
+    }
+  }
+  out.append('"');
+}
+} // namespace
+
+StreamExporter::StreamExporter(DatabaseManager *dbManager, QObject *parent)
+    : QObject(parent), m_dbManager(dbManager), m_cancelled(false) {
+  connect(&m_watcher, &QFutureWatcher<Result>::finished, this,
+          &StreamExporter::onFinished);
+}
+
+StreamExporter::~StreamExporter() {
+  m_cancelled = true;
+  m_watcher.waitForFinished();
+}
+
+bool StreamExporter::parseFormat(const QString &name, Format *format) {
+  const QString normalized = name.trimmed().toLower();
+  if (normalized.isEmpty() || normalized == "csv") {
+    *format = Csv;
+    return true;
+  }
+  if (normalized == "jsonl" || normalized == "ndjson" ||
+      normalized == "json") {
+    *format = JsonLines;
+    return true;
+  }
+  return false;
+}
+
+bool StreamExporter::start(const Request &queued) {
+  if (m_watcher.isRunning())
+    return false;
+
+  m_cancelled = false;
+  m_filePath = queued.filePath;
+  const DatabaseManager *dbManager = m_dbManager;
+  // The user may switch shards before the worker opens its connection.
+  Request request = queued;
+  if (request.databasePath.isEmpty())
+    request.databasePath = dbManager->databasePath();
+  m_watcher.setFuture(QtConcurrent::run([this, dbManager, request]() {
+    return run(dbManager, request, m_cancelled,
+               [this](qint64 rows) { emit progress(rows); });
+  }));
+  return true;
+}
+
+void StreamExporter::cancel() { m_cancelled = true; }
+
+bool StreamExporter::isRunning() const { return m_watcher.isRunning(); }
+
+void StreamExporter::onFinished() {
+  const Result result = m_watcher.future().result();
+  QString error = result.error;
+  if (result.cancelled)
+    error = tr("Export cancelled");
+  emit finished(result.ok, result.rows, m_filePath, error);
+}
+
+StreamExporter::Result
+StreamExporter::run(const DatabaseManager *dbManager, const Request &request,
+                    const std::atomic_bool &cancelled,
+                    const ProgressCallback &progress) {
+  Result result;
+  WorkerConnection connection(dbManager, true, request.databasePath);
+  if (!connection.isOpen()) {
+    result.error = connection.lastError();
+    return result;
+  }
+
+  QSaveFile file(request.filePath);
+  if (!file.open(QIODevice::WriteOnly)) {
+    result.error = file.errorString();
+    return result;
+  }
+
+  QSqlQuery query(connection.database());
+  query.setForwardOnly(true);
+  query.prepare(request.sql);
+  for (auto it = request.bindings.constBegin();
+       it != request.bindings.constEnd(); ++it)
+    query.bindValue(it.key(), it.value());
+  if (!query.exec()) {
+    result.error = query.lastError().text();
+    file.cancelWriting();
+    return result;
+  }
+
+  const QSqlRecord record = query.record();
+  const int columnCount = record.count();
+  QVector<QByteArray> names(columnCount);
+  for (int c = 0; c < columnCount; ++c)
+    names[c] = record.fieldName(c).toUtf8();
+
+  BufferedWriter writer(&file);
+  QByteArray &out = writer.buffer();
+  if (request.format == Csv) {
+    for (int c = 0; c < columnCount; ++c) {
+      if (c > 0)
+        out.append(',');
+      appendCsvField(out, names.at(c));
+    }
+    out.append('\n');
+  }
+
+  while (query.next()) {
+    if (cancelled) {
+      result.cancelled = true;
+      file.cancelWriting();
+      return result;
+    }
+
+    if (request.format == Csv) {
+      for (int c = 0; c < columnCount; ++c) {
+        if (c > 0)
+          out.append(',');
+        const QVariant value = query.value(c);
+        if (!value.isNull())
+          appendCsvField(out, textOf(value));
+      }
+    } else {
+      out.append('{');
+      for (int c = 0; c < columnCount; ++c) {
+        if (c > 0)
+          out.append(',');
+        appendJsonString(out, names.at(c));
+        out.append(':');
+        const QVariant value = query.value(c);
+        if (value.isNull())
+          out.append("null");
+        else if (isNumeric(value))
+          out.append(value.toString().toUtf8());
+        else
+          appendJsonString(out, textOf(value));
+      }
+      out.append('}');
+    }
+    out.append('\n');
+
+    if (!writer.flushIfFull()) {
+      result.error = file.errorString();
+      file.cancelWriting();
+      return result;
+    }
+    if (++result.rows % PROGRESS_INTERVAL_ROWS == 0 && progress)
+      progress(result.rows);
+  }
+  // next() also returns false when a step fails part way, e.g. a busy or
+  // unreadable file; the rows so far must not be committed as the export.
+  if (query.lastError().isValid()) {
+    result.error = query.lastError().text();
+    file.cancelWriting();
+    return result;
+  }
+
+  if (!writer.flush() || !file.commit()) {
+    result.error = file.errorString();
+    return result;
+  }
+  if (progress)
+    progress(result.rows);
+  result.ok = true;
+  return result;
+}
@@ -0,0 +1,66 @@
+#ifndef STREAMEXPORTER_H
+#define STREAMEXPORTER_H
+
+#include <QFutureWatcher>
+#include <QObject>
+#include <QVariantMap>
+#include <atomic>
+#include <functional>
+#include "databasemanager.h"
+
+// Streams the result of a query to CSV or JSON Lines on a worker thread. Rows
+// are read with a forward-only cursor over a private connection and written
+// through a fixed-size buffer, so memory stays flat whatever the row count.
+class StreamExporter : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum Format { Csv, JsonLines };
+
+    struct Request {
+        QString sql;
+        QVariantMap bindings;
+        QString filePath;
+        Format format = Csv;
+        // File to read; start() fills in the one in use when empty.
+        QString databasePath;
+    };
+
+    struct Result {
+        bool ok = false;
+        bool cancelled = false;
+        qint64 rows = 0;
+        QString error;
+    };
+
+    using ProgressCallback = std::function<void(qint64 rows)>;
+
+    explicit StreamExporter(DatabaseManager *dbManager, QObject *parent = nullptr);
+    ~StreamExporter();
+
+    static bool parseFormat(const QString &name, Format *format);
+
+    bool start(const Request &request);
+    void cancel();
+    bool isRunning() const;
+
+    // Runs an export on the calling thread; used directly by the CLI.
+    static Result run(const DatabaseManager *dbManager, const Request &request,
+                      const std::atomic_bool &cancelled, const ProgressCallback &progress);
+
+signals:
+    void progress(qint64 rows);
+    void finished(bool ok, qint64 rows, const QString &filePath, const QString &error);
+
+private slots:
+    void onFinished();
+
+private:
+    DatabaseManager *m_dbManager;
+    QFutureWatcher<Result> m_watcher;
+    std::atomic_bool m_cancelled;
+    QString m_filePath;
+};
+
+#endif // STREAMEXPORTER_H
@@ -0,0 +1,490 @@
+#include "tilljournal.h"
+#include "databasemanager.h"
+#include "rowmapper.h"
+#include "stockledger.h"
+#include "tracer.h"
+#include <QAtomicInt>
+#include <QDebug>
+#include <QMap>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QUuid>
+#include <QtConcurrent>
+
+namespace {
+const int MERGE_DELAY_MS = 200;      // lets a burst of scans share a batch
+const int MAX_RETRY_DELAY_MS = 60000; // while the shared database is away
+
+QAtomicInt mergeConnectionCounter;
+
+struct JournalRow {
+  QString saleUuid;
+  int userId;
+  int itemId;
+  int quantity;
+  Money::Cents price;
+  QDateTime saleDate;
+
+  static auto columns() {
+    return std::make_tuple(column("sale_uuid", &JournalRow::saleUuid),
+                           column("user_id", &JournalRow::userId),
+                           column("item_id", &JournalRow::itemId),
+                           column("quantity", &JournalRow::quantity),
+                           column("price", &JournalRow::price),
+                           column("sale_date", &JournalRow::saleDate));
+  }
+};
+
+// `conflict` is NULL while a sale waits to be merged and holds the reason
+// once the shared database refused it.
+bool createJournal(QSqlDatabase db, QString *error) {
+  QSqlQuery query(db);
+  // The journal is always on local disk, where WAL is safe; with the default
+  // synchronous=FULL an acknowledged sale survives a power cut.
+  query.exec("PRAGMA journal_mode=WAL");
+  if (!query.exec("CREATE TABLE IF NOT EXISTS JournalSales ("
+                  "seq INTEGER PRIMARY KEY AUTOINCREMENT, "
+                  "sale_uuid TEXT NOT NULL UNIQUE, "
+                  "user_id INTEGER NOT NULL, "
+                  "item_id INTEGER NOT NULL, "
+                  "quantity INTEGER NOT NULL, "
+                  "price INTEGER NOT NULL, "
+                  "sale_date DATETIME NOT NULL, "
+                  "conflict TEXT)") ||
+      !query.exec("CREATE INDEX IF NOT EXISTS idx_journalsales_item ON "
+                  "JournalSales(user_id, item_id)")) {
+    *error = query.lastError().text();
+    return false;
+  }
+  return true;
+}
+
+// Applies one user's sales to their shared database in one transaction.
+// Only on success are the outcomes added to result and the sales that no
+// longer need merging to settled; a failed batch is retried as a whole.
+bool applyToShared(const DatabaseManager *dbManager, int userId,
+                   const QVector<JournalRow> &rows,
+                   TillJournal::MergeResult *result, QStringList *settled,
+                   QString *error) {
+  WorkerConnection connection(dbManager, false, dbManager->dataPath(userId));
+  if (!connection.isOpen()) {
+    *error = connection.lastError();
+    return false;
+  }
+  QSqlDatabase db = connection.database();
+  if (!db.transaction()) {
+    *error = db.lastError().text();
+    return false;
+  }
+
+  QSqlQuery query(db);
+  auto fail = [&](const QString &message) {
+    *error = message;
+    db.rollback();
+    return false;
+  };
+
+  int merged = 0;
+  int duplicates = 0;
+  QStringList done;
+  QVector<TillJournal::Conflict> conflicts;
+  for (const JournalRow &row : rows) {
+    query.prepare("SELECT 1 FROM Sales WHERE sale_uuid = :saleUuid");
+    query.bindValue(":saleUuid", row.saleUuid);
+    if (!query.exec())
+      return fail(query.lastError().text());
+    if (query.next()) {
+      ++duplicates;
+      done.append(row.saleUuid);
+      continue;
+    }
+
+    // As in SalesModel::addSaleBySku, the stock check and the decrement are
+    // one statement, so tills merging at the same time cannot oversell.
+    query.prepare("UPDATE Inventory SET quantity = quantity - :quantity "
+                  "WHERE id = :itemId AND user_id = :userId "
+                  "AND quantity >= :quantity");
+    query.bindValue(":quantity", row.quantity);
+    query.bindValue(":itemId", row.itemId);
+    query.bindValue(":userId", userId);
+    if (!query.exec())
+      return fail(query.lastError().text());
+    if (query.numRowsAffected() == 0) {
+      query.prepare("SELECT quantity FROM Inventory "
+                    "WHERE id = :itemId AND user_id = :userId");
+      query.bindValue(":itemId", row.itemId);
+      query.bindValue(":userId", userId);
+      if (!query.exec())
+        return fail(query.lastError().text());
+      TillJournal::Conflict conflict;
+      conflict.saleUuid = row.saleUuid;
+      conflict.userId = userId;
+      conflict.itemId = row.itemId;
+      conflict.quantity = row.quantity;
+      conflict.reason =
+          query.next()
+              ? QString("only %1 in stock").arg(query.value(0).toInt())
+              : QString("item no longer exists");
+      conflicts.append(conflict);
+      continue;
+    }
+
+    Money::Cents totalCost = 0;
+    if (!StockLedger::issue(db, userId, row.itemId, row.quantity, &totalCost,
+                            error)) {
+      db.rollback();
+      return false;
+    }
+
+    query.prepare("INSERT INTO Sales (user_id, item_id, quantity, price, "
+                  "total_price, sale_date, unit_cost, total_cost, sale_uuid) "
+                  "VALUES (:userId, :itemId, :quantity, :price, :totalPrice, "
+                  ":saleDate, :unitCost, :totalCost, :saleUuid)");
+    query.bindValue(":userId", userId);
+    query.bindValue(":itemId", row.itemId);
+    query.bindValue(":quantity", row.quantity);
+    query.bindValue(":price", row.price);
+    query.bindValue(":totalPrice", row.price * row.quantity);
+    query.bindValue(":saleDate", row.saleDate);
+    query.bindValue(":unitCost",
+                    row.quantity > 0
+                        ? qRound64(double(totalCost) / row.quantity)
+                        : 0);
+    query.bindValue(":totalCost", totalCost);
+    query.bindValue(":saleUuid", row.saleUuid);
+    if (!query.exec())
+      return fail(query.lastError().text());
+    const int saleId = query.lastInsertId().toInt();
+
+    if (!StockLedger::record(db, userId, row.itemId, StockLedger::Sale,
+                             -row.quantity, saleId, error)) {
+      db.rollback();
+      return false;
+    }
+    ++merged;
+    done.append(row.saleUuid);
+  }
+
+  if (!db.commit())
+    return fail(db.lastError().text());
+
+  result->merged += merged;
+  result->duplicates += duplicates;
+  result->conflicts += conflicts;
+  *settled += done;
+  return true;
+}
+
+// Removes merged sales from the journal and marks the refused ones.
+bool settleJournal(QSqlDatabase journal, const QStringList &settled,
+                   const QVector<TillJournal::Conflict> &conflicts,
+                   QString *error) {
+  if (settled.isEmpty() && conflicts.isEmpty())
+    return true;
+
+  journal.transaction();
+  QSqlQuery query(journal);
+  query.prepare("DELETE FROM JournalSales WHERE sale_uuid = :saleUuid");
+  for (const QString &saleUuid : settled) {
+    query.bindValue(":saleUuid", saleUuid);
+    if (!query.exec()) {
+      *error = query.lastError().text();
+      journal.rollback();
+      return false;
+    }
+  }
+  query.prepare(
+      "UPDATE JournalSales SET conflict = :reason WHERE sale_uuid = :saleUuid");
+  for (const TillJournal::Conflict &conflict : conflicts) {
+    query.bindValue(":reason", conflict.reason);
+    query.bindValue(":saleUuid", conflict.saleUuid);
+    if (!query.exec()) {
+      *error = query.lastError().text();
+      journal.rollback();
+      return false;
+    }
+  }
+  if (!journal.commit()) {
+    *error = journal.lastError().text();
+    return false;
+  }
+  return true;
+}
+
+TillJournal::MergeResult mergeBatch(QSqlDatabase journal,
+                                    const DatabaseManager *dbManager,
+                                    int batchSize) {
+  TillJournal::MergeResult result;
+  if (!createJournal(journal, &result.error)) {
+    result.ok = false;
+    return result;
+  }
+
+  QSqlQuery query(journal);
+  query.setForwardOnly(true);
+  query.prepare("SELECT sale_uuid, user_id, item_id, quantity, price, "
+                "sale_date FROM JournalSales WHERE conflict IS NULL "
+                "ORDER BY seq LIMIT :limit");
+  query.bindValue(":limit", batchSize + 1);
+  if (!query.exec()) {
+    result.ok = false;
+    result.error = query.lastError().text();
+    return result;
+  }
+
+  // Sales keep their till order within each user's batch.
+  QMap<int, QVector<JournalRow>> byUser;
+  const RowMapper<JournalRow> mapper(query);
+  int count = 0;
+  while (query.next()) {
+    if (++count > batchSize) {
+      result.more = true;
+      break;
+    }
+    const JournalRow row = mapper.read(query);
+    byUser[row.userId].append(row);
+  }
+  query.finish();
+
+  QStringList settled;
+  for (auto it = byUser.constBegin(); it != byUser.constEnd(); ++it) {
+    if (!applyToShared(dbManager, it.key(), it.value(), &result, &settled,
+                       &result.error)) {
+      result.ok = false;
+      result.more = false;
+      break;
+    }
+  }
+
+  // Users whose batch went through are settled even if a later one failed.
+  QString error;
+  if (!settleJournal(journal, settled, result.conflicts, &error)) {
+    // The shared database already has these sales; the UUIDs make the next
+    // attempt skip them.
+    result.ok = false;
+    result.error = error;
+  }
+  return result;
+}
+} // namespace
+
+TillJournal::TillJournal(DatabaseManager *dbManager, QObject *parent)
+    : QObject(parent), m_dbManager(dbManager),
+      m_connectionName("bims_till_journal"), m_retryDelayMs(0),
+      m_pendingCount(0), m_conflictCount(0) {
+  m_mergeTimer.setSingleShot(true);
+  connect(&m_mergeTimer, &QTimer::timeout, this, &TillJournal::mergeNow);
+  connect(&m_mergeWatcher, &QFutureWatcher<MergeResult>::finished, this,
+          &TillJournal::onMergeFinished);
+}
+
+TillJournal::~TillJournal() {
+  m_mergeTimer.stop();
+  m_mergeWatcher.waitForFinished();
+  if (isOpen()) {
+    {
+      QSqlDatabase db = QSqlDatabase::database(m_connectionName, false);
+      db.close();
+    }
+    QSqlDatabase::removeDatabase(m_connectionName);
+  }
+}
+
+bool TillJournal::open(const QString &filePath, QString *error) {
+  QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", m_connectionName);
+  db.setDatabaseName(filePath);
+  db.setConnectOptions("QSQLITE_BUSY_TIMEOUT=5000");
+  QString message;
+  if (!db.open()) {
+    message = db.lastError().text();
+  } else if (!createJournal(db, &message)) {
+    db.close();
+  }
+  if (!message.isEmpty()) {
+    db = QSqlDatabase();
+    QSqlDatabase::removeDatabase(m_connectionName);
+    if (error)
+      *error = message;
+    return false;
+  }
+
+  m_filePath = filePath;
+  updateCounts();
+  if (m_pendingCount > 0)
+    scheduleMerge(0);
+  return true;
+}
+
+bool TillJournal::isOpen() const { return !m_filePath.isEmpty(); }
+
+QString TillJournal::filePath() const { return m_filePath; }
+
+QString TillJournal::append(int userId, int itemId, int quantity,
+                            Money::Cents price, QString *error) {
+  Tracer::Scope trace("model", "TillJournal::append");
+  if (quantity <= 0) {
+    if (error)
+      *error = "Quantity must be positive";
+    return QString();
+  }
+  const QString saleUuid = QUuid::createUuid().toString(QUuid::WithoutBraces);
+
+  QSqlQuery query(QSqlDatabase::database(m_connectionName, false));
+  query.prepare("INSERT INTO JournalSales (sale_uuid, user_id, item_id, "
+                "quantity, price, sale_date) VALUES (:saleUuid, :userId, "
+                ":itemId, :quantity, :price, :saleDate)");
+  query.bindValue(":saleUuid", saleUuid);
+  query.bindValue(":userId", userId);
+  query.bindValue(":itemId", itemId);
+  query.bindValue(":quantity", quantity);
+  query.bindValue(":price", price);
+  query.bindValue(":saleDate", QDateTime::currentDateTime());
+  if (!query.exec()) {
+    if (error)
+      *error = query.lastError().text();
+    return QString();
+  }
+
+  ++m_pendingCount;
+  emit countsChanged();
+  scheduleMerge(MERGE_DELAY_MS);
+  return saleUuid;
+}
+
+int TillJournal::pendingQuantity(int userId, int itemId) const {
+  QSqlQuery query(QSqlDatabase::database(m_connectionName, false));
+  query.prepare("SELECT IFNULL(SUM(quantity), 0) FROM JournalSales "
+                "WHERE user_id = :userId AND item_id = :itemId "
+                "AND conflict IS NULL");
+  query.bindValue(":userId", userId);
+  query.bindValue(":itemId", itemId);
+  if (!query.exec() || !query.next())
+    return 0;
+  return query.value(0).toInt();
+}
+
+int TillJournal::pendingCount() const { return m_pendingCount; }
+
+int TillJournal::conflictCount() const { return m_conflictCount; }
+
+QVector<TillJournal::Conflict> TillJournal::conflicts() const {
+  QVector<Conflict> conflicts;
+  QSqlQuery query(QSqlDatabase::database(m_connectionName, false));
+  if (!query.exec("SELECT sale_uuid, user_id, item_id, quantity, conflict "
+                  "FROM JournalSales WHERE conflict IS NOT NULL ORDER BY seq"))
+    return conflicts;
+  while (query.next()) {
+    Conflict conflict;
+    conflict.saleUuid = query.value(0).toString();
+    conflict.userId = query.value(1).toInt();
+    conflict.itemId = query.value(2).toInt();
+    conflict.quantity = query.value(3).toInt();
+    conflict.reason = query.value(4).toString();
+    conflicts.append(conflict);
+  }
+  return conflicts;
+}
+
+void TillJournal::mergeNow() {
+  if (!isOpen() || m_mergeWatcher.isRunning())
+    return;
+  m_mergeTimer.stop();
+  const QString journalPath = m_filePath;
+  const DatabaseManager *dbManager = m_dbManager;
+  m_mergeWatcher.setFuture(QtConcurrent::run([journalPath, dbManager]() {
+    Tracer::Scope trace("model", "TillJournal::merge");
+    return merge(journalPath, dbManager);
+  }));
+}
+
+void TillJournal::retryConflicts() {
+  QSqlQuery query(QSqlDatabase::database(m_connectionName, false));
+  if (!query.exec("UPDATE JournalSales SET conflict = NULL "
+                  "WHERE conflict IS NOT NULL")) {
+    emit errorOccurred(tr("Failed to requeue conflicting sales: %1")
+                           .arg(query.lastError().text()));
+    return;
+  }
+  updateCounts();
+  scheduleMerge(0);
+}
+
+TillJournal::MergeResult TillJournal::merge(const QString &journalPath,
+                                            const DatabaseManager *dbManager,
+                                            int batchSize) {
+  const QString connectionName =
+      QString("bims_till_merge_%1")
+          .arg(mergeConnectionCounter.fetchAndAddRelaxed(1));
+  MergeResult result;
+  {
+    QSqlDatabase journal =
+        QSqlDatabase::addDatabase("QSQLITE", connectionName);
+    journal.setDatabaseName(journalPath);
+    journal.setConnectOptions("QSQLITE_BUSY_TIMEOUT=5000");
+    if (journal.open()) {
+      result = mergeBatch(journal, dbManager, batchSize);
+    } else {
+      result.ok = false;
+      result.error = journal.lastError().text();
+    }
+    journal.close();
+  }
+  QSqlDatabase::removeDatabase(connectionName);
+  return result;
+}
+
+void TillJournal::onMergeFinished() {
+  const MergeResult result = m_mergeWatcher.result();
+  updateCounts();
+
+  for (const Conflict &refused : result.conflicts) {
+    qWarning() << "Till sale" << refused.saleUuid << "not merged:"
+               << refused.reason;
+    emit conflict(refused.saleUuid, refused.itemId, refused.quantity,
+                  refused.reason);
+  }
+  if (result.merged > 0)
+    emit merged(result.merged);
+
+  if (!result.ok) {
+    // Most likely the shared database is locked or unreachable; back off
+    // rather than hammering it, and keep the till taking sales meanwhile.
+    // Only the first failure in a row is worth telling the user about.
+    if (m_retryDelayMs == 0)
+      emit errorOccurred(tr("Sales are saved locally but could not be merged "
+                            "yet: %1")
+                             .arg(result.error));
+    m_retryDelayMs = qBound(1000, m_retryDelayMs * 2, MAX_RETRY_DELAY_MS);
+    qWarning() << "Merging the till journal failed, retrying in"
+               << m_retryDelayMs << "ms:" << result.error;
+    scheduleMerge(m_retryDelayMs);
+    return;
+  }
+
+  m_retryDelayMs = 0;
+  if (result.more || m_pendingCount > 0)
+    scheduleMerge(result.more ? 0 : MERGE_DELAY_MS);
+}
+
+void TillJournal::scheduleMerge(int delayMs) {
+  // A merge in flight reschedules itself when it finishes.
+  if (m_mergeWatcher.isRunning())
+    return;
+  if (!m_mergeTimer.isActive() || m_mergeTimer.remainingTime() > delayMs)
+    m_mergeTimer.start(delayMs);
+}
+
+void TillJournal::updateCounts() {
+  QSqlQuery query(QSqlDatabase::database(m_connectionName, false));
+  if (!query.exec("SELECT IFNULL(SUM(conflict IS NULL), 0), "
+                  "IFNULL(SUM(conflict IS NOT NULL), 0) FROM JournalSales") ||
+      !query.next())
+    return;
+  const int pending = query.value(0).toInt();
+  const int conflicts = query.value(1).toInt();
+  if (pending == m_pendingCount && conflicts == m_conflictCount)
+    return;
+  m_pendingCount = pending;
+  m_conflictCount = conflicts;
+  emit countsChanged();
+}
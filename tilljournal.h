@@ -0,0 +1,101 @@
+#ifndef TILLJOURNAL_H
+#define TILLJOURNAL_H
+
+#include <QDateTime>
+#include <QFutureWatcher>
+#include <QObject>
+#include <QTimer>
+#include <QVector>
+#include "money.h"
+
+class DatabaseManager;
+
+// Offline-first checkout. Sales are appended to a small SQLite journal on
+// local disk and acknowledged at once; a background merger applies them to
+// the shared database in batches, so a slow or locked file on the NAS never
+// holds up the till. Every sale carries a UUID that is stored in
+// Sales.sale_uuid, which makes merging idempotent: a batch that reached the
+// shared database but was not yet cleared from the journal is skipped the
+// next time round.
+//
+// Stock is checked when a sale is merged. A sale the shared database no
+// longer has the stock for is not applied; it stays in the journal as a
+// conflict, is reported through conflict(), and is merged again after
+// retryConflicts(), e.g. once the stock has been counted.
+class TillJournal : public QObject
+{
+    Q_OBJECT
+    Q_PROPERTY(int pendingCount READ pendingCount NOTIFY countsChanged)
+    Q_PROPERTY(int conflictCount READ conflictCount NOTIFY countsChanged)
+
+public:
+    static const int MERGE_BATCH_SIZE = 100;
+
+    struct Conflict {
+        QString saleUuid;
+        int userId = -1;
+        int itemId = -1;
+        int quantity = 0;
+        QString reason;
+    };
+
+    struct MergeResult {
+        bool ok = true;
+        QString error;
+        int merged = 0;
+        int duplicates = 0; // already in the shared database
+        QVector<Conflict> conflicts;
+        bool more = false; // pending sales were left for the next batch
+    };
+
+    explicit TillJournal(DatabaseManager *dbManager, QObject *parent = nullptr);
+    ~TillJournal();
+
+    // Opens or creates the journal and schedules a merge of anything left
+    // from the previous run.
+    bool open(const QString &filePath, QString *error = nullptr);
+    bool isOpen() const;
+    QString filePath() const;
+
+    // Journals one sale and returns its UUID, or an empty string on failure.
+    QString append(int userId, int itemId, int quantity, Money::Cents price,
+                   QString *error = nullptr);
+    // Units of itemId sold here but not merged yet, for the local stock check.
+    int pendingQuantity(int userId, int itemId) const;
+    int pendingCount() const;
+    int conflictCount() const;
+    QVector<Conflict> conflicts() const;
+
+    Q_INVOKABLE void mergeNow();
+    Q_INVOKABLE void retryConflicts();
+
+    // Applies up to batchSize pending sales from the journal file to the
+    // shared database, one transaction per user. Uses its own connections,
+    // so it may run on any thread; the journal can be open elsewhere.
+    static MergeResult merge(const QString &journalPath, const DatabaseManager *dbManager,
+                             int batchSize = MERGE_BATCH_SIZE);
+
+signals:
+    void countsChanged();
+    void merged(int count);
+    void conflict(const QString &saleUuid, int itemId, int quantity, const QString &reason);
+    void errorOccurred(const QString &error);
+
+private slots:
+    void onMergeFinished();
+
+private:
+    DatabaseManager *m_dbManager;
+    QString m_connectionName;
+    QString m_filePath;
+    QFutureWatcher<MergeResult> m_mergeWatcher;
+    QTimer m_mergeTimer;
+    int m_retryDelayMs;
+    int m_pendingCount;
+    int m_conflictCount;
+
+    void scheduleMerge(int delayMs);
+    void updateCounts();
+};
+
+#endif // TILLJOURNAL_H
@@ -0,0 +1,191 @@
+#include "tracer.h"
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QQuickWindow>
+#include <QSaveFile>
+#include <QThread>
+#include <memory>
+#include <vector>
+
+namespace {
+struct Event {
+  const char *category;
+  const char *name;
+  qint64 timeNs;
+  qint64 value; // duration for 'X', the value for 'C'
+  char phase;
+};
+
+// Written only by its own thread; `written` is published with release
+// ordering so that the exporter sees whole events up to it.
+struct ThreadBuffer {
+  int tid = 0;
+  QString threadName;
+  std::vector<Event> events;
+  std::atomic<quint64> written{0};
+};
+
+QMutex registryMutex; // guards buffers, taken once per thread and on export
+std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+// When the current recording began. Buffers are never rewound, since their
+// threads may be writing; events from before this are skipped on export.
+std::atomic<qint64> startedNs{0};
+thread_local ThreadBuffer *threadBuffer = nullptr;
+thread_local qint64 frameStartNs = -1;
+
+const QElapsedTimer &clock() {
+  static const QElapsedTimer timer = [] {
+    QElapsedTimer timer;
+    timer.start();
+    return timer;
+  }();
+  return timer;
+}
+
+QString currentThreadName() {
+  QThread *thread = QThread::currentThread();
+  if (QCoreApplication::instance() &&
+      thread == QCoreApplication::instance()->thread())
+    return "main";
+  if (!thread->objectName().isEmpty())
+    return thread->objectName();
+  // The scene graph render thread is a QSGRenderThread.
+  return QString::fromLatin1(thread->metaObject()->className());
+}
+
+ThreadBuffer *bufferForCurrentThread() {
+  if (threadBuffer)
+    return threadBuffer;
+
+  // Buffers outlive their threads so pool threads that have exited still
+  // show up in the export.
+  auto buffer = std::make_unique<ThreadBuffer>();
+  buffer->events.resize(Tracer::EVENTS_PER_THREAD);
+  buffer->threadName = currentThreadName();
+  QMutexLocker locker(&registryMutex);
+  buffer->tid = int(buffers.size()) + 1;
+  threadBuffer = buffer.get();
+  buffers.push_back(std::move(buffer));
+  return threadBuffer;
+}
+
+void appendJsonString(QByteArray &out, const char *text) {
+  out.append('"');
+  for (const char *c = text; *c; ++c) {
+    if (*c == '"' || *c == '\\')
+      out.append('\\');
+    out.append(*c);
+  }
+  out.append('"');
+}
+
+QByteArray microseconds(qint64 ns) { return QByteArray::number(ns / 1e3, 'f', 3); }
+} // namespace
+
+std::atomic_bool Tracer::s_enabled{false};
+
+void Tracer::start() {
+  startedNs.store(now(), std::memory_order_relaxed);
+  s_enabled.store(true, std::memory_order_release);
+}
+
+void Tracer::stop() { s_enabled.store(false, std::memory_order_release); }
+
+qint64 Tracer::now() { return clock().nsecsElapsed(); }
+
+void Tracer::record(char phase, const char *category, const char *name,
+                    qint64 timeNs, qint64 value) {
+  ThreadBuffer *buffer = bufferForCurrentThread();
+  const quint64 index = buffer->written.load(std::memory_order_relaxed);
+  buffer->events[index % EVENTS_PER_THREAD] = {category, name, timeNs, value,
+                                               phase};
+  buffer->written.store(index + 1, std::memory_order_release);
+}
+
+void Tracer::traceFrames(QQuickWindow *window) {
+  // Both signals come from the thread that renders the window, so the
+  // frame's start can be kept per thread.
+  QObject::connect(
+      window, &QQuickWindow::beforeSynchronizing, window,
+      []() { frameStartNs = isEnabled() ? now() : -1; },
+      Qt::DirectConnection);
+  QObject::connect(
+      window, &QQuickWindow::frameSwapped, window,
+      []() {
+        if (frameStartNs >= 0)
+          complete("frame", "frame", frameStartNs, now() - frameStartNs);
+        frameStartNs = -1;
+      },
+      Qt::DirectConnection);
+  // Animations advance on the GUI thread; marking them lines the frames up
+  // with the model work that delayed them.
+  QObject::connect(
+      window, &QQuickWindow::afterAnimating, window,
+      []() { instant("frame", "animate"); }, Qt::DirectConnection);
+}
+
+bool Tracer::writeChromeTrace(const QString &filePath, QString *error) {
+  // Writers check the flag before touching their buffer; a thread in the
+  // middle of an event when tracing stops can at worst leave that one
+  // event torn.
+  stop();
+
+  const QByteArray pid = QByteArray::number(QCoreApplication::applicationPid());
+  QByteArray out("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+  bool first = true;
+  auto separate = [&]() {
+    if (!first)
+      out.append(",\n");
+    first = false;
+  };
+
+  const qint64 started = startedNs.load(std::memory_order_relaxed);
+  QMutexLocker locker(&registryMutex);
+  for (const auto &buffer : buffers) {
+    const QByteArray tid = QByteArray::number(buffer->tid);
+    separate();
+    out.append("{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":" + pid +
+               ",\"tid\":" + tid + ",\"args\":{\"name\":");
+    appendJsonString(out, buffer->threadName.toUtf8().constData());
+    out.append("}}");
+
+    const quint64 written = buffer->written.load(std::memory_order_acquire);
+    const quint64 from =
+        written > quint64(EVENTS_PER_THREAD) ? written - EVENTS_PER_THREAD : 0;
+    for (quint64 i = from; i < written; ++i) {
+      const Event &event = buffer->events[i % EVENTS_PER_THREAD];
+      if (event.timeNs < started)
+        continue;
+      separate();
+      out.append("{\"ph\":\"");
+      out.append(event.phase);
+      out.append("\",\"cat\":");
+      appendJsonString(out, event.category);
+      out.append(",\"name\":");
+      appendJsonString(out, event.name);
+      out.append(",\"pid\":" + pid + ",\"tid\":" + tid +
+                 ",\"ts\":" + microseconds(event.timeNs));
+      if (event.phase == 'X')
+        out.append(",\"dur\":" + microseconds(event.value));
+      else if (event.phase == 'C')
+        out.append(",\"args\":{\"value\":" + QByteArray::number(event.value) +
+                   "}");
+      else
+        out.append(",\"s\":\"t\"");
+      out.append('}');
+    }
+  }
+  locker.unlock();
+  out.append("\n]}\n");
+
+  QSaveFile file(filePath);
+  if (!file.open(QIODevice::WriteOnly) || file.write(out) != out.size() ||
+      !file.commit()) {
+    if (error)
+      *error = file.errorString();
+    return false;
+  }
+  return true;
+}
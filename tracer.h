@@ -0,0 +1,80 @@
+#ifndef TRACER_H
+#define TRACER_H
+
+#include <QString>
+#include <atomic>
+
+class QQuickWindow;
+
+// Timeline tracing of model operations, signal bursts and frames, written
+// as Chrome trace JSON (chrome://tracing, ui.perfetto.dev).
+//
+// Each thread appends to its own fixed-size ring buffer, so recording takes
+// no lock and never allocates after the thread's first event; when a buffer
+// is full the oldest events are overwritten. While tracing is off a Scope
+// costs one relaxed atomic load. Names and categories must be string
+// literals: only the pointers are stored.
+class Tracer
+{
+public:
+    static const int EVENTS_PER_THREAD = 32768;
+
+    static bool isEnabled() { return s_enabled.load(std::memory_order_relaxed); }
+    static void start();
+    static void stop();
+    // Stops tracing and writes every buffered event to filePath.
+    static bool writeChromeTrace(const QString &filePath, QString *error = nullptr);
+
+    // Times the enclosing block as one event.
+    class Scope
+    {
+    public:
+        Scope(const char *category, const char *name)
+            : m_category(category), m_name(name), m_startNs(isEnabled() ? now() : -1) {}
+        ~Scope()
+        {
+            if (m_startNs >= 0)
+                complete(m_category, m_name, m_startNs, now() - m_startNs);
+        }
+
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+
+    private:
+        const char *m_category;
+        const char *m_name;
+        qint64 m_startNs;
+    };
+
+    // A point in time, e.g. one emission of a signal.
+    static void instant(const char *category, const char *name)
+    {
+        if (isEnabled())
+            record('i', category, name, now(), 0);
+    }
+    // A value plotted over time, e.g. the number of rows in a model.
+    static void counter(const char *category, const char *name, qint64 value)
+    {
+        if (isEnabled())
+            record('C', category, name, now(), value);
+    }
+    static void complete(const char *category, const char *name, qint64 startNs, qint64 durationNs)
+    {
+        if (isEnabled())
+            record('X', category, name, startNs, durationNs);
+    }
+
+    // Adds a "frame" event per frame of window, from the start of scene
+    // graph synchronisation to the buffer swap, on the thread rendering it.
+    static void traceFrames(QQuickWindow *window);
+
+    // Nanoseconds on the monotonic clock shared by every thread.
+    static qint64 now();
+
+private:
+    static std::atomic_bool s_enabled;
+
+    static void record(char phase, const char *category, const char *name, qint64 timeNs, qint64 value);
+};
+
+#endif // TRACER_H
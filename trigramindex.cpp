@@ -0,0 +1,188 @@
+#include "trigramindex.h"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+// A candidate must share at least this fraction of the query's trigrams.
+const double MIN_SCORE = 0.34;
+
+quint64 packTrigram(QChar a, QChar b, QChar c) {
+    return (quint64(a.unicode()) << 32) | (quint64(b.unicode()) << 16) | c.unicode();
+}
+} // namespace
+
+void TrigramIndex::clear()
+{
+    m_documents.clear();
+    m_freeSlots.clear();
+    m_slotById.clear();
+    m_postings.clear();
+    m_hits.clear();
+    m_touched.clear();
+}
+
+void TrigramIndex::reserve(int count)
+{
+    m_documents.reserve(count);
+    m_slotById.reserve(count);
+}
+
+void TrigramIndex::insert(int id, const QString &name, const QString &category, const QString &supplier)
+{
+    remove(id);
+
+    int slot;
+    if (!m_freeSlots.isEmpty()) {
+        slot = m_freeSlots.takeLast();
+    } else {
+        slot = m_documents.size();
+        m_documents.append(Document());
+    }
+
+    Document &document = m_documents[slot];
+    document.id = id;
+    document.name = name;
+    document.category = category;
+    document.supplier = supplier;
+    document.grams = trigrams(name + QLatin1Char(' ') + category + QLatin1Char(' ') + supplier);
+
+    for (quint64 gram : document.grams)
+        m_postings[gram].append(slot);
+    m_slotById.insert(id, slot);
+}
+
+void TrigramIndex::remove(int id)
+{
+    auto it = m_slotById.find(id);
+    if (it == m_slotById.end())
+        return;
+
+    const int slot = it.value();
+    m_slotById.erase(it);
+
+    Document &document = m_documents[slot];
+    for (quint64 gram : document.grams) {
+        auto posting = m_postings.find(gram);
+        if (posting == m_postings.end())
+            continue;
+        QVector<int> &slots = posting.value();
+        const int at = slots.indexOf(slot);
+        if (at != -1) {
+            // Order within a posting list does not matter.
+            slots[at] = slots.last();
+            slots.removeLast();
+        }
+        if (slots.isEmpty())
+            m_postings.erase(posting);
+    }
+
+    document = Document();
+    m_freeSlots.append(slot);
+}
+
+bool TrigramIndex::contains(int id) const
+{
+    return m_slotById.contains(id);
+}
+
+int TrigramIndex::size() const
+{
+    return m_slotById.size();
+}
+
+QVector<TrigramIndex::Match> TrigramIndex::search(const QString &text, int limit) const
+{
+    QVector<Match> matches;
+    const QVector<quint64> queryGrams = trigrams(text);
+    if (queryGrams.isEmpty() || limit <= 0)
+        return matches;
+
+    if (m_hits.size() < m_documents.size())
+        m_hits.resize(m_documents.size());
+    m_touched.clear();
+
+    for (quint64 gram : queryGrams) {
+        auto posting = m_postings.constFind(gram);
+        if (posting == m_postings.constEnd())
+            continue;
+        for (int slot : posting.value()) {
+            if (m_hits[slot]++ == 0)
+                m_touched.append(slot);
+        }
+    }
+
+    const int required = qMax(1, int(std::ceil(queryGrams.size() * MIN_SCORE)));
+    struct Candidate {
+        int slot;
+        int hits;
+        int grams;
+    };
+    QVector<Candidate> candidates;
+    for (int slot : m_touched) {
+        const int hits = m_hits[slot];
+        m_hits[slot] = 0;
+        if (hits >= required)
+            candidates.append({slot, hits, m_documents.at(slot).grams.size()});
+    }
+
+    // More shared trigrams first; among equals, the item with less
+    // unrelated text is the closer match.
+    auto better = [](const Candidate &a, const Candidate &b) {
+        return a.hits != b.hits ? a.hits > b.hits : a.grams < b.grams;
+    };
+    const int count = qMin(limit, candidates.size());
+    std::partial_sort(candidates.begin(), candidates.begin() + count, candidates.end(), better);
+
+    matches.reserve(count);
+    for (int i = 0; i < count; ++i) {
+        const Document &document = m_documents.at(candidates.at(i).slot);
+        matches.append({document.id, double(candidates.at(i).hits) / queryGrams.size(),
+                        document.name, document.category, document.supplier});
+    }
+    return matches;
+}
+
+qint64 TrigramIndex::memoryBytes() const
+{
+    qint64 bytes = m_documents.capacity() * qint64(sizeof(Document))
+                   + m_freeSlots.capacity() * qint64(sizeof(int))
+                   + m_slotById.size() * qint64(2 * sizeof(int) + 2 * sizeof(void *))
+                   + m_hits.capacity() * qint64(sizeof(quint16))
+                   + m_touched.capacity() * qint64(sizeof(int));
+    for (const Document &document : m_documents)
+        bytes += document.grams.capacity() * qint64(sizeof(quint64));
+    for (auto it = m_postings.constBegin(); it != m_postings.constEnd(); ++it)
+        bytes += qint64(sizeof(quint64) + sizeof(QVector<int>) + 2 * sizeof(void *))
+                 + it.value().capacity() * qint64(sizeof(int));
+    // The strings are shared with InventoryModel's rows and not counted here.
+    return bytes;
+}
+
+QVector<quint64> TrigramIndex::trigrams(const QString &text)
+{
+    // Each word is padded as "  word " so that prefixes weigh more than
+    // suffixes and short words still yield trigrams.
+    QVector<quint64> grams;
+    const QString folded = text.toCaseFolded();
+    QString word;
+    auto flush = [&grams, &word]() {
+        if (word.isEmpty())
+            return;
+        const QString padded = QLatin1String("  ") + word + QLatin1Char(' ');
+        for (int i = 0; i + 2 < padded.size(); ++i)
+            grams.append(packTrigram(padded.at(i), padded.at(i + 1), padded.at(i + 2)));
+        word.clear();
+    };
+
+    for (const QChar ch : folded) {
+        if (ch.isLetterOrNumber())
+            word.append(ch);
+        else
+            flush();
+    }
+    flush();
+
+    std::sort(grams.begin(), grams.end());
+    grams.erase(std::unique(grams.begin(), grams.end()), grams.end());
+    return grams;
+}
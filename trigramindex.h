@@ -0,0 +1,55 @@
+#ifndef TRIGRAMINDEX_H
+#define TRIGRAMINDEX_H
+
+#include <QHash>
+#include <QString>
+#include <QVector>
+
+// In-memory trigram posting lists over item name, category and supplier for
+// typo-tolerant lookup. A query is split into the same trigrams and every item
+// sharing enough of them is ranked by the fraction it matches, so
+// "chocolte" still finds "Chocolate". Searches reuse scratch buffers and are
+// meant for the GUI thread only.
+class TrigramIndex
+{
+public:
+    struct Match {
+        int id;
+        double score; // fraction of the query's trigrams found, 0..1
+        QString name;
+        QString category;
+        QString supplier;
+    };
+
+    void clear();
+    void reserve(int count);
+    // Inserting an id that is already present replaces its entry.
+    void insert(int id, const QString &name, const QString &category, const QString &supplier);
+    void remove(int id);
+    bool contains(int id) const;
+    int size() const;
+
+    QVector<Match> search(const QString &text, int limit) const;
+    qint64 memoryBytes() const;
+
+private:
+    struct Document {
+        int id = -1;
+        QString name;
+        QString category;
+        QString supplier;
+        QVector<quint64> grams; // sorted, unique
+    };
+
+    QVector<Document> m_documents; // indexed by slot; removed slots have id -1
+    QVector<int> m_freeSlots;
+    QHash<int, int> m_slotById;
+    QHash<quint64, QVector<int>> m_postings; // trigram -> slots
+
+    mutable QVector<quint16> m_hits;
+    mutable QVector<int> m_touched;
+
+    static QVector<quint64> trigrams(const QString &text);
+};
+
+#endif // TRIGRAMINDEX_H
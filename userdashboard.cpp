@@ -2,31 +2,103 @@
 #include <QDebug>
 #include <QSqlError>
 #include <QSqlQuery>
+#include <algorithm>
+#include "memoryestimate.h"
+#include "rowmapper.h"
+#include "tracer.h"
+#include "workloadrecorder.h"
+
+namespace {
+struct ActivityRow {
+  QString type;
+  QDateTime date;
+  QString itemName;
+  int quantity;
+  Money::Cents price;
+
+  static auto columns() {
+    return std::make_tuple(column("type", &ActivityRow::type),
+                           column("date", &ActivityRow::date),
+                           column("item_name", &ActivityRow::itemName),
+                           column("quantity", &ActivityRow::quantity),
+                           column("total_price", &ActivityRow::price));
+  }
+};
+
+struct KpiRow {
+  int itemCount;
+  Money::Cents inventoryValue;
+  int lowStockItems;
+  int saleCount;
+  Money::Cents revenue;
+  Money::Cents cost;
+
+  static auto columns() {
+    return std::make_tuple(column("item_count", &KpiRow::itemCount),
+                           column("inventory_value", &KpiRow::inventoryValue),
+                           column("low_stock_items", &KpiRow::lowStockItems),
+                           column("sale_count", &KpiRow::saleCount),
+                           column("revenue", &KpiRow::revenue),
+                           column("cost", &KpiRow::cost));
+  }
+};
+
+struct MonthlyProfitRow {
+  QString month;
+  Money::Cents revenue;
+  Money::Cents cost;
+
+  static auto columns() {
+    return std::make_tuple(column("month", &MonthlyProfitRow::month),
+                           column("revenue", &MonthlyProfitRow::revenue),
+                           column("cost", &MonthlyProfitRow::cost));
+  }
+};
+} // namespace
 
 UserDashboard::UserDashboard(DatabaseManager *dbManager,
                              InventoryModel *inventoryModel,
                              SalesModel *salesModel, QObject *parent)
     : QObject(parent), m_dbManager(dbManager), m_inventoryModel(inventoryModel),
       m_salesModel(salesModel), m_userId(-1), m_totalInventoryItems(0),
-      m_lowStockItems(0), m_totalInventoryValue(0.0), m_totalSales(0),
-      m_totalRevenue(0.0), m_totalCost(0.0), m_grossProfit(0.0),
+      m_lowStockItems(0), m_totalInventoryValue(0), m_totalSales(0),
+      m_totalRevenue(0), m_totalCost(0), m_grossProfit(0),
       m_profitMargin(0.0), m_expiringItems(0) {
   qDebug() << "UserDashboard constructed";
-  connect(m_inventoryModel, &InventoryModel::itemNearExpiry, this,
-          &UserDashboard::itemNearExpiry);
+  // The counters move with every write, whether or not the models holding
+  // the rows are loaded. Reorder points arrive from the forecaster after the
+  // dashboard has loaded.
+  auto onItemsChanged = [this]() {
+    if (m_userId == -1)
+      return;
+    loadKpis();
+    updateLowStockItems();
+  };
+  connect(m_inventoryModel, &InventoryModel::itemsChanged, this,
+          onItemsChanged);
+  connect(m_inventoryModel, &InventoryModel::lowStockItemsChanged, this,
+          onItemsChanged);
+  connect(m_salesModel, &SalesModel::salesChanged, this, [this]() {
+    if (m_userId != -1)
+      loadKpis();
+  });
 }
 
 void UserDashboard::setUserId(int userId) {
+  WorkloadRecorder::Scope scope("UserDashboard::setUserId", {userId});
+  Tracer::Scope trace("dashboard", "UserDashboard::setUserId");
   qDebug() << "UserDashboard::setUserId called with userId:" << userId;
   if (m_userId != userId) {
     m_userId = userId;
     m_inventoryModel->setUserId(userId);
     m_salesModel->setUserId(userId);
-    refresh();
+    recalculate();
   }
 }
 
 void UserDashboard::refresh() {
+  WorkloadRecorder::Scope scope("UserDashboard::refresh");
+  Tracer::Scope trace("dashboard", "UserDashboard::refresh");
   qDebug() << "UserDashboard::refresh() called for userId:" << m_userId;
 
   if (m_userId == -1) {
@@ -34,21 +106,97 @@ void UserDashboard::refresh() {
     return;
   }
 
-  m_inventoryModel->refresh();
-  m_salesModel->refresh();
+  // Models nobody has opened yet stay unloaded.
+  if (m_inventoryModel->isLoaded())
+    m_inventoryModel->refresh();
+  if (m_salesModel->isLoaded())
+    m_salesModel->refresh();
+  recalculate();
+}
 
-  m_totalInventoryItems = m_inventoryModel->rowCount();
-  m_lowStockItems = m_inventoryModel->lowStockItems();
-  m_totalInventoryValue = m_inventoryModel->totalCost();
-  m_totalSales = m_salesModel->totalSales();
-  m_totalRevenue = m_salesModel->totalRevenue();
+void UserDashboard::recalculate() {
+  WorkloadRecorder::Scope scope("UserDashboard::recalculate");
+  Tracer::Scope trace("dashboard", "UserDashboard::recalculate");
+  if (m_userId == -1)
+    return;
 
-  calculateProfitAndLoss();
+  loadKpis();
   updateRecentActivities();
   updateLowStockItems();
   fetchMonthlyProfitData();
   checkExpiringItems();
 
+  qDebug() << "UserDashboard refreshed:" << "Total Inventory Items:"
+           << m_totalInventoryItems << "Low Stock Items:" << m_lowStockItems
+           << "Total Inventory Value:" << totalInventoryValue()
+           << "Total Sales:" << m_totalSales
+           << "Total Revenue:" << totalRevenue() << "Total Cost:" << totalCost()
+           << "Gross Profit:" << grossProfit()
+           << "Profit Margin:" << m_profitMargin
+           << "Expiring Items:" << m_expiringItems;
+}
+
+UserDashboard::Snapshot UserDashboard::snapshot() const {
+  Snapshot snapshot;
+  snapshot.totalInventoryItems = m_totalInventoryItems;
+  snapshot.lowStockItems = m_lowStockItems;
+  snapshot.totalInventoryValue = m_totalInventoryValue;
+  snapshot.totalSales = m_totalSales;
+  snapshot.totalRevenue = m_totalRevenue;
+  snapshot.totalCost = m_totalCost;
+  snapshot.grossProfit = m_grossProfit;
+  snapshot.profitMargin = m_profitMargin;
+  snapshot.recentActivities = m_recentActivities;
+  snapshot.lowStockItemsList = m_lowStockItemsList;
+  snapshot.monthlyProfitData = m_monthlyProfitData;
+  snapshot.expiringItems = m_expiringItems;
+
+  snapshot.bytes = sizeof(Snapshot) + memoryBytes();
+  return snapshot;
+}
+
+qint64 UserDashboard::memoryBytes() const {
+  return MemoryEstimate::variantListBytes(m_recentActivities) +
+         MemoryEstimate::variantListBytes(m_lowStockItemsList) +
+         MemoryEstimate::variantListBytes(m_monthlyProfitData);
+}
+
+int UserDashboard::trimLists(qint64 budgetBytes) {
+  qint64 bytes = memoryBytes();
+  if (bytes <= budgetBytes || m_lowStockItemsList.isEmpty())
+    return 0;
+
+  std::stable_sort(m_lowStockItemsList.begin(), m_lowStockItemsList.end(),
+                   [](const QVariant &a, const QVariant &b) {
+                     return a.toMap().value("quantity").toInt() <
+                            b.toMap().value("quantity").toInt();
+                   });
+  int dropped = 0;
+  while (bytes > budgetBytes && !m_lowStockItemsList.isEmpty()) {
+    bytes -= MemoryEstimate::variantBytes(m_lowStockItemsList.takeLast());
+    ++dropped;
+  }
+  emit lowStockItemsListChanged();
+  qDebug() << "Dashboard low stock list trimmed by" << dropped
+           << "entries to fit its memory budget";
+  return dropped;
+}
+
+void UserDashboard::restoreSnapshot(int userId, const Snapshot &snapshot) {
+  m_userId = userId;
+  m_totalInventoryItems = snapshot.totalInventoryItems;
+  m_lowStockItems = snapshot.lowStockItems;
+  m_totalInventoryValue = snapshot.totalInventoryValue;
+  m_totalSales = snapshot.totalSales;
+  m_totalRevenue = snapshot.totalRevenue;
+  m_totalCost = snapshot.totalCost;
+  m_grossProfit = snapshot.grossProfit;
+  m_profitMargin = snapshot.profitMargin;
+  m_recentActivities = snapshot.recentActivities;
+  m_lowStockItemsList = snapshot.lowStockItemsList;
+  m_monthlyProfitData = snapshot.monthlyProfitData;
+  m_expiringItems = snapshot.expiringItems;
+
   emit totalInventoryItemsChanged();
   emit lowStockItemsChanged();
   emit totalInventoryValueChanged();
@@ -57,19 +205,51 @@ void UserDashboard::refresh() {
   emit totalCostChanged();
   emit grossProfitChanged();
   emit profitMarginChanged();
+  emit recentActivitiesChanged();
+  emit lowStockItemsListChanged();
+  emit monthlyProfitDataChanged();
   emit expiringItemsChanged();
+}
 
-  qDebug() << "UserDashboard refreshed:" << "Total Inventory Items:"
-           << m_totalInventoryItems << "Low Stock Items:" << m_lowStockItems
-           << "Total Inventory Value:" << m_totalInventoryValue
-           << "Total Sales:" << m_totalSales
-           << "Total Revenue:" << m_totalRevenue << "Total Cost:" << m_totalCost
-           << "Gross Profit:" << m_grossProfit
-           << "Profit Margin:" << m_profitMargin
-           << "Expiring Items:" << m_expiringItems;
+void UserDashboard::loadKpis() {
+  Tracer::Scope trace("dashboard", "UserDashboard::loadKpis");
+  QSqlQuery query(m_dbManager->database());
+  query.prepare("SELECT item_count, inventory_value, low_stock_items, "
+                "sale_count, revenue, cost FROM UserKpis "
+                "WHERE user_id = :userId");
+  query.bindValue(":userId", m_userId);
+
+  if (!query.exec()) {
+    emit errorOccurred(
+        tr("Failed to fetch dashboard figures: %1").arg(query.lastError().text()));
+    return;
+  }
+
+  // No row yet means the user has never had an item or a sale.
+  KpiRow row{};
+  if (query.next())
+    row = RowMapper<KpiRow>(query).read(query);
+
+  m_totalInventoryItems = row.itemCount;
+  m_totalInventoryValue = row.inventoryValue;
+  m_lowStockItems = row.lowStockItems;
+  m_totalSales = row.saleCount;
+  m_totalRevenue = row.revenue;
+  m_totalCost = row.cost;
+  calculateProfitAndLoss();
+
+  emit totalInventoryItemsChanged();
+  emit lowStockItemsChanged();
+  emit totalInventoryValueChanged();
+  emit totalSalesChanged();
+  emit totalRevenueChanged();
+  emit totalCostChanged();
+  emit grossProfitChanged();
+  emit profitMarginChanged();
 }
 
 void UserDashboard::updateRecentActivities() {
+  Tracer::Scope trace("dashboard", "UserDashboard::updateRecentActivities");
   QSqlQuery query(m_dbManager->database());
   query.prepare("SELECT 'Sale' as type, s.sale_date as date, i.name as "
                 "item_name, s.quantity, s.total_price "
@@ -91,13 +271,15 @@ void UserDashboard::updateRecentActivities() {
   }
 
   m_recentActivities.clear();
+  const RowMapper<ActivityRow> mapper(query);
   while (query.next()) {
+    const ActivityRow row = mapper.read(query);
     QVariantMap activity;
-    activity["type"] = query.value("type").toString();
-    activity["date"] = query.value("date").toDateTime();
-    activity["itemName"] = query.value("item_name").toString();
-    activity["quantity"] = query.value("quantity").toInt();
-    activity["price"] = query.value("total_price").toDouble();
+    activity["type"] = row.type;
+    activity["date"] = row.date;
+    activity["itemName"] = row.itemName;
+    activity["quantity"] = row.quantity;
+    activity["price"] = Money::toUnits(row.price);
     m_recentActivities.append(activity);
   }
 
@@ -106,34 +288,42 @@ void UserDashboard::updateRecentActivities() {
 }
 
 void UserDashboard::updateLowStockItems() {
+  Tracer::Scope trace("dashboard", "UserDashboard::updateLowStockItems");
   m_lowStockItemsList = m_inventoryModel->getLowStockItems();
   emit lowStockItemsListChanged();
   qDebug() << "Low stock items updated. Count:" << m_lowStockItemsList.size();
 }
 
 void UserDashboard::calculateProfitAndLoss() {
-  m_totalCost = m_inventoryModel->totalCost();
+  // m_totalCost is the cost of goods sold, as costed on each sale when it
+  // was made.
   m_grossProfit = m_totalRevenue - m_totalCost;
 
   if (m_totalRevenue > 0) {
-    m_profitMargin = (m_grossProfit / m_totalRevenue) * 100;
+    m_profitMargin = double(m_grossProfit) / m_totalRevenue * 100;
   } else {
     m_profitMargin = 0;
   }
 }
 
 void UserDashboard::fetchMonthlyProfitData() {
+  Tracer::Scope trace("dashboard", "UserDashboard::fetchMonthlyProfitData");
+  const QDate today = QDate::currentDate();
+  const QDate from = QDate(today.year(), today.month(), 1).addMonths(-5);
+
   QSqlQuery query(m_dbManager->database());
-  query.prepare("SELECT strftime('%Y-%m', s.sale_date) as month, "
-                "SUM(s.total_price) as revenue, "
-                "SUM(i.price * s.quantity) as cost "
-                "FROM Sales s "
-                "JOIN Inventory i ON s.item_id = i.id "
-                "WHERE s.user_id = :userId "
+  query.prepare("SELECT strftime('%Y-%m', sale_date) as month, "
+                "SUM(total_price) as revenue, "
+                "SUM(total_cost) as cost "
+                "FROM " +
+                m_dbManager->salesSource(from) +
+                " "
+                "WHERE user_id = :userId AND sale_date >= :from "
                 "GROUP BY month "
                 "ORDER BY month DESC "
                 "LIMIT 6");
   query.bindValue(":userId", m_userId);
+  query.bindValue(":from", from);
 
   if (!query.exec()) {
     emit errorOccurred(tr("Failed to fetch monthly profit data: %1")
@@ -142,17 +332,15 @@ void UserDashboard::fetchMonthlyProfitData() {
   }
 
   m_monthlyProfitData.clear();
+  const RowMapper<MonthlyProfitRow> mapper(query);
   while (query.next()) {
-    QString month = query.value("month").toString();
-    double revenue = query.value("revenue").toDouble();
-    double cost = query.value("cost").toDouble();
-    double profit = revenue - cost;
+    const MonthlyProfitRow row = mapper.read(query);
 
     QVariantMap dataPoint;
-    dataPoint["month"] = month;
-    dataPoint["revenue"] = revenue;
-    dataPoint["cost"] = cost;
-    dataPoint["profit"] = profit;
+    dataPoint["month"] = row.month;
+    dataPoint["revenue"] = Money::toUnits(row.revenue);
+    dataPoint["cost"] = Money::toUnits(row.cost);
+    dataPoint["profit"] = Money::toUnits(row.revenue - row.cost);
     m_monthlyProfitData.prepend(dataPoint);
   }
 
@@ -162,11 +350,12 @@ void UserDashboard::fetchMonthlyProfitData() {
 }
 
 void UserDashboard::checkExpiringItems() {
+  Tracer::Scope trace("dashboard", "UserDashboard::checkExpiringItems");
   QDate currentDate = QDate::currentDate();
   QDate thirtyDaysFromNow = currentDate.addDays(30);
 
   QSqlQuery query(m_dbManager->database());
-  query.prepare("SELECT id, name, expiry_date FROM Inventory "
+  query.prepare("SELECT COUNT(*) FROM Inventory "
                 "WHERE user_id = :userId AND expiry_date <= :expiryDate AND "
                 "expiry_date >= :currentDate");
   query.bindValue(":userId", m_userId);
@@ -179,20 +368,9 @@ void UserDashboard::checkExpiringItems() {
     return;
   }
 
-  m_expiringItems = 0;
-  QSet<int> notifiedItems;
-  while (query.next()) {
-    int itemId = query.value("id").toInt();
-    QString itemName = query.value("name").toString();
-    QDate expiryDate = query.value("expiry_date").toDate();
-
-    m_expiringItems++;
-
-    if (!notifiedItems.contains(itemId)) {
-      emit itemNearExpiry(itemId, itemName, expiryDate);
-      notifiedItems.insert(itemId);
-    }
-  }
+  // Only the count is needed here; the alerts themselves reach the UI
+  // through NotificationHub.
+  m_expiringItems = query.next() ? query.value(0).toInt() : 0;
 
   emit expiringItemsChanged();
   qDebug() << "Expiring items updated. Count:" << m_expiringItems;
@@ -201,12 +379,16 @@ void UserDashboard::checkExpiringItems() {
 int UserDashboard::totalInventoryItems() const { return m_totalInventoryItems; }
 int UserDashboard::lowStockItems() const { return m_lowStockItems; }
 double UserDashboard::totalInventoryValue() const {
-  return m_totalInventoryValue;
+  return Money::toUnits(m_totalInventoryValue);
 }
 int UserDashboard::totalSales() const { return m_totalSales; }
-double UserDashboard::totalRevenue() const { return m_totalRevenue; }
-double UserDashboard::totalCost() const { return m_totalCost; }
-double UserDashboard::grossProfit() const { return m_grossProfit; }
+double UserDashboard::totalRevenue() const {
+  return Money::toUnits(m_totalRevenue);
+}
+double UserDashboard::totalCost() const { return Money::toUnits(m_totalCost); }
+double UserDashboard::grossProfit() const {
+  return Money::toUnits(m_grossProfit);
+}
 double UserDashboard::profitMargin() const { return m_profitMargin; }
 QVariantList UserDashboard::recentActivities() const {
   return m_recentActivities;
@@ -5,6 +5,7 @@
 #include <QVariantList>
 #include "databasemanager.h"
 #include "inventorymodel.h"
+#include "money.h"
 #include "salesmodel.h"
 
 class UserDashboard : public QObject
@@ -26,8 +27,40 @@ class UserDashboard : public QObject
 public:
     explicit UserDashboard(DatabaseManager *dbManager, InventoryModel *inventoryModel, SalesModel *salesModel, QObject *parent = nullptr);
 
+    // Aggregates for one user, as kept by SessionCache.
+    struct Snapshot {
+        int totalInventoryItems = 0;
+        int lowStockItems = 0;
+        Money::Cents totalInventoryValue = 0;
+        int totalSales = 0;
+        Money::Cents totalRevenue = 0;
+        Money::Cents totalCost = 0;
+        Money::Cents grossProfit = 0;
+        double profitMargin = 0.0;
+        QVariantList recentActivities;
+        QVariantList lowStockItemsList;
+        QVariantList monthlyProfitData;
+        int expiringItems = 0;
+        qint64 bytes = 0; // estimated heap footprint
+    };
+
     void setUserId(int userId);
+    // Reloads whichever models are loaded, then recalculates.
     Q_INVOKABLE void refresh();
+    // Rereads the headline figures from UserKpis, one row kept current by
+    // triggers, and the lists and charts from their queries. Neither model
+    // has to be loaded.
+    Q_INVOKABLE void recalculate();
+
+    Snapshot snapshot() const;
+    void restoreSnapshot(int userId, const Snapshot &snapshot);
+
+    // Approximate heap footprint of the lists behind the dashboard.
+    qint64 memoryBytes() const;
+    // The recent activity and monthly lists are bounded by their queries;
+    // the low-stock list is not. Cuts it down, keeping the lowest quantities,
+    // until the dashboard fits budgetBytes. Returns the entries dropped.
+    int trimLists(qint64 budgetBytes);
 
     int totalInventoryItems() const;
     int lowStockItems() const;
@@ -56,7 +89,6 @@ signals:
     void lowStockItemsListChanged();
     void monthlyProfitDataChanged();
     void expiringItemsChanged();
-    void itemNearExpiry(int itemId, const QString &itemName, const QDate &expiryDate);
 
 private:
     DatabaseManager *m_dbManager;
@@ -65,17 +97,18 @@ private:
     int m_userId;
     int m_totalInventoryItems;
     int m_lowStockItems;
-    double m_totalInventoryValue;
+    Money::Cents m_totalInventoryValue;
     int m_totalSales;
-    double m_totalRevenue;
-    double m_totalCost;
-    double m_grossProfit;
+    Money::Cents m_totalRevenue;
+    Money::Cents m_totalCost;
+    Money::Cents m_grossProfit;
     double m_profitMargin;
     QVariantList m_recentActivities;
     QVariantList m_lowStockItemsList;
     QVariantList m_monthlyProfitData;
     int m_expiringItems;
 
+    void loadKpis();
     void calculateProfitAndLoss();
     void updateRecentActivities();
     void updateLowStockItems();
@@ -1,4 +1,6 @@
 #include "usermodel.h"
+#include "sessioncache.h"
+#include "workloadrecorder.h"
 #include <QCryptographicHash>
 #include <QDebug>
 #include <QSqlError>
@@ -7,10 +9,16 @@
 UserModel::UserModel(DatabaseManager *dbManager, InventoryModel *invModel,
                      SalesModel *salesModel, QObject *parent)
     : QObject(parent), m_dbManager(dbManager), m_invModel(invModel),
-      m_salesModel(salesModel), m_isLoggedIn(false), m_currentUserId(-1) {}
+      m_salesModel(salesModel), m_sessionCache(nullptr), m_isLoggedIn(false), m_currentUserId(-1) {}
 
 bool UserModel::login(const QString &username, const QString &password) {
-  QSqlQuery query(m_dbManager->database());
+  // Passwords never reach the trace.
+  WorkloadRecorder::Scope scope("UserModel::login", {username});
+  if (!m_dbManager->isReady()) {
+    emit errorOccurred("The database is still opening, please try again");
+    return false;
+  }
+  QSqlQuery query(m_dbManager->catalogDatabase());
   query.prepare(
       "SELECT id, password_hash FROM Users WHERE username = :username");
   query.bindValue(":username", username);
@@ -29,8 +37,19 @@ bool UserModel::login(const QString &username, const QString &password) {
       m_isLoggedIn = true;
       m_currentUser = username;
       m_currentUserId = query.value("id").toInt();
-      m_invModel->setUserId(m_currentUserId);
-      m_salesModel->setUserId(m_currentUserId);
+      if (!m_dbManager->activateUser(m_currentUserId)) {
+        m_isLoggedIn = false;
+        m_currentUser.clear();
+        m_currentUserId = -1;
+        emit errorOccurred("Unable to open this account's data");
+        return false;
+      }
+      if (m_sessionCache) {
+        m_sessionCache->activate(m_currentUserId);
+      } else {
+        m_invModel->setUserId(m_currentUserId);
+        m_salesModel->setUserId(m_currentUserId);
+      }
       emit loginStatusChanged();
       emit loginSuccessful();
       return true;
@@ -43,12 +62,17 @@ bool UserModel::login(const QString &username, const QString &password) {
 
 bool UserModel::signup(const QString &username, const QString &password,
                        const QString &email) {
+  WorkloadRecorder::Scope scope("UserModel::signup", {username});
+  if (!m_dbManager->isReady()) {
+    emit errorOccurred("The database is still opening, please try again");
+    return false;
+  }
   if (username.isEmpty() || password.isEmpty() || email.isEmpty()) {
     emit errorOccurred("All fields must be filled");
     return false;
   }
 
-  QSqlQuery query(m_dbManager->database());
+  QSqlQuery query(m_dbManager->catalogDatabase());
   query.prepare("SELECT username FROM Users WHERE username = :username");
   query.bindValue(":username", username);
 
@@ -76,6 +100,14 @@ bool UserModel::signup(const QString &username, const QString &password,
     m_isLoggedIn = true;
     m_currentUser = username;
     m_currentUserId = query.lastInsertId().toInt();
+    if (!m_dbManager->activateUser(m_currentUserId)) {
+      // The account exists; logging in again retries opening its data.
+      m_isLoggedIn = false;
+      m_currentUser.clear();
+      m_currentUserId = -1;
+      emit errorOccurred("Account created, but unable to open its data");
+      return false;
+    }
     emit loginStatusChanged();
     emit loginSuccessful();
     return true;
@@ -86,12 +118,18 @@ bool UserModel::signup(const QString &username, const QString &password,
 }
 
 void UserModel::logout() {
+  WorkloadRecorder::Scope scope("UserModel::logout");
+  if (m_sessionCache)
+    m_sessionCache->stash(m_currentUserId);
   m_isLoggedIn = false;
   m_currentUser.clear();
   m_currentUserId = -1;
+  m_dbManager->activateUser(-1);
   emit loginStatusChanged();
 }
 
+void UserModel::setSessionCache(SessionCache *cache) { m_sessionCache = cache; }
+
 bool UserModel::isLoggedIn() const { return m_isLoggedIn; }
 
 QString UserModel::currentUser() const { return m_currentUser; }
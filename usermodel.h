@@ -6,6 +6,8 @@
 #include "inventorymodel.h"
 #include "salesmodel.h"
 
+class SessionCache;
+
 class UserModel : public QObject
 {
     Q_OBJECT
@@ -18,6 +20,8 @@ public:
     Q_INVOKABLE bool login(const QString &username, const QString &password);
     Q_INVOKABLE bool signup(const QString &username, const QString &password, const QString &email);
     Q_INVOKABLE void logout();
+    // Optional; with a cache, switching back to a recent user skips the reload.
+    void setSessionCache(SessionCache *cache);
 
     bool isLoggedIn() const;
     QString currentUser() const;
@@ -32,6 +36,7 @@ private:
     DatabaseManager *m_dbManager;
     InventoryModel *m_invModel;
     SalesModel *m_salesModel;
+    SessionCache *m_sessionCache;
     bool m_isLoggedIn;
     QString m_currentUser;
     int m_currentUserId;
@@ -0,0 +1,92 @@
+#include "workloadrecorder.h"
+#include <QDateTime>
+#include <QDebug>
+
+namespace {
+WorkloadRecorder *activeRecorder = nullptr;
+} // namespace
+
+WorkloadRecorder::WorkloadRecorder() : m_depth(0) {}
+
+WorkloadRecorder::~WorkloadRecorder() {
+  if (activeRecorder == this)
+    activeRecorder = nullptr;
+  close();
+}
+
+bool WorkloadRecorder::open(const QString &filePath, QString *error) {
+  close();
+  m_file.setFileName(filePath);
+  if (!m_file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+    if (error)
+      *error = m_file.errorString();
+    return false;
+  }
+
+  m_stream.setDevice(&m_file);
+  m_stream.setVersion(STREAM_VERSION);
+  m_stream << MAGIC << VERSION << QDateTime::currentDateTimeUtc();
+  m_operationIds.clear();
+  m_clock.start();
+  return true;
+}
+
+void WorkloadRecorder::close() {
+  if (!m_file.isOpen())
+    return;
+  m_stream.setDevice(nullptr);
+  m_file.close();
+}
+
+WorkloadRecorder *WorkloadRecorder::active() { return activeRecorder; }
+
+void WorkloadRecorder::setActive(WorkloadRecorder *recorder) {
+  activeRecorder = recorder;
+}
+
+void WorkloadRecorder::write(const char *operation, qint64 startNs,
+                             qint64 durationNs,
+                             const QVariantList &arguments) {
+  if (!m_file.isOpen())
+    return;
+
+  // Operation names are string literals, so the pointer identifies them.
+  auto it = m_operationIds.constFind(operation);
+  if (it == m_operationIds.constEnd()) {
+    const quint16 id = quint16(m_operationIds.size());
+    it = m_operationIds.insert(operation, id);
+    m_stream << quint8('D') << id << QString::fromLatin1(operation);
+  }
+  m_stream << quint8('C') << it.value() << startNs / 1000 << durationNs / 1000
+           << arguments;
+
+  if (m_stream.status() != QDataStream::Ok) {
+    qWarning() << "Workload trace write failed; recording stopped:"
+               << m_file.errorString();
+    close();
+  }
+}
+
+WorkloadRecorder::Scope::Scope(const char *operation,
+                               const QVariantList &arguments)
+    : m_recorder(activeRecorder), m_operation(operation), m_startNs(0) {
+  if (!m_recorder)
+    return;
+  // Nested calls are covered by the outermost one.
+  if (m_recorder->m_depth++ > 0) {
+    m_operation = nullptr;
+    return;
+  }
+  m_arguments = arguments;
+  m_startNs = m_recorder->m_clock.nsecsElapsed();
+}
+
+WorkloadRecorder::Scope::~Scope() {
+  if (!m_recorder)
+    return;
+  --m_recorder->m_depth;
+  if (!m_operation)
+    return;
+  const qint64 endNs = m_recorder->m_clock.nsecsElapsed();
+  m_recorder->write(m_operation, m_startNs, endNs - m_startNs, m_arguments);
+}
@@ -0,0 +1,64 @@
+#ifndef WORKLOADRECORDER_H
+#define WORKLOADRECORDER_H
+
+#include <QDataStream>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QHash>
+#include <QVariantList>
+
+// Opt-in trace of the calls the UI makes on the models, for replaying a
+// store's real workload later (see WorkloadReplay). Only outermost calls are
+// recorded: work a call does through other models is part of its own cost
+// and is repeated by replaying it.
+//
+// Trace layout (QDataStream, Qt 5.15 format): the magic and version, the
+// wall-clock start, then records. A 'D' record names an operation the first
+// time it is seen (quint16 id, "Class::method"); a 'C' record is one call
+// (quint16 id, start offset and duration in microseconds, arguments).
+class WorkloadRecorder
+{
+public:
+    static const quint32 MAGIC = 0x424d5452; // "BMTR"
+    static const quint32 VERSION = 1;
+    static const int STREAM_VERSION = QDataStream::Qt_5_15;
+
+    WorkloadRecorder();
+    ~WorkloadRecorder();
+
+    bool open(const QString &filePath, QString *error);
+    void close();
+
+    // The recorder that Scope writes to, or nullptr when recording is off.
+    static WorkloadRecorder *active();
+    static void setActive(WorkloadRecorder *recorder);
+
+    // Place at the top of a recorded method. When recording is off this
+    // costs a pointer check plus building the (short) argument list.
+    class Scope
+    {
+    public:
+        Scope(const char *operation, const QVariantList &arguments = QVariantList());
+        ~Scope();
+
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+
+    private:
+        WorkloadRecorder *m_recorder;
+        const char *m_operation;
+        QVariantList m_arguments;
+        qint64 m_startNs;
+    };
+
+private:
+    QFile m_file;
+    QDataStream m_stream;
+    QElapsedTimer m_clock;
+    QHash<const char *, quint16> m_operationIds;
+    int m_depth;
+
+    void write(const char *operation, qint64 startNs, qint64 durationNs, const QVariantList &arguments);
+};
+
+#endif // WORKLOADRECORDER_H
@@ -0,0 +1,199 @@
+#include "workloadreplay.h"
+#include <QDataStream>
+#include <QDateTime>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QSqlQuery>
+#include <algorithm>
+#include <cmath>
+#include "workloadrecorder.h"
+
+WorkloadReplay::WorkloadReplay(DatabaseManager *dbManager)
+    : m_dbManager(dbManager), m_inventoryModel(dbManager),
+      m_salesModel(dbManager),
+      m_dashboard(dbManager, &m_inventoryModel, &m_salesModel) {
+  m_salesModel.setInventoryModel(&m_inventoryModel);
+}
+
+WorkloadReplay::Result WorkloadReplay::run(const QString &tracePath) {
+  Result result;
+
+  QFile file(tracePath);
+  if (!file.open(QIODevice::ReadOnly)) {
+    result.error = file.errorString();
+    return result;
+  }
+
+  QDataStream in(&file);
+  in.setVersion(WorkloadRecorder::STREAM_VERSION);
+  quint32 magic = 0;
+  quint32 version = 0;
+  QDateTime recordedAt;
+  in >> magic >> version >> recordedAt;
+  if (magic != WorkloadRecorder::MAGIC ||
+      version != WorkloadRecorder::VERSION) {
+    result.error = QString("%1 is not a workload trace").arg(tracePath);
+    return result;
+  }
+
+  QHash<quint16, QString> names;
+  QHash<QString, QVector<qint64>> replayed;
+  QHash<QString, QVector<qint64>> recorded;
+  QElapsedTimer total;
+  total.start();
+
+  while (!in.atEnd()) {
+    quint8 type = 0;
+    quint16 id = 0;
+    in >> type >> id;
+    if (type == 'D') {
+      QString name;
+      in >> name;
+      names.insert(id, name);
+    } else if (type == 'C') {
+      qint64 startUs = 0;
+      qint64 durationUs = 0;
+      QVariantList args;
+      in >> startUs >> durationUs >> args;
+      if (in.status() != QDataStream::Ok)
+        break;
+
+      const QString operation = names.value(id);
+      QElapsedTimer timer;
+      timer.start();
+      if (!dispatch(operation, args)) {
+        ++result.skipped;
+        continue;
+      }
+      replayed[operation].append(timer.nsecsElapsed() / 1000);
+      recorded[operation].append(durationUs);
+      ++result.calls;
+    } else {
+      result.error = QString("Corrupt trace record at offset %1").arg(file.pos());
+      return result;
+    }
+
+    if (in.status() != QDataStream::Ok) {
+      result.error = QString("Truncated trace at offset %1").arg(file.pos());
+      return result;
+    }
+  }
+  result.elapsedMs = total.elapsed();
+
+  QStringList operations = replayed.keys();
+  operations.sort();
+  for (const QString &operation : operations) {
+    QVector<qint64> latencies = replayed.value(operation);
+    QVector<qint64> original = recorded.value(operation);
+    std::sort(latencies.begin(), latencies.end());
+    std::sort(original.begin(), original.end());
+
+    OperationStats stats;
+    stats.operation = operation;
+    stats.calls = latencies.size();
+    qint64 sum = 0;
+    for (qint64 latency : latencies)
+      sum += latency;
+    stats.meanUs = double(sum) / latencies.size();
+    stats.p50Us = percentile(latencies, 0.50);
+    stats.p90Us = percentile(latencies, 0.90);
+    stats.p99Us = percentile(latencies, 0.99);
+    stats.maxUs = latencies.last();
+    stats.recordedP50Us = percentile(original, 0.50);
+    result.operations.append(stats);
+  }
+
+  result.ok = true;
+  return result;
+}
+
+bool WorkloadReplay::dispatch(const QString &operation,
+                              const QVariantList &args) {
+  auto arg = [&args](int i) { return args.value(i); };
+
+  if (operation == "UserModel::login")
+    return login(arg(0).toString());
+  if (operation == "UserModel::logout") {
+    m_dashboard.setUserId(-1);
+    m_dbManager->activateUser(-1);
+    return true;
+  }
+
+  if (operation == "InventoryModel::setUserId")
+    m_inventoryModel.setUserId(arg(0).toInt());
+  else if (operation == "InventoryModel::addItem")
+    m_inventoryModel.addItem(arg(0).toString(), arg(1).toString(),
+                             arg(2).toInt(), arg(3).toDouble(),
+                             arg(4).toString(), arg(5).toString(),
+                             arg(6).toDate(), arg(7).toString());
+  else if (operation == "InventoryModel::updateItem")
+    m_inventoryModel.updateItem(arg(0).toInt(), arg(1).toString(),
+                                arg(2).toString(), arg(3).toInt(),
+                                arg(4).toDouble(), arg(5).toString(),
+                                arg(6).toString(), arg(7).toDate());
+  else if (operation == "InventoryModel::deleteItem")
+    m_inventoryModel.deleteItem(arg(0).toInt());
+  else if (operation == "InventoryModel::setItemSku")
+    m_inventoryModel.setItemSku(arg(0).toInt(), arg(1).toString());
+  else if (operation == "InventoryModel::adjustQuantities")
+    m_inventoryModel.adjustQuantities(arg(0).toList());
+  else if (operation == "InventoryModel::adjustPrices")
+    m_inventoryModel.adjustPrices(arg(0).toString(), arg(1).toDouble());
+  else if (operation == "InventoryModel::setQuantities")
+    m_inventoryModel.setQuantities(arg(0).toMap());
+  else if (operation == "InventoryModel::deleteItems")
+    m_inventoryModel.deleteItems(arg(0).toList());
+  else if (operation == "InventoryModel::searchItems")
+    m_inventoryModel.searchItems(arg(0).toString());
+  else if (operation == "InventoryModel::refresh")
+    m_inventoryModel.refresh();
+  else if (operation == "InventoryModel::fuzzySearch")
+    m_inventoryModel.fuzzySearch(arg(0).toString(), arg(1).toInt());
+  else if (operation == "SalesModel::setUserId")
+    m_salesModel.setUserId(arg(0).toInt());
+  else if (operation == "SalesModel::addSale")
+    m_salesModel.addSale(arg(0).toInt(), arg(1).toInt(), arg(2).toDouble());
+  else if (operation == "SalesModel::addSaleBySku")
+    m_salesModel.addSaleBySku(arg(0).toString(), arg(1).toInt());
+  else if (operation == "SalesModel::searchSales")
+    m_salesModel.searchSales(arg(0).toString());
+  else if (operation == "SalesModel::refresh")
+    m_salesModel.refresh();
+  else if (operation == "UserDashboard::setUserId")
+    m_dashboard.setUserId(arg(0).toInt());
+  else if (operation == "UserDashboard::refresh")
+    m_dashboard.refresh();
+  else if (operation == "UserDashboard::recalculate")
+    m_dashboard.recalculate();
+  else
+    return false; // signups and operations this build does not know
+  return true;
+}
+
+bool WorkloadReplay::login(const QString &username) {
+  QSqlQuery query(m_dbManager->catalogDatabase());
+  query.prepare("SELECT id FROM Users WHERE username = :username");
+  query.bindValue(":username", username);
+  if (!query.exec() || !query.next()) {
+    qWarning() << "Replay: unknown user" << username;
+    return false;
+  }
+  const int userId = query.value(0).toInt();
+  if (!m_dbManager->activateUser(userId))
+    return false;
+
+  // The same sequence as a GUI login without a session cache hit.
+  m_inventoryModel.setUserId(userId);
+  m_salesModel.setUserId(userId);
+  m_dashboard.setUserId(userId);
+  return true;
+}
+
+qint64 WorkloadReplay::percentile(const QVector<qint64> &sorted,
+                                  double fraction) {
+  if (sorted.isEmpty())
+    return 0;
+  const int rank = int(std::ceil(fraction * sorted.size())) - 1;
+  return sorted.at(qBound(0, rank, sorted.size() - 1));
+}
@@ -0,0 +1,54 @@
+#ifndef WORKLOADREPLAY_H
+#define WORKLOADREPLAY_H
+
+#include <QHash>
+#include <QString>
+#include <QVector>
+#include "databasemanager.h"
+#include "inventorymodel.h"
+#include "salesmodel.h"
+#include "userdashboard.h"
+
+// Runs a trace written by WorkloadRecorder against an initialised database,
+// call by call and as fast as possible, and reports latency percentiles per
+// operation next to the latencies measured when the trace was recorded.
+// Logins are replayed by username, since traces carry no passwords.
+class WorkloadReplay
+{
+public:
+    struct OperationStats {
+        QString operation;
+        int calls = 0;
+        double meanUs = 0.0;
+        qint64 p50Us = 0;
+        qint64 p90Us = 0;
+        qint64 p99Us = 0;
+        qint64 maxUs = 0;
+        qint64 recordedP50Us = 0;
+    };
+
+    struct Result {
+        bool ok = false;
+        QString error;
+        int calls = 0;
+        int skipped = 0;
+        qint64 elapsedMs = 0;
+        QVector<OperationStats> operations; // by operation name
+    };
+
+    explicit WorkloadReplay(DatabaseManager *dbManager);
+
+    Result run(const QString &tracePath);
+
+private:
+    DatabaseManager *m_dbManager;
+    InventoryModel m_inventoryModel;
+    SalesModel m_salesModel;
+    UserDashboard m_dashboard;
+
+    bool dispatch(const QString &operation, const QVariantList &args);
+    bool login(const QString &username);
+    static qint64 percentile(const QVector<qint64> &sorted, double fraction);
+};
+
+#endif // WORKLOADREPLAY_H